@@ -0,0 +1,61 @@
+/* paq8px.h - library interface to paq8px_v68p3.cpp
+
+  Build the library by compiling paq8px_v68p3.cpp with -DPAQLIB (and
+  -DUNIX or -DWINDOWS) into a static or shared library, as the Makefile
+  does.  Programs using it are linked with it and with the C++ library
+  and -lpthread.
+
+  paq8px_new(level) creates a context that compresses at level 0 to 8
+  like the -0 to -8 options (or up to 10 in a 64-bit build), or returns
+  0 if out of memory.
+  paq8px_free(ctx) frees it.
+
+  paq8px_compress(ctx, in, n, out, outsize) compresses the n bytes at in
+  to out and returns the compressed size, or -1 on error (for example,
+  if it would not fit in outsize bytes).  paq8px_decompress(ctx, in, n,
+  out, outsize) decompresses the n bytes at in to out and returns the
+  decompressed size, or -1 on error.  paq8px_size(in, n) returns the
+  decompressed size of the compressed data at in, or -1 if it is not
+  compressed by paq8px_compress().  paq8px_error(ctx) returns a message
+  describing the last error.
+
+  A context keeps its model tables between calls and clears them before
+  each call instead of allocating them again.  Each call is independent
+  of the calls before it.  Contexts may be used in several threads at
+  the same time, each context by one thread at a time (unless the library
+  was compiled with -DNOTHREADS).
+*/
+
+#ifndef PAQ8PX_H
+#define PAQ8PX_H
+
+#include <stddef.h>
+
+#if defined(_WIN32) && defined(PAQLIB)
+#define PAQ8PX_API __declspec(dllexport)
+#elif defined(__GNUC__)
+#define PAQ8PX_API __attribute__((visibility("default")))
+#else
+#define PAQ8PX_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct paq8px_ctx paq8px_ctx;
+
+PAQ8PX_API paq8px_ctx* paq8px_new(int level);
+PAQ8PX_API void paq8px_free(paq8px_ctx* ctx);
+PAQ8PX_API long paq8px_compress(paq8px_ctx* ctx, const void* in, size_t n,
+  void* out, size_t outsize);
+PAQ8PX_API long paq8px_decompress(paq8px_ctx* ctx, const void* in, size_t n,
+  void* out, size_t outsize);
+PAQ8PX_API long paq8px_size(const void* in, size_t n);
+PAQ8PX_API const char* paq8px_error(const paq8px_ctx* ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,4665 +1,8817 @@
-/* paq8px file compressor/archiver.  Release by Jan Ondrus, Jan. 18, 2010
-
-    Copyright (C) 2008 Matt Mahoney, Serge Osnach, Alexander Ratushnyak,
-    Bill Pettis, Przemyslaw Skibinski, Matthew Fite, wowtiger, Andrew Paterson,
-    Jan Ondrus, Andreas Morphis, Pavel L. Holoborodko, KZ., Simon Berger,
-    Neill Corlett
-
-    LICENSE
-
-    This program is free software; you can redistribute it and/or
-    modify it under the terms of the GNU General Public License as
-    published by the Free Software Foundation; either version 2 of
-    the License, or (at your option) any later version.
-
-    This program is distributed in the hope that it will be useful, but
-    WITHOUT ANY WARRANTY; without even the implied warranty of
-    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
-    General Public License for more details at
-    Visit <http://www.gnu.org/copyleft/gpl.html>.
-
-To install and use in Windows:
-
-- To install, put paq8px.exe or a shortcut to it on your desktop.
-- To compress a file or folder, drop it on the paq8px icon.
-- To decompress, drop a .paq8px file on the icon.
-
-A .paq8px extension is added for compression, removed for decompression.
-The output will go in the same folder as the input.
-
-While paq8px is working, a command window will appear and report
-progress.  When it is done you can close the window by pressing
-ENTER or clicking [X].
-
-
-COMMAND LINE INTERFACE
-
-- To install, put paq8px.exe somewhere in your PATH.
-- To compress:      paq8px [-N] file1 [file2...]
-- To decompress:    paq8px [-d] file1.paq8px [dir2]
-- To view contents: more < file1.paq8px
-
-The compressed output file is named by adding ".paq8px" extension to
-the first named file (file1.paq8px).  Each file that exists will be
-added to the archive and its name will be stored without a path.
-The option -N specifies a compression level ranging from -0
-(fastest) to -8 (smallest).  The default is -5.  If there is
-no option and only one file, then the program will pause when
-finished until you press the ENTER key (to support drag and drop).
-If file1.paq8px exists then it is overwritten.
-
-If the first named file ends in ".paq8px" then it is assumed to be
-an archive and the files within are extracted to the same directory
-as the archive unless a different directory (dir2) is specified.
-The -d option forces extraction even if there is not a ".paq8px"
-extension.  If any output file already exists, then it is compared
-with the archive content and the first byte that differs is reported.
-No files are overwritten or deleted.  If there is only one argument
-(no -d or dir2) then the program will pause when finished until
-you press ENTER.
-
-For compression, if any named file is actually a directory, then all
-files and subdirectories are compressed, preserving the directory
-structure, except that empty directories are not stored, and file
-attributes (timestamps, permissions, etc.) are not preserved.
-During extraction, directories are created as needed.  For example:
-
-  paq8px -4 c:\tmp\foo bar
-
-compresses foo and bar (if they exist) to c:\tmp\foo.paq8px at level 4.
-
-  paq8px -d c:\tmp\foo.paq8px .
-
-extracts foo and compares bar in the current directory.  If foo and bar
-are directories then their contents are extracted/compared.
-
-There are no commands to update an existing archive or to extract
-part of an archive.  Files and archives larger than 2GB are not
-supported (but might work on 64-bit machines, not tested).
-File names with nonprintable characters are not supported (spaces
-are OK).
-
-
-TO COMPILE
-
-There are 2 files: paq8px.cpp (C++) and paq7asm.asm (NASM/YASM).
-paq7asm.asm is the same as in paq7 and paq8x.  paq8px.cpp recognizes the
-following compiler options:
-
-  -DWINDOWS           (to compile in Windows)
-  -DUNIX              (to compile in Unix, Linux, Solairs, MacOS/Darwin, etc)
-  -DNOASM             (to replace paq7asm.asm with equivalent C++)
-  -DDEFAULT_OPTION=N  (to change the default compression level from 5 to N).
-
-If you compile without -DWINDOWS or -DUNIX, you can still compress files,
-but you cannot compress directories or create them during extraction.
-You can extract directories if you manually create the empty directories
-first.
-
-Use -DEFAULT_OPTION=N to change the default compression level to support
-drag and drop on machines with less than 256 MB of memory.  Use
--DDEFAULT_OPTION=4 for 128 MB, 3 for 64 MB, 2 for 32 MB, etc.
-
-Use -DNOASM for non x86-32 machines, or older than a Pentium-MMX (about
-1997), or if you don't have NASM or YASM to assemble paq7asm.asm.  The
-program will still work but it will be slower.  For NASM in Windows,
-use the options "--prefix _" and either "-f win32" or "-f obj" depending
-on your C++ compiler.  In Linux, use "-f elf".
-
-Recommended compiler commands and optimizations:
-
-  MINGW g++:
-    nasm paq7asm.asm -f win32 --prefix _
-    g++ paq8px.cpp -DWINDOWS -O2 -Os -s -march=pentiumpro -fomit-frame-pointer -o paq8px.exe paq7asm.obj
-
-  Borland:
-    nasm paq7asm.asm -f obj --prefix _
-    bcc32 -DWINDOWS -O -w-8027 paq8px.cpp paq7asm.obj
-
-  Mars:
-    nasm paq7asm.asm -f obj --prefix _
-    dmc -DWINDOWS -Ae -O paq8px.cpp paq7asm.obj
-
-  UNIX/Linux (PC):
-    nasm -f elf paq7asm.asm
-    g++ paq8px.cpp -DUNIX -O2 -Os -s -march=pentiumpro -fomit-frame-pointer -o paq8px paq7asm.o
-
-  Non PC (e.g. PowerPC under MacOS X)
-    g++ paq8px.cpp -O2 -DUNIX -DNOASM -s -o paq8px
-
-MinGW produces faster executables than Borland or Mars, but Intel 9
-is about 4% faster than MinGW).
-
-
-ARCHIVE FILE FORMAT
-
-An archive has the following format.  It is intended to be both
-human and machine readable.  The header ends with CTRL-Z (Windows EOF)
-so that the binary compressed data is not displayed on the screen.
-
-  paq8px -N CR LF
-  size TAB filename CR LF
-  size TAB filename CR LF
-  ...
-  CTRL-Z
-  compressed binary data
-
--N is the option (-0 to -9), even if a default was used.
-Plain file names are stored without a path.  Files in compressed
-directories are stored with path relative to the compressed directory
-(using UNIX style forward slashes "/").  For example, given these files:
-
-  123 C:\dir1\file1.txt
-  456 C:\dir2\file2.txt
-
-Then
-
-  paq8px archive \dir1\file1.txt \dir2
-
-will create archive.paq8px with the header:
-
-  paq8px -5
-  123     file1.txt
-  456     dir2/file2.txt
-
-The command:
-
-  paq8px archive.paq8px C:\dir3
-
-will create the files:
-
-  C:\dir3\file1.txt
-  C:\dir3\dir2\file2.txt
-
-Decompression will fail if the first 7 bytes are not "paq8px -".  Sizes
-are stored as decimal numbers.  CR, LF, TAB, CTRL-Z are ASCII codes
-13, 10, 9, 26 respectively.
-
-
-ARITHMETIC CODING
-
-The binary data is arithmetic coded as the shortest base 256 fixed point
-number x = SUM_i x_i 256^-1-i such that p(<y) <= x < p(<=y), where y is the
-input string, x_i is the i'th coded byte, p(<y) (and p(<=y)) means the
-probability that a string is lexicographcally less than (less than
-or equal to) y according to the model, _ denotes subscript, and ^ denotes
-exponentiation.
-
-The model p(y) for y is a conditional bit stream,
-p(y) = PROD_j p(y_j | y_0..j-1) where y_0..j-1 denotes the first j
-bits of y, and y_j is the next bit.  Compression depends almost entirely
-on the ability to predict the next bit accurately.
-
-
-MODEL MIXING
-
-paq8px uses a neural network to combine a large number of models.  The
-i'th model independently predicts
-p1_i = p(y_j = 1 | y_0..j-1), p0_i = 1 - p1_i.
-The network computes the next bit probabilty
-
-  p1 = squash(SUM_i w_i t_i), p0 = 1 - p1                        (1)
-
-where t_i = stretch(p1_i) is the i'th input, p1_i is the prediction of
-the i'th model, p1 is the output prediction, stretch(p) = ln(p/(1-p)),
-and squash(s) = 1/(1+exp(-s)).  Note that squash() and stretch() are
-inverses of each other.
-
-After bit y_j (0 or 1) is received, the network is trained:
-
-  w_i := w_i + eta t_i (y_j - p1)                                (2)
-
-where eta is an ad-hoc learning rate, t_i is the i'th input, (y_j - p1)
-is the prediction error for the j'th input but, and w_i is the i'th
-weight.  Note that this differs from back propagation:
-
-  w_i := w_i + eta t_i (y_j - p1) p0 p1                          (3)
-
-which is a gradient descent in weight space to minimize root mean square
-error.  Rather, the goal in compression is to minimize coding cost,
-which is -log(p0) if y = 1 or -log(p1) if y = 0.  Taking
-the partial derivative of cost with respect to w_i yields (2).
-
-
-MODELS
-
-Most models are context models.  A function of the context (last few
-bytes) is mapped by a lookup table or hash table to a state which depends
-on the bit history (prior sequence of 0 and 1 bits seen in this context).
-The bit history is then mapped to p1_i by a fixed or adaptive function.
-There are several types of bit history states:
-
-- Run Map. The state is (b,n) where b is the last bit seen (0 or 1) and
-  n is the number of consecutive times this value was seen.  The initial
-  state is (0,0).  The output is computed directly:
-
-    t_i = (2b - 1)K log(n + 1).
-
-  where K is ad-hoc, around 4 to 10.  When bit y_j is seen, the state
-  is updated:
-
-    (b,n) := (b,n+1) if y_j = b, else (y_j,1).
-
-- Stationary Map.  The state is p, initially 1/2.  The output is
-  t_i = stretch(p).  The state is updated at ad-hoc rate K (around 0.01):
-
-    p := p + K(y_j - p)
-
-- Nonstationary Map.  This is a compromise between a stationary map, which
-  assumes uniform statistics, and a run map, which adapts quickly by
-  discarding old statistics.  An 8 bit state represents (n0,n1,h), initially
-  (0,0,0) where:
-
-    n0 is the number of 0 bits seen "recently".
-    n1 is the number of 1 bits seen "recently".
-    n = n0 + n1.
-    h is the full bit history for 0 <= n <= 4,
-      the last bit seen (0 or 1) if 5 <= n <= 15,
-      0 for n >= 16.
-
-  The primaty output is t_i := stretch(sm(n0,n1,h)), where sm(.) is
-  a stationary map with K = 1/256, initialized to
-  sm(n0,n1,h) = (n1+(1/64))/(n+2/64).  Four additional inputs are also
-  be computed to improve compression slightly:
-
-    p1_i = sm(n0,n1,h)
-    p0_i = 1 - p1_i
-    t_i   := stretch(p_1)
-    t_i+1 := K1 (p1_i - p0_i)
-    t_i+2 := K2 stretch(p1) if n0 = 0, -K2 stretch(p1) if n1 = 0, else 0
-    t_i+3 := K3 (-p0_i if n1 = 0, p1_i if n0 = 0, else 0)
-    t_i+4 := K3 (-p0_i if n0 = 0, p1_i if n1 = 0, else 0)
-
-  where K1..K4 are ad-hoc constants.
-
-  h is updated as follows:
-    If n < 4, append y_j to h.
-    Else if n <= 16, set h := y_j.
-    Else h = 0.
-
-  The update rule is biased toward newer data in a way that allows
-  n0 or n1, but not both, to grow large by discarding counts of the
-  opposite bit.  Large counts are incremented probabilistically.
-  Specifically, when y_j = 0 then the update rule is:
-
-    n0 := n0 + 1, n < 29
-          n0 + 1 with probability 2^(27-n0)/2 else n0, 29 <= n0 < 41
-          n0, n = 41.
-    n1 := n1, n1 <= 5
-          round(8/3 lg n1), if n1 > 5
-
-  swapping (n0,n1) when y_j = 1.
-
-  Furthermore, to allow an 8 bit representation for (n0,n1,h), states
-  exceeding the following values of n0 or n1 are replaced with the
-  state with the closest ratio n0:n1 obtained by decrementing the
-  smaller count: (41,0,h), (40,1,h), (12,2,h), (5,3,h), (4,4,h),
-  (3,5,h), (2,12,h), (1,40,h), (0,41,h).  For example:
-  (12,2,1) 0-> (7,1,0) because there is no state (13,2,0).
-
-- Match Model.  The state is (c,b), initially (0,0), where c is 1 if
-  the context was previously seen, else 0, and b is the next bit in
-  this context.  The prediction is:
-
-    t_i := (2b - 1)Kc log(m + 1)
-
-  where m is the length of the context.  The update rule is c := 1,
-  b := y_j.  A match model can be implemented efficiently by storing
-  input in a buffer and storing pointers into the buffer into a hash
-  table indexed by context.  Then c is indicated by a hash table entry
-  and b can be retrieved from the buffer.
-
-
-CONTEXTS
-
-High compression is achieved by combining a large number of contexts.
-Most (not all) contexts start on a byte boundary and end on the bit
-immediately preceding the predicted bit.  The contexts below are
-modeled with both a run map and a nonstationary map unless indicated.
-
-- Order n.  The last n bytes, up to about 16.  For general purpose data.
-  Most of the compression occurs here for orders up to about 6.
-  An order 0 context includes only the 0-7 bits of the partially coded
-  byte and the number of these bits (255 possible values).
-
-- Sparse.  Usually 1 or 2 of the last 8 bytes preceding the byte containing
-  the predicted bit, e.g (2), (3),..., (8), (1,3), (1,4), (1,5), (1,6),
-  (2,3), (2,4), (3,6), (4,8).  The ordinary order 1 and 2 context, (1)
-  or (1,2) are included above.  Useful for binary data.
-
-- Text.  Contexts consists of whole words (a-z, converted to lower case
-  and skipping other values).  Contexts may be sparse, e.g (0,2) meaning
-  the current (partially coded) word and the second word preceding the
-  current one.  Useful contexts are (0), (0,1), (0,1,2), (0,2), (0,3),
-  (0,4).  The preceding byte may or may not be included as context in the
-  current word.
-
-- Formatted text.  The column number (determined by the position of
-  the last linefeed) is combined with other contexts: the charater to
-  the left and the character above it.
-
-- Fixed record length.  The record length is determined by searching for
-  byte sequences with a uniform stride length.  Once this is found, then
-  the record length is combined with the context of the bytes immediately
-  preceding it and the corresponding byte locations in the previous
-  one or two records (as with formatted text).
-
-- Context gap.  The distance to the previous occurrence of the order 1
-  or order 2 context is combined with other low order (1-2) contexts.
-
-- FAX.  For 2-level bitmapped images.  Contexts are the surrounding
-  pixels already seen.  Image width is assumed to be 1728 bits (as
-  in calgary/pic).
-
-- Image.  For uncompressed 24-bit color BMP, TIFF and TGA images.  Contexts
-  are the high order bits of the surrounding pixels and linear
-  combinations of those pixels, including other color planes.  The
-  image width is detected from the file header.  When an image is
-  detected, other models are turned off to improve speed.
-
-- JPEG.  Files are further compressed by partially uncompressing back
-  to the DCT coefficients to provide context for the next Huffman code.
-  Only baseline DCT-Huffman coded files are modeled.  (This ia about
-  90% of images, the others are usually progresssive coded).  JPEG images
-  embedded in other files (quite common) are detected by headers.  The
-  baseline JPEG coding process is:
-  - Convert to grayscale and 2 chroma colorspace.
-  - Sometimes downsample the chroma images 2:1 or 4:1 in X and/or Y.
-  - Divide each of the 3 images into 8x8 blocks.
-  - Convert using 2-D discrete cosine transform (DCT) to 64 12-bit signed
-    coefficients.
-  - Quantize the coefficients by integer division (lossy).
-  - Split the image into horizontal slices coded independently, separated
-    by restart codes.
-  - Scan each block starting with the DC (0,0) coefficient in zigzag order
-    to the (7,7) coefficient, interleaving the 3 color components in
-    order to scan the whole image left to right starting at the top.
-  - Subtract the previous DC component from the current in each color.
-  - Code the coefficients using RS codes, where R is a run of R zeros (0-15)
-    and S indicates 0-11 bits of a signed value to follow.  (There is a
-    special RS code (EOB) to indicate the rest of the 64 coefficients are 0).
-  - Huffman code the RS symbol, followed by S literal bits.
-  The most useful contexts are the current partially coded Huffman code
-  (including S following bits) combined with the coefficient position
-  (0-63), color (0-2), and last few RS codes.
-
-- Match.  When a context match of 400 bytes or longer is detected,
-  the next bit of the match is predicted and other models are turned
-  off to improve speed.
-
-- Exe.  When a x86 file (.exe, .obj, .dll) is detected, sparse contexts
-  with gaps of 1-12 selecting only the prefix, opcode, and the bits
-  of the modR/M byte that are relevant to parsing are selected.
-  This model is turned off otherwise.
-
-- Indirect.  The history of the last 1-3 bytes in the context of the
-  last 1-2 bytes is combined with this 1-2 byte context.
-
-- DMC. A bitwise n-th order context is built from a state machine using
-  DMC, described in http://plg.uwaterloo.ca/~ftp/dmc/dmc.c
-  The effect is to extend a single context, one bit at a time and predict
-  the next bit based on the history in this context.  The model here differs
-  in that two predictors are used.  One is a pair of counts as in the original
-  DMC.  The second predictor is a bit history state mapped adaptively to
-  a probability as as in a Nonstationary Map.
-
-ARCHITECTURE
-
-The context models are mixed by several of several hundred neural networks
-selected by a low-order context.  The outputs of these networks are
-combined using a second neural network, then fed through several stages of
-adaptive probability maps (APM) before arithmetic coding.
-
-For images, only one neural network is used and its context is fixed.
-
-An APM is a stationary map combining a context and an input probability.
-The input probability is stretched and divided into 32 segments to
-combine with other contexts.  The output is interpolated between two
-adjacent quantized values of stretch(p1).  There are 2 APM stages in series:
-
-  p1 := (p1 + 3 APM(order 0, p1)) / 4.
-  p1 := (APM(order 1, p1) + 2 APM(order 2, p1) + APM(order 3, p1)) / 4.
-
-PREPROCESSING
-
-paq8px uses preprocessing transforms on certain data types to improve
-compression.  To improve reliability, the decoding transform is
-tested during compression to ensure that the input file can be
-restored.  If the decoder output is not identical to the input file
-due to a bug, then the transform is abandoned and the data is compressed
-without a transform so that it will still decompress correctly.
-
-The input is split into blocks with the format <type> <decoded size> <data>
-where <type> is 1 byte (0 = no transform), <decoded size> is the size
-of the data after decoding, which may be different than the size of <data>.
-Blocks do not span file boundaries, and have a maximum size of 4MB to
-2GB depending on compression level.  Large files are split into blocks
-of this size.  The preprocessor has 3 parts:
-
-- Detector.  Splits the input into smaller blocks depending on data type.
-
-- Coder.  Input is a block to be compressed.  Output is a temporary
-  file.  The coder determines whether a transform is to be applied
-  based on file type, and if so, which one.  A coder may use lots
-  of resources (memory, time) and make multiple passes through the
-  input file.  The file type is stored (as one byte) during compression.
-
-- Decoder.  Performs the inverse transform of the coder.  It uses few
-  resorces (fast, low memory) and runs in a single pass (stream oriented).
-  It takes input either from a file or the arithmetic decoder.  Each call
-  to the decoder returns a single decoded byte.
-
-The following transforms are used:
-
-- EXE:  CALL (0xE8) and JMP (0xE9) address operands are converted from
-  relative to absolute address.  The transform is to replace the sequence
-  E8/E9 xx xx xx 00/FF by adding file offset modulo 2^25 (signed range,
-  little-endian format).  Data to transform is identified by trying the
-  transform and applying a crude compression test: testing whether the
-  byte following the E8/E8 (LSB of the address) occurred more recently
-  in the transformed data than the original and within 4KB 4 times in
-  a row.  The block ends when this does not happen for 4KB.
-
-- JPEG: detected by SOI and SOF and ending with EOI or any nondecodable
-  data.  No transform is applied.  The purpose is to separate images
-  embedded in execuables to block the EXE transform, and for a future
-  place to insert a transform.
-
-
-IMPLEMENTATION
-
-Hash tables are designed to minimize cache misses, which consume most
-of the CPU time.
-
-Most of the memory is used by the nonstationary context models.
-Contexts are represented by 32 bits, possibly a hash.  These are
-mapped to a bit history, represented by 1 byte.  The hash table is
-organized into 64-byte buckets on cache line boundaries.  Each bucket
-contains 7 x 7 bit histories, 7 16-bit checksums, and a 2 element LRU
-queue packed into one byte.  Each 7 byte element represents 7 histories
-for a context ending on a 3-bit boundary plus 0-2 more bits.  One
-element (for bits 0-1, which have 4 unused bytes) also contains a run model
-consisting of the last byte seen and a count (as 1 byte each).
-
-Run models use 4 byte hash elements consisting of a 2 byte checksum, a
-repeat count (0-255) and the byte value.  The count also serves as
-a priority.
-
-Stationary models are most appropriate for small contexts, so the
-context is used as a direct table lookup without hashing.
-
-The match model maintains a pointer to the last match until a mismatching
-bit is found.  At the start of the next byte, the hash table is referenced
-to find another match.  The hash table of pointers is updated after each
-whole byte.  There is no checksum.  Collisions are detected by comparing
-the current and matched context in a rotating buffer.
-
-The inner loops of the neural network prediction (1) and training (2)
-algorithms are implemented in MMX assembler, which computes 4 elements
-at a time.  Using assembler is 8 times faster than C++ for this code
-and 1/3 faster overall.  (However I found that SSE2 code on an AMD-64,
-which computes 8 elements at a time, is not any faster).
-
-
-DIFFERENCES FROM PAQ7
-
-An .exe model and filter are added.  Context maps are improved using 16-bit
-checksums to reduce collisions.  The state table uses probabilistic updates
-for large counts, more states that remember the last bit, and decreased
-discounting of the opposite count.  It is implemented as a fixed table.
-There are also many minor changes.
-
-DIFFERENCES FROM PAQ8A
-
-The user interface supports directory compression and drag and drop.
-The preprocessor segments the input into blocks and uses more robust
-EXE detection.  An indirect context model was added.  There is no
-dictionary preprocesor like PAQ8B/C/D/E.
-
-DIFFERENCES FROM PAQ8F
-
-Different models, usually from paq8hp*. Also changed rate from 8 to 7. A bug
-in Array was fixed that caused the program to silently crash upon exit.
-
-DIFFERENCES FROM PAQ8J
-
-1) Slightly improved sparse model.
-2) Added new family of sparse contexts. Each byte mapped to 3-bit value, where
-different values corresponds to different byte classes. For example, input
-byte 0x00 transformed into 0, all bytes that less then 16 -- into 5, all
-punctuation marks (ispunct(c)!=0) -- into 2 etc. Then this flags from 11
-previous bytes combined into 32-bit pseudo-context.
-
-All this improvements gives only 62 byte on BOOK1, but on binaries archive size
-reduced on 1-2%.
-
-DIFFERENCES FROM PAQ8JA
-
-Introduced distance model. Distance model uses distance to last occurence
-of some anchor char (0x00, space, newline, 0xff), combined with previous
-charactes as context. This slightly improves compression of files with
-variable-width record data.
-
-DIFFERENCES FROM PAQ8JB
-
-Restored recordModel(), broken in paq8hp*. Slightly tuned indirectModel().
-
-DIFFERENCES FROM PAQ8JC
-
-Changed the APMs in the Predictor. Up to a 0.2% improvement for some files.
-
-DIFFERENCES FROM PAQ8JD
-
-Added DMCModel.  Removed some redundant models from SparseModel and other
-minor tuneups.  Changes introduced in PAQ8K were not carried over.
-
-PAQ8L v.2
-
-Changed Mixer::p() to p() to fix a compiler error in Linux
-(patched by Indrek Kruusa, Apr. 15, 2007).
-
-DIFFERENCES FROM PAQ8L, PAQ8M
-
-Modified JPEG model by Jan Ondrus (paq8fthis2).  The new model improves
-compression by using decoded pixel values of current and adjacent blocks
-as context.  PAQ8M was an earlier version of the new JPEG model
-(from paq8fthis).
-
-DIFFERENCES FROM PAQ8N
-
-Improved bmp model. Slightly faster.
-
-DIFFERENCES FROM PAQ8O
-
-Modified JPEG model by Jan Ondrus (paq8fthis4).
-Added PGM (grayscale image) model form PAQ8I.
-Added grayscale BMP model to PGM model.
-Ver. 2 can be compiled using either old or new "for" loop scoping rules.
-Added APM and StateMap from LPAQ1
-Code optimizations from Enrico Zeidler
-Detection of BMP 4,8,24 bit and PGM 8 bit images before compress
-On non BMP,PGM,JPEG data mem is lower
-Fixed bug in BMP 8-bit detection in other files like .exe
-15. oct 2007
-Updates JPEG model by Jan Ondrus
-PGM detection bug fix
-22. oct 2007
-improved JPEG model by Jan Ondrus
-16. feb 2008
-fixed bmp detection bug
-added .rgb file support (uncompressed grayscale)
-
-DIFFERENCES FROM PAQ8O9
-
-Added wav Model. Slightly improved bmp model.
-
-DIFFERENCES FROM PAQ8P
-
-Added nestModel from paq8p3
-Modified wordModel from paq8p3
-Modified .pbm, .pgm, .ppm, .bmp, .rgb detection (from paq8p3)
-Modified WAV model (from paq8p_)
-Modified JPEG model (from paq8p2)
-Added im1bitModel (1-bit) (from paq8p3)
-Added compression of PPM, PBM images (from paq8p3)
-Removed pic model
-Modified EXE transformation (e8/e9)
-Changed image and audio data handling (separated in blocks)
-Added compression of (8-bit, 24-bit) TGA image data
-Improved TIFF image detection
-*/
-
-#define PROGNAME "paq8px"  // Please change this if you change the program.
-
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <time.h>
-#include <math.h>
-#include <ctype.h>
-#define NDEBUG  // remove for debugging (turns on Array bound checks)
-#include <assert.h>
-
-#ifdef UNIX
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <dirent.h>
-#include <errno.h>
-#endif
-
-#ifdef WINDOWS
-#include <windows.h>
-#endif
-
-#ifndef DEFAULT_OPTION
-#define DEFAULT_OPTION 5
-#endif
-
-// 8, 16, 32 bit unsigned types (adjust as appropriate)
-typedef unsigned char  U8;
-typedef unsigned short U16;
-typedef unsigned int   U32;
-
-// min, max functions
-#ifndef WINDOWS
-inline int min(int a, int b) {return a<b?a:b;}
-inline int max(int a, int b) {return a<b?b:a;}
-#endif
-
-// Error handler: print message if any, and exit
-void quit(const char* message=0) {
-  throw message;
-}
-
-// strings are equal ignoring case?
-int equals(const char* a, const char* b) {
-  assert(a && b);
-  while (*a && *b) {
-    int c1=*a;
-    if (c1>='A'&&c1<='Z') c1+='a'-'A';
-    int c2=*b;
-    if (c2>='A'&&c2<='Z') c2+='a'-'A';
-    if (c1!=c2) return 0;
-    ++a;
-    ++b;
-  }
-  return *a==*b;
-}
-
-//////////////////////// Program Checker /////////////////////
-
-// Track time and memory used
-class ProgramChecker {
-  int memused;  // bytes allocated by Array<T> now
-  int maxmem;   // most bytes allocated ever
-  clock_t start_time;  // in ticks
-public:
-  void alloc(int n) {  // report memory allocated, may be negative
-    memused+=n;
-    if (memused>maxmem) maxmem=memused;
-  }
-  ProgramChecker(): memused(0), maxmem(0) {
-    start_time=clock();
-    assert(sizeof(U8)==1);
-    assert(sizeof(U16)==2);
-    assert(sizeof(U32)==4);
-    assert(sizeof(short)==2);
-    assert(sizeof(int)==4);
-  }
-  void print() const {  // print time and memory used
-    printf("Time %1.2f sec, used %d bytes of memory\n",
-      double(clock()-start_time)/CLOCKS_PER_SEC, maxmem);
-  }
-} programChecker;
-
-//////////////////////////// Array ////////////////////////////
-
-// Array<T, ALIGN> a(n); creates n elements of T initialized to 0 bits.
-// Constructors for T are not called.
-// Indexing is bounds checked if assertions are on.
-// a.size() returns n.
-// a.resize(n) changes size to n, padding with 0 bits or truncating.
-// a.push_back(x) appends x and increases size by 1, reserving up to size*2.
-// a.pop_back() decreases size by 1, does not free memory.
-// Copy and assignment are not supported.
-// Memory is aligned on a ALIGN byte boundary (power of 2), default is none.
-
-template <class T, int ALIGN=0> class Array {
-private:
-  int n;     // user size
-  int reserved;  // actual size
-  char *ptr; // allocated memory, zeroed
-  T* data;   // start of n elements of aligned data
-  void create(int i);  // create with size i
-public:
-  explicit Array(int i=0) {create(i);}
-  ~Array();
-  T& operator[](int i) {
-#ifndef NDEBUG
-    if (i<0 || i>=n) fprintf(stderr, "%d out of bounds %d\n", i, n), quit();
-#endif
-    return data[i];
-  }
-  const T& operator[](int i) const {
-#ifndef NDEBUG
-    if (i<0 || i>=n) fprintf(stderr, "%d out of bounds %d\n", i, n), quit();
-#endif
-    return data[i];
-  }
-  int size() const {return n;}
-  void resize(int i);  // change size to i
-  void pop_back() {if (n>0) --n;}  // decrement size
-  void push_back(const T& x);  // increment size, append x
-private:
-  Array(const Array&);  // no copy or assignment
-  Array& operator=(const Array&);
-};
-
-template<class T, int ALIGN> void Array<T, ALIGN>::resize(int i) {
-  if (i<=reserved) {
-    n=i;
-    return;
-  }
-  char *saveptr=ptr;
-  T *savedata=data;
-  int saven=n;
-  create(i);
-  if (saveptr) {
-    if (savedata) {
-      memcpy(data, savedata, sizeof(T)*min(i, saven));
-      programChecker.alloc(-ALIGN-n*sizeof(T));
-    }
-    free(saveptr);
-  }
-}
-
-template<class T, int ALIGN> void Array<T, ALIGN>::create(int i) {
-  n=reserved=i;
-  if (i<=0) {
-    data=0;
-    ptr=0;
-    return;
-  }
-  const int sz=ALIGN+n*sizeof(T);
-  programChecker.alloc(sz);
-  ptr = (char*)calloc(sz, 1);
-  if (!ptr) quit("Out of memory");
-  data = (ALIGN ? (T*)(ptr+ALIGN-(((long)ptr)&(ALIGN-1))) : (T*)ptr);
-  assert((char*)data>=ptr && (char*)data<=ptr+ALIGN);
-}
-
-template<class T, int ALIGN> Array<T, ALIGN>::~Array() {
-  programChecker.alloc(-ALIGN-n*sizeof(T));
-  free(ptr);
-}
-
-template<class T, int ALIGN> void Array<T, ALIGN>::push_back(const T& x) {
-  if (n==reserved) {
-    int saven=n;
-    resize(max(1, n*2));
-    n=saven;
-  }
-  data[n++]=x;
-}
-
-/////////////////////////// String /////////////////////////////
-
-// A tiny subset of std::string
-// size() includes NUL terminator.
-
-class String: public Array<char> {
-public:
-  const char* c_str() const {return &(*this)[0];}
-  void operator=(const char* s) {
-    resize(strlen(s)+1);
-    strcpy(&(*this)[0], s);
-  }
-  void operator+=(const char* s) {
-    assert(s);
-    pop_back();
-    while (*s) push_back(*s++);
-    push_back(0);
-  }
-  String(const char* s=""): Array<char>(1) {
-    (*this)+=s;
-  }
-};
-
-
-//////////////////////////// rnd ///////////////////////////////
-
-// 32-bit pseudo random number generator
-class Random{
-  Array<U32> table;
-  int i;
-public:
-  Random(): table(64) {
-    table[0]=123456789;
-    table[1]=987654321;
-    for (int j=0; j<62; j++) table[j+2]=table[j+1]*11+table[j]*23/16;
-    i=0;
-  }
-  U32 operator()() {
-    return ++i, table[i&63]=table[(i-24)&63]^table[(i-55)&63];
-  }
-} rnd;
-
-////////////////////////////// Buf /////////////////////////////
-
-// Buf(n) buf; creates an array of n bytes (must be a power of 2).
-// buf[i] returns a reference to the i'th byte with wrap (no out of bounds).
-// buf(i) returns i'th byte back from pos (i > 0)
-// buf.size() returns n.
-
-int pos;  // Number of input bytes in buf (not wrapped)
-
-class Buf {
-  Array<U8> b;
-public:
-  Buf(int i=0): b(i) {}
-  void setsize(int i) {
-    if (!i) return;
-    assert(i>0 && (i&(i-1))==0);
-    b.resize(i);
-  }
-  U8& operator[](int i) {
-    return b[i&(b.size()-1)];
-  }
-  int operator()(int i) const {
-    assert(i>0);
-    return b[(pos-i)&(b.size()-1)];
-  }
-  int size() const {
-    return b.size();
-  }
-};
-
-// IntBuf(n) is a buffer of n int (must be a power of 2).
-// intBuf[i] returns a reference to i'th element with wrap.
-
-class IntBuf {
-  Array<int> b;
-public:
-  IntBuf(int i=0): b(i) {}
-  int& operator[](int i) {
-    return b[i&(b.size()-1)];
-  }
-};
-
-/////////////////////// Global context /////////////////////////
-
-int level=DEFAULT_OPTION;  // Compression level 0 to 8
-#define MEM (0x10000<<level)
-int y=0;  // Last bit, 0 or 1, set by encoder
-
-// Global context set by Predictor and available to all models.
-int c0=1; // Last 0-7 bits of the partial byte with a leading 1 bit (1-255)
-U32 c4=0; // Last 4 whole bytes, packed.  Last byte is bits 0-7.
-int bpos=0; // bits in c0 (0 to 7)
-Buf buf;  // Rotating input queue set by Predictor
-int blpos=0; // Relative position in block
-
-///////////////////////////// ilog //////////////////////////////
-
-// ilog(x) = round(log2(x) * 16), 0 <= x < 64K
-class Ilog {
-  Array<U8> t;
-public:
-  int operator()(U16 x) const {return t[x];}
-  Ilog();
-} ilog;
-
-// Compute lookup table by numerical integration of 1/x
-Ilog::Ilog(): t(65536) {
-  U32 x=14155776;
-  for (int i=2; i<65536; ++i) {
-    x+=774541002/(i*2-1);  // numerator is 2^29/ln 2
-    t[i]=x>>24;
-  }
-}
-
-// llog(x) accepts 32 bits
-inline int llog(U32 x) {
-  if (x>=0x1000000)
-    return 256+ilog(x>>16);
-  else if (x>=0x10000)
-    return 128+ilog(x>>8);
-  else
-    return ilog(x);
-}
-
-///////////////////////// state table ////////////////////////
-
-// State table:
-//   nex(state, 0) = next state if bit y is 0, 0 <= state < 256
-//   nex(state, 1) = next state if bit y is 1
-//   nex(state, 2) = number of zeros in bit history represented by state
-//   nex(state, 3) = number of ones represented
-//
-// States represent a bit history within some context.
-// State 0 is the starting state (no bits seen).
-// States 1-30 represent all possible sequences of 1-4 bits.
-// States 31-252 represent a pair of counts, (n0,n1), the number
-//   of 0 and 1 bits respectively.  If n0+n1 < 16 then there are
-//   two states for each pair, depending on if a 0 or 1 was the last
-//   bit seen.
-// If n0 and n1 are too large, then there is no state to represent this
-// pair, so another state with about the same ratio of n0/n1 is substituted.
-// Also, when a bit is observed and the count of the opposite bit is large,
-// then part of this count is discarded to favor newer data over old.
-
-#if 1 // change to #if 0 to generate this table at run time (4% slower)
-static const U8 State_table[256][4]={
-  {  1,  2, 0, 0},{  3,  5, 1, 0},{  4,  6, 0, 1},{  7, 10, 2, 0}, // 0-3
-  {  8, 12, 1, 1},{  9, 13, 1, 1},{ 11, 14, 0, 2},{ 15, 19, 3, 0}, // 4-7
-  { 16, 23, 2, 1},{ 17, 24, 2, 1},{ 18, 25, 2, 1},{ 20, 27, 1, 2}, // 8-11
-  { 21, 28, 1, 2},{ 22, 29, 1, 2},{ 26, 30, 0, 3},{ 31, 33, 4, 0}, // 12-15
-  { 32, 35, 3, 1},{ 32, 35, 3, 1},{ 32, 35, 3, 1},{ 32, 35, 3, 1}, // 16-19
-  { 34, 37, 2, 2},{ 34, 37, 2, 2},{ 34, 37, 2, 2},{ 34, 37, 2, 2}, // 20-23
-  { 34, 37, 2, 2},{ 34, 37, 2, 2},{ 36, 39, 1, 3},{ 36, 39, 1, 3}, // 24-27
-  { 36, 39, 1, 3},{ 36, 39, 1, 3},{ 38, 40, 0, 4},{ 41, 43, 5, 0}, // 28-31
-  { 42, 45, 4, 1},{ 42, 45, 4, 1},{ 44, 47, 3, 2},{ 44, 47, 3, 2}, // 32-35
-  { 46, 49, 2, 3},{ 46, 49, 2, 3},{ 48, 51, 1, 4},{ 48, 51, 1, 4}, // 36-39
-  { 50, 52, 0, 5},{ 53, 43, 6, 0},{ 54, 57, 5, 1},{ 54, 57, 5, 1}, // 40-43
-  { 56, 59, 4, 2},{ 56, 59, 4, 2},{ 58, 61, 3, 3},{ 58, 61, 3, 3}, // 44-47
-  { 60, 63, 2, 4},{ 60, 63, 2, 4},{ 62, 65, 1, 5},{ 62, 65, 1, 5}, // 48-51
-  { 50, 66, 0, 6},{ 67, 55, 7, 0},{ 68, 57, 6, 1},{ 68, 57, 6, 1}, // 52-55
-  { 70, 73, 5, 2},{ 70, 73, 5, 2},{ 72, 75, 4, 3},{ 72, 75, 4, 3}, // 56-59
-  { 74, 77, 3, 4},{ 74, 77, 3, 4},{ 76, 79, 2, 5},{ 76, 79, 2, 5}, // 60-63
-  { 62, 81, 1, 6},{ 62, 81, 1, 6},{ 64, 82, 0, 7},{ 83, 69, 8, 0}, // 64-67
-  { 84, 71, 7, 1},{ 84, 71, 7, 1},{ 86, 73, 6, 2},{ 86, 73, 6, 2}, // 68-71
-  { 44, 59, 5, 3},{ 44, 59, 5, 3},{ 58, 61, 4, 4},{ 58, 61, 4, 4}, // 72-75
-  { 60, 49, 3, 5},{ 60, 49, 3, 5},{ 76, 89, 2, 6},{ 76, 89, 2, 6}, // 76-79
-  { 78, 91, 1, 7},{ 78, 91, 1, 7},{ 80, 92, 0, 8},{ 93, 69, 9, 0}, // 80-83
-  { 94, 87, 8, 1},{ 94, 87, 8, 1},{ 96, 45, 7, 2},{ 96, 45, 7, 2}, // 84-87
-  { 48, 99, 2, 7},{ 48, 99, 2, 7},{ 88,101, 1, 8},{ 88,101, 1, 8}, // 88-91
-  { 80,102, 0, 9},{103, 69,10, 0},{104, 87, 9, 1},{104, 87, 9, 1}, // 92-95
-  {106, 57, 8, 2},{106, 57, 8, 2},{ 62,109, 2, 8},{ 62,109, 2, 8}, // 96-99
-  { 88,111, 1, 9},{ 88,111, 1, 9},{ 80,112, 0,10},{113, 85,11, 0}, // 100-103
-  {114, 87,10, 1},{114, 87,10, 1},{116, 57, 9, 2},{116, 57, 9, 2}, // 104-107
-  { 62,119, 2, 9},{ 62,119, 2, 9},{ 88,121, 1,10},{ 88,121, 1,10}, // 108-111
-  { 90,122, 0,11},{123, 85,12, 0},{124, 97,11, 1},{124, 97,11, 1}, // 112-115
-  {126, 57,10, 2},{126, 57,10, 2},{ 62,129, 2,10},{ 62,129, 2,10}, // 116-119
-  { 98,131, 1,11},{ 98,131, 1,11},{ 90,132, 0,12},{133, 85,13, 0}, // 120-123
-  {134, 97,12, 1},{134, 97,12, 1},{136, 57,11, 2},{136, 57,11, 2}, // 124-127
-  { 62,139, 2,11},{ 62,139, 2,11},{ 98,141, 1,12},{ 98,141, 1,12}, // 128-131
-  { 90,142, 0,13},{143, 95,14, 0},{144, 97,13, 1},{144, 97,13, 1}, // 132-135
-  { 68, 57,12, 2},{ 68, 57,12, 2},{ 62, 81, 2,12},{ 62, 81, 2,12}, // 136-139
-  { 98,147, 1,13},{ 98,147, 1,13},{100,148, 0,14},{149, 95,15, 0}, // 140-143
-  {150,107,14, 1},{150,107,14, 1},{108,151, 1,14},{108,151, 1,14}, // 144-147
-  {100,152, 0,15},{153, 95,16, 0},{154,107,15, 1},{108,155, 1,15}, // 148-151
-  {100,156, 0,16},{157, 95,17, 0},{158,107,16, 1},{108,159, 1,16}, // 152-155
-  {100,160, 0,17},{161,105,18, 0},{162,107,17, 1},{108,163, 1,17}, // 156-159
-  {110,164, 0,18},{165,105,19, 0},{166,117,18, 1},{118,167, 1,18}, // 160-163
-  {110,168, 0,19},{169,105,20, 0},{170,117,19, 1},{118,171, 1,19}, // 164-167
-  {110,172, 0,20},{173,105,21, 0},{174,117,20, 1},{118,175, 1,20}, // 168-171
-  {110,176, 0,21},{177,105,22, 0},{178,117,21, 1},{118,179, 1,21}, // 172-175
-  {110,180, 0,22},{181,115,23, 0},{182,117,22, 1},{118,183, 1,22}, // 176-179
-  {120,184, 0,23},{185,115,24, 0},{186,127,23, 1},{128,187, 1,23}, // 180-183
-  {120,188, 0,24},{189,115,25, 0},{190,127,24, 1},{128,191, 1,24}, // 184-187
-  {120,192, 0,25},{193,115,26, 0},{194,127,25, 1},{128,195, 1,25}, // 188-191
-  {120,196, 0,26},{197,115,27, 0},{198,127,26, 1},{128,199, 1,26}, // 192-195
-  {120,200, 0,27},{201,115,28, 0},{202,127,27, 1},{128,203, 1,27}, // 196-199
-  {120,204, 0,28},{205,115,29, 0},{206,127,28, 1},{128,207, 1,28}, // 200-203
-  {120,208, 0,29},{209,125,30, 0},{210,127,29, 1},{128,211, 1,29}, // 204-207
-  {130,212, 0,30},{213,125,31, 0},{214,137,30, 1},{138,215, 1,30}, // 208-211
-  {130,216, 0,31},{217,125,32, 0},{218,137,31, 1},{138,219, 1,31}, // 212-215
-  {130,220, 0,32},{221,125,33, 0},{222,137,32, 1},{138,223, 1,32}, // 216-219
-  {130,224, 0,33},{225,125,34, 0},{226,137,33, 1},{138,227, 1,33}, // 220-223
-  {130,228, 0,34},{229,125,35, 0},{230,137,34, 1},{138,231, 1,34}, // 224-227
-  {130,232, 0,35},{233,125,36, 0},{234,137,35, 1},{138,235, 1,35}, // 228-231
-  {130,236, 0,36},{237,125,37, 0},{238,137,36, 1},{138,239, 1,36}, // 232-235
-  {130,240, 0,37},{241,125,38, 0},{242,137,37, 1},{138,243, 1,37}, // 236-239
-  {130,244, 0,38},{245,135,39, 0},{246,137,38, 1},{138,247, 1,38}, // 240-243
-  {140,248, 0,39},{249,135,40, 0},{250, 69,39, 1},{ 80,251, 1,39}, // 244-247
-  {140,252, 0,40},{249,135,41, 0},{250, 69,40, 1},{ 80,251, 1,40}, // 248-251
-  {140,252, 0,41}};  // 252, 253-255 are reserved
-
-#define nex(state,sel) State_table[state][sel]
-
-// The code used to generate the above table at run time (4% slower).
-// To print the table, uncomment the 4 lines of print statements below.
-// In this code x,y = n0,n1 is the number of 0,1 bits represented by a state.
-#else
-
-class StateTable {
-  Array<U8> ns;  // state*4 -> next state if 0, if 1, n0, n1
-  enum {B=5, N=64}; // sizes of b, t
-  static const int b[B];  // x -> max y, y -> max x
-  static U8 t[N][N][2];  // x,y -> state number, number of states
-  int num_states(int x, int y);  // compute t[x][y][1]
-  void discount(int& x);  // set new value of x after 1 or y after 0
-  void next_state(int& x, int& y, int b);  // new (x,y) after bit b
-public:
-  int operator()(int state, int sel) {return ns[state*4+sel];}
-  StateTable();
-} nex;
-
-const int StateTable::b[B]={42,41,13,6,5};  // x -> max y, y -> max x
-U8 StateTable::t[N][N][2];
-
-int StateTable::num_states(int x, int y) {
-  if (x<y) return num_states(y, x);
-  if (x<0 || y<0 || x>=N || y>=N || y>=B || x>=b[y]) return 0;
-
-  // States 0-30 are a history of the last 0-4 bits
-  if (x+y<=4) {  // x+y choose x = (x+y)!/x!y!
-    int r=1;
-    for (int i=x+1; i<=x+y; ++i) r*=i;
-    for (int i=2; i<=y; ++i) r/=i;
-    return r;
-  }
-
-  // States 31-255 represent a 0,1 count and possibly the last bit
-  // if the state is reachable by either a 0 or 1.
-  else
-    return 1+(y>0 && x+y<16);
-}
-
-// New value of count x if the opposite bit is observed
-void StateTable::discount(int& x) {
-  if (x>2) x=ilog(x)/6-1;
-}
-
-// compute next x,y (0 to N) given input b (0 or 1)
-void StateTable::next_state(int& x, int& y, int b) {
-  if (x<y)
-    next_state(y, x, 1-b);
-  else {
-    if (b) {
-      ++y;
-      discount(x);
-    }
-    else {
-      ++x;
-      discount(y);
-    }
-    while (!t[x][y][1]) {
-      if (y<2) --x;
-      else {
-        x=(x*(y-1)+(y/2))/y;
-        --y;
-      }
-    }
-  }
-}
-
-// Initialize next state table ns[state*4] -> next if 0, next if 1, x, y
-StateTable::StateTable(): ns(1024) {
-
-  // Assign states
-  int state=0;
-  for (int i=0; i<256; ++i) {
-    for (int y=0; y<=i; ++y) {
-      int x=i-y;
-      int n=num_states(x, y);
-      if (n) {
-        t[x][y][0]=state;
-        t[x][y][1]=n;
-        state+=n;
-      }
-    }
-  }
-
-  // Print/generate next state table
-  state=0;
-  for (int i=0; i<N; ++i) {
-    for (int y=0; y<=i; ++y) {
-      int x=i-y;
-      for (int k=0; k<t[x][y][1]; ++k) {
-        int x0=x, y0=y, x1=x, y1=y;  // next x,y for input 0,1
-        int ns0=0, ns1=0;
-        if (state<15) {
-          ++x0;
-          ++y1;
-          ns0=t[x0][y0][0]+state-t[x][y][0];
-          ns1=t[x1][y1][0]+state-t[x][y][0];
-          if (x>0) ns1+=t[x-1][y+1][1];
-          ns[state*4]=ns0;
-          ns[state*4+1]=ns1;
-          ns[state*4+2]=x;
-          ns[state*4+3]=y;
-        }
-        else if (t[x][y][1]) {
-          next_state(x0, y0, 0);
-          next_state(x1, y1, 1);
-          ns[state*4]=ns0=t[x0][y0][0];
-          ns[state*4+1]=ns1=t[x1][y1][0]+(t[x1][y1][1]>1);
-          ns[state*4+2]=x;
-          ns[state*4+3]=y;
-        }
-          // uncomment to print table above
-//        printf("{%3d,%3d,%2d,%2d},", ns[state*4], ns[state*4+1],
-//          ns[state*4+2], ns[state*4+3]);
-//        if (state%4==3) printf(" // %d-%d\n  ", state-3, state);
-        assert(state>=0 && state<256);
-        assert(t[x][y][1]>0);
-        assert(t[x][y][0]<=state);
-        assert(t[x][y][0]+t[x][y][1]>state);
-        assert(t[x][y][1]<=6);
-        assert(t[x0][y0][1]>0);
-        assert(t[x1][y1][1]>0);
-        assert(ns0-t[x0][y0][0]<t[x0][y0][1]);
-        assert(ns0-t[x0][y0][0]>=0);
-        assert(ns1-t[x1][y1][0]<t[x1][y1][1]);
-        assert(ns1-t[x1][y1][0]>=0);
-        ++state;
-      }
-    }
-  }
-//  printf("%d states\n", state); exit(0);  // uncomment to print table above
-}
-
-#endif
-
-///////////////////////////// Squash //////////////////////////////
-
-// return p = 1/(1 + exp(-d)), d scaled by 8 bits, p scaled by 12 bits
-int squash(int d) {
-  static const int t[33]={
-    1,2,3,6,10,16,27,45,73,120,194,310,488,747,1101,
-    1546,2047,2549,2994,3348,3607,3785,3901,3975,4022,
-    4050,4068,4079,4085,4089,4092,4093,4094};
-  if (d>2047) return 4095;
-  if (d<-2047) return 0;
-  int w=d&127;
-  d=(d>>7)+16;
-  return (t[d]*(128-w)+t[(d+1)]*w+64) >> 7;
-}
-
-//////////////////////////// Stretch ///////////////////////////////
-
-// Inverse of squash. d = ln(p/(1-p)), d scaled by 8 bits, p by 12 bits.
-// d has range -2047 to 2047 representing -8 to 8.  p has range 0 to 4095.
-
-class Stretch {
-  Array<short> t;
-public:
-  Stretch();
-  int operator()(int p) const {
-    assert(p>=0 && p<4096);
-    return t[p];
-  }
-} stretch;
-
-Stretch::Stretch(): t(4096) {
-  int pi=0;
-  for (int x=-2047; x<=2047; ++x) {  // invert squash()
-    int i=squash(x);
-    for (int j=pi; j<=i; ++j)
-      t[j]=x;
-    pi=i+1;
-  }
-  t[4095]=2047;
-}
-
-//////////////////////////// Mixer /////////////////////////////
-
-// Mixer m(N, M, S=1, w=0) combines models using M neural networks with
-//   N inputs each, of which up to S may be selected.  If S > 1 then
-//   the outputs of these neural networks are combined using another
-//   neural network (with parameters S, 1, 1).  If S = 1 then the
-//   output is direct.  The weights are initially w (+-32K).
-//   It is used as follows:
-// m.update() trains the network where the expected output is the
-//   last bit (in the global variable y).
-// m.add(stretch(p)) inputs prediction from one of N models.  The
-//   prediction should be positive to predict a 1 bit, negative for 0,
-//   nominally +-256 to +-2K.  The maximum allowed value is +-32K but
-//   using such large values may cause overflow if N is large.
-// m.set(cxt, range) selects cxt as one of 'range' neural networks to
-//   use.  0 <= cxt < range.  Should be called up to S times such
-//   that the total of the ranges is <= M.
-// m.p() returns the output prediction that the next bit is 1 as a
-//   12 bit number (0 to 4095).
-
-// dot_product returns dot product t*w of n elements.  n is rounded
-// up to a multiple of 8.  Result is scaled down by 8 bits.
-#ifdef NOASM  // no assembly language
-int dot_product(short *t, short *w, int n) {
-  int sum=0;
-  n=(n+7)&-8;
-  for (int i=0; i<n; i+=2)
-    sum+=(t[i]*w[i]+t[i+1]*w[i+1]) >> 8;
-  return sum;
-}
-#else  // The NASM version uses MMX and is about 8 times faster.
-extern "C" int dot_product(short *t, short *w, int n);  // in NASM
-#endif
-
-// Train neural network weights w[n] given inputs t[n] and err.
-// w[i] += t[i]*err, i=0..n-1.  t, w, err are signed 16 bits (+- 32K).
-// err is scaled 16 bits (representing +- 1/2).  w[i] is clamped to +- 32K
-// and rounded.  n is rounded up to a multiple of 8.
-#ifdef NOASM
-void train(short *t, short *w, int n, int err) {
-  n=(n+7)&-8;
-  for (int i=0; i<n; ++i) {
-    int wt=w[i]+(((t[i]*err*2>>16)+1)>>1);
-    if (wt<-32768) wt=-32768;
-    if (wt>32767) wt=32767;
-    w[i]=wt;
-  }
-}
-#else
-extern "C" void train(short *t, short *w, int n, int err);  // in NASM
-#endif
-
-class Mixer {
-  const int N, M, S;   // max inputs, max contexts, max context sets
-  Array<short, 16> tx; // N inputs from add()
-  Array<short, 16> wx; // N*M weights
-  Array<int> cxt;  // S contexts
-  int ncxt;        // number of contexts (0 to S)
-  int base;        // offset of next context
-  int nx;          // Number of inputs in tx, 0 to N
-  Array<int> pr;   // last result (scaled 12 bits)
-  Mixer* mp;       // points to a Mixer to combine results
-public:
-  Mixer(int n, int m, int s=1, int w=0);
-
-  // Adjust weights to minimize coding cost of last prediction
-  void update() {
-    for (int i=0; i<ncxt; ++i) {
-      int err=((y<<12)-pr[i])*7;
-      assert(err>=-32768 && err<32768);
-      if (err) train(&tx[0], &wx[cxt[i]*N], nx, err);
-    }
-    nx=base=ncxt=0;
-  }
-
-  // Input x (call up to N times)
-  void add(int x) {
-    assert(nx<N);
-    tx[nx++]=x;
-  }
-
-  // Set a context (call S times, sum of ranges <= M)
-  void set(int cx, int range) {
-    assert(range>=0);
-    assert(ncxt<S);
-    assert(cx>=0);
-    assert(base+cx<M);
-    cxt[ncxt++]=base+cx;
-    base+=range;
-  }
-
-  // predict next bit
-  int p() {
-    while (nx&7) tx[nx++]=0;  // pad
-    if (mp) {  // combine outputs
-      mp->update();
-      for (int i=0; i<ncxt; ++i) {
-        pr[i]=squash(dot_product(&tx[0], &wx[cxt[i]*N], nx)>>5);
-        mp->add(stretch(pr[i]));
-      }
-      mp->set(0, 1);
-      return mp->p();
-    }
-    else {  // S=1 context
-      return pr[0]=squash(dot_product(&tx[0], &wx[0], nx)>>8);
-    }
-  }
-  ~Mixer();
-};
-
-Mixer::~Mixer() {
-  delete mp;
-}
-
-
-Mixer::Mixer(int n, int m, int s, int w):
-    N((n+7)&-8), M(m), S(s), tx(N), wx(N*M),
-    cxt(S), ncxt(0), base(0), nx(0), pr(S), mp(0) {
-  assert(n>0 && N>0 && (N&7)==0 && M>0);
-  int i;
-  for (i=0; i<S; ++i)
-    pr[i]=2048;
-  for (i=0; i<N*M; ++i)
-    wx[i]=w;
-  if (S>1) mp=new Mixer(S, 1, 1);
-}
-
-//////////////////////////// APM1 //////////////////////////////
-
-// APM1 maps a probability and a context into a new probability
-// that bit y will next be 1.  After each guess it updates
-// its state to improve future guesses.  Methods:
-//
-// APM1 a(N) creates with N contexts, uses 66*N bytes memory.
-// a.p(pr, cx, rate=7) returned adjusted probability in context cx (0 to
-//   N-1).  rate determines the learning rate (smaller = faster, default 7).
-//   Probabilities are scaled 12 bits (0-4095).
-
-class APM1 {
-  int index;     // last p, context
-  const int N;   // number of contexts
-  Array<U16> t;  // [N][33]:  p, context -> p
-public:
-  APM1(int n);
-  int p(int pr=2048, int cxt=0, int rate=7) {
-    assert(pr>=0 && pr<4096 && cxt>=0 && cxt<N && rate>0 && rate<32);
-    pr=stretch(pr);
-    int g=(y<<16)+(y<<rate)-y-y;
-    t[index] += (g-t[index]) >> rate;
-    t[index+1] += (g-t[index+1]) >> rate;
-    const int w=pr&127;  // interpolation weight (33 points)
-    index=((pr+2048)>>7)+cxt*33;
-    return (t[index]*(128-w)+t[index+1]*w) >> 11;
-  }
-};
-
-// maps p, cxt -> p initially
-APM1::APM1(int n): index(0), N(n), t(n*33) {
-  for (int i=0; i<N; ++i)
-    for (int j=0; j<33; ++j)
-      t[i*33+j] = i==0 ? squash((j-16)*128)*16 : t[j];
-}
-
-//////////////////////////// StateMap, APM //////////////////////////
-
-// A StateMap maps a context to a probability.  Methods:
-//
-// Statemap sm(n) creates a StateMap with n contexts using 4*n bytes memory.
-// sm.p(y, cx, limit) converts state cx (0..n-1) to a probability (0..4095).
-//     that the next y=1, updating the previous prediction with y (0..1).
-//     limit (1..1023, default 1023) is the maximum count for computing a
-//     prediction.  Larger values are better for stationary sources.
-
-static int dt[1024];  // i -> 16K/(i+3)
-
-class StateMap {
-protected:
-  const int N;  // Number of contexts
-  int cxt;      // Context of last prediction
-  Array<U32> t;       // cxt -> prediction in high 22 bits, count in low 10 bits
-  inline void update(int limit) {
-    assert(cxt>=0 && cxt<N);
-    U32 *p=&t[cxt], p0=p[0];
-    int n=p0&1023, pr=p0>>10;  // count, prediction
-    if (n<limit) ++p0;
-    else p0=(p0&0xfffffc00)|limit;
-    p0+=(((y<<22)-pr)>>3)*dt[n]&0xfffffc00;
-    p[0]=p0;
-  }
-
-public:
-  StateMap(int n=256);
-
-  // update bit y (0..1), predict next bit in context cx
-  int p(int cx, int limit=1023) {
-    assert(cx>=0 && cx<N);
-    assert(limit>0 && limit<1024);
-    update(limit);
-    return t[cxt=cx]>>20;
-  }
-};
-
-StateMap::StateMap(int n): N(n), cxt(0), t(n) {
-  for (int i=0; i<N; ++i)
-    t[i]=1<<31;
-}
-
-// An APM maps a probability and a context to a new probability.  Methods:
-//
-// APM a(n) creates with n contexts using 96*n bytes memory.
-// a.pp(y, pr, cx, limit) updates and returns a new probability (0..4095)
-//     like with StateMap.  pr (0..4095) is considered part of the context.
-//     The output is computed by interpolating pr into 24 ranges nonlinearly
-//     with smaller ranges near the ends.  The initial output is pr.
-//     y=(0..1) is the last bit.  cx=(0..n-1) is the other context.
-//     limit=(0..1023) defaults to 255.
-
-class APM: public StateMap {
-public:
-  APM(int n);
-  int p(int pr, int cx, int limit=255) {
-   // assert(y>>1==0);
-    assert(pr>=0 && pr<4096);
-    assert(cx>=0 && cx<N/24);
-    assert(limit>0 && limit<1024);
-    update(limit);
-    pr=(stretch(pr)+2048)*23;
-    int wt=pr&0xfff;  // interpolation weight of next element
-    cx=cx*24+(pr>>12);
-    assert(cx>=0 && cx<N-1);
-    cxt=cx+(wt>>11);
-    pr=((t[cx]>>13)*(0x1000-wt)+(t[cx+1]>>13)*wt)>>19;
-    return pr;
-  }
-};
-
-APM::APM(int n): StateMap(n*24) {
-  for (int i=0; i<N; ++i) {
-    int p=((i%24*2+1)*4096)/48-2048;
-    t[i]=(U32(squash(p))<<20)+6;
-  }
-}
-
-
-//////////////////////////// hash //////////////////////////////
-
-// Hash 2-5 ints.
-inline U32 hash(U32 a, U32 b, U32 c=0xffffffff, U32 d=0xffffffff,
-    U32 e=0xffffffff) {
-  U32 h=a*200002979u+b*30005491u+c*50004239u+d*70004807u+e*110002499u;
-  return h^h>>9^a>>2^b>>3^c>>4^d>>5^e>>6;
-}
-
-///////////////////////////// BH ////////////////////////////////
-
-// A BH maps a 32 bit hash to an array of B bytes (checksum and B-2 values)
-//
-// BH bh(N); creates N element table with B bytes each.
-//   N must be a power of 2.  The first byte of each element is
-//   reserved for a checksum to detect collisions.  The remaining
-//   B-1 bytes are values, prioritized by the first value.  This
-//   byte is 0 to mark an unused element.
-//
-// bh[i] returns a pointer to the i'th element, such that
-//   bh[i][0] is a checksum of i, bh[i][1] is the priority, and
-//   bh[i][2..B-1] are other values (0-255).
-//   The low lg(n) bits as an index into the table.
-//   If a collision is detected, up to M nearby locations in the same
-//   cache line are tested and the first matching checksum or
-//   empty element is returned.
-//   If no match or empty element is found, then the lowest priority
-//   element is replaced.
-
-// 2 byte checksum with LRU replacement (except last 2 by priority)
-template <int B> class BH {
-  enum {M=8};  // search limit
-  Array<U8, 64> t; // elements
-  U32 n; // size-1
-public:
-  BH(int i): t(i*B), n(i-1) {
-    assert(B>=2 && i>0 && (i&(i-1))==0); // size a power of 2?
-  }
-  U8* operator[](U32 i);
-};
-
-template <int B>
-inline  U8* BH<B>::operator[](U32 i) {
-  U16 chk=(i>>16^i)&0xffff;
-  i=i*M&n;
-  U8 *p;
-  U16 *cp;
-  int j;
-  for (j=0; j<M; ++j) {
-    p=&t[(i+j)*B];
-    cp=(U16*)p;
-    if (p[2]==0) {*cp=chk;break;}
-    if (*cp==chk) break;  // found
-  }
-  if (j==0) return p+1;  // front
-  static U8 tmp[B];  // element to move to front
-  if (j==M) {
-    --j;
-    memset(tmp, 0, B);
-    memmove(tmp, &chk, 2);
-    if (M>2 && t[(i+j)*B+2]>t[(i+j-1)*B+2]) --j;
-  }
-  else memcpy(tmp, cp, B);
-  memmove(&t[(i+1)*B], &t[i*B], j*B);
-  memcpy(&t[i*B], tmp, B);
-  return &t[i*B+1];
-}
-
-/////////////////////////// ContextMap /////////////////////////
-//
-// A ContextMap maps contexts to a bit histories and makes predictions
-// to a Mixer.  Methods common to all classes:
-//
-// ContextMap cm(M, C); creates using about M bytes of memory (a power
-//   of 2) for C contexts.
-// cm.set(cx);  sets the next context to cx, called up to C times
-//   cx is an arbitrary 32 bit value that identifies the context.
-//   It should be called before predicting the first bit of each byte.
-// cm.mix(m) updates Mixer m with the next prediction.  Returns 1
-//   if context cx is found, else 0.  Then it extends all the contexts with
-//   global bit y.  It should be called for every bit:
-//
-//     if (bpos==0)
-//       for (int i=0; i<C; ++i) cm.set(cxt[i]);
-//     cm.mix(m);
-//
-// The different types are as follows:
-//
-// - RunContextMap.  The bit history is a count of 0-255 consecutive
-//     zeros or ones.  Uses 4 bytes per whole byte context.  C=1.
-//     The context should be a hash.
-// - SmallStationaryContextMap.  0 <= cx < M/512.
-//     The state is a 16-bit probability that is adjusted after each
-//     prediction.  C=1.
-// - ContextMap.  For large contexts, C >= 1.  Context need not be hashed.
-
-// Predict to mixer m from bit history state s, using sm to map s to
-// a probability.
-inline int mix2(Mixer& m, int s, StateMap& sm, bool isThree, int runs) {
-  static int va[8], vb[8], vc[8];
-  static int threeCount;
-  for(int i=0; i<8; i++){
-    vc[i]=vb[i];
-    vb[i]=va[i];
-  }
-  int v[8];
-  int p1=sm.p(s);
-  int n0=-!nex(s,2);
-  int n1=-!nex(s,3);
-  int st=stretch(p1)>>2;
-  va[0]=v[0]=st;
-  p1>>=4;
-  int p0=255-p1;
-  va[1]=v[1]=p1-p0;
-  va[2]=v[2]=st*(n1-n0);
-  va[3]=v[3]=(p1&n0)-(p0&n1);
-  va[4]=v[4]=(p1&n1)-(p0&n0);
-  va[5]=v[5]=v[1]-v[3];
-  va[6]=v[6]=v[1]-v[4];
-  va[7]=v[7]=runs;
-  if(isThree){
-     threeCount++;
-     if (threeCount==3){
-       m.add(va[0]+vb[0]-vc[0]);
-       m.add(vb[0]+vc[0]-va[0]);
-       m.add(vc[0]+va[0]-vb[0]); 
-       m.add(va[7]+vb[7]-vc[7]);
-       m.add(vb[7]+vc[7]-va[7]);
-       m.add(vc[7]+va[7]-vb[7]); 
-       threeCount=0;
-    }
-  }else{
-    m.add(v[7]);
-    m.add(v[5]);
-    m.add(v[6]);
-    m.add(v[0]);
-    m.add(v[2]);
-  }
-  m.add(v[3]);
-  m.add(v[4]);
-  return s>0;
-}
-
-// A RunContextMap maps a context into the next byte and a repeat
-// count up to M.  Size should be a power of 2.  Memory usage is 3M/4.
-class RunContextMap {
-  BH<4> t;
-  U8* cp;
-public:
-  RunContextMap(int m): t(m/4) {cp=t[0]+1;}
-  void set(U32 cx) {  // update count
-    if (cp[0]==0 || cp[1]!=buf(1)) cp[0]=1, cp[1]=buf(1);
-    else if (cp[0]<255) ++cp[0];
-    cp=t[cx]+1;
-  }
-  int p() {  // predict next bit
-    if ((cp[1]+256)>>(8-bpos)==c0)
-      return ((cp[1]>>(7-bpos)&1)*2-1)*ilog(cp[0]+1)*8;
-    else
-      return 0;
-  }
-  int mix(Mixer& m) {  // return run length
-    m.add(p());
-    return cp[0]!=0;
-  }
-};
-
-// Context is looked up directly.  m=size is power of 2 in bytes.
-// Context should be < m/512.  High bits are discarded.
-class SmallStationaryContextMap {
-  Array<U16> t;
-  int cxt;
-  U16 *cp;
-public:
-  SmallStationaryContextMap(int m): t(m/2), cxt(0) {
-    assert((m/2&m/2-1)==0); // power of 2?
-    for (int i=0; i<t.size(); ++i)
-      t[i]=32768;
-    cp=&t[0];
-  }
-  void set(U32 cx) {
-    cxt=cx*256&(t.size()-256);
-  }
-  void mix(Mixer& m, int rate=7) {
-    *cp += ((y<<16)-(*cp)+(1<<(rate-1))) >> rate;
-    cp=&t[cxt+c0];
-    m.add(stretch((*cp)>>4));
-  }
-};
-
-// Context map for large contexts.  Most modeling uses this type of context
-// map.  It includes a built in RunContextMap to predict the last byte seen
-// in the same context, and also bit-level contexts that map to a bit
-// history state.
-//
-// Bit histories are stored in a hash table.  The table is organized into
-// 64-byte buckets alinged on cache page boundaries.  Each bucket contains
-// a hash chain of 7 elements, plus a 2 element queue (packed into 1 byte)
-// of the last 2 elements accessed for LRU replacement.  Each element has
-// a 2 byte checksum for detecting collisions, and an array of 7 bit history
-// states indexed by the last 0 to 2 bits of context.  The buckets are indexed
-// by a context ending after 0, 2, or 5 bits of the current byte.  Thus, each
-// byte modeled results in 3 main memory accesses per context, with all other
-// accesses to cache.
-//
-// On bits 0, 2 and 5, the context is updated and a new bucket is selected.
-// The most recently accessed element is tried first, by comparing the
-// 16 bit checksum, then the 7 elements are searched linearly.  If no match
-// is found, then the element with the lowest priority among the 5 elements
-// not in the LRU queue is replaced.  After a replacement, the queue is
-// emptied (so that consecutive misses favor a LFU replacement policy).
-// In all cases, the found/replaced element is put in the front of the queue.
-//
-// The priority is the state number of the first element (the one with 0
-// additional bits of context).  The states are sorted by increasing n0+n1
-// (number of bits seen), implementing a LFU replacement policy.
-//
-// When the context ends on a byte boundary (bit 0), only 3 of the 7 bit
-// history states are used.  The remaining 4 bytes implement a run model
-// as follows: <count:7,d:1> <b1> <unused> <unused> where <b1> is the last byte
-// seen, possibly repeated.  <count:7,d:1> is a 7 bit count and a 1 bit
-// flag (represented by count * 2 + d).  If d=0 then <count> = 1..127 is the
-// number of repeats of <b1> and no other bytes have been seen.  If d is 1 then
-// other byte values have been seen in this context prior to the last <count>
-// copies of <b1>.
-//
-// As an optimization, the last two hash elements of each byte (representing
-// contexts with 2-7 bits) are not updated until a context is seen for
-// a second time.  This is indicated by <count,d> = <1,0> (2).  After update,
-// <count,d> is updated to <2,0> or <1,1> (4 or 3).
-
-class ContextMap {
-  const int C;  // max number of contexts
-  const bool ThreeWay;
-  class E {  // hash element, 64 bytes
-    U16 chk[7];  // byte context checksums
-    U8 last;     // last 2 accesses (0-6) in low, high nibble
-  public:
-    U8 bh[7][7]; // byte context, 3-bit context -> bit history state
-      // bh[][0] = 1st bit, bh[][1,2] = 2nd bit, bh[][3..6] = 3rd bit
-      // bh[][0] is also a replacement priority, 0 = empty
-    U8* get(U16 chk);  // Find element (0-6) matching checksum.
-      // If not found, insert or replace lowest priority (not last).
-  };
-  Array<E, 64> t;  // bit histories for bits 0-1, 2-4, 5-7
-    // For 0-1, also contains a run count in bh[][4] and value in bh[][5]
-    // and pending update count in bh[7]
-  Array<U8*> cp;   // C pointers to current bit history
-  Array<U8*> cp0;  // First element of 7 element array containing cp[i]
-  Array<U32> cxt;  // C whole byte contexts (hashes)
-  Array<U8*> runp; // C [0..3] = count, value, unused, unused
-  StateMap *sm;    // C maps of state -> p
-  int cn;          // Next context to set by set()
-  void update(U32 cx, int c);  // train model that context cx predicts c
-  int mix1(Mixer& m, int cc, int bp, int c1, int y1);
-    // mix() with global context passed as arguments to improve speed.
-public:
-  ContextMap(int m, int c=1, bool isThree=false);  // m = memory in bytes, a power of 2, C = c
-  ~ContextMap();
-  void set(U32 cx, int next=-1);   // set next whole byte context to cx
-    // if next is 0 then set order does not matter
-  int mix(Mixer& m) {return mix1(m, c0, bpos, buf(1), y);}
-};
-
-// Find or create hash element matching checksum ch
-inline U8* ContextMap::E::get(U16 ch) {
-  if (chk[last&15]==ch) return &bh[last&15][0];
-  int b=0xffff, bi=0;
-  for (int i=0; i<7; ++i) {
-    if (chk[i]==ch) return last=last<<4|i, (U8*)&bh[i][0];
-    int pri=bh[i][0];
-    if (pri<b && (last&15)!=i && last>>4!=i) b=pri, bi=i;
-  }
-  return last=0xf0|bi, chk[bi]=ch, (U8*)memset(&bh[bi][0], 0, 7);
-}
-
-// Construct using m bytes of memory for c contexts
-ContextMap::ContextMap(int m, int c, bool isThree): ThreeWay(isThree), C(c), t(m>>6), cp(c), cp0(c),
-    cxt(c), runp(c), cn(0) {
-  assert(m>=64 && (m&m-1)==0);  // power of 2?
-  assert(sizeof(E)==64);
-  sm=new StateMap[C];
-  for (int i=0; i<C; ++i) {
-    cp0[i]=cp[i]=&t[0].bh[0][0];
-    runp[i]=cp[i]+3;
-  }
-}
-
-ContextMap::~ContextMap() {
-  delete[] sm;
-}
-
-// Set the i'th context to cx
-inline void ContextMap::set(U32 cx, int next) {
-  int i=cn++;
-  i&=next;
-  assert(i>=0 && i<C);
-  cx=cx*987654323+i;  // permute (don't hash) cx to spread the distribution
-  cx=cx<<16|cx>>16;
-  cxt[i]=cx*123456791+i;
-}
-
-// Update the model with bit y1, and predict next bit to mixer m.
-// Context: cc=c0, bp=bpos, c1=buf(1), y1=y.
-int ContextMap::mix1(Mixer& m, int cc, int bp, int c1, int y1) {
-
-  // Update model with y
-  int result=0;
-  for (int i=0; i<cn; ++i) {
-    if (cp[i]) {
-      assert(cp[i]>=&t[0].bh[0][0] && cp[i]<=&t[t.size()-1].bh[6][6]);
-      assert((long(cp[i])&63)>=15);
-      int ns=nex(*cp[i], y1);
-      if (ns>=204 && rnd() << ((452-ns)>>3)) ns-=4;  // probabilistic increment
-      *cp[i]=ns;
-    }
-
-    // Update context pointers
-    if (bpos>1 && runp[i][0]==0)
-    {
-     cp[i]=0;
-    }
-    else
-    {
-     switch(bpos)
-     {
-      case 1: case 3: case 6: cp[i]=cp0[i]+1+(cc&1); break;
-      case 4: case 7: cp[i]=cp0[i]+3+(cc&3); break;
-      case 2: case 5: cp0[i]=cp[i]=t[(cxt[i]+cc)&(t.size()-1)].get(cxt[i]>>16); break;
-      default:
-      {
-       cp0[i]=cp[i]=t[(cxt[i]+cc)&(t.size()-1)].get(cxt[i]>>16);
-       // Update pending bit histories for bits 2-7
-       if (cp0[i][3]==2) {
-         const int c=cp0[i][4]+256;
-         U8 *p=t[(cxt[i]+(c>>6))&(t.size()-1)].get(cxt[i]>>16);
-         p[0]=1+((c>>5)&1);
-         p[1+((c>>5)&1)]=1+((c>>4)&1);
-         p[3+((c>>4)&3)]=1+((c>>3)&1);
-         p=t[(cxt[i]+(c>>3))&(t.size()-1)].get(cxt[i]>>16);
-         p[0]=1+((c>>2)&1);
-         p[1+((c>>2)&1)]=1+((c>>1)&1);
-         p[3+((c>>1)&3)]=1+(c&1);
-         cp0[i][6]=0;
-       }
-       // Update run count of previous context
-       if (runp[i][0]==0)  // new context
-         runp[i][0]=2, runp[i][1]=c1;
-       else if (runp[i][1]!=c1)  // different byte in context
-         runp[i][0]=1, runp[i][1]=c1;
-       else if (runp[i][0]<254)  // same byte in context
-         runp[i][0]+=2;
-       else if (runp[i][0]==255)
-         runp[i][0]=128;
-       runp[i]=cp0[i]+3;
-      } break;
-     }
-    }
-
-    int runs;
-    // predict from last byte in context
-    if ((runp[i][1]+256)>>(8-bp)==cc) {
-      int rc=runp[i][0];  // count*2, +1 if 2 different bytes seen
-      int b=(runp[i][1]>>(7-bp)&1)*2-1;  // predicted bit + for 1, - for 0
-      int c=ilog(rc+1)<<(2+(~rc&1));
-      runs=b*c;
-    }
-    else
-      runs=0;
-
-    // predict from bit context
-   if (cp[i])
-   {
-    result+=mix2(m, *cp[i], sm[i], ThreeWay, runs);
-   }
-   else
-   {
-    mix2(m, 0, sm[i], ThreeWay, runs);
-   }
-
-
-  }
-  if (bp==7) cn=0;
-  return result;
-}
-
-//////////////////////////// Models //////////////////////////////
-
-// All of the models below take a Mixer as a parameter and write
-// predictions to it.
-
-//////////////////////////// matchModel ///////////////////////////
-
-// matchModel() finds the longest matching context and returns its length
-
-int matchModel(Mixer& m) {
-  const int MAXLEN=65534;  // longest allowed match + 1
-  static Array<int> t(MEM);  // hash table of pointers to contexts
-  static int h=0;  // hash of last 7 bytes
-  static int ptr=0;  // points to next byte of match if any
-  static int len=0;  // length of match, or 0 if no match
-  static int result=0;
-
-  static SmallStationaryContextMap scm1(0x20000);
-
-  if (!bpos) {
-    h=(h*997*8+buf(1)+1)&(t.size()-1);  // update context hash
-    if (len) ++len, ++ptr;
-    else {  // find match
-      ptr=t[h];
-      if (ptr && pos-ptr<buf.size())
-        while (buf(len+1)==buf[ptr-len-1] && len<MAXLEN) ++len;
-    }
-    t[h]=pos;  // update hash table
-    result=len;
-//    if (result>0 && !(result&0xfff)) printf("pos=%d len=%d ptr=%d\n", pos, len, ptr);
-    scm1.set(pos);
-  }
-
-  // predict
-  if (len)
-  {
-   if (buf(1)==buf[ptr-1] && c0==(buf[ptr]+256)>>(8-bpos))
-   {
-    if (len>MAXLEN) len=MAXLEN;
-    if (buf[ptr]>>(7-bpos)&1)
-    {
-     m.add(ilog(len)<<2);
-     m.add(min(len, 32)<<6);
-    }
-    else
-    {
-     m.add(-(ilog(len)<<2));
-     m.add(-(min(len, 32)<<6));
-    }
-   }
-   else
-   {
-    len=0;
-    m.add(0);
-    m.add(0);
-   }
-  }
-  else
-  {
-   m.add(0);
-   m.add(0);
-  }
-
-  scm1.mix(m);
-  return result;
-}
-
-//////////////////////////// wordModel /////////////////////////
-
-// Model English text (words and columns/end of line)
-static U32 frstchar=0, spafdo=0, spaces=0, spacecount=0, words=0, wordcount=0,wordlen=0,wordlen1=0;
-void wordModel(Mixer& m) {
-  static U32 word0=0, word1=0, word2=0, word3=0, word4=0, word5=0;  // hashes
-  static U32 number0=0, number1=0;  // hashes
-  static U32 text0=0;  // hash stream of letters
-  static ContextMap cm(MEM*16, 20+3+3+6+1+1+1+1+1+1+2+1+1+1+1);
-  static int nl1=-3, nl=-2;  // previous, current newline position
-  // Update word hashes
-  if (bpos==0) {
-    int c=c4&255;
-    if (spaces&0x80000000) --spacecount;
-    if (words&0x80000000) --wordcount;
-    spaces=spaces*2;
-    words=words*2;
-
-    if (c>='A' && c<='Z') c+='a'-'A';
-    if ((c>='a' && c<='z') || c>=128) {
-      ++words, ++wordcount;
-      word0=word0*263*32+c;
-      text0=text0*997*16+c;
-      wordlen++;
-      wordlen=min(wordlen,45);
-    }
-    else if (word0) {
-      word5=word4*23;
-      word4=word3*19;
-      word3=word2*17;
-      word2=word1*13;
-      word1=word0*11;
-      wordlen1=wordlen;
-      word0=wordlen=0;
-    }
-    if (c>='0' && c<='9') {
-      number0=number0*263*32+c;
-    }
-    else if (number0) {
-      number1=number0*11;
-      number0=0;
-    }
-    if (c=='.' || c=='!' || c=='?' || c==',' || c==';' || c==':') spafdo=0; else { ++spafdo; spafdo=min(63,spafdo); }
-    if (c==32 || c==10) { ++spaces, ++spacecount; if (c==10) nl1=nl, nl=pos-1;}
-    int col=min(255, pos-nl), above=buf[nl1+col]; // text column context
-    if (col<=2) frstchar=(col==2?min(c,96):0);
-    cm.set(spafdo|col<<8);
-    cm.set(spafdo|spaces<<8);
-    cm.set(frstchar<<11|c);
-    cm.set(col<<8|frstchar);
-    cm.set(spaces<<8|(words&255));
-
-    cm.set(number0+word2*31);
-    cm.set(number0+word1*31);
-    cm.set(number0*31+c);
-    cm.set(number0+number1*31);
-    cm.set(word0+number1*31);
-
-    cm.set(frstchar<<7);
-    cm.set(wordlen<<16|c);
-    cm.set(wordlen1<<8|col);
-    cm.set(c*64+spacecount/2);
-    U32 h=wordcount*64+spacecount;
-    cm.set((c<<13)+h);
-    cm.set(h);
-    cm.set(h+spafdo*8);
-
-    U32 d=c4&0xffff;
-    cm.set(d<<9|frstchar);
-
-    h=word0*271+buf(1);
-    cm.set(h);
-    cm.set(word0);
-    cm.set(h+word1);
-    cm.set(word0+word1*31);
-    cm.set(h+word1+word2*29);
-    cm.set(text0&0xffffff);
-    cm.set(text0&0xfffff);
-
-    cm.set(h+word2);
-    cm.set(h+word3);
-    cm.set(h+word4);
-    cm.set(h+word5);
-    cm.set(buf(1)|buf(3)<<8|buf(5)<<16);
-    cm.set(buf(2)|buf(4)<<8|buf(6)<<16);
-
-    cm.set(h+word1+word3);
-    cm.set(h+word2+word3);
-
-    // Text column models
-    cm.set(col<<16|buf(1)<<8|above);
-    cm.set(buf(1)<<8|above);
-    cm.set(col<<8|buf(1));
-    cm.set(col*(c==32));
-    cm.set(col);
-  }
-  cm.mix(m);
-}
-
-//////////////////////////// recordModel ///////////////////////
-
-// Model 2-D data with fixed record length.  Also order 1-2 models
-// that include the distance to the last match.
-
-void recordModel(Mixer& m) {
-  static int cpos1[256] , cpos2[256], cpos3[256], cpos4[256];
-  static int wpos1[0x10000]; // buf(1..2) -> last position
-  static int rlen=2, rlen1=3, rlen2=4;  // run length and 2 candidates
-  static int rcount1=0, rcount2=0;  // candidate counts
-  static ContextMap cm(32768, 3), cn(32768/2, 3), co(32768*2, 3), cp(MEM, 3);
-
-  // Find record length
-  if (!bpos) {
-    int w=c4&0xffff, c=w&255, d=w>>8;
-    int r=pos-cpos1[c];
-    if (r>1 && r==cpos1[c]-cpos2[c]
-        && r==cpos2[c]-cpos3[c] && r==cpos3[c]-cpos4[c]
-        && (r>15 || ((c==buf(r*5+1)) && c==buf(r*6+1)))) {
-      if (r==rlen1) ++rcount1;
-      else if (r==rlen2) ++rcount2;
-      else if (rcount1>rcount2) rlen2=r, rcount2=1;
-      else rlen1=r, rcount1=1;
-    }
-    if (rcount1>15 && rlen!=rlen1) rlen=rlen1, rcount1=rcount2=0;
-    if (rcount2>15 && rlen!=rlen2) rlen=rlen2, rcount1=rcount2=0;
-
-    // Set 2 dimensional contexts
-    assert(rlen>0);
-    cm.set(c<<8| (min(255, pos-cpos1[c])/4));
-    cm.set(w<<9| llog(pos-wpos1[w])>>2);
-
-    cm.set(rlen|buf(rlen)<<10|buf(rlen*2)<<18);
-    cn.set(w|rlen<<8);
-    cn.set(d|rlen<<16);
-    cn.set(c|rlen<<8);
-
-    co.set(buf(1)<<8|min(255, pos-cpos1[buf(1)]));
-    co.set(buf(1)<<17|buf(2)<<9|llog(pos-wpos1[w])>>2);
-    int col=pos%rlen;
-    co.set(buf(1)<<8|buf(rlen));
-
-    //cp.set(w*16);
-    //cp.set(d*32);
-    //cp.set(c*64);
-    cp.set(rlen|buf(rlen)<<10|col<<18);
-    cp.set(rlen|buf(1)<<10|col<<18);
-    cp.set(col|rlen<<12);
-
-    // update last context positions
-    cpos4[c]=cpos3[c];
-    cpos3[c]=cpos2[c];
-    cpos2[c]=cpos1[c];
-    cpos1[c]=pos;
-    wpos1[w]=pos;
-  }
-  cm.mix(m);
-  cn.mix(m);
-  co.mix(m);
-  cp.mix(m);
-}
-
-
-//////////////////////////// sparseModel ///////////////////////
-
-// Model order 1-2 contexts with gaps.
-
-void sparseModel(Mixer& m, int seenbefore, int howmany) {
-  static ContextMap cm(MEM*2, 40);
-  if (bpos==0) {
-    cm.set(seenbefore);
-    cm.set(howmany);
-    cm.set(buf(1)|buf(5)<<8);
-    cm.set(buf(1)|buf(6)<<8);
-    cm.set(buf(3)|buf(6)<<8);
-    cm.set(buf(4)|buf(8)<<8);
-    cm.set(c4&0x00f0f0ff);
-    cm.set(c4&0x00ff00ff);
-    cm.set(c4&0xff0000ff);
-    cm.set(c4&0x00f8f8f8);
-    cm.set(c4&0xf8f8f8f8);
-    cm.set(c4&0x00f0f0f0);
-    cm.set(c4&0xf0f0f0f0);
-    cm.set(c4&0x00e0e0e0);
-    cm.set(c4&0xe0e0e0e0);
-    cm.set(c4&0x810000c1);
-    cm.set(c4&0xC3CCC38C);
-    cm.set(c4&0x0081CC81);
-    cm.set(c4&0x00c10081);
-    for (int i=1; i<8; ++i) {
-      cm.set(seenbefore|buf(i)<<8);
-      cm.set((buf(i+2)<<8)|buf(i+1));
-      cm.set((buf(i+3)<<8)|buf(i+1));
-    }
-  }
-  cm.mix(m);
-}
-
-//////////////////////////// distanceModel ///////////////////////
-
-// Model for modelling distances between symbols
-
-void distanceModel(Mixer& m) {
-  static ContextMap cr(MEM, 3);
-  if (bpos == 0) {
-    static int pos00=0,pos20=0,posnl=0;
-    int c=c4&0xff;
-    if (c==0x00) pos00=pos;
-    if (c==0x20) pos20=pos;
-    if (c==0xff||c=='\r'||c=='\n') posnl=pos;
-    cr.set(min(pos-pos00,255)|(c<<8));
-    cr.set(min(pos-pos20,255)|(c<<8));
-    cr.set(min(pos-posnl,255)|((c<<8)+234567));
-  }
-  cr.mix(m);
-}
-
-
-//////////////////////////// im24bitModel /////////////////////////////////
-
-// Model for 24-bit image data
-
-// Square buf(i)
-inline int sqrbuf(int i) {
-  assert(i>0);
-  return buf(i)*buf(i);
-}
-
-void im24bitModel(Mixer& m, int w) {
-  const int SC=0x20000;
-  static SmallStationaryContextMap scm1(SC), scm2(SC),
-    scm3(SC), scm4(SC), scm5(SC), scm6(SC), scm7(SC), scm8(SC), scm9(SC*2), scm10(512);
-  static ContextMap cm(MEM*4, 13);
-
-  // Select nearby pixels as context
-  if (!bpos) {
-    assert(w>3);
-    int color=pos%3;
-    int mean=buf(3)+buf(w-3)+buf(w)+buf(w+3);
-    const int var=(sqrbuf(3)+sqrbuf(w-3)+sqrbuf(w)+sqrbuf(w+3)-mean*mean/4)>>2;
-    mean>>=2;
-    const int logvar=ilog(var);
-    int i=color<<4;
-    cm.set(hash(++i, buf(3)));
-    cm.set(hash(++i, buf(3), buf(1)));
-    cm.set(hash(++i, buf(3), buf(1), buf(2)));
-    cm.set(hash(++i, buf(w)));
-    cm.set(hash(++i, buf(w), buf(1)));
-    cm.set(hash(++i, buf(w), buf(1), buf(2)));
-    cm.set(hash(++i, (buf(3)+buf(w))>>3, buf(1)>>4, buf(2)>>4));
-    cm.set(hash(++i, buf(1), buf(2)));
-    cm.set(hash(++i, buf(3), buf(1)-buf(4)));
-    cm.set(hash(++i, buf(3)+buf(1)-buf(4)));
-    cm.set(hash(++i, buf(w), buf(1)-buf(w+1)));
-    cm.set(hash(++i, buf(w)+buf(1)-buf(w+1)));
-    cm.set(hash(++i, mean, logvar>>4));
-    scm1.set(buf(3)+buf(w)-buf(w+3));
-    scm2.set(buf(3)+buf(w-3)-buf(w));
-    scm3.set(buf(3)*2-buf(6));
-    scm4.set(buf(w)*2-buf(w*2));
-    scm5.set(buf(w+3)*2-buf(w*2+6));
-    scm6.set(buf(w-3)*2-buf(w*2-6));
-    scm7.set(buf(w-3)+buf(1)-buf(w-2));
-    scm8.set(buf(w)+buf(w-3)-buf(w*2-3));
-    scm9.set(mean>>1|(logvar<<1&0x180));
-  }
-
-  // Predict next bit
-  scm1.mix(m);
-  scm2.mix(m);
-  scm3.mix(m);
-  scm4.mix(m);
-  scm5.mix(m);
-  scm6.mix(m);
-  scm7.mix(m);
-  scm8.mix(m);
-  scm9.mix(m);
-  scm10.mix(m);
-  cm.mix(m);
-  static int col=0;
-  if (++col>=24) col=0;
-  m.set(2, 8);
-  m.set(col, 24);
-  m.set((buf(1)>>4)*3+(pos%3), 48);
-  m.set(c0, 256);
-}
-
-//////////////////////////// im8bitModel /////////////////////////////////
-
-// Model for 8-bit image data
-
-void im8bitModel(Mixer& m, int w) {
-  const int SC=0x20000;
-  static SmallStationaryContextMap scm1(SC), scm2(SC),
-    scm3(SC), scm4(SC), scm5(SC), scm6(SC*2),scm7(SC);
-  static ContextMap cm(MEM*4, 32);
-
-  // Select nearby pixels as context
-  if (!bpos) {
-    assert(w>3);
-    int mean=buf(1)+buf(w-1)+buf(w)+buf(w+1);
-    const int var=(sqrbuf(1)+sqrbuf(w-1)+sqrbuf(w)+sqrbuf(w+1)-mean*mean/4)>>2;
-    mean>>=2;
-    const int logvar=ilog(var);
-    int i=0;
-    // 2 x
-    cm.set(hash(++i, buf(1)>>2, buf(w)>>2));
-    cm.set(hash(++i, buf(1)>>2, buf(2)>>2));
-    cm.set(hash(++i, buf(w)>>2, buf(w*2)>>2));
-    cm.set(hash(++i, buf(1)>>2, buf(w-1)>>2));
-    cm.set(hash(++i, buf(w)>>2, buf(w+1)>>2));
-    cm.set(hash(++i, buf(w+1)>>2, buf(w+2)>>2));
-    cm.set(hash(++i, buf(w+1)>>2, buf(w*2+2)>>2));
-    cm.set(hash(++i, buf(w-1)>>2, buf(w*2-2)>>2));
-    cm.set(hash(++i, (buf(1)+buf(w))>>1));
-    cm.set(hash(++i, (buf(1)+buf(2))>>1));
-    cm.set(hash(++i, (buf(w)+buf(w*2))>>1));
-    cm.set(hash(++i, (buf(1)+buf(w-1))>>1));
-    cm.set(hash(++i, (buf(w)+buf(w+1))>>1));
-    cm.set(hash(++i, (buf(w+1)+buf(w+2))>>1));
-    cm.set(hash(++i, (buf(w+1)+buf(w*2+2))>>1));
-    cm.set(hash(++i, (buf(w-1)+buf(w*2-2))>>1));
-    // 3 x
-    cm.set(hash(++i, buf(w)>>2, buf(1)>>2, buf(w-1)>>2));
-    cm.set(hash(++i, buf(w-1)>>2, buf(w)>>2, buf(w+1)>>2));
-    cm.set(hash(++i, buf(1)>>2, buf(w-1)>>2, buf(w*2-1)>>2));
-    // mixed
-    cm.set(hash(++i, (buf(3)+buf(w))>>1, buf(1)>>2, buf(2)>>2));
-    cm.set(hash(++i, (buf(2)+buf(1))>>1,(buf(w)+buf(w*2))>>1,buf(w-1)>>2));
-    cm.set(hash(++i, (buf(2)+buf(1))>>2,(buf(w-1)+buf(w))>>2));
-    cm.set(hash(++i, (buf(2)+buf(1))>>1,(buf(w)+buf(w*2))>>1));
-    cm.set(hash(++i, (buf(2)+buf(1))>>1,(buf(w-1)+buf(w*2-2))>>1));
-    cm.set(hash(++i, (buf(2)+buf(1))>>1,(buf(w+1)+buf(w*2+2))>>1));
-    cm.set(hash(++i, (buf(w)+buf(w*2))>>1,(buf(w-1)+buf(w*2+2))>>1));
-    cm.set(hash(++i, (buf(w-1)+buf(w))>>1,(buf(w)+buf(w+1))>>1));
-    cm.set(hash(++i, (buf(1)+buf(w-1))>>1,(buf(w)+buf(w*2))>>1));
-    cm.set(hash(++i, (buf(1)+buf(w-1))>>2,(buf(w)+buf(w+1))>>2));
-    cm.set(hash(++i, (((buf(1)-buf(w-1))>>1)+buf(w))>>2));
-    cm.set(hash(++i, (((buf(w-1)-buf(w))>>1)+buf(1))>>2));
-    cm.set(hash(++i, (-buf(1)+buf(w-1)+buf(w))>>2));
-    scm1.set((buf(1)+buf(w))>>1);
-    scm2.set((buf(1)+buf(w)-buf(w+1))>>1);
-    scm3.set((buf(1)*2-buf(2))>>1);
-    scm4.set((buf(w)*2-buf(w*2))>>1);
-    scm5.set((buf(1)+buf(w)-buf(w-1))>>1);
-    scm6.set(mean>>1|(logvar<<1&0x180));
-  }
-
-  // Predict next bit
-  scm1.mix(m);
-  scm2.mix(m);
-  scm3.mix(m);
-  scm4.mix(m);
-  scm5.mix(m);
-  scm6.mix(m);
-  scm7.mix(m); // Amazingly but improves compression!
-  cm.mix(m);
-  static int col=0;
-  if (++col>=8) col=0; // reset after every 24 columns?
-  m.set(2, 8);
-  m.set(col, 8);
-  m.set((buf(w)+buf(1))>>4, 32);
-  m.set(c0, 256);
-}
-
-//////////////////////////// im1bitModel /////////////////////////////////
-
-// Model for 1-bit image data
-
-void im1bitModel(Mixer& m, int w) {
-  static U32 r0, r1, r2, r3;  // last 4 rows, bit 8 is over current pixel
-  static Array<U8> t(0x10200);  // model: cxt -> state
-  const int N=4+1+1+1+1+1;  // number of contexts
-  static int cxt[N];  // contexts
-  static StateMap sm[N];
-
-  // update the model
-  int i;
-  for (i=0; i<N; ++i)
-    t[cxt[i]]=nex(t[cxt[i]],y);
-
-  // update the contexts (pixels surrounding the predicted one)
-  r0+=r0+y;
-  r1+=r1+((buf(w-1)>>(7-bpos))&1);
-  r2+=r2+((buf(w+w-1)>>(7-bpos))&1);
-  r3+=r3+((buf(w+w+w-1)>>(7-bpos))&1);
-  cxt[0]=(r0&0x7)|(r1>>4&0x38)|(r2>>3&0xc0);
-  cxt[1]=0x100+((r0&1)|(r1>>4&0x3e)|(r2>>2&0x40)|(r3>>1&0x80));
-  cxt[2]=0x200+((r0&0x3f)^(r1&0x3ffe)^(r2<<2&0x7f00)^(r3<<5&0xf800));
-  cxt[3]=0x400+((r0&0x3e)^(r1&0x0c0c)^(r2&0xc800));
-  cxt[4]=0x800+(((r1&0x30)^(r3&0x0c0c))|(r0&3));
-  cxt[5]=0x1000+((!r0&0x444)|(r1&0xC0C)|(r2&0xAE3)|(r3&0x51C));
-  cxt[6]=0x2000+((r0&1)|(r1>>4&0x1d)|(r2>>1&0x60)|(r3&0xC0));
-  cxt[7]=0x4000+((r0>>4&0x2AC)|(r1&0xA4)|(r2&0x349)|(!r3&0x14D));
-
-  // predict
-  for (i=0; i<N; ++i) m.add(stretch(sm[i].p(t[cxt[i]])));
-}
-
-//////////////////////////// jpegModel /////////////////////////
-
-// Model JPEG. Return 1 if a JPEG file is detected or else 0.
-// Only the baseline and 8 bit extended Huffman coded DCT modes are
-// supported.  The model partially decodes the JPEG image to provide
-// context for the Huffman coded symbols.
-
-// Print a JPEG segment at buf[p...] for debugging
-/*
-void dump(const char* msg, int p) {
-  printf("%s:", msg);
-  int len=buf[p+2]*256+buf[p+3];
-  for (int i=0; i<len+2; ++i)
-    printf(" %02X", buf[p+i]);
-  printf("\n");
-}
-*/
-
-// Detect invalid JPEG data.  The proper response is to silently
-// fall back to a non-JPEG model.
-#define jassert(x) if (!(x)) { \
-/*  printf("JPEG error at %d, line %d: %s\n", pos, __LINE__, #x); */ \
-  jpeg=0; \
-  return next_jpeg;}
-
-struct HUF {U32 min, max; int val;}; // Huffman decode tables
-  // huf[Tc][Th][m] is the minimum, maximum+1, and pointer to codes for
-  // coefficient type Tc (0=DC, 1=AC), table Th (0-3), length m+1 (m=0-15)
-
-int jpegModel(Mixer& m) {
-
-  // State of parser
-  enum {SOF0=0xc0, SOF1, SOF2, SOF3, DHT, RST0=0xd0, SOI=0xd8, EOI, SOS, DQT,
-    DNL, DRI, APP0=0xe0, COM=0xfe, FF};  // Second byte of 2 byte codes
-  static int jpeg=0;  // 1 if JPEG is header detected, 2 if image data
-  static int next_jpeg=0;  // updated with jpeg on next byte boundary
-  static int app;  // Bytes remaining to skip in APPx or COM field
-  static int sof=0, sos=0, data=0;  // pointers to buf
-  static Array<int> ht(8);  // pointers to Huffman table headers
-  static int htsize=0;  // number of pointers in ht
-
-  // Huffman decode state
-  static U32 huffcode=0;  // Current Huffman code including extra bits
-  static int huffbits=0;  // Number of valid bits in huffcode
-  static int huffsize=0;  // Number of bits without extra bits
-  static int rs=-1;  // Decoded huffcode without extra bits.  It represents
-    // 2 packed 4-bit numbers, r=run of zeros, s=number of extra bits for
-    // first nonzero code.  huffcode is complete when rs >= 0.
-    // rs is -1 prior to decoding incomplete huffcode.
-  static int mcupos=0;  // position in MCU (0-639).  The low 6 bits mark
-    // the coefficient in zigzag scan order (0=DC, 1-63=AC).  The high
-    // bits mark the block within the MCU, used to select Huffman tables.
-
-  // Decoding tables
-  static Array<HUF> huf(128);  // Tc*64+Th*16+m -> min, max, val
-  static int mcusize=0;  // number of coefficients in an MCU
-  static int linesize=0; // width of image in MCU
-  static int hufsel[2][10];  // DC/AC, mcupos/64 -> huf decode table
-  static Array<U8> hbuf(2048);  // Tc*1024+Th*256+hufcode -> RS
-
-  // Image state
-  static Array<int> color(10);  // block -> component (0-3)
-  static Array<int> pred(4);  // component -> last DC value
-  static int dc=0;  // DC value of the current block
-  static int width=0;  // Image width in MCU
-  static int row=0, column=0;  // in MCU (column 0 to width-1)
-  static Buf cbuf(0x20000); // Rotating buffer of coefficients, coded as:
-    // DC: level shifted absolute value, low 4 bits discarded, i.e.
-    //   [-1023...1024] -> [0...255].
-    // AC: as an RS code: a run of R (0-15) zeros followed by an S (0-15)
-    //   bit number, or 00 for end of block (in zigzag order).
-    //   However if R=0, then the format is ssss11xx where ssss is S,
-    //   xx is the first 2 extra bits, and the last 2 bits are 1 (since
-    //   this never occurs in a valid RS code).
-  static int cpos=0;  // position in cbuf
-  static U32 huff1=0, huff2=0, huff3=0, huff4=0;  // hashes of last codes
-  static int rs1, rs2, rs3, rs4;  // last 4 RS codes
-  static int ssum=0, ssum1=0, ssum2=0, ssum3=0;
-    // sum of S in RS codes in block and sum of S in first component
-
-  static IntBuf cbuf2(0x20000);
-  static Array<int> adv_pred(7), sumu(8), sumv(8);
-  static Array<int> ls(10);  // block -> distance to previous block
-  static Array<int> lcp(4), zpos(64);
-
-    //for parsing Quantization tables
-  static int dqt_state = -1, dqt_end = 0, qnum = 0;
-  static Array<U8> qtab(256); // table
-  static Array<int> qmap(10); // block -> table number
-
-  const static U8 zzu[64]={  // zigzag coef -> u,v
-    0,1,0,0,1,2,3,2,1,0,0,1,2,3,4,5,4,3,2,1,0,0,1,2,3,4,5,6,7,6,5,4,
-    3,2,1,0,1,2,3,4,5,6,7,7,6,5,4,3,2,3,4,5,6,7,7,6,5,4,5,6,7,7,6,7};
-  const static U8 zzv[64]={
-    0,0,1,2,1,0,0,1,2,3,4,3,2,1,0,0,1,2,3,4,5,6,5,4,3,2,1,0,0,1,2,3,
-    4,5,6,7,7,6,5,4,3,2,1,2,3,4,5,6,7,7,6,5,4,3,4,5,6,7,7,6,5,6,7,7};
-
-  // Be sure to quit on a byte boundary
-  if (!bpos) next_jpeg=jpeg>1;
-  if (bpos && !jpeg) return next_jpeg;
-  if (!bpos && app>=0) --app;
-  if (app>0) return next_jpeg;
-  if (!bpos) {
-
-    // Parse.  Baseline DCT-Huffman JPEG syntax is:
-    // SOI APPx... misc... SOF0 DHT... SOS data EOI
-    // SOI (= FF D8) start of image.
-    // APPx (= FF Ex) len ... where len is always a 2 byte big-endian length
-    //   including the length itself but not the 2 byte preceding code.
-    //   Application data is ignored.  There may be more than one APPx.
-    // misc codes are DQT, DNL, DRI, COM (ignored).
-    // SOF0 (= FF C0) len 08 height width Nf [C HV Tq]...
-    //   where len, height, width (in pixels) are 2 bytes, Nf is the repeat
-    //   count (1 byte) of [C HV Tq], where C is a component identifier
-    //   (color, 0-3), HV is the horizontal and vertical dimensions
-    //   of the MCU (high, low bits, packed), and Tq is the quantization
-    //   table ID (not used).  An MCU (minimum compression unit) consists
-    //   of 64*H*V DCT coefficients for each color.
-    // DHT (= FF C4) len [TcTh L1...L16 V1,1..V1,L1 ... V16,1..V16,L16]...
-    //   defines Huffman table Th (1-4) for Tc (0=DC (first coefficient)
-    //   1=AC (next 63 coefficients)).  L1..L16 are the number of codes
-    //   of length 1-16 (in ascending order) and Vx,y are the 8-bit values.
-    //   A V code of RS means a run of R (0-15) zeros followed by S (0-15)
-    //   additional bits to specify the next nonzero value, negative if
-    //   the first additional bit is 0 (e.g. code x63 followed by the
-    //   3 bits 1,0,1 specify 7 coefficients: 0, 0, 0, 0, 0, 0, 5.
-    //   Code 00 means end of block (remainder of 63 AC coefficients is 0).
-    // SOS (= FF DA) len Ns [Cs TdTa]... 0 3F 00
-    //   Start of scan.  TdTa specifies DC/AC Huffman tables (0-3, packed
-    //   into one byte) for component Cs matching C in SOF0, repeated
-    //   Ns (1-4) times.
-    // EOI (= FF D9) is end of image.
-    // Huffman coded data is between SOI and EOI.  Codes may be embedded:
-    // RST0-RST7 (= FF D0 to FF D7) mark the start of an independently
-    //   compressed region.
-    // DNL (= FF DC) 04 00 height
-    //   might appear at the end of the scan (ignored).
-    // FF 00 is interpreted as FF (to distinguish from RSTx, DNL, EOI).
-
-    // Detect JPEG (SOI, APPx)
-    if (!jpeg && buf(4)==FF && buf(3)==SOI && buf(2)==FF && buf(1)>>4==0xe) {
-      jpeg=1;
-      sos=sof=htsize=data=mcusize=linesize=0, app=2;
-      huffcode=huffbits=huffsize=mcupos=cpos=0, rs=-1;
-      memset(&huf[0], 0, huf.size()*sizeof(HUF));
-      memset(&pred[0], 0, pred.size()*sizeof(int));
-    }
-
-    // Detect end of JPEG when data contains a marker other than RSTx
-    // or byte stuff (00).
-    if (jpeg && data && buf(2)==FF && buf(1) && (buf(1)&0xf8)!=RST0) {
-      jassert(buf(1)==EOI);
-      jpeg=0;
-    }
-    if (!jpeg) return next_jpeg;
-
-    // Detect APPx or COM field
-    if (!data && !app && buf(4)==FF && (buf(3)>>4==0xe || buf(3)==COM))
-      app=buf(2)*256+buf(1)+2;
-
-    // Save pointers to sof, ht, sos, data,
-    if (buf(5)==FF && buf(4)==SOS) {
-      int len=buf(3)*256+buf(2);
-      if (len==6+2*buf(1) && buf(1) && buf(1)<=4)  // buf(1) is Ns
-        sos=pos-5, data=sos+len+2, jpeg=2;
-    }
-    if (buf(4)==FF && buf(3)==DHT && htsize<8) ht[htsize++]=pos-4;
-    if (buf(4)==FF && buf(3)==SOF0) sof=pos-4;
-
-    // Parse Quantizazion tables
-    if (buf(4)==FF && buf(3)==DQT)
-      dqt_end=pos+buf(2)*256+buf(1)-1, dqt_state=0;
-    else if (dqt_state>=0) {
-      if (pos>=dqt_end)
-        dqt_state = -1;
-      else {
-        if (dqt_state%65==0)
-          qnum = buf(1);
-        else {
-          jassert(buf(1)>0);
-          jassert(qnum>=0 && qnum<4);
-          qtab[qnum*64+((dqt_state%65)-1)]=buf(1)-1;
-        }
-        dqt_state++;
-      }
-    }
-
-    // Restart
-    if (buf(2)==FF && (buf(1)&0xf8)==RST0) {
-      huffcode=huffbits=huffsize=mcupos=0, rs=-1;
-      memset(&pred[0], 0, pred.size()*sizeof(int));
-    }
-  }
-
-  {
-    // Build Huffman tables
-    // huf[Tc][Th][m] = min, max+1 codes of length m, pointer to byte values
-    if (pos==data && bpos==1) {
-      jassert(htsize>0);
-      int i;
-      for (i=0; i<htsize; ++i) {
-        int p=ht[i]+4;  // pointer to current table after length field
-        int end=p+buf[p-2]*256+buf[p-1]-2;  // end of Huffman table
-        int count=0;  // sanity check
-        while (p<end && end<pos && end<p+2100 && ++count<10) {
-          int tc=buf[p]>>4, th=buf[p]&15;
-          if (tc>=2 || th>=4) break;
-          jassert(tc>=0 && tc<2 && th>=0 && th<4);
-          HUF* h=&huf[tc*64+th*16]; // [tc][th][0];
-          int val=p+17;  // pointer to values
-          int hval=tc*1024+th*256;  // pointer to RS values in hbuf
-          int j;
-          for (j=0; j<256; ++j) // copy RS codes
-            hbuf[hval+j]=buf[val+j];
-          int code=0;
-          for (j=0; j<16; ++j) {
-            h[j].min=code;
-            h[j].max=code+=buf[p+j+1];
-            h[j].val=hval;
-            val+=buf[p+j+1];
-            hval+=buf[p+j+1];
-            code*=2;
-          }
-          p=val;
-          jassert(hval>=0 && hval<2048);
-        }
-        jassert(p==end);
-      }
-      huffcode=huffbits=huffsize=0, rs=-1;
-
-      // Build Huffman table selection table (indexed by mcupos).
-      // Get image width.
-      if (!sof && sos) return next_jpeg;
-      int ns=buf[sos+4];
-      int nf=buf[sof+9];
-      jassert(ns<=4 && nf<=4);
-      mcusize=0;  // blocks per MCU
-      int hmax=0;  // MCU horizontal dimension
-      for (i=0; i<ns; ++i) {
-        for (int j=0; j<nf; ++j) {
-          if (buf[sos+2*i+5]==buf[sof+3*j+10]) { // Cs == C ?
-            int hv=buf[sof+3*j+11];  // packed dimensions H x V
-            if (hv>>4>hmax) hmax=hv>>4;
-            hv=(hv&15)*(hv>>4);  // number of blocks in component C
-            jassert(hv>=1 && hv+mcusize<=10);
-            while (hv) {
-              jassert(mcusize<10);
-              hufsel[0][mcusize]=buf[sos+2*i+6]>>4&15;
-              hufsel[1][mcusize]=buf[sos+2*i+6]&15;
-              jassert (hufsel[0][mcusize]<4 && hufsel[1][mcusize]<4);
-              color[mcusize]=i;
-              int tq=buf[sof+3*j+12];  // quantization table index (0..3)
-              jassert(tq>=0 && tq<4);
-              qmap[mcusize]=tq; // quantizazion table mapping
-              --hv;
-              ++mcusize;
-            }
-          }
-        }
-      }
-      jassert(hmax>=1 && hmax<=10);
-      int j;
-      for (j=0; j<mcusize; ++j) {
-        ls[j]=0;
-        for (int i=1; i<mcusize; ++i) if (color[(j+i)%mcusize]==color[j]) ls[j]=i;
-        ls[j]=(mcusize-ls[j])<<6;
-      }
-      for (j=0; j<64; ++j) zpos[zzu[j]+8*zzv[j]]=j;
-      width=buf[sof+7]*256+buf[sof+8];  // in pixels
-      width=(width-1)/(hmax*8)+1;  // in MCU
-      jassert(width>0);
-      mcusize*=64;  // coefficients per MCU
-      row=column=0;
-    }
-  }
-
-
-  // Decode Huffman
-  {
-    if (mcusize && buf(1+(!bpos))!=FF) {  // skip stuffed byte
-      jassert(huffbits<=32);
-      huffcode+=huffcode+y;
-      ++huffbits;
-      if (rs<0) {
-        jassert(huffbits>=1 && huffbits<=16);
-        const int ac=(mcupos&63)>0;
-        jassert(mcupos>=0 && (mcupos>>6)<10);
-        jassert(ac==0 || ac==1);
-        const int sel=hufsel[ac][mcupos>>6];
-        jassert(sel>=0 && sel<4);
-        const int i=huffbits-1;
-        jassert(i>=0 && i<16);
-        const HUF *h=&huf[ac*64+sel*16]; // [ac][sel];
-        jassert(h[i].min<=h[i].max && h[i].val<2048 && huffbits>0);
-        if (huffcode<h[i].max) {
-          jassert(huffcode>=h[i].min);
-          int k=h[i].val+huffcode-h[i].min;
-          jassert(k>=0 && k<2048);
-          rs=hbuf[k];
-          huffsize=huffbits;
-        }
-      }
-      if (rs>=0) {
-        if (huffsize+(rs&15)==huffbits) { // done decoding
-          huff4=huff3;
-          huff3=huff2;
-          huff2=huff1;
-          huff1=hash(huffcode, huffbits);
-          rs4=rs3;
-          rs3=rs2;
-          rs2=rs1;
-          rs1=rs;
-          int x=0;  // decoded extra bits
-          if (mcupos&63) {  // AC
-            if (rs==0) { // EOB
-              mcupos=(mcupos+63)&-64;
-              jassert(mcupos>=0 && mcupos<=mcusize && mcupos<=640);
-              while (cpos&63) {
-                cbuf2[cpos]=0;
-                cbuf[cpos++]=0;
-              }
-            }
-            else {  // rs = r zeros + s extra bits for the next nonzero value
-                    // If first extra bit is 0 then value is negative.
-              jassert((rs&15)<=10);
-              const int r=rs>>4;
-              const int s=rs&15;
-              jassert(mcupos>>6==(mcupos+r)>>6);
-              mcupos+=r+1;
-              x=huffcode&((1<<s)-1);
-              if (s && !(x>>(s-1))) x-=(1<<s)-1;
-              for (int i=r; i>=1; --i) {
-                cbuf2[cpos]=0;
-                cbuf[cpos++]=i<<4|s;
-              }
-              cbuf2[cpos]=x;
-              cbuf[cpos++]=(s<<4)|(huffcode<<2>>s&3)|12;
-              ssum+=s;
-            }
-          }
-          else {  // DC: rs = 0S, s<12
-            jassert(rs<12);
-            ++mcupos;
-            x=huffcode&((1<<rs)-1);
-            if (rs && !(x>>(rs-1))) x-=(1<<rs)-1;
-            jassert(mcupos>=0 && mcupos>>6<10);
-            const int comp=color[mcupos>>6];
-            jassert(comp>=0 && comp<4);
-            dc=pred[comp]+=x;
-            jassert((cpos&63)==0);
-            cbuf2[cpos]=dc;
-            cbuf[cpos++]=(dc+1023)>>3;
-            if ((mcupos>>6)==0) {
-              ssum1=0;
-              ssum2=ssum3;
-            } else {
-              if (color[(mcupos>>6)-1]==color[0]) ssum1+=(ssum3=ssum);
-              ssum2=ssum1;
-            }
-            ssum=rs;
-          }
-          jassert(mcupos>=0 && mcupos<=mcusize);
-          if (mcupos>=mcusize) {
-            mcupos=0;
-            if (++column==width) column=0, ++row;
-          }
-          huffcode=huffsize=huffbits=0, rs=-1;
-
-          // UPDATE_ADV_PRED !!!!
-          {
-            const int acomp=mcupos>>6, q=64*qmap[acomp];
-            const int zz=mcupos&63, cpos_dc=cpos-zz;
-            if (zz==0) {
-              for (int i=0; i<8; ++i) sumu[i]=sumv[i]=0;
-              int cpos_dc_ls_acomp = cpos_dc-ls[acomp];
-              int cpos_dc_mcusize_width = cpos_dc-mcusize*width;
-              for (int i=0; i<64; ++i) {
-                sumu[zzu[i]]+=(zzv[i]&1?-1:1)*(zzv[i]?16*(16+zzv[i]):181)*(qtab[q+i]+1)*cbuf2[cpos_dc_mcusize_width+i];
-                sumv[zzv[i]]+=(zzu[i]&1?-1:1)*(zzu[i]?16*(16+zzu[i]):181)*(qtab[q+i]+1)*cbuf2[cpos_dc_ls_acomp+i];
-              }
-            }
-            else {
-              sumu[zzu[zz-1]]-=(zzv[zz-1]?16*(16+zzv[zz-1]):181)*(qtab[q+zz-1]+1)*cbuf2[cpos-1];
-              sumv[zzv[zz-1]]-=(zzu[zz-1]?16*(16+zzu[zz-1]):181)*(qtab[q+zz-1]+1)*cbuf2[cpos-1];
-            }
-
-            for (int i=0; i<3; ++i)
-              for (int st=0; st<8; ++st) {
-                const int zz2=min(zz+st, 63);
-                int p=(sumu[zzu[zz2]]*i+sumv[zzv[zz2]]*(2-i))/2;
-                p/=(qtab[q+zz2]+1)*181*(16+zzv[zz2])*(16+zzu[zz2])/256;
-                if (zz2==0) p-=cbuf2[cpos_dc-ls[acomp]];
-                p=(p<0?-1:+1)*ilog(10*abs(p)+1)/10;
-                if (st==0) {
-                  adv_pred[i]=p;
-                  adv_pred[i+4]=p/4;
-                }
-                else if (abs(p)>abs(adv_pred[i])+1) {
-                  adv_pred[i]+=(st*2+(p>0))<<6;
-                  if (abs(p/4)>abs(adv_pred[i+4])+1) adv_pred[i+4]+=(st*2+(p>0))<<6;
-                  break;
-                }
-              }
-            x=2*sumu[zzu[zz]]+2*sumv[zzv[zz]];
-            for (int i=0; i<8; ++i) x-=(zzu[zz]<i)*sumu[i]+(zzv[zz]<i)*sumv[i];
-            x/=(qtab[q+zz]+1)*181;
-            if (zz==0) x-=cbuf2[cpos_dc-ls[acomp]];
-            adv_pred[3]=(x<0?-1:+1)*ilog(10*abs(x)+1)/10;
-
-            for (int i=0; i<4; ++i) {
-              const int a=(i&1?zzv[zz]:zzu[zz]), b=(i&2?2:1);
-              if (a<b) x=255;
-              else {
-                const int zz2=zpos[zzu[zz]+8*zzv[zz]-(i&1?8:1)*b];
-                x=(qtab[q+zz2]+1)*cbuf2[cpos_dc+zz2]/(qtab[q+zz]+1);
-                x=(x<0?-1:+1)*ilog(10*abs(x)+1)/10;
-              }
-              lcp[i]=x;
-            }
-            if (column==0) adv_pred[1]=adv_pred[2], adv_pred[0]=1;
-            if (row==0) adv_pred[1]=adv_pred[0], adv_pred[2]=1;
-          } // !!!!
-
-        }
-      }
-    }
-  }
-
-  // Estimate next bit probability
-  if (!jpeg || !data) return next_jpeg;
-  if (buf(1+(!bpos))==FF) {
-    m.add(128);
-    m.set(1, 8);
-    m.set(0, 257);
-    m.set(buf(1), 256);
-    return 1;
-  }
-
-  // Context model
-  const int N=28; // size of t, number of contexts
-  static BH<9> t(MEM);  // context hash -> bit history
-    // As a cache optimization, the context does not include the last 1-2
-    // bits of huffcode if the length (huffbits) is not a multiple of 3.
-    // The 7 mapped values are for context+{"", 0, 00, 01, 1, 10, 11}.
-  static Array<U32> cxt(N);  // context hashes
-  static Array<U8*> cp(N);  // context pointers
-  static StateMap sm[N];
-  static Mixer m1(32, 770, 3);
-  static APM a1(0x8000), a2(0x10000);
-
-
-  // Update model
-  if (cp[N-1]) {
-    for (int i=0; i<N; ++i)
-      *cp[i]=nex(*cp[i],y);
-  }
-  m1.update();
-
-  // Update context
-  const int comp=color[mcupos>>6];
-  const int coef=(mcupos&63)|comp<<6;
-  const int hc=(huffcode*4+((mcupos&63)==0)*2+(comp==0))|1<<(huffbits+2);
-  static int hbcount=2;
-  if (++hbcount>2 || huffbits==0) hbcount=0;
-  jassert(coef>=0 && coef<256);
-  const int zu=zzu[mcupos&63], zv=zzv[mcupos&63];
-  if (hbcount==0) {
-    int n=0;
-    cxt[0]=hash(++n, hc, coef, adv_pred[2], ssum2>>6);
-    cxt[1]=hash(++n, hc, coef, adv_pred[0], ssum2>>6);
-    cxt[2]=hash(++n, hc, coef, adv_pred[1], ssum2>>6);
-    cxt[3]=hash(++n, hc, rs1, adv_pred[2]);
-    cxt[4]=hash(++n, hc, rs1, adv_pred[0]);
-    cxt[5]=hash(++n, hc, rs1, adv_pred[1]);
-    cxt[6]=hash(++n, hc, adv_pred[2], adv_pred[0]);
-    cxt[7]=hash(++n, hc, cbuf[cpos-width*mcusize], adv_pred[3]);
-    cxt[8]=hash(++n, hc, cbuf[cpos-ls[mcupos>>6]], adv_pred[3]);
-    cxt[9]=hash(++n, hc, lcp[0], lcp[1], adv_pred[1]);
-    cxt[10]=hash(++n, hc, lcp[0], lcp[1], mcupos&63);
-    cxt[11]=hash(++n, hc, zu, lcp[0], lcp[2]/3);
-    cxt[12]=hash(++n, hc, zv, lcp[1], lcp[3]/3);
-    cxt[13]=hash(++n, hc, mcupos>>1);
-    cxt[14]=hash(++n, hc, mcupos&63, column>>1);
-    cxt[15]=hash(++n, hc, column>>3, lcp[0]+256*(lcp[2]/4), lcp[1]+256*(lcp[3]/4));
-    cxt[16]=hash(++n, hc, ssum>>3, mcupos&63);
-    cxt[17]=hash(++n, hc, rs1, mcupos&63);
-    cxt[18]=hash(++n, hc, mcupos>>3, ssum2>>5, adv_pred[3]);
-    cxt[19]=hash(++n, hc, lcp[0]/4, lcp[1]/4, adv_pred[5]);
-    cxt[20]=hash(++n, hc, cbuf[cpos-width*mcusize], adv_pred[6]);
-    cxt[21]=hash(++n, hc, cbuf[cpos-ls[mcupos>>6]], adv_pred[4]);
-    cxt[22]=hash(++n, hc, adv_pred[2]);
-    cxt[23]=hash(n, hc, adv_pred[0]);
-    cxt[24]=hash(n, hc, adv_pred[1]);
-    cxt[25]=hash(++n, hc, zv, lcp[1], adv_pred[6]);
-    cxt[26]=hash(++n, hc, zu, lcp[0], adv_pred[4]);
-    cxt[27]=hash(++n, hc, lcp[0], lcp[1], adv_pred[3]);
-  }
-
-  // Predict next bit
-  m1.add(128);
-  assert(hbcount<=2);
- switch(hbcount)
-  {
-   case 0: for (int i=0; i<N; ++i) cp[i]=t[cxt[i]]+1, m1.add(stretch(sm[i].p(*cp[i]))); break;
-   case 1: { int hc=1+(huffcode&1)*3; for (int i=0; i<N; ++i) cp[i]+=hc, m1.add(stretch(sm[i].p(*cp[i]))); } break;
-   default: { int hc=1+(huffcode&1); for (int i=0; i<N; ++i) cp[i]+=hc, m1.add(stretch(sm[i].p(*cp[i]))); } break;
-  }
-
-  m1.set(column==0, 2);
-  m1.set(coef, 256);
-  m1.set(hc&511, 512);
-  int pr=m1.p();
-  m.add(stretch(pr));
-  pr=a1.p(pr, (hc&511)|((adv_pred[1]==0?0:(abs(adv_pred[1])-4)&63)<<9), 1023);
-  pr=a2.p(pr, (hc&255)|(coef<<8), 255);
-  m.add(stretch(pr));
-  m.set(1, 8);
-  m.set(1+(hc&255), 257);
-  m.set(buf(1), 256);
-  return 1;
-}
-
-//////////////////////////// wavModel /////////////////////////////////
-
-// Model a 16/8-bit stereo/mono uncompressed .wav file.
-// Based on 'An asymptotically Optimal Predictor for Stereo Lossless Audio Compression'
-// by Florin Ghido.
-
-static int S,D;
-static int wmode;
-
-inline int s2(int i) { return int(short(buf(i)+256*buf(i-1))); }
-inline int t2(int i) { return int(short(buf(i-1)+256*buf(i))); }
-
-inline int X1(int i) {
-  switch (wmode) {
-    case 0: return buf(i)-128;
-    case 1: return buf(i<<1)-128;
-    case 2: return s2(i<<1);
-    case 3: return s2(i<<2);
-    case 4: return (buf(i)^128)-128;
-    case 5: return (buf(i<<1)^128)-128;
-    case 6: return t2(i<<1);
-    case 7: return t2(i<<2);
-    default: return 0;
-  }
-}
-
-inline int X2(int i) {
-  switch (wmode) {
-    case 0: return buf(i+S)-128;
-    case 1: return buf((i<<1)-1)-128;
-    case 2: return s2((i+S)<<1);
-    case 3: return s2((i<<2)-2);
-    case 4: return (buf(i+S)^128)-128;
-    case 5: return (buf((i<<1)-1)^128)-128;
-    case 6: return t2((i+S)<<1);
-    case 7: return t2((i<<2)-2);
-    default: return 0;
-  }
-}
-
-void wavModel(Mixer& m, int info) {
-  static int pr[3][2], n[2], counter[2];
-  static double F[49][49][2],L[49][49];
-  int j,k,l,i=0;
-  long double sum;
-  const double a=0.996,a2=1/a;
-  const int SC=0x20000;
-  static SmallStationaryContextMap scm1(SC), scm2(SC), scm3(SC), scm4(SC), scm5(SC), scm6(SC), scm7(SC);
-  static ContextMap cm(MEM*4, 10);
-  static int bits, channels, w;
-  static int z1, z2, z3, z4, z5, z6, z7;
-
-  if (!bpos && !blpos) {
-    bits=((info%4)/2)*8+8;
-    channels=info%2+1;
-    w=channels*(bits>>3);
-    wmode=info;
-    if (channels==1) S=48,D=0; else S=36,D=12;
-    for (int j=0; j<channels; j++) {
-      for (k=0; k<=S+D; k++) for (l=0; l<=S+D; l++) F[k][l][j]=0, L[k][l]=0;
-      F[1][0][j]=1;
-      n[j]=counter[j]=pr[2][j]=pr[1][j]=pr[0][j]=0;
-      z1=z2=z3=z4=z5=z6=z7=0;
-    }
-  }
-  // Select previous samples and predicted sample as context
-  if (!bpos && blpos>=w) {
-    const int ch=blpos%w;
-    const int msb=ch%(bits>>3);
-    const int chn=ch/(bits>>3);
-    if (!msb) {
-      z1=X1(1), z2=X1(2), z3=X1(3), z4=X1(4), z5=X1(5);
-      k=X1(1);
-      for (l=0; l<=min(S,counter[chn]-1); l++) { F[0][l][chn]*=a; F[0][l][chn]+=X1(l+1)*k; }
-      for (l=1; l<=min(D,counter[chn]); l++) { F[0][l+S][chn]*=a; F[0][l+S][chn]+=X2(l+1)*k; }
-      if (channels==2) {
-        k=X2(2);
-        for (l=1; l<=min(D,counter[chn]); l++) { F[S+1][l+S][chn]*=a; F[S+1][l+S][chn]+=X2(l+1)*k; }
-        for (l=1; l<=min(S,counter[chn]-1); l++) { F[l][S+1][chn]*=a; F[l][S+1][chn]+=X1(l+1)*k; }
-        z6=X2(1)+X1(1)-X2(2), z7=X2(1);
-      } else z6=2*X1(1)-X1(2), z7=X1(1);
-      if (++n[chn]==(256>>level)) {
-        if (channels==1) for (k=1; k<=S+D; k++) for (l=k; l<=S+D; l++) F[k][l][chn]=(F[k-1][l-1][chn]-X1(k)*X1(l))*a2;
-        else for (k=1; k<=S+D; k++) if (k!=S+1) for (l=k; l<=S+D; l++) if (l!=S+1) F[k][l][chn]=(F[k-1][l-1][chn]-(k-1<=S?X1(k):X2(k-S))*(l-1<=S?X1(l):X2(l-S)))*a2;
-        for (i=1; i<=S+D; i++) {
-           sum=F[i][i][chn];
-           for (k=1; k<i; k++) sum-=L[i][k]*L[i][k];
-           sum=floor(sum+0.5);
-           sum=1/sum;
-           if (sum>0) {
-             L[i][i]=sqrt(sum);
-             for (j=(i+1); j<=S+D; j++) {
-               sum=F[i][j][chn];
-               for (k=1; k<i; k++) sum-=L[j][k]*L[i][k];
-               sum=floor(sum+0.5);
-               L[j][i]=sum*L[i][i];
-             }
-           } else break;
-        }
-        if (i>S+D && counter[chn]>S+1) {
-          for (k=1; k<=S+D; k++) {
-            F[k][0][chn]=F[0][k][chn];
-            for (j=1; j<k; j++) F[k][0][chn]-=L[k][j]*F[j][0][chn];
-            F[k][0][chn]*=L[k][k];
-          }
-          for (k=S+D; k>0; k--) {
-            for (j=k+1; j<=S+D; j++) F[k][0][chn]-=L[j][k]*F[j][0][chn];
-            F[k][0][chn]*=L[k][k];
-          }
-        }
-        n[chn]=0;
-      }
-      sum=0;
-      for (l=1; l<=S+D; l++) sum+=F[l][0][chn]*(l<=S?X1(l):X2(l-S));
-      pr[2][chn]=pr[1][chn];
-      pr[1][chn]=pr[0][chn];
-      pr[0][chn]=int(floor(sum));
-      counter[chn]++;
-    }
-    const int y1=pr[0][chn], y2=pr[1][chn], y3=pr[2][chn];
-    int x1=buf(1), x2=buf(2), x3=buf(3);
-    if (wmode==4 || wmode==5) x1^=128, x2^=128;
-    if (bits==8) x1-=128, x2-=128;
-    const int t=((bits==8) || ((!msb)^(wmode<6)));
-    i=ch<<4;
-    if ((msb)^(wmode<6)) {
-      cm.set(hash(++i, y1&0xff));
-      cm.set(hash(++i, y1&0xff, ((z1-y2+z2-y3)>>1)&0xff));
-      cm.set(hash(++i, x1, y1&0xff));
-      cm.set(hash(++i, x1, x2>>3, x3));
-      cm.set(hash(++i, (y1+z1-y2)&0xff));
-      cm.set(hash(++i, x1));
-      cm.set(hash(++i, x1, x2));
-      cm.set(hash(++i, z1&0xff));
-      cm.set(hash(++i, (z1*2-z2)&0xff));
-      cm.set(hash(++i, z6&0xff));
-    } else {
-      cm.set(hash(++i, (y1-x1+z1-y2)>>8));
-      cm.set(hash(++i, (y1-x1)>>8));
-      cm.set(hash(++i, (y1-x1+z1*2-y2*2-z2+y3)>>8));
-      cm.set(hash(++i, (y1-x1)>>8, (z1-y2+z2-y3)>>9));
-      cm.set(hash(++i, z1>>12));
-      cm.set(hash(++i, x1));
-      cm.set(hash(++i, x1>>7, x2, x3>>7));
-      cm.set(hash(++i, z1>>8));
-      cm.set(hash(++i, (z1*2-z2)>>8));
-      cm.set(hash(++i, y1>>8));
-    }
-    scm1.set(t*ch);
-    scm2.set(t*((z1-x1+y1)>>9)&0xff);
-    scm3.set(t*((z1*2-z2-x1+y1)>>8)&0xff);
-    scm4.set(t*((z1*3-z2*3+z3-x1)>>7)&0xff);
-    scm5.set(t*((z1+z7-x1+y1*2)>>10)&0xff);
-    scm6.set(t*((z1*4-z2*6+z3*4-z4-x1)>>7)&0xff);
-    scm7.set(t*((z1*5-z2*10+z3*10-z4*5+z5-x1+y1)>>9)&0xff);
-  }
-
-  // Predict next bit
-  scm1.mix(m);
-  scm2.mix(m);
-  scm3.mix(m);
-  scm4.mix(m);
-  scm5.mix(m);
-  scm6.mix(m);
-  scm7.mix(m);
-  cm.mix(m);
-  if (level>=4) recordModel(m);
-  static int col=0;
-  if (++col>=w*8) col=0;
-  m.set(3, 8);
-  m.set(col%bits<8, 2);
-  m.set(col%bits, bits);
-  m.set(col, w*8);
-  m.set(c0, 256);
-}
-
-//////////////////////////// exeModel /////////////////////////
-
-// Model x86 code.  The contexts are sparse containing only those
-// bits relevant to parsing (2 prefixes, opcode, and mod and r/m fields
-// of modR/M byte).
-
-inline int pref(int i) { return (buf(i)==0x0f)+2*(buf(i)==0x66)+3*(buf(i)==0x67); }
-
-// Get context at buf(i) relevant to parsing 32-bit x86 code
-U32 execxt(int i, int x=0) {
-  int prefix=0, opcode=0, modrm=0;
-  if (i) prefix+=4*pref(i--);
-  if (i) prefix+=pref(i--);
-  if (i) opcode+=buf(i--);
-  if (i) modrm+=buf(i)&0xc7;
-  return prefix|opcode<<4|modrm<<12|x<<20;
-}
-
-void exeModel(Mixer& m) {
-  const int N=14;
-  static ContextMap cm(MEM, N);
-  if (!bpos) {
-    for (int i=0; i<N; ++i) cm.set(execxt(i+1, buf(1)*(i>6)));
-  }
-  cm.mix(m);
-}
-
-//////////////////////////// indirectModel /////////////////////
-
-// The context is a byte string history that occurs within a
-// 1 or 2 byte context.
-
-void indirectModel(Mixer& m) {
-  static ContextMap cm(MEM, 9);
-  static U32 t1[256];
-  static U16 t2[0x10000];
-  static U16 t3[0x8000];
-
-  if (!bpos) {
-    U32 d=c4&0xffff, c=d&255, d2=(buf(1)&31)+32*(buf(2)&31)+1024*(buf(3)&31);
-    U32& r1=t1[d>>8];
-    r1=r1<<8|c;
-    U16& r2=t2[c4>>8&0xffff];
-    r2=r2<<8|c;
-    U16& r3=t3[(buf(2)&31)+32*(buf(3)&31)+1024*(buf(4)&31)];
-    r3=r3<<8|c;
-    const U32 t=c|t1[c]<<8;
-    const U32 t0=d|t2[d]<<16;
-    const U32 ta=d2|t3[d2]<<16;
-    cm.set(t);
-    cm.set(t0);
-    cm.set(ta);
-    cm.set(t&0xff00);
-    cm.set(t0&0xff0000);
-    cm.set(ta&0xff0000);
-    cm.set(t&0xffff);
-    cm.set(t0&0xffffff);
-    cm.set(ta&0xffffff);
-  }
-  cm.mix(m);
-}
-
-//////////////////////////// dmcModel //////////////////////////
-
-// Model using DMC.  The bitwise context is represented by a state graph,
-// initilaized to a bytewise order 1 model as in
-// http://plg.uwaterloo.ca/~ftp/dmc/dmc.c but with the following difference:
-// - It uses integer arithmetic.
-// - The threshold for cloning a state increases as memory is used up.
-// - Each state maintains both a 0,1 count and a bit history (as in a
-//   context model).  The 0,1 count is best for stationary data, and the
-//   bit history for nonstationary data.  The bit history is mapped to
-//   a probability adaptively using a StateMap.  The two computed probabilities
-//   are combined.
-// - When memory is used up the state graph is reinitialized to a bytewise
-//   order 1 context as in the original DMC.  However, the bit histories
-//   are not cleared.
-
-struct DMCNode {  // 12 bytes
-  unsigned int nx[2];  // next pointers
-  U8 state;  // bit history
-  unsigned int c0:12, c1:12;  // counts * 256
-};
-
-void dmcModel(Mixer& m) {
-  static int top=0, curr=0;  // allocated, current node
-  static Array<DMCNode> t(MEM*2);  // state graph
-  static StateMap sm;
-  static int threshold=256;
-
-  // clone next state
-  if (top>0 && top<t.size()) {
-    int next=t[curr].nx[y];
-    int n=y?t[curr].c1:t[curr].c0;
-    int nn=t[next].c0+t[next].c1;
-    if (n>=threshold*2 && nn-n>=threshold*3) {
-      int r=n*4096/nn;
-      assert(r>=0 && r<=4096);
-      t[next].c0 -= t[top].c0 = t[next].c0*r>>12;
-      t[next].c1 -= t[top].c1 = t[next].c1*r>>12;
-      t[top].nx[0]=t[next].nx[0];
-      t[top].nx[1]=t[next].nx[1];
-      t[top].state=t[next].state;
-      t[curr].nx[y]=top;
-      ++top;
-      if (top==MEM*2) threshold=512;
-      if (top==MEM*3) threshold=768;
-    }
-  }
-
-  // Initialize to a bytewise order 1 model at startup or when flushing memory
-  if (top==t.size() && bpos==1) top=0;
-  if (top==0) {
-    assert(t.size()>=65536);
-    for (int i=0; i<256; ++i) {
-      for (int j=0; j<256; ++j) {
-        if (i<127) {
-          t[j*256+i].nx[0]=j*256+i*2+1;
-          t[j*256+i].nx[1]=j*256+i*2+2;
-        }
-        else {
-          t[j*256+i].nx[0]=(i-127)*256;
-          t[j*256+i].nx[1]=(i+1)*256;
-        }
-        t[j*256+i].c0=128;
-        t[j*256+i].c1=128;
-      }
-    }
-    top=65536;
-    curr=0;
-    threshold=256;
-  }
-
-  // update count, state
-  if (y) {
-    if (t[curr].c1<3800) t[curr].c1+=256;
-  }
-  else if (t[curr].c0<3800) t[curr].c0+=256;
-  t[curr].state=nex(t[curr].state, y);
-  curr=t[curr].nx[y];
-
-  // predict
-  const int pr1=sm.p(t[curr].state);
-  const int n1=t[curr].c1;
-  const int n0=t[curr].c0;
-  const int pr2=(n1+5)*4096/(n0+n1+10);
-  m.add(stretch(pr1));
-  m.add(stretch(pr2));
-}
-
-void nestModel(Mixer& m)
-{
-  static int ic=0, bc=0, pc=0,vc=0, qc=0, lvc=0, wc=0;
-  static ContextMap cm(MEM, 14);
-  static U32 mask = 0;
-  if (bpos==0) {
-    int c=c4&255, matched=1, vv;
-    const int lc = (c >= 'A' && c <= 'Z'?c+'a'-'A':c);
-    if (lc == 'a' || lc == 'e' || lc == 'i' || lc == 'o' || lc == 'u') vv = 1; else
-    if (lc >= 'a' && lc <= 'z') vv = 2; else
-    if (lc == ' ' || lc == '.' || lc == ',' || lc == '\n') vv = 3; else
-    if (lc >= '0' && lc <= '9') vv = 4; else
-    if (lc == 'y') vv = 5; else
-    if (lc == '\'') vv = 6; else vv=(c&32)?7:0;
-    vc = (vc << 3) | vv;
-    if (vv != lvc) {
-      wc = (wc << 3) | vv;
-      lvc = vv;
-    }
-    switch(c) {
-      case ' ': qc = 0; break;
-      case '(': ic += 513; break;
-      case ')': ic -= 513; break;
-      case '[': ic += 17; break;
-      case ']': ic -= 17; break;
-      case '<': ic += 23; qc += 34; break;
-      case '>': ic -= 23; qc /= 5; break;
-      case ':': pc = 20; break;
-      case '{': ic += 22; break;
-      case '}': ic -= 22; break;
-      case '|': pc += 223; break;
-      case '"': pc += 0x40; break;
-      case '\'': pc += 0x42; break;
-      case '\n': pc = qc = 0; break;
-      case '.': pc = 0; break;
-      case '!': pc = 0; break;
-      case '?': pc = 0; break;
-      case '#': pc += 0x08; break;
-      case '%': pc += 0x76; break;
-      case '$': pc += 0x45; break;
-      case '*': pc += 0x35; break;
-      case '-': pc += 0x3; break;
-      case '@': pc += 0x72; break;
-      case '&': qc += 0x12; break;
-      case ';': qc /= 3; break;
-      case '\\': pc += 0x29; break;
-      case '/': pc += 0x11;
-                if (buf.size() > 1 && buf(1) == '<') qc += 74;
-                break;
-      case '=': pc += 87; break;
-      default: matched = 0;
-    }
-    if (matched) bc = 0; else bc += 1;
-    if (bc > 300) bc = ic = pc = qc = 0;
-
-    int fl = 0;
-    if ((c4&0xff) != 0) {
-      if (isalpha(c4&0xff)) fl = 1;
-      else if (ispunct(c4&0xff)) fl = 2;
-      else if (isspace(c4&0xff)) fl = 3;
-      else if ((c4&0xff) == 0xff) fl = 4;
-      else if ((c4&0xff) < 16) fl = 5;
-      else if ((c4&0xff) < 64) fl = 6;
-      else fl = 7;
-    }
-    mask = (mask<<3)|fl;
-
-    cm.set((3*vc+77*pc+373*ic+qc)&0xffff);
-    cm.set((31*vc+27*pc+281*qc)&0xffff);
-    cm.set((13*vc+271*ic+qc+bc)&0xffff);
-    cm.set((17*pc+7*ic)&0xffff);
-    cm.set((13*vc+ic)&0xffff);
-    cm.set((vc/3+pc)&0xffff);
-    cm.set((7*wc+qc)&0xffff);
-    cm.set((vc&0xffff)|((c4&0xff)<<16));
-    cm.set(((3*pc)&0xffff)|((c4&0xff)<<16));
-    cm.set((ic&0xffff)|((c4&0xff)<<16));
-    cm.set(mask);
-    cm.set((mask<<8)|buf(1));
-    cm.set((mask<<17)|(buf(2)<<8)|buf(3));
-    cm.set((mask&0x1ff)|((c4&0xf0f0f0f0)<<9));
-  }
-  cm.mix(m);
-}
-
-//////////////////////////// contextModel //////////////////////
-
-
-typedef enum {DEFAULT, JPEG, HDR, IMAGE1, IMAGE8, IMAGE24, AUDIO, EXE, CD} Filetype;
-
-
-// This combines all the context models with a Mixer.
-
-int contextModel2() {
-  static ContextMap cm(MEM*32, 9*3, true);
-  static RunContextMap rcm7(MEM), rcm9(MEM), rcm10(MEM);
-  static Mixer m(1800, 3095, 7);
-  static U32 cxt1[16];  // order 0-11 contexts
-  static U32 cxt3[16];  // order 0-11 contexts
-  static U32 cxt2[16];  // order 0-11 contexts
-  static Filetype ft2,filetype=DEFAULT;
-  static int size=0;  // bytes remaining in block
-  static int info=0;  // image width or audio type
-
-  // Parse filetype and size
-  if (bpos==0) {
-    --size;
-    ++blpos;
-    if (size==-1) ft2=(Filetype)buf(1);
-    if (size==-5 && ft2!=IMAGE1 && ft2!=IMAGE8 && ft2!=IMAGE24 && ft2!=AUDIO) {
-      size=buf(4)<<24|buf(3)<<16|buf(2)<<8|buf(1);
-      if (ft2==CD) size=0;
-      blpos=0;
-    }
-    if (size==-9) {
-      size=buf(8)<<24|buf(7)<<16|buf(6)<<8|buf(5);
-      info=buf(4)<<24|buf(3)<<16|buf(2)<<8|buf(1);
-      blpos=0;
-    }
-    if (!blpos) filetype=ft2;
-    if (size==0) filetype=DEFAULT;
-  }
-
-  m.update();
-  m.add(256);
-
-  // Test for special file types
-  int ismatch=ilog(matchModel(m));  // Length of longest matching context
-  if (filetype==IMAGE1) im1bitModel(m, info);
-  if (filetype==IMAGE8) return im8bitModel(m, info), m.p();
-  if (filetype==IMAGE24) return im24bitModel(m, info), m.p();
-  if (filetype==AUDIO) return wavModel(m, info), m.p();
-  if (filetype==JPEG) if (jpegModel(m)) return m.p();
-
-  // Normal model
-  if (bpos==0) {
-    int i;
-    for (i=15; i>0; --i){  // update order 0-11 context hashes
-      cxt1[i]=cxt1[i-1]*257+(c4&252)+1;
-      cxt2[i]=cxt2[i-1]*257+(c4&227)+1;
-      cxt3[i]=cxt3[i-1]*257+(c4&31)+1;
-    }
-    for (i=0; i<7; ++i){
-      cm.set(cxt1[i]);
-      cm.set(cxt2[i]);
-      cm.set(cxt3[i]);
-    }
-    rcm7.set(cxt1[7]);
-    cm.set(cxt1[8]);
-    cm.set(cxt2[8]);
-    cm.set(cxt3[8]);
-    rcm9.set(cxt1[10]);
-    rcm10.set(cxt1[12]);
-    cm.set(cxt1[14]);
-    cm.set(cxt2[14]);
-    cm.set(cxt3[14]);
-  }
-  int order=cm.mix(m);
-
-  rcm7.mix(m);
-  rcm9.mix(m);
-  rcm10.mix(m);
-
-  if (level>=4 && filetype!=IMAGE1) {
-    sparseModel(m,ismatch,order);
-    distanceModel(m);
-    recordModel(m);
-    wordModel(m);
-    indirectModel(m);
-    dmcModel(m);
-    nestModel(m);
-    if (filetype==EXE) exeModel(m);
-  }
-
-
-  order = order-2;
-  if (order<0) order=0;
-
-  U32 c1=buf(1), c2=buf(2), c3=buf(3), c;
-
-  m.set(c1+8, 264);
-  m.set(c0, 256);
-  m.set(order+8*(c4>>6&3)+32*(bpos==0)+64*(c1==c2)+128*(filetype==EXE), 256);
-  m.set(c2, 256);
-  m.set(c3, 256);
-  m.set(ismatch, 256);
-
-  if (bpos)
-  {
-    c=c0<<(8-bpos); if (bpos==1)c+=c3/2;
-    c=(min(bpos,5))*256+c1/32+8*(c2/32)+(c&192);
-  }
-  else c=c3/128+(c4>>31)*2+4*(c2/64)+(c1&240);
-  m.set(c, 1536);
-  int pr=m.p();
-  return pr;
-}
-
-
-//////////////////////////// Predictor /////////////////////////
-
-// A Predictor estimates the probability that the next bit of
-// uncompressed data is 1.  Methods:
-// p() returns P(1) as a 12 bit number (0-4095).
-// update(y) trains the predictor with the actual bit (0 or 1).
-
-class Predictor {
-  int pr;  // next prediction
-public:
-  Predictor();
-  int p() const {assert(pr>=0 && pr<4096); return pr;}
-  void update();
-};
-
-Predictor::Predictor(): pr(2048) {}
-
-void Predictor::update() {
-  static APM1 a(256), a1(0x10000), a2(0x10000), a3(0x10000),
-                      a4(0x10000), a5(0x10000), a6(0x10000);
-
-  // Update global context: pos, bpos, c0, c4, buf
-  c0+=c0+y;
-  if (c0>=256) {
-    buf[pos++]=c0;
-    c4=(c4<<8)+c0-256;
-    c0=1;
-  }
-  bpos=(bpos+1)&7;
-
-  // Filter the context model with APMs
-  int pr0=contextModel2();
-
-  pr=a.p(pr0, c0);
-
-  int pr1=a1.p(pr0, c0+256*buf(1));
-  int pr2=a2.p(pr0, (c0^hash(buf(1), buf(2)))&0xffff);
-  int pr3=a3.p(pr0, (c0^hash(buf(1), buf(2), buf(3)))&0xffff);
-  pr0=(pr0+pr1+pr2+pr3+2)>>2;
-
-  pr1=a4.p(pr, c0+256*buf(1));
-  pr2=a5.p(pr, (c0^hash(buf(1), buf(2)))&0xffff);
-  pr3=a6.p(pr, (c0^hash(buf(1), buf(2), buf(3)))&0xffff);
-  pr=(pr+pr1+pr2+pr3+2)>>2;
-
-  pr=(pr+pr0+1)>>1;
-}
-
-//////////////////////////// Encoder ////////////////////////////
-
-// An Encoder does arithmetic encoding.  Methods:
-// Encoder(COMPRESS, f) creates encoder for compression to archive f, which
-//   must be open past any header for writing in binary mode.
-// Encoder(DECOMPRESS, f) creates encoder for decompression from archive f,
-//   which must be open past any header for reading in binary mode.
-// code(i) in COMPRESS mode compresses bit i (0 or 1) to file f.
-// code() in DECOMPRESS mode returns the next decompressed bit from file f.
-//   Global y is set to the last bit coded or decoded by code().
-// compress(c) in COMPRESS mode compresses one byte.
-// decompress() in DECOMPRESS mode decompresses and returns one byte.
-// flush() should be called exactly once after compression is done and
-//   before closing f.  It does nothing in DECOMPRESS mode.
-// size() returns current length of archive
-// setFile(f) sets alternate source to FILE* f for decompress() in COMPRESS
-//   mode (for testing transforms).
-// If level (global) is 0, then data is stored without arithmetic coding.
-
-typedef enum {COMPRESS, DECOMPRESS} Mode;
-class Encoder {
-private:
-  Predictor predictor;
-  const Mode mode;       // Compress or decompress?
-  FILE* archive;         // Compressed data file
-  U32 x1, x2;            // Range, initially [0, 1), scaled by 2^32
-  U32 x;                 // Decompress mode: last 4 input bytes of archive
-  FILE *alt;             // decompress() source in COMPRESS mode
-
-  // Compress bit y or return decompressed bit
-  int code(int i=0) {
-    int p=predictor.p();
-    assert(p>=0 && p<4096);
-    p+=p<2048;
-    U32 xmid=x1 + ((x2-x1)>>12)*p + (((x2-x1)&0xfff)*p>>12);
-    assert(xmid>=x1 && xmid<x2);
-    if (mode==DECOMPRESS) y=x<=xmid; else y=i;
-    y ? (x2=xmid) : (x1=xmid+1);
-    predictor.update();
-    while (((x1^x2)&0xff000000)==0) {  // pass equal leading bytes of range
-      if (mode==COMPRESS) putc(x2>>24, archive);
-      x1<<=8;
-      x2=(x2<<8)+255;
-      if (mode==DECOMPRESS) x=(x<<8)+(getc(archive)&255);  // EOF is OK
-    }
-    return y;
-  }
-
-public:
-  Encoder(Mode m, FILE* f);
-  Mode getMode() const {return mode;}
-  long size() const {return ftell(archive);}  // length of archive so far
-  void flush();  // call this when compression is finished
-  void setFile(FILE* f) {alt=f;}
-
-  // Compress one byte
-  void compress(int c) {
-    assert(mode==COMPRESS);
-    if (level==0)
-      putc(c, archive);
-    else
-      for (int i=7; i>=0; --i)
-        code((c>>i)&1);
-  }
-
-  // Decompress and return one byte
-  int decompress() {
-    if (mode==COMPRESS) {
-      assert(alt);
-      return getc(alt);
-    }
-    else if (level==0)
-      return getc(archive);
-    else {
-      int c=0;
-      for (int i=0; i<8; ++i)
-        c+=c+code();
-      return c;
-    }
-  }
-};
-
-Encoder::Encoder(Mode m, FILE* f):
-    mode(m), archive(f), x1(0), x2(0xffffffff), x(0), alt(0) {
-  if (level>0 && mode==DECOMPRESS) {  // x = first 4 bytes of archive
-    for (int i=0; i<4; ++i)
-      x=(x<<8)+(getc(archive)&255);
-  }
-  for (int i=0; i<1024; ++i)
-    dt[i]=16384/(i+i+3);
-
-}
-
-void Encoder::flush() {
-  if (mode==COMPRESS && level>0)
-    putc(x1>>24, archive);  // Flush first unequal byte of range
-}
-
-/////////////////////////// Filters /////////////////////////////////
-//
-// Before compression, data is encoded in blocks with the following format:
-//
-//   <type> <size> <encoded-data>
-//
-// Type is 1 byte (type Filetype): DEFAULT=0, JPEG, EXE
-// Size is 4 bytes in big-endian format.
-// Encoded-data decodes to <size> bytes.  The encoded size might be
-// different.  Encoded data is designed to be more compressible.
-//
-//   void encode(FILE* in, FILE* out, int n);
-//
-// Reads n bytes of in (open in "rb" mode) and encodes one or
-// more blocks to temporary file out (open in "wb+" mode).
-// The file pointer of in is advanced n bytes.  The file pointer of
-// out is positioned after the last byte written.
-//
-//   en.setFile(FILE* out);
-//   int decode(Encoder& en);
-//
-// Decodes and returns one byte.  Input is from en.decompress(), which
-// reads from out if in COMPRESS mode.  During compression, n calls
-// to decode() must exactly match n bytes of in, or else it is compressed
-// as type 0 without encoding.
-//
-//   Filetype detect(FILE* in, int n, Filetype type);
-//
-// Reads n bytes of in, and detects when the type changes to
-// something else.  If it does, then the file pointer is repositioned
-// to the start of the change and the new type is returned.  If the type
-// does not change, then it repositions the file pointer n bytes ahead
-// and returns the old type.
-//
-// For each type X there are the following 2 functions:
-//
-//   void encode_X(FILE* in, FILE* out, int n, ...);
-//
-// encodes n bytes from in to out.
-//
-//   int decode_X(Encoder& en);
-//
-// decodes one byte from en and returns it.  decode() and decode_X()
-// maintain state information using static variables.
-#define bswap(x) \
-+   ((((x) & 0xff000000) >> 24) | \
-+    (((x) & 0x00ff0000) >>  8) | \
-+    (((x) & 0x0000ff00) <<  8) | \
-+    (((x) & 0x000000ff) << 24))
-
-#define IMG_DET(type,start_pos,header_len,width,height) return dett=(type),\
-deth=(header_len),detd=(width)*(height),info=(width),\
-fseek(in, start+(start_pos), SEEK_SET),HDR
-
-#define AUD_DET(type,start_pos,header_len,data_len,wmode) return dett=(type),\
-deth=(header_len),detd=(data_len),info=(wmode),\
-fseek(in, start+(start_pos), SEEK_SET),HDR
-
-
-// Function ecc_compute(), edc_compute() and eccedc_init() taken from 
-// ** UNECM - Decoder for ECM (Error Code Modeler) format.
-// ** Version 1.0
-// ** Copyright (C) 2002 Neill Corlett
-
-/* LUTs used for computing ECC/EDC */
-static U8 ecc_f_lut[256];
-static U8 ecc_b_lut[256];
-static U32 edc_lut[256];
-static int luts_init=0;
-
-void eccedc_init(void) {
-  if (luts_init) return;
-  U32 i, j, edc;
-  for(i = 0; i < 256; i++) {
-    j = (i << 1) ^ (i & 0x80 ? 0x11D : 0);
-    ecc_f_lut[i] = j;
-    ecc_b_lut[i ^ j] = i;
-    edc = i;
-    for(j = 0; j < 8; j++) edc = (edc >> 1) ^ (edc & 1 ? 0xD8018001 : 0);
-    edc_lut[i] = edc;
-  }
-  luts_init=1;
-}
-
-void ecc_compute(U8 *src, U32 major_count, U32 minor_count, U32 major_mult, U32 minor_inc, U8 *dest) {
-  U32 size = major_count * minor_count;
-  U32 major, minor;
-  for(major = 0; major < major_count; major++) {
-    U32 index = (major >> 1) * major_mult + (major & 1);
-    U8 ecc_a = 0;
-    U8 ecc_b = 0;
-    for(minor = 0; minor < minor_count; minor++) {
-      U8 temp = src[index];
-      index += minor_inc;
-      if(index >= size) index -= size;
-      ecc_a ^= temp;
-      ecc_b ^= temp;
-      ecc_a = ecc_f_lut[ecc_a];
-    }
-    ecc_a = ecc_b_lut[ecc_f_lut[ecc_a] ^ ecc_b];
-    dest[major              ] = ecc_a;
-    dest[major + major_count] = ecc_a ^ ecc_b;
-  }
-}
-
-U32 edc_compute(const U8  *src, int size) {
-  U32 edc = 0;
-  while(size--) edc = (edc >> 8) ^ edc_lut[(edc ^ (*src++)) & 0xFF];
-  return edc;
-}
-
-int expand_cd_sector(U8 *data, int a, int test) {
-  U8 d2[2352];
-  eccedc_init();
-  d2[0]=d2[11]=0;
-  for (int i=1; i<11; i++) d2[i]=255;
-  int mode=(data[15]!=1?2:1);
-  int form=(data[15]==3?2:1);
-  if (a==-1) for (int i=12; i<15; i++) d2[i]=data[i]; else {
-    int c1=(a&15)+((a>>4)&15)*10;
-    int c2=((a>>8)&15)+((a>>12)&15)*10;
-    int c3=((a>>16)&15)+((a>>20)&15)*10;
-    c1=(c1+1)%75;
-    if (c1==0) {
-      c2=(c2+1)%60;
-      if (c2==0) c3++;
-    }
-    d2[12]=(c3%10)+16*(c3/10);
-    d2[13]=(c2%10)+16*(c2/10);
-    d2[14]=(c1%10)+16*(c1/10);
-  }
-  d2[15]=mode;
-  if (mode==2) for (int i=16; i<24; i++) d2[i]=data[i-4*(i>=20)];
-  if (form==1) {
-    if (mode==2) {
-      d2[1]=d2[12],d2[2]=d2[13],d2[3]=d2[14];
-      d2[12]=d2[13]=d2[14]=d2[15]=0;
-    } else {
-      for(int i=2068; i<2076; i++) d2[i]=0;
-    }
-    for (int i=16+8*(mode==2); i<2064+8*(mode==2); i++) d2[i]=data[i];
-    U32 edc=edc_compute(d2+16*(mode==2), 2064-8*(mode==2));
-    for (int i=0; i<4; i++) d2[2064+8*(mode==2)+i]=(edc>>(8*i))&0xff;
-    ecc_compute(d2+12, 86, 24,  2, 86, d2+2076);
-    ecc_compute(d2+12, 52, 43, 86, 88, d2+2248);
-    if (mode==2) {
-      d2[12]=d2[1],d2[13]=d2[2],d2[14]=d2[3],d2[15]=2;
-      d2[1]=d2[2]=d2[3]=255;
-    }
-  }
-  for (int i=0; i<2352; i++) if (d2[i]!=data[i] && test) form=2;
-  if (form==2) {
-    for (int i=24; i<2348; i++) d2[i]=data[i];
-    U32 edc=edc_compute(d2+16, 2332);
-    for (int i=0; i<4; i++) d2[2348+i]=(edc>>(8*i))&0xff;
-  }
-  for (int i=0; i<2352; i++) if (d2[i]!=data[i] && test) return 0; else data[i]=d2[i];
-  return mode+form-1;
-}
-
-// Detect EXE or JPEG data
-Filetype detect(FILE* in, int n, Filetype type, int &info) {
-  U32 buf1=0, buf0=0;  // last 8 bytes
-  long start=ftell(in);
-
-  // For EXE detection
-  Array<int> abspos(256),  // CALL/JMP abs. addr. low byte -> last offset
-    relpos(256);    // CALL/JMP relative addr. low byte -> last offset
-  int e8e9count=0;  // number of consecutive CALL/JMPs
-  int e8e9pos=0;    // offset of first CALL or JMP instruction
-  int e8e9last=0;   // offset of most recent CALL or JMP
-
-  int soi=0, sof=0, sos=0, app=0;  // For JPEG detection - position where found
-  int wavi=0,wavsize=0,wavch=0,wavbps=0,wavm=0;  // For WAVE detection
-  int aiff=0,aiffm=0,aiffs=0;  // For AIFF detection
-  int s3mi=0,s3mno=0,s3mni=0;  // For S3M detection
-  int bmp=0,imgbpp=0,bmpx=0,bmpy=0,bmpof=0;  // For BMP detection
-  int rgbi=0,rgbx=0,rgby=0;  // For RGB detection
-  int tga=0,tgax=0,tgay=0,tgaz=0,tgat=0;  // For TGA detection
-  int pgm=0,pgmcomment=0,pgmw=0,pgmh=0,pgm_ptr=0,pgmc=0,pgmn=0;  // For PBM, PGM, PPM detection
-  char pgm_buf[32];
-  int cdi=0,cda=0,cdm=0;  // For CD sectors detection
-  U32 cdf=0;
-
-  // For image detection
-  static int deth=0,detd=0;  // detected header/data size in bytes
-  static Filetype dett;  // detected block type
-  if (deth) return fseek(in, start+deth, SEEK_SET),deth=0,dett;
-  else if (detd) return fseek(in, start+detd, SEEK_SET),detd=0,DEFAULT;
-
-  for (int i=0; i<n; ++i) {
-    int c=getc(in);
-    if (c==EOF) return (Filetype)(-1);
-    buf1=buf1<<8|buf0>>24;
-    buf0=buf0<<8|c;
-
-    // CD sectors detection (mode 1 and mode 2 form 1+2 - 2352 bytes)
-    if (buf1==0x00ffffff && buf0==0xffffffff && !cdi) cdi=i,cda=-1,cdm=0;
-    if (cdi && i>cdi) {
-      const int p=(i-cdi)%2352;
-      if (p==8 && (buf1!=0xffffff00 || ((buf0&0xff)!=1 && (buf0&0xff)!=2))) cdi=0;
-      else if (p==16 && i+2336<n) {
-        U8 data[2352];
-        long savedpos=ftell(in);
-        fseek(in, start+i-23, SEEK_SET);
-        fread(data, 1, 2352, in);
-        fseek(in, savedpos, SEEK_SET);
-        int t=expand_cd_sector(data, cda, 1);
-        if (t!=cdm) cdm=t*(i-cdi<2352);
-        if (cdm && cda!=10 && (cdm==1 || buf0==buf1)) {
-          if (type!=CD) return info=cdm,fseek(in, start+cdi-7, SEEK_SET), CD;
-          cda=(data[12]<<16)+(data[13]<<8)+data[14];
-          if (cdm!=1 && i-cdi>2352 && buf0!=cdf) cda=10;
-          if (cdm!=1) cdf=buf0;
-        } else cdi=0;
-      }
-      if (!cdi && type==CD) return fseek(in, start+i-p-7, SEEK_SET), DEFAULT;
-    }
-    if (type==CD) continue;
-
-    // Detect JPEG by code SOI APPx (FF D8 FF Ex) followed by
-    // SOF0 (FF C0 xx xx 08) and SOS (FF DA) within a reasonable distance.
-    // Detect end by any code other than RST0-RST7 (FF D9-D7) or
-    // a byte stuff (FF 00).
-
-    if (!soi && i>=3 && (buf0&0xfffffff0)==0xffd8ffe0) soi=i, app=i+2, sos=sof=0;
-    if (soi) {
-      if (app==i && (buf0>>24)==0xff &&
-         ((buf0>>16)&0xff)>0xc0 && ((buf0>>16)&0xff)<0xff) app=i+(buf0&0xffff)+2;
-      if (app<i && (buf1&0xff)==0xff && (buf0&0xff0000ff)==0xc0000008) sof=i;
-      if (sof && sof>soi && i-sof<0x1000 && (buf0&0xffff)==0xffda) {
-        sos=i;
-        if (type!=JPEG) return fseek(in, start+soi-3, SEEK_SET), JPEG;
-      }
-      if (i-soi>0x40000 && !sos) soi=0;
-    }
-    if (type==JPEG && sos && i>sos && (buf0&0xff00)==0xff00
-        && (buf0&0xff)!=0 && (buf0&0xf8)!=0xd0) return DEFAULT;
-
-    // Detect .wav file header
-    if (buf0==0x52494646) wavi=i,wavm=0;
-    if (wavi) {
-      const int p=i-wavi;
-      if (p==4) wavsize=bswap(buf0);
-      else if (p==8 && buf0!=0x57415645) wavi=0;
-      else if (p==16 && (buf1!=0x666d7420 || bswap(buf0)!=16)) wavi=0;
-      else if (p==22) wavch=bswap(buf0)&0xffff;
-      else if (p==34) wavbps=bswap(buf0)&0xffff;
-      else if (p==40+wavm && buf1!=0x64617461) wavm+=bswap(buf0)+8,wavi=(wavm>0xfffff?0:wavi);
-      else if (p==40+wavm) {
-        int wavd=bswap(buf0);
-        if ((wavch==1 || wavch==2) && (wavbps==8 || wavbps==16) && wavd>0 && wavsize>=wavd+36
-           && wavd%((wavbps/8)*wavch)==0) AUD_DET(AUDIO,wavi-3,44+wavm,wavd,wavch+wavbps/4-3);
-        wavi=0;
-      }
-    }
-
-    // Detect .aiff file header
-    if (buf0==0x464f524d) aiff=i,aiffs=0; // FORM
-    if (aiff) {
-      const int p=i-aiff;
-      if (p==12 && (buf1!=0x41494646 || buf0!=0x434f4d4d)) aiff=0; // AIFF COMM
-      else if (p==24) {
-        const int bits=buf0&0xffff, chn=buf1>>16;
-        if ((bits==8 || bits==16) && (chn==1 || chn==2)) aiffm=chn+bits/4+1; else aiff=0;
-      } else if (p==42+aiffs && buf1!=0x53534e44) aiffs+=(buf0+8)+(buf0&1),aiff=(aiffs>0x400?0:aiff);
-      else if (p==42+aiffs) AUD_DET(AUDIO,aiff-3,54+aiffs,buf0-8,aiffm);
-    }
-
-    // Detect .mod file header 
-    if ((buf0==0x4d2e4b2e || buf0==0x3643484e || buf0==0x3843484e  // M.K. 6CHN 8CHN
-       || buf0==0x464c5434 || buf0==0x464c5438) && (buf1&0xc0c0c0c0)==0 && i>=1083) {
-      long savedpos=ftell(in);
-      const int chn=((buf0>>24)==0x36?6:(((buf0>>24)==0x38 || (buf0&0xff)==0x38)?8:4));
-      int len=0; // total length of samples
-      int numpat=1; // number of patterns
-      for (int j=0; j<31; j++) {
-        fseek(in, start+i-1083+42+j*30, SEEK_SET);
-        const int i1=getc(in);
-        const int i2=getc(in);
-        len+=i1*512+i2*2;
-      }
-      fseek(in, start+i-131, SEEK_SET);
-      for (int j=0; j<128; j++) {
-        int x=getc(in);
-        if (x+1>numpat) numpat=x+1;
-      }
-      if (numpat<65) AUD_DET(AUDIO,i-1083,1084+numpat*256*chn,len,4);
-      fseek(in, savedpos, SEEK_SET);
-    }
-
-    // Detect .s3m file header 
-    if (buf0==0x1a100000) s3mi=i,s3mno=s3mni=0;
-    if (s3mi) {
-      const int p=i-s3mi;
-      if (p==4) s3mno=bswap(buf0)&0xffff,s3mni=(bswap(buf0)>>16);
-      else if (p==16 && (((buf1>>16)&0xff)!=0x13 || buf0!=0x5343524d)) s3mi=0;
-      else if (p==16) {
-        long savedpos=ftell(in);
-        int b[31],sam_start=(1<<16),sam_end=0,ok=1;
-        for (int j=0;j<s3mni;j++) {
-          fseek(in, start+s3mi-31+0x60+s3mno+j*2, SEEK_SET);
-          int i1=getc(in);
-          i1+=getc(in)*256;
-          fseek(in, start+s3mi-31+i1*16, SEEK_SET);
-          i1=getc(in);
-          if (i1==1) { // type: sample
-            for (int k=0;k<31;k++) b[k]=fgetc(in);
-            int len=b[15]+(b[16]<<8);
-            int ofs=b[13]+(b[14]<<8);
-            if (b[30]>1) ok=0;
-            if (ofs*16<sam_start) sam_start=ofs*16;
-            if (ofs*16+len>sam_end) sam_end=ofs*16+len;
-          }
-        }
-        if (ok && sam_start<(1<<16)) AUD_DET(AUDIO,s3mi-31,sam_start,sam_end-sam_start,0);
-        s3mi=0;
-        fseek(in, savedpos, SEEK_SET);
-      }
-    }
-
-    // Detect .bmp image
-    if ((buf0&0xffff)==16973) imgbpp=bmpx=bmpy=bmpof=0,bmp=i;  //possible 'BM'
-    if (bmp) {
-      const int p=i-bmp;
-      if (p==12) bmpof=bswap(buf0);
-      else if (p==16 && buf0!=0x28000000) bmp=0; //windows bmp?
-      else if (p==20) bmpx=bswap(buf0),bmp=((bmpx==0||bmpx>0x30000)?0:bmp); //width
-      else if (p==24) bmpy=abs((int)bswap(buf0)),bmp=((bmpy==0||bmpy>0x10000)?0:bmp); //height
-      else if (p==27) imgbpp=c,bmp=((imgbpp!=1 && imgbpp!=8 && imgbpp!=24)?0:bmp);
-      else if (p==31) {
-        if (imgbpp!=0 && buf0==0) {
-          if (imgbpp==1) IMG_DET(IMAGE1,bmp-1,bmpof,(((bmpx-1)>>5)+1)*4,bmpy);
-          else if (imgbpp==8) IMG_DET(IMAGE8,bmp-1,bmpof,(bmpx+3)&-4,bmpy);
-          else if (imgbpp==24) IMG_DET(IMAGE24,bmp-1,bmpof,((bmpx*3)+3)&-4,bmpy);
-        }
-        bmp=0;
-      }
-    }
-
-    // Detect .pbm .pgm .ppm image
-    if ((buf0&0xfff0ff)==0x50300a) {
-      pgmn=(buf0&0xf00)>>8;
-      if (pgmn>=4 && pgmn <=6) pgm=i,pgm_ptr=pgmw=pgmh=pgmc=pgmcomment=0;
-    }
-    if (pgm) {
-      if (i-pgm==1 && c==0x23) pgmcomment=1; //pgm comment
-      if (!pgmcomment && pgm_ptr) {
-        int s=0;
-        if (c==0x20 && !pgmw) s=1;
-        else if (c==0x0a && !pgmh) s=2;
-        else if (c==0x0a && !pgmc && pgmn!=4) s=3;
-        if (s) {
-          pgm_buf[pgm_ptr++]=0;
-          int v=atoi(pgm_buf);
-          if (s==1) pgmw=v; else if (s==2) pgmh=v; else if (s==3) pgmc=v;
-          if (v==0 || (s==3 && v>255)) pgm=0; else pgm_ptr=0;
-        }
-      }
-      if (!pgmcomment) pgm_buf[pgm_ptr++]=c;
-      if (pgm_ptr>=32) pgm=0;
-      if (pgmcomment && c==0x0a) pgmcomment=0;
-      if (pgmw && pgmh && !pgmc && pgmn==4) IMG_DET(IMAGE1,pgm-2,i-pgm+3,(pgmw+7)/8,pgmh);
-      if (pgmw && pgmh && pgmc && pgmn==5) IMG_DET(IMAGE8,pgm-2,i-pgm+3,pgmw,pgmh);
-      if (pgmw && pgmh && pgmc && pgmn==6) IMG_DET(IMAGE24,pgm-2,i-pgm+3,pgmw*3,pgmh);
-    }
-
-    // Detect .rgb image
-    if ((buf0&0xffff)==0x01da) rgbi=i,rgbx=rgby=0;
-    if (rgbi) {
-      const int p=i-rgbi;
-      if (p==1 && c!=0) rgbi=0;
-      else if (p==2 && c!=1) rgbi=0;
-      else if (p==4 && (buf0&0xffff)!=1 && (buf0&0xffff)!=2 && (buf0&0xffff)!=3) rgbi=0;
-      else if (p==6) rgbx=buf0&0xffff,rgbi=(rgbx==0?0:rgbi);
-      else if (p==8) rgby=buf0&0xffff,rgbi=(rgby==0?0:rgbi);
-      else if (p==10) {
-        int z=buf0&0xffff;
-        if (rgbx && rgby && (z==1 || z==3 || z==4)) IMG_DET(IMAGE8,rgbi-1,512,rgbx,rgby*z);
-        rgbi=0;
-      }
-    }
-
-    // Detect .tiff file header (2/8/24 bit color, not compressed).
-    if (buf1==0x49492a00 && n>i+(int)bswap(buf0)) {
-      long savedpos=ftell(in);
-      fseek(in, start+i+bswap(buf0)-7, SEEK_SET);
-
-      // read directory
-      int dirsize=getc(in);
-      int tifx=0,tify=0,tifz=0,tifzb=0,tifc=0,tifofs=0,tifofval=0,b[12];
-      if (getc(in)==0) {
-        for (int i=0; i<dirsize; i++) {
-          for (int j=0; j<12; j++) b[j]=getc(in);
-          if (b[11]==EOF) break;
-          int tag=b[0]+(b[1]<<8);
-          int tagfmt=b[2]+(b[3]<<8);
-          int taglen=b[4]+(b[5]<<8)+(b[6]<<16)+(b[7]<<24);
-          int tagval=b[8]+(b[9]<<8)+(b[10]<<16)+(b[11]<<24);
-          if (tagfmt==3||tagfmt==4) {
-            if (tag==256) tifx=tagval;
-            else if (tag==257) tify=tagval;
-            else if (tag==258) tifzb=taglen==1?tagval:8; // bits per component
-            else if (tag==259) tifc=tagval; // 1 = no compression
-            else if (tag==273 && tagfmt==4) tifofs=tagval,tifofval=(taglen<=1);
-            else if (tag==277) tifz=tagval; // components per pixel
-          }
-        }
-      }
-      if (tifx && tify && tifzb && (tifz==1 || tifz==3) && (tifc==1) && (tifofs && tifofs+i<n)) {
-        if (!tifofval) {
-          fseek(in, start+i+tifofs-7, SEEK_SET);
-          for (int j=0; j<4; j++) b[j]=getc(in);
-          tifofs=b[0]+(b[1]<<8)+(b[2]<<16)+(b[3]<<24);
-        }
-        if (tifofs && tifofs<(1<<18) && tifofs+i<n) {
-          if (tifz==1 && tifzb==1) IMG_DET(IMAGE1,i-7,tifofs,((tifx-1)>>3)+1,tify);
-          else if (tifz==1 && tifzb==8) IMG_DET(IMAGE8,i-7,tifofs,tifx,tify);
-          else if (tifz==3 && tifzb==8) IMG_DET(IMAGE24,i-7,tifofs,tifx*3,tify);
-        }
-      }
-      fseek(in, savedpos, SEEK_SET);
-    }
-
-    // Detect .tga image (8-bit 256 colors or 24-bit uncompressed)
-    if (buf1==0x00010100 && buf0==0x00000118) tga=i,tgax=tgay,tgaz=8,tgat=1;
-    else if (buf1==0x00000200 && buf0==0x00000000) tga=i,tgax=tgay,tgaz=24,tgat=2;
-    else if (buf1==0x00000300 && buf0==0x00000000) tga=i,tgax=tgay,tgaz=8,tgat=3;
-    if (tga) {
-      if (i-tga==8) tga=(buf1==0?tga:0),tgax=(bswap(buf0)&0xffff),tgay=(bswap(buf0)>>16);
-      else if (i-tga==10) {
-        if (tgaz==(int)((buf0&0xffff)>>8) && tgax && tgay) {
-          if (tgat==1) IMG_DET(IMAGE8,tga-7,18+256*3,tgax,tgay);
-          else if (tgat==2) IMG_DET(IMAGE24,tga-7,18,tgax*3,tgay);
-          else if (tgat==3) IMG_DET(IMAGE8,tga-7,18,tgax,tgay);
-        }
-        tga=0;
-      }
-    }
-
-    // Detect EXE if the low order byte (little-endian) XX is more
-    // recently seen (and within 4K) if a relative to absolute address
-    // conversion is done in the context CALL/JMP (E8/E9) XX xx xx 00/FF
-    // 4 times in a row.  Detect end of EXE at the last
-    // place this happens when it does not happen for 64KB.
-
-    if (((buf1&0xfe)==0xe8 || (buf1&0xfff0)==0x0f80) && ((buf0+1)&0xfe)==0) {
-      int r=buf0>>24;  // relative address low 8 bits
-      int a=((buf0>>24)+i)&0xff;  // absolute address low 8 bits
-      int rdist=i-relpos[r];
-      int adist=i-abspos[a];
-      if (adist<rdist && adist<0x800 && abspos[a]>5) {
-        e8e9last=i;
-        ++e8e9count;
-        if (e8e9pos==0 || e8e9pos>abspos[a]) e8e9pos=abspos[a];
-      }
-      else e8e9count=0;
-      if (type==DEFAULT && e8e9count>=4 && e8e9pos>5)
-        return fseek(in, start+e8e9pos-5, SEEK_SET), EXE;
-      abspos[a]=i;
-      relpos[r]=i;
-    }
-    if (i-e8e9last>0x4000) {
-      if (type==EXE) return fseek(in, start+e8e9last, SEEK_SET), DEFAULT;
-      e8e9count=e8e9pos=0;
-    }
-  }
-  return type;
-}
-
-typedef enum {FDECOMPRESS, FCOMPARE, FDISCARD} FMode;
-
-// Print progress: n is the number of bytes compressed or decompressed
-void printStatus(int n, int size) {
-  printf("%6.2f%%\b\b\b\b\b\b\b", float(100)*n/(size+1)), fflush(stdout);
-}
-
-void encode_cd(FILE* in, FILE* out, int len, int info) {
-  const int BLOCK=2352;
-  U8 blk[BLOCK];
-  fputc((len%BLOCK)>>8,out);
-  fputc(len%BLOCK,out);
-  for (int offset=0; offset<len; offset+=BLOCK) {
-    if (offset+BLOCK > len) {
-      fread(&blk[0], 1, len-offset, in);
-      fwrite(&blk[0], 1, len-offset, out);
-    } else {
-      fread(&blk[0], 1, BLOCK, in);
-      if (info==3) blk[15]=3;
-      if (offset==0) fwrite(&blk[12], 1, 4+4*(blk[15]!=1), out);
-      fwrite(&blk[16+8*(blk[15]!=1)], 1, 2048+276*(info==3), out);
-      if (offset+BLOCK*2 > len && blk[15]!=1) fwrite(&blk[16], 1, 4, out);
-    }
-  }
-}
-
-int decode_cd(FILE *in, int size, FILE *out, FMode mode, int &diffFound) {
-  const int BLOCK=2352;
-  U8 blk[BLOCK];
-  long i=0, i2=0;
-  int a=-1, bsize=0, q=fgetc(in);
-  q=(q<<8)+fgetc(in);
-  size-=2;
-  while (i<size) {
-    if (size-i==q) {
-      fread(blk, q, 1, in);
-      fwrite(blk, q, 1, out);
-      i+=q;
-      i2+=q;
-    } else if (i==0) {
-      fread(blk+12, 4, 1, in);
-      if (blk[15]!=1) fread(blk+16, 4, 1, in);
-      bsize=2048+(blk[15]==3)*276;
-      i+=4*(blk[15]!=1)+4;
-    } else {
-      a=(blk[12]<<16)+(blk[13]<<8)+blk[14];
-    }
-    fread(blk+16+(blk[15]!=1)*8, bsize, 1, in);
-    i+=bsize;
-    if (bsize>2048) blk[15]=3;
-    if (blk[15]!=1 && size-q-i==4) {
-      fread(blk+16, 4, 1, in);
-      i+=4;
-    }
-    expand_cd_sector(blk, a, 0);
-    if (mode==FDECOMPRESS) fwrite(blk, BLOCK, 1, out);
-    else if (mode==FCOMPARE) for (int j=0; j<BLOCK; ++j) if (blk[j]!=getc(out) && !diffFound) diffFound=i2+j+1;
-    i2+=BLOCK;
-  }
-  return i2;
-}
-
-
-// 24-bit image data transform:
-// simple color transform (b, g, r) -> (g, g-r, g-b)
-
-void encode_bmp(FILE* in, FILE* out, int len, int width) {
-  int r,g,b;
-  for (int i=0; i<len/width; i++) {
-    for (int j=0; j<width/3; j++) {
-      b=fgetc(in), g=fgetc(in), r=fgetc(in);
-      fputc(g, out);
-      fputc(g-r, out);
-      fputc(g-b, out);
-    }
-    for (int j=0; j<width%3; j++) fputc(fgetc(in), out);
-  }
-}
-
-int decode_bmp(Encoder& en, int size, int width, FILE *out, FMode mode, int &diffFound) {
-  int r,g,b,p;
-  for (int i=0; i<size/width; i++) {
-    p=i*width;
-    for (int j=0; j<width/3; j++) {
-      b=en.decompress(), g=en.decompress(), r=en.decompress();
-      if (mode==FDECOMPRESS) {
-        fputc(b-r, out);
-        fputc(b, out);
-        fputc(b-g, out);
-      }
-      else if (mode==FCOMPARE) {
-        if (((b-r)&255)!=getc(out) && !diffFound) diffFound=p+1;
-        if (b!=getc(out) && !diffFound) diffFound=p+2;
-        if (((b-g)&255)!=getc(out) && !diffFound) diffFound=p+3;
-        p+=3;
-      }
-    }
-    for (int j=0; j<width%3; j++) {
-      if (mode==FDECOMPRESS) {
-        fputc(en.decompress(), out);
-      }
-      else if (mode==FCOMPARE) {
-        if (en.decompress()!=getc(out) && !diffFound) diffFound=p+j+1;
-      }
-    }
-  }
-  return size;
-}
-
-// EXE transform: <encoded-size> <begin> <block>...
-// Encoded-size is 4 bytes, MSB first.
-// begin is the offset of the start of the input file, 4 bytes, MSB first.
-// Each block applies the e8e9 transform to strings falling entirely
-// within the block starting from the end and working backwards.
-// The 5 byte pattern is E8/E9 xx xx xx 00/FF (x86 CALL/JMP xxxxxxxx)
-// where xxxxxxxx is a relative address LSB first.  The address is
-// converted to an absolute address by adding the offset mod 2^25
-// (in range +-2^24).
-
-void encode_exe(FILE* in, FILE* out, int len, int begin) {
-  const int BLOCK=0x10000;
-  Array<U8> blk(BLOCK);
-  fprintf(out, "%c%c%c%c", begin>>24, begin>>16, begin>>8, begin);
-
-  // Transform
-  for (int offset=0; offset<len; offset+=BLOCK) {
-    int size=min(len-offset, BLOCK);
-    int bytesRead=fread(&blk[0], 1, size, in);
-    if (bytesRead!=size) quit("encode_exe read error");
-    for (int i=bytesRead-1; i>=5; --i) {
-      if ((blk[i-4]==0xe8 || blk[i-4]==0xe9 || (blk[i-5]==0x0f && (blk[i-4]&0xf0)==0x80))
-         && (blk[i]==0||blk[i]==0xff)) {
-        int a=(blk[i-3]|blk[i-2]<<8|blk[i-1]<<16|blk[i]<<24)+offset+begin+i+1;
-        a<<=7;
-        a>>=7;
-        blk[i]=a>>24;
-        blk[i-1]=a^176;
-        blk[i-2]=(a>>8)^176;
-        blk[i-3]=(a>>16)^176;
-      }
-    }
-    fwrite(&blk[0], 1, bytesRead, out);
-  }
-}
-
-int decode_exe(Encoder& en, int size, FILE *out, FMode mode, int &diffFound, long s1=0, long s2=0) {
-  const int BLOCK=0x10000;  // block size
-  int begin, offset=6, a, showstatus=(s2!=0);
-  U8 c[6];
-  begin=en.decompress()<<24;
-  begin|=en.decompress()<<16;
-  begin|=en.decompress()<<8;
-  begin|=en.decompress();
-  size-=4;
-  for (int i=4; i>=0; i--) c[i]=en.decompress();  // Fill queue
-
-  while (offset<size+6) {
-    memmove(c+1, c, 5);
-    if (offset<=size) c[0]=en.decompress();
-    // E8E9 transform: E8/E9 xx xx xx 00/FF -> subtract location from x
-    if ((c[0]==0x00 || c[0]==0xFF) && (c[4]==0xE8 || c[4]==0xE9 || (c[5]==0x0F && (c[4]&0xF0)==0x80))
-     && (((offset-1)^(offset-6))&-BLOCK)==0 && offset<=size) { // not crossing block boundary
-      a=((c[1]^176)|(c[2]^176)<<8|(c[3]^176)<<16|c[0]<<24)-offset-begin;
-      a<<=7;
-      a>>=7;
-      c[3]=a;
-      c[2]=a>>8;
-      c[1]=a>>16;
-      c[0]=a>>24;
-    }
-    if (mode==FDECOMPRESS) putc(c[5], out);
-    else if (mode==FCOMPARE && c[5]!=getc(out) && !diffFound) diffFound=offset-6+1;
-    if (showstatus && !(offset&0xfff)) printStatus(s1+offset-6, s2);
-    offset++;
-  }
-  return size;
-}
-
-//////////////////// Compress, Decompress ////////////////////////////
-
-void direct_encode_block(Filetype type, FILE *in, int len, Encoder &en, int s1, int s2, int info=-1) {
-  en.compress(type);
-  en.compress(len>>24);
-  en.compress(len>>16);
-  en.compress(len>>8);
-  en.compress(len);
-  if (info!=-1) {
-    en.compress(info>>24);
-    en.compress(info>>16);
-    en.compress(info>>8);
-    en.compress(info);
-  }
-  printf("Compressing... ");
-  const int total=s1+len+s2;
-  for (int j=s1; j<s1+len; ++j) {
-    if (!(j&0xfff)) printStatus(j, total);
-    en.compress(getc(in));
-  }
-  printf("\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b");
-}
-
-void compressRecursive(FILE *in, long n, Encoder &en, char *blstr, int it=0, int s1=0, int s2=0) {
-  static const char* typenames[9]={"default", "jpeg", "hdr",
-    "1b-image", "8b-image", "24b-image", "audio", "exe", "cd"};
-  static const char* audiotypes[4]={"8b mono", "8b stereo", "16b mono",
-    "16b stereo"};
-  Filetype type=DEFAULT;
-  int blnum=0, info;  // image width or audio type
-  long begin=ftell(in), end0=begin+n;
-  FILE* tmp;
-  char b2[32];
-  strcpy(b2, blstr);
-  if (b2[0]) strcat(b2, "-");
-  if (it==5) {
-    direct_encode_block(DEFAULT, in, n, en, s1, s2);
-    return;
-  }
-  s2+=n;
-
-  // Transform and test in blocks
-  while (n>0) {
-    Filetype nextType=detect(in, n, type, info);
-    long end=ftell(in);
-    fseek(in, begin, SEEK_SET);
-    if (end>end0) {  // if some detection reports longer then actual size file is
-      end=begin+1;
-      type=DEFAULT;
-    }
-    int len=int(end-begin);
-    if (len>0) {
-      s2-=len;
-      sprintf(blstr,"%s%d",b2,blnum++);
-      printf(" %-11s | %-9s |%10d bytes [%ld - %ld]",blstr,typenames[type],len,begin,end-1);
-      if (type==AUDIO) printf(" (%s)", audiotypes[info%4]);
-      else if (type==IMAGE1 || type==IMAGE8 || type==IMAGE24) printf(" (width: %d)", info);
-      else if (type==CD) printf(" (m%d/f%d)", info==1?1:2, info!=3?1:2);
-      printf("\n");
-      if (type==EXE || type==CD || type==IMAGE24) {
-        tmp=tmpfile();  // temporary encoded file
-        if (!tmp) perror("tmpfile"), quit();
-        if (type==IMAGE24) encode_bmp(in, tmp, len, info);
-        else if (type==EXE) encode_exe(in, tmp, len, begin);
-        else if (type==CD) encode_cd(in, tmp, len, info);
-        const long tmpsize=ftell(tmp);
-
-        rewind(tmp);
-        en.setFile(tmp);
-        fseek(in, begin, SEEK_SET);
-        int diffFound=0;
-        if (type==IMAGE24) decode_bmp(en, tmpsize, info, in, FCOMPARE, diffFound);
-        else if (type==EXE) decode_exe(en, tmpsize, in, FCOMPARE, diffFound);
-        else if (type==CD) decode_cd(tmp, tmpsize, in, FCOMPARE, diffFound);
-
-        // Test fails, compress without transform
-        if (diffFound || fgetc(tmp)!=EOF) {
-          printf("Transform fails at %d, skipping...\n", diffFound-1);
-          fseek(in, begin, SEEK_SET);
-          direct_encode_block(DEFAULT, in, len, en, s1, s2);
-        } else {
-          rewind(tmp);
-          if (type==CD) {
-            en.compress(type), en.compress(tmpsize>>24), en.compress(tmpsize>>16);
-            en.compress(tmpsize>>8), en.compress(tmpsize);
-            compressRecursive(tmp, tmpsize, en, blstr, it+1, s1, s2);
-          } else if (type==EXE) {
-            direct_encode_block(type, tmp, tmpsize, en, s1, s2);
-          } else if (type==IMAGE24) {
-            direct_encode_block(type, tmp, tmpsize, en, s1, s2, info);
-          }
-        }
-        fclose(tmp);  // deletes
-      } else {
-        const int i1=(type==IMAGE1 || type==IMAGE8 || type==AUDIO)?info:-1;
-        direct_encode_block(type, in, len, en, s1, s2, i1);
-      }
-      s1+=len;
-    }
-    n-=len;
-    type=nextType;
-    begin=end;
-  }
-}
-
-// Compress a file. Split filesize bytes into blocks by type.
-// For each block, output
-// <type> <size> and call encode_X to convert to type X.
-// Test transform and compress.
-void compress(const char* filename, long filesize, Encoder& en) {
-  assert(en.getMode()==COMPRESS);
-  assert(filename && filename[0]);
-  FILE *in=fopen(filename, "rb");
-  if (!in) perror(filename), quit();
-  long start=en.size();
-  printf("Block segmentation:\n");
-  char blstr[32]="";
-  compressRecursive(in, filesize, en, blstr);
-  if (in) fclose(in);
-  printf("Compressed from %ld to %ld bytes.\n",filesize,en.size()-start);
-}
-
-// Try to make a directory, return true if successful
-bool makedir(const char* dir) {
-#ifdef WINDOWS
-  return CreateDirectory(dir, 0)==TRUE;
-#else
-#ifdef UNIX
-  return mkdir(dir, 0777)==0;
-#else
-  return false;
-#endif
-#endif
-}
-
-
-int decompressRecursive(FILE *out, long size, Encoder& en, FMode mode, int it=0, int s1=0, int s2=0) {
-  Filetype type;
-  long len, i=0;
-  int diffFound=0, info;
-  FILE *tmp;
-  s2+=size;
-  while (i<size) {
-    type=(Filetype)en.decompress();
-    len=en.decompress()<<24;
-    len|=en.decompress()<<16;
-    len|=en.decompress()<<8;
-    len|=en.decompress();
-
-    if (type==IMAGE1 || type==IMAGE8 || type==IMAGE24 || type==AUDIO) {
-      info=0; for (int i=0; i<4; ++i) { info<<=8; info+=en.decompress(); }
-    }
-    if (type==IMAGE24) len=decode_bmp(en, len, info, out, mode, diffFound);
-    else if (type==EXE) len=decode_exe(en, len, out, mode, diffFound, s1, s2);
-    else if (type==CD) {
-      tmp=tmpfile();
-      decompressRecursive(tmp, len, en, FDECOMPRESS, it+1, s1+i, s2-len);
-      if (mode!=FDISCARD) {
-        rewind(tmp);
-        len=decode_cd(tmp, len, out, mode, diffFound);
-      }
-      fclose(tmp);
-    } else {
-      for (int j=i+s1; j<i+s1+len; ++j) {
-        if (!(j&0xfff)) printStatus(j, s2);
-        if (mode==FDECOMPRESS) putc(en.decompress(), out);
-        else if (mode==FCOMPARE) {
-          if (en.decompress()!=fgetc(out) && !diffFound) {
-            mode=FDISCARD;
-            diffFound=j+1;
-          }
-        } else en.decompress();
-      }
-    }
-
-    i+=len;
-  }
-  return diffFound;
-}
-
-// Decompress a file
-void decompress(const char* filename, long filesize, Encoder& en) {
-  FMode mode=FDECOMPRESS;
-  assert(en.getMode()==DECOMPRESS);
-  assert(filename && filename[0]);
-
-  // Test if output file exists.  If so, then compare.
-  FILE* f=fopen(filename, "rb");
-  if (f) mode=FCOMPARE,printf("Comparing");
-  else {
-    // Create file
-    f=fopen(filename, "wb");
-    if (!f) {  // Try creating directories in path and try again
-      String path(filename);
-      for (int i=0; path[i]; ++i) {
-        if (path[i]=='/' || path[i]=='\\') {
-          char savechar=path[i];
-          path[i]=0;
-          if (makedir(path.c_str()))
-            printf("Created directory %s\n", path.c_str());
-          path[i]=savechar;
-        }
-      }
-      f=fopen(filename, "wb");
-    }
-    if (!f) mode=FDISCARD,printf("Skipping"); else printf("Extracting");
-  }
-  printf(" %s %ld -> ", filename, filesize);
-
-  // Decompress/Compare
-  int r=decompressRecursive(f, filesize, en, mode);
-  if (mode==FCOMPARE && !r && getc(f)!=EOF) printf("file is longer\n");
-  else if (mode==FCOMPARE && r) printf("differ at %d\n",r-1);
-  else if (mode==FCOMPARE) printf("identical\n");
-  else printf("done   \n");
-  if (f) fclose(f);
-}
-
-//////////////////////////// User Interface ////////////////////////////
-
-
-// int expand(String& archive, String& s, const char* fname, int base) {
-// Given file name fname, print its length and base name (beginning
-// at fname+base) to archive in format "%ld\t%s\r\n" and append the
-// full name (including path) to String s in format "%s\n".  If fname
-// is a directory then substitute all of its regular files and recursively
-// expand any subdirectories.  Base initially points to the first
-// character after the last / in fname, but in subdirectories includes
-// the path from the topmost directory.  Return the number of files
-// whose names are appended to s and archive.
-
-// Same as expand() except fname is an ordinary file
-int putsize(String& archive, const char* fname, int base) {
-  int result=0;
-  FILE *f=fopen(fname, "rb");
-  if (f) {
-    fseek(f, 0, SEEK_END);
-    long len=ftell(f);
-    if (len>=0) {
-      static char blk[24];
-      sprintf(blk, "%ld\t", len);
-      archive+=blk;
-      archive+=(fname+base);
-      archive+="\n";
-      ++result;
-    }
-    fclose(f);
-  }
-  return result;
-}
-
-#ifdef WINDOWS
-
-int expand(String& archive, const char* fname, int base) {
-  int result=0;
-  DWORD attr=GetFileAttributes(fname);
-  if ((attr != 0xFFFFFFFF) && (attr & FILE_ATTRIBUTE_DIRECTORY)) {
-    WIN32_FIND_DATA ffd;
-    String fdir(fname);
-    fdir+="/*";
-    HANDLE h=FindFirstFile(fdir.c_str(), &ffd);
-    while (h!=INVALID_HANDLE_VALUE) {
-      if (!equals(ffd.cFileName, ".") && !equals(ffd.cFileName, "..")) {
-        String d(fname);
-        d+="/";
-        d+=ffd.cFileName;
-        result+=expand(archive, d.c_str(), base);
-      }
-      if (FindNextFile(h, &ffd)!=TRUE) break;
-    }
-    FindClose(h);
-  }
-  else // ordinary file
-    result=putsize(archive, fname, base);
-  return result;
-}
-
-#else
-#ifdef UNIX
-
-int expand(String& archive, const char* fname, int base) {
-  int result=0;
-  struct stat sb;
-  if (stat(fname, &sb)<0) return 0;
-
-  // If a regular file and readable, get file size
-  if (sb.st_mode & S_IFREG && sb.st_mode & 0400)
-    result+=putsize(archive, fname, base);
-
-  // If a directory with read and execute permission, traverse it
-  else if (sb.st_mode & S_IFDIR && sb.st_mode & 0400 && sb.st_mode & 0100) {
-    DIR *dirp=opendir(fname);
-    if (!dirp) {
-      perror("opendir");
-      return result;
-    }
-    dirent *dp;
-    while(errno=0, (dp=readdir(dirp))!=0) {
-      if (!equals(dp->d_name, ".") && !equals(dp->d_name, "..")) {
-        String d(fname);
-        d+="/";
-        d+=dp->d_name;
-        result+=expand(archive, d.c_str(), base);
-      }
-    }
-    if (errno) perror("readdir");
-    closedir(dirp);
-  }
-  else printf("%s is not a readable file or directory\n", fname);
-  return result;
-}
-
-#else  // Not WINDOWS or UNIX, ignore directories
-
-int expand(String& archive, const char* fname, int base) {
-  return putsize(archive, fname, base);
-}
-
-#endif
-#endif
-
-
-// To compress to file1.paq8px: paq8px [-n] file1 [file2...]
-// To decompress: paq8px file1.paq8px [output_dir]
-int main(int argc, char** argv) {
-  bool pause=argc<=2;  // Pause when done?
-  try {
-
-    // Get option
-    bool doExtract=false;  // -d option
-    bool doList=false;  // -l option
-    if (argc>1 && argv[1][0]=='-' && argv[1][1] && !argv[1][2]) {
-      if (argv[1][1]>='0' && argv[1][1]<='8')
-        level=argv[1][1]-'0';
-      else if (argv[1][1]=='d')
-        doExtract=true;
-      else if (argv[1][1]=='l')
-        doList=true;
-      else
-        quit("Valid options are -0 through -8, -d, -l\n");
-      --argc;
-      ++argv;
-      pause=false;
-    }
-
-    // Print help message
-    if (argc<2) {
-      printf(PROGNAME " archiver (C) 2008, Matt Mahoney et al.\n"
-        "Free under GPL, http://www.gnu.org/licenses/gpl.txt\n\n"
-#ifdef WINDOWS
-        "To compress or extract, drop a file or folder on the "
-        PROGNAME " icon.\n"
-        "The output will be put in the same folder as the input.\n"
-        "\n"
-        "Or from a command window: "
-#endif
-        "To compress:\n"
-        "  " PROGNAME " -level file               (compresses to file." PROGNAME ")\n"
-        "  " PROGNAME " -level archive files...   (creates archive." PROGNAME ")\n"
-        "  " PROGNAME " file                      (level -%d, pause when done)\n"
-        "level: -0 = store, -1 -2 -3 = faster (uses 35, 48, 59 MB)\n"
-        "-4 -5 -6 -7 -8 = smaller (uses 133, 233, 435, 837, 1643 MB)\n"
-#if defined(WINDOWS) || defined (UNIX)
-        "You may also compress directories.\n"
-#endif
-        "\n"
-        "To extract or compare:\n"
-        "  " PROGNAME " -d dir1/archive." PROGNAME "      (extract to dir1)\n"
-        "  " PROGNAME " -d dir1/archive." PROGNAME " dir2 (extract to dir2)\n"
-        "  " PROGNAME " archive." PROGNAME "              (extract, pause when done)\n"
-        "\n"
-        "To view contents: " PROGNAME " -l archive." PROGNAME "\n"
-        "\n",
-        DEFAULT_OPTION);
-      quit();
-    }
-
-    FILE* archive=0;  // compressed file
-    int files=0;  // number of files to compress/decompress
-    Array<const char*> fname(1);  // file names (resized to files)
-    Array<long> fsize(1);   // file lengths (resized to files)
-
-    // Compress or decompress?  Get archive name
-    Mode mode=COMPRESS;
-    String archiveName(argv[1]);
-    {
-      const int prognamesize=strlen(PROGNAME);
-      const int arg1size=strlen(argv[1]);
-      if (arg1size>prognamesize+1 && argv[1][arg1size-prognamesize-1]=='.'
-          && equals(PROGNAME, argv[1]+arg1size-prognamesize)) {
-        mode=DECOMPRESS;
-      }
-      else if (doExtract || doList)
-        mode=DECOMPRESS;
-      else {
-        archiveName+=".";
-        archiveName+=PROGNAME;
-      }
-    }
-
-    // Compress: write archive header, get file names and sizes
-    String header_string;
-    if (mode==COMPRESS) {
-
-      // Expand filenames to read later.  Write their base names and sizes
-      // to archive.
-      int i;
-      for (i=1; i<argc; ++i) {
-        String name(argv[i]);
-        int len=name.size()-1;
-        for (int j=0; j<=len; ++j)  // change \ to /
-          if (name[j]=='\\') name[j]='/';
-        while (len>0 && name[len-1]=='/')  // remove trailing /
-          name[--len]=0;
-        int base=len-1;
-        while (base>=0 && name[base]!='/') --base;  // find last /
-        ++base;
-        if (base==0 && len>=2 && name[1]==':') base=2;  // chop "C:"
-        int expanded=expand(header_string, name.c_str(), base);
-        if (!expanded && (i>1||argc==2))
-          printf("%s: not found, skipping...\n", name.c_str());
-        files+=expanded;
-      }
-
-      // If there is at least one file to compress
-      // then create the archive header.
-      if (files<1) quit("Nothing to compress\n");
-      archive=fopen(archiveName.c_str(), "wb+");
-      if (!archive) perror(archiveName.c_str()), quit();
-      fprintf(archive, PROGNAME "%c%d", 0, level);
-      printf("Creating archive %s with %d file(s)...\n",
-        archiveName.c_str(), files);
-    }
-
-    // Decompress: open archive for reading and store file names and sizes
-    if (mode==DECOMPRESS) {
-      archive=fopen(archiveName.c_str(), "rb+");
-      if (!archive) perror(archiveName.c_str()), quit();
-
-      // Check for proper format and get option
-      String header;
-      int len=strlen(PROGNAME)+2, c, i=0;
-      header.resize(len+1);
-      while (i<len && (c=getc(archive))!=EOF) {
-        header[i]=c;
-        i++;
-      }
-      header[i]=0;
-      if (strncmp(header.c_str(), PROGNAME "\0", strlen(PROGNAME)+1))
-        printf("%s: not a %s file\n", archiveName.c_str(), PROGNAME), quit();
-      level=header[strlen(PROGNAME)+1]-'0';
-      if (level<0||level>8) level=DEFAULT_OPTION;
-    }
-
-    // Set globals according to option
-    assert(level>=0 && level<=8);
-    buf.setsize(MEM*8);
-    Encoder en(mode, archive);
-
-    // Compress header
-    if (mode==COMPRESS) {
-      int len=header_string.size();
-      printf("\nFile list (%ld bytes)\n", len);
-      assert(en.getMode()==COMPRESS);
-      long start=en.size();
-      en.compress(0); // block type 0
-      en.compress(len>>24); en.compress(len>>16); en.compress(len>>8); en.compress(len); // block length
-      for (int i=0; i<len; i++) en.compress(header_string[i]);
-      printf("Compressed from %ld to %ld bytes.\n",len,en.size()-start);
-    }
-
-    // Deompress header
-    if (mode==DECOMPRESS) {
-      if (en.decompress()!=0) printf("%s: header corrupted\n", archiveName.c_str()), quit();
-      int len=0;
-      len+=en.decompress()<<24;
-      len+=en.decompress()<<16;
-      len+=en.decompress()<<8;
-      len+=en.decompress();
-      header_string.resize(len);
-      for (int i=0; i<len; i++) {
-        header_string[i]=en.decompress();
-        if (header_string[i]=='\n') files++;
-      }
-      if (doList) printf("File list of %s archive:\n%s", archiveName.c_str(), header_string.c_str());
-    }
-
-    // Fill fname[files], fsize[files] with input filenames and sizes
-    fname.resize(files);
-    fsize.resize(files);
-    char *p=&header_string[0];
-    for (int i=0; i<files; ++i) {
-      assert(p);
-      fsize[i]=atol(p);
-      assert(fsize[i]>=0);
-      while (*p!='\t') ++p; *(p++)='\0';
-      fname[i]=p;
-      while (*p!='\n') ++p; *(p++)='\0';
-    }
-
-    // Compress or decompress files
-    assert(fname.size()==files);
-    assert(fsize.size()==files);
-    long total_size=0;  // sum of file sizes
-    for (int i=0; i<files; ++i) total_size+=fsize[i];
-    if (mode==COMPRESS) {
-      for (int i=0; i<files; ++i) {
-        printf("\n%d/%d  Filename: %s (%ld bytes)\n", i+1, files, fname[i], fsize[i]);
-        compress(fname[i], fsize[i], en);
-      }
-      en.flush();
-      printf("\nTotal %ld bytes compressed to %ld bytes.\n", total_size, en.size());
-    }
-
-    // Decompress files to dir2: paq8px -d dir1/archive.paq8px dir2
-    // If there is no dir2, then extract to dir1
-    // If there is no dir1, then extract to .
-    else if (!doList) {
-      assert(argc>=2);
-      String dir(argc>2?argv[2]:argv[1]);
-      if (argc==2) {  // chop "/archive.paq8px"
-        int i;
-        for (i=dir.size()-2; i>=0; --i) {
-          if (dir[i]=='/' || dir[i]=='\\') {
-            dir[i]=0;
-            break;
-          }
-          if (i==1 && dir[i]==':') {  // leave "C:"
-            dir[i+1]=0;
-            break;
-          }
-        }
-        if (i==-1) dir=".";  // "/" not found
-      }
-      dir=dir.c_str();
-      if (dir[0] && (dir.size()!=3 || dir[1]!=':')) dir+="/";
-      for (int i=0; i<files; ++i) {
-        String out(dir.c_str());
-        out+=fname[i];
-        decompress(out.c_str(), fsize[i], en);
-      }
-    }
-    fclose(archive);
-    if (!doList) programChecker.print();
-  }
-  catch(const char* s) {
-    if (s) printf("%s\n", s);
-  }
-  if (pause) {
-    printf("\nClose this window or press ENTER to continue...\n");
-    getchar();
-  }
-  return 0;
-}
+/* paq8px file compressor/archiver.  Release by Jan Ondrus, Jan. 18, 2010
+
+    Copyright (C) 2008 Matt Mahoney, Serge Osnach, Alexander Ratushnyak,
+    Bill Pettis, Przemyslaw Skibinski, Matthew Fite, wowtiger, Andrew Paterson,
+    Jan Ondrus, Andreas Morphis, Pavel L. Holoborodko, KZ., Simon Berger,
+    Neill Corlett
+
+    LICENSE
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of
+    the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details at
+    Visit <http://www.gnu.org/copyleft/gpl.html>.
+
+To install and use in Windows:
+
+- To install, put paq8px.exe or a shortcut to it on your desktop.
+- To compress a file or folder, drop it on the paq8px icon.
+- To decompress, drop a .paq8px file on the icon.
+
+A .paq8px extension is added for compression, removed for decompression.
+The output will go in the same folder as the input.
+
+While paq8px is working, a command window will appear and report
+progress.  When it is done you can close the window by pressing
+ENTER or clicking [X].
+
+
+COMMAND LINE INTERFACE
+
+- To install, put paq8px.exe somewhere in your PATH.
+- To compress:      paq8px [-N] [-tN] [-n] [-r] [-m bytes] [-p snapshot] file1 [file2...]
+- To decompress:    paq8px [-d] [-p snapshot] file1.paq8px [dir2] [files...]
+- To add files:     paq8px -a [-N] [-m bytes] [-p snapshot] file1.paq8px file2 [file3...]
+- To make a snapshot: paq8px -N [-m bytes] -P snapshot file1 [file2...]
+- To run a server:  paq8px -N -D socket [-tN] [-m bytes]
+- To view contents: more < file1.paq8px
+- To compress a pipe: paq8px -s [-N] [-m bytes] < file1 > file1.paq8px
+- To extract a pipe:  paq8px -s -d < file1.paq8px > file1
+
+The compressed output file is named by adding ".paq8px" extension to
+the first named file (file1.paq8px).  Each file that exists will be
+added to the archive and its name will be stored without a path.
+The option -N specifies a compression level ranging from -0
+(fastest) to -10 (smallest).  The default is -5.  Each level above -4
+doubles the memory, so -9 and -10 use about 4.5 and 8.9 GB and are only
+in 64-bit builds.  At -1 and above, about 1/8 of it (272 MB at -8) is
+the window of past input that long repeats are found in.  Small inputs
+use smaller tables than the level selects (4 KB uses about 60 MB at -8
+instead of 2.2 GB), since larger tables would not help.  If there is
+no option and only one file, then the program will pause when
+finished until you press the ENTER key (to support drag and drop).
+If file1.paq8px exists then it is overwritten.
+
+The option -tN (N = 1 to 255) compresses in parallel.  The input is
+cut into segments which are compressed independently by up to N
+threads at a time, each with its own model.  Each thread uses as much
+memory as the level alone, and compression is a little worse because
+each segment starts with an empty model.  Extraction runs in the same
+number of threads unless another -tN is given.
+
+The option -m bytes limits the memory used to compress to about that
+many bytes, in all threads together.  A suffix K, M or G multiplies
+the number by 1024, 1024*1024 or 1024*1024*1024, so -8 -m 2G compresses
+with all the models of -8 in 2 GB.  The tables are made smaller (by
+halves, as for small inputs) until they fit, which costs much less
+compression than a lower level would.  The tables cannot be smaller than
+those of 4 KB of input (about 60 MB per thread).  -m auto uses 7/8 of
+the memory limit of the cgroup of the process (as in a container) or of
+the physical memory if that is less.  The table size is stored in the
+archive, so extraction uses the same memory without -m.  -m does not
+change an archive that files are added to, or a snapshot given by -p.
+
+The option -n makes a non-solid archive.  The files are cut into
+segments at file boundaries (after at least 64 KB) and each segment is
+compressed with its own model, so that a file can be extracted by
+decoding only the segments holding it.  Compression is worse because
+the files do not share a model.  -n can be combined with -tN.  Segments
+are also cut every 256 MB.
+
+An archive made with -tN or -n is written one segment at a time.  If
+compression is interrupted, then running the same command with -r added
+keeps the segments that are finished and compresses the rest.  The
+files and options must be the same as before.
+
+A solid archive of 16 MB or more (made without -tN or -n) saves the
+whole state of the compressor every 30 minutes to archive.ck0 and
+archive.ck1 in turn.  If compression is interrupted, then running the
+same command with -r added continues from the last one: the files are
+read again up to that point, which is much faster than compressing
+them, and the rest is compressed as if there had been no interruption,
+so the archive is the same.  The files and options must be the same as
+before.  Each checkpoint file is about as large as the model (2.2 GB at
+-8), and the compressor uses about 10% more memory.  They are removed
+when compression finishes.
+
+The option -a adds files to an archive made with -a, and makes one
+(at level -N) if it does not exist.  Such an archive keeps the state of
+the model after its last file, so the new files are compressed by the
+model that learned from the old ones, almost as well as if they had
+been compressed with them, and only the new files are read.  The old
+files are copied without decoding them.  The state costs archive space,
+not memory: it grows with what the model has learned, from about 20 MB
+after a small file at -4 (25 MB at -6) to at most about the memory the
+level uses.  A lower level or -m keeps it smaller.  It is replaced by
+each -a, is only used by the same build of paq8px, and extraction
+skips it.
+
+The option -a also adds files to an archive made with -tN or -n.  Its
+state is not kept, so the new files are compressed as new segments
+starting from an empty model (or the snapshot of -p), about as well as
+a non-solid archive.  Files that are identical to one of the other new
+files are stored once, but not files identical to old ones.
+
+The option -P snapshot trains the model at level -N on the named files
+(a corpus of data like the data to be compressed later) and saves its
+tables in the file snapshot.  Then -p snapshot starts the model of each
+file list, file or segment from those tables instead of from empty
+ones, which compresses small files much better.  The level is that of
+the snapshot.  The archive holds a hash of the snapshot, and it can
+only be extracted (or added to) with -p and the same snapshot.  A
+snapshot is about as large as the memory the level uses.  In Unix its
+tables are mapped rather than read, so programs using the same snapshot
+at the same time share the memory of the parts they do not change.
+
+The option -D socket runs paq8px as a server for other programs (in
+Unix).  It listens on the Unix domain socket named socket and
+compresses or extracts what clients send in the -s format, in up to N
+threads at a time with -tN.  Each thread keeps its tables from one
+request to the next, so that a small request does not pay for starting
+a program and allocating memory.  See "Server" for the protocol.
+
+The option -s compresses standard input to standard output, and with
+-d extracts it again, so that paq8px can be used in a pipe.  The input
+is read 16 MB at a time and need not fit in memory or on disk.  Data
+is written as it is compressed.  A stream has no file names and cannot
+be extracted without -s.  Errors are reported on standard error.
+
+If the first named file ends in ".paq8px" then it is assumed to be
+an archive and the files within are extracted to the same directory
+as the archive unless a different directory (dir2) is specified.
+The -d option forces extraction even if there is not a ".paq8px"
+extension.  If any output file already exists, then it is compared
+with the archive content and the first byte that differs is reported.
+No files are overwritten or deleted.  If file names (or directory
+names) from the archive follow dir2, or follow the archive and the
+first of them is in the archive, then only those files are extracted.
+In a non-solid or -tN archive only the segments holding them (or the
+files they are copies of) are decoded.  Otherwise the files before
+them are decoded but not written.  If there is only one argument
+(no -d or dir2) then the program will pause when finished until
+you press ENTER.
+
+A file that is identical to an earlier file in the archive is stored
+only once.  On extraction it is copied from the earlier file if that was
+just extracted or compared identical, and otherwise from its data
+decoded to a temporary file.
+
+For compression, if any named file is actually a directory, then all
+files and subdirectories are compressed, preserving the directory
+structure, except that empty directories are not stored, and file
+attributes (timestamps, permissions, etc.) are not preserved.
+During extraction, directories are created as needed.  For example:
+
+  paq8px -4 c:\tmp\foo bar
+
+compresses foo and bar (if they exist) to c:\tmp\foo.paq8px at level 4.
+
+  paq8px -d c:\tmp\foo.paq8px .
+
+extracts foo and compares bar in the current directory.  If foo and bar
+are directories then their contents are extracted/compared.
+
+Files and archives of 2 GB or more need a 64-bit build (see TO COMPILE),
+except on Windows, where sizes are 32 bits.
+File names with nonprintable characters are not supported (spaces
+are OK).
+
+
+TO COMPILE
+
+There are 2 files: paq8px.cpp (C++) and paq7asm.asm (NASM/YASM).
+paq7asm.asm is the same as in paq7 and paq8x.  paq8px.cpp recognizes the
+following compiler options:
+
+  -DWINDOWS           (to compile in Windows)
+  -DUNIX              (to compile in Unix, Linux, Solairs, MacOS/Darwin, etc)
+  -DNOASM             (to replace paq7asm.asm with equivalent C++, and
+                       for 64-bit builds)
+  -DDEFAULT_OPTION=N  (to change the default compression level from 5 to N).
+  -DNOTHREADS         (to run -tN segments one at a time without threads)
+  -DNOAVX             (to not use AVX2/AVX-512 in the Mixer and ContextMap)
+  -DNOPREFETCH        (to not prefetch ContextMap buckets)
+  -DNOHUGEPAGES       (to not map large tables in huge pages in Linux)
+  -DMIXERSTATS        (to report x86 CPU cycles per bit in Mixer training)
+  -DPAQLIB            (to build a library with the interface in paq8px.h)
+  -DCMBENCH           (to build a ContextMap lookup benchmark instead)
+
+If you compile without -DWINDOWS or -DUNIX, you can still compress files,
+but you cannot compress directories or create them during extraction.
+You can extract directories if you manually create the empty directories
+first.
+
+Use -DEFAULT_OPTION=N to change the default compression level to support
+drag and drop on machines with less than 256 MB of memory.  Use
+-DDEFAULT_OPTION=4 for 128 MB, 3 for 64 MB, 2 for 32 MB, etc.
+
+Use -DNOASM for non x86-32 machines, or older than a Pentium-MMX (about
+1997), or if you don't have NASM or YASM to assemble paq7asm.asm.  The
+program will still work but it will be slower.  For NASM in Windows,
+use the options "--prefix _" and either "-f win32" or "-f obj" depending
+on your C++ compiler.  In Linux, use "-f elf".
+
+paq7asm.asm is 32-bit code, so a 64-bit build (which -9 and -10 need)
+uses -DNOASM.  On x86-64 the Mixer and ContextMap still use AVX2 or
+AVX-512 if the CPU has them.  "make BITS=64" builds all versions for
+x86-64, with paq7asm-x86_64.asm for the versions that have it.
+
+Recommended compiler commands and optimizations:
+
+  MINGW g++:
+    nasm paq7asm.asm -f win32 --prefix _
+    g++ paq8px.cpp -DWINDOWS -O2 -Os -s -march=pentiumpro -fomit-frame-pointer -o paq8px.exe paq7asm.obj
+
+  Borland:
+    nasm paq7asm.asm -f obj --prefix _
+    bcc32 -DWINDOWS -O -w-8027 paq8px.cpp paq7asm.obj
+
+  Mars:
+    nasm paq7asm.asm -f obj --prefix _
+    dmc -DWINDOWS -Ae -O paq8px.cpp paq7asm.obj
+
+  UNIX/Linux (PC):
+    nasm -f elf paq7asm.asm
+    g++ paq8px.cpp -DUNIX -O2 -Os -s -march=pentiumpro -fomit-frame-pointer -o paq8px paq7asm.o -lpthread
+
+  UNIX/Linux (x86-64):
+    g++ paq8px.cpp -DUNIX -DNOASM -O2 -s -fomit-frame-pointer -o paq8px -lpthread
+
+  Non PC (e.g. PowerPC under MacOS X)
+    g++ paq8px.cpp -O2 -DUNIX -DNOASM -s -o paq8px -lpthread
+
+With -DPAQLIB, main() is left out and the functions in paq8px.h compress
+and decompress buffers in memory.  The Makefile builds a static and a
+shared library this way.  A context keeps its memory between calls, so
+many small buffers can be compressed without starting a program or
+allocating the tables for each one.
+
+With -DCMBENCH, main() records the ContextMap hash table lookups made
+while compressing a file and replays them to time the lookup code
+("make bench" builds it).
+
+Threads need a C++11 compiler (for thread_local).  Use -DNOTHREADS with
+older compilers.
+
+With g++ on x86, the Mixer checks the CPU at startup and uses AVX2 or
+AVX-512BW if available (with or without -DNOASM).  The results are
+identical to the MMX and C++ versions, so archives are compatible.
+
+MinGW produces faster executables than Borland or Mars, but Intel 9
+is about 4% faster than MinGW).
+
+
+ARCHIVE FILE FORMAT
+
+An archive has the following format.  It is intended to be both
+human and machine readable.  The header ends with CTRL-Z (Windows EOF)
+so that the binary compressed data is not displayed on the screen.
+
+  paq8px -N CR LF
+  size TAB filename CR LF
+  size TAB filename CR LF
+  ...
+  CTRL-Z
+  compressed binary data
+
+-N is the option (-0 to -10), even if a default was used.
+Plain file names are stored without a path.  Files in compressed
+directories are stored with path relative to the compressed directory
+(using UNIX style forward slashes "/").  For example, given these files:
+
+  123 C:\dir1\file1.txt
+  456 C:\dir2\file2.txt
+
+Then
+
+  paq8px archive \dir1\file1.txt \dir2
+
+will create archive.paq8px with the header:
+
+  paq8px -5
+  123     file1.txt
+  456     dir2/file2.txt
+
+The command:
+
+  paq8px archive.paq8px C:\dir3
+
+will create the files:
+
+  C:\dir3\file1.txt
+  C:\dir3\dir2\file2.txt
+
+Decompression will fail if the first 7 bytes are not "paq8px -".  Sizes
+are stored as decimal numbers.  CR, LF, TAB, CTRL-Z are ASCII codes
+13, 10, 9, 26 respectively.
+
+The byte after "paq8px" holds flags: 1 if the archive was made with -tN,
+plus 2 if the tables are smaller than the level selects.  Then comes the
+level as a digit ('0'+level, so ':' for level 10).  If flag 2 is set, the next digit is the level used for
+table sizes, chosen from the total input size so that small inputs do
+not allocate (or clear) gigabytes of memory.  The decompressor uses the
+same sizes.  An archive with flags 0 can be read by older versions.
+
+Flag 16 is set if some files in the list are identical to an earlier
+file.  The size of such a file is followed by "=k", where k is the
+number of the first copy (counting from 1), as in:
+
+  123     file1.txt
+  123=1   dir2/copy.txt
+
+It is not in the compressed data, which holds only the files without "=".
+
+Flag 64 marks an archive made with a snapshot (-p).  The level digits
+are followed by the hash of the snapshot (4 bytes, big-endian), and
+every model whose tables have the level and table sizes of the
+snapshot starts from it.  Non-solid segments then use the table sizes
+of the snapshot.  See "Snapshot" for the snapshot file format.
+
+Flag 32 (with flag 1) marks a non-solid archive made with -n.  The
+file list is coded with the tables of level 0 and each segment with the
+tables memoryLevel() selects for its own size, at most those of the
+archive.  Segments are cut at file ends as described in "Segments".
+
+A stream made with -s has flag 4 and no file list.  After the level
+digit(s), the compressed data holds the input in pieces of up to 16 MB,
+each as its length (4 bytes, big-endian) followed by its blocks.  A
+length of 0 ends the stream.  The model is not reset between pieces.
+
+An archive made with -tN or -n (flag 1) continues with the compressed size of
+the file list (4 bytes, big-endian), and the compressed file list.  Then there is an index:
+N (1 byte), the number of segments (4 bytes), and for each segment its
+uncompressed and compressed size (4 bytes each).  A compressed size of
+0 means that the segment was not finished (see -r).  If the input is 2 GB
+or more, flag 128 is set and these sizes are 8 bytes each.  The segments follow,
+each coded from a fresh model.  The files are stored one after another
+across the segments, so a file may begin in one segment and end in
+another.
+
+Flag 8 (with flag 1, not with 32) marks an archive made with -a.  The
+file list is coded with the tables of level 0, N is 1, and there is a
+segment for the files the archive was made with and one for those of
+each -a, each ending at a file end.  Each segment is a separate
+arithmetic code, but they are coded one after another by the same model
+(and Dedup window), which is not reset between them.  After the last
+segment comes the state of the model after it, to continue from with
+-a, in a format that depends on the build.  It is not needed to extract.
+
+
+ARITHMETIC CODING
+
+The binary data is arithmetic coded as the shortest base 256 fixed point
+number x = SUM_i x_i 256^-1-i such that p(<y) <= x < p(<=y), where y is the
+input string, x_i is the i'th coded byte, p(<y) (and p(<=y)) means the
+probability that a string is lexicographcally less than (less than
+or equal to) y according to the model, _ denotes subscript, and ^ denotes
+exponentiation.
+
+The model p(y) for y is a conditional bit stream,
+p(y) = PROD_j p(y_j | y_0..j-1) where y_0..j-1 denotes the first j
+bits of y, and y_j is the next bit.  Compression depends almost entirely
+on the ability to predict the next bit accurately.
+
+
+MODEL MIXING
+
+paq8px uses a neural network to combine a large number of models.  The
+i'th model independently predicts
+p1_i = p(y_j = 1 | y_0..j-1), p0_i = 1 - p1_i.
+The network computes the next bit probabilty
+
+  p1 = squash(SUM_i w_i t_i), p0 = 1 - p1                        (1)
+
+where t_i = stretch(p1_i) is the i'th input, p1_i is the prediction of
+the i'th model, p1 is the output prediction, stretch(p) = ln(p/(1-p)),
+and squash(s) = 1/(1+exp(-s)).  Note that squash() and stretch() are
+inverses of each other.
+
+After bit y_j (0 or 1) is received, the network is trained:
+
+  w_i := w_i + eta t_i (y_j - p1)                                (2)
+
+where eta is an ad-hoc learning rate, t_i is the i'th input, (y_j - p1)
+is the prediction error for the j'th input but, and w_i is the i'th
+weight.  Note that this differs from back propagation:
+
+  w_i := w_i + eta t_i (y_j - p1) p0 p1                          (3)
+
+which is a gradient descent in weight space to minimize root mean square
+error.  Rather, the goal in compression is to minimize coding cost,
+which is -log(p0) if y = 1 or -log(p1) if y = 0.  Taking
+the partial derivative of cost with respect to w_i yields (2).
+
+
+MODELS
+
+Most models are context models.  A function of the context (last few
+bytes) is mapped by a lookup table or hash table to a state which depends
+on the bit history (prior sequence of 0 and 1 bits seen in this context).
+The bit history is then mapped to p1_i by a fixed or adaptive function.
+There are several types of bit history states:
+
+- Run Map. The state is (b,n) where b is the last bit seen (0 or 1) and
+  n is the number of consecutive times this value was seen.  The initial
+  state is (0,0).  The output is computed directly:
+
+    t_i = (2b - 1)K log(n + 1).
+
+  where K is ad-hoc, around 4 to 10.  When bit y_j is seen, the state
+  is updated:
+
+    (b,n) := (b,n+1) if y_j = b, else (y_j,1).
+
+- Stationary Map.  The state is p, initially 1/2.  The output is
+  t_i = stretch(p).  The state is updated at ad-hoc rate K (around 0.01):
+
+    p := p + K(y_j - p)
+
+- Nonstationary Map.  This is a compromise between a stationary map, which
+  assumes uniform statistics, and a run map, which adapts quickly by
+  discarding old statistics.  An 8 bit state represents (n0,n1,h), initially
+  (0,0,0) where:
+
+    n0 is the number of 0 bits seen "recently".
+    n1 is the number of 1 bits seen "recently".
+    n = n0 + n1.
+    h is the full bit history for 0 <= n <= 4,
+      the last bit seen (0 or 1) if 5 <= n <= 15,
+      0 for n >= 16.
+
+  The primaty output is t_i := stretch(sm(n0,n1,h)), where sm(.) is
+  a stationary map with K = 1/256, initialized to
+  sm(n0,n1,h) = (n1+(1/64))/(n+2/64).  Four additional inputs are also
+  be computed to improve compression slightly:
+
+    p1_i = sm(n0,n1,h)
+    p0_i = 1 - p1_i
+    t_i   := stretch(p_1)
+    t_i+1 := K1 (p1_i - p0_i)
+    t_i+2 := K2 stretch(p1) if n0 = 0, -K2 stretch(p1) if n1 = 0, else 0
+    t_i+3 := K3 (-p0_i if n1 = 0, p1_i if n0 = 0, else 0)
+    t_i+4 := K3 (-p0_i if n0 = 0, p1_i if n1 = 0, else 0)
+
+  where K1..K4 are ad-hoc constants.
+
+  h is updated as follows:
+    If n < 4, append y_j to h.
+    Else if n <= 16, set h := y_j.
+    Else h = 0.
+
+  The update rule is biased toward newer data in a way that allows
+  n0 or n1, but not both, to grow large by discarding counts of the
+  opposite bit.  Large counts are incremented probabilistically.
+  Specifically, when y_j = 0 then the update rule is:
+
+    n0 := n0 + 1, n < 29
+          n0 + 1 with probability 2^(27-n0)/2 else n0, 29 <= n0 < 41
+          n0, n = 41.
+    n1 := n1, n1 <= 5
+          round(8/3 lg n1), if n1 > 5
+
+  swapping (n0,n1) when y_j = 1.
+
+  Furthermore, to allow an 8 bit representation for (n0,n1,h), states
+  exceeding the following values of n0 or n1 are replaced with the
+  state with the closest ratio n0:n1 obtained by decrementing the
+  smaller count: (41,0,h), (40,1,h), (12,2,h), (5,3,h), (4,4,h),
+  (3,5,h), (2,12,h), (1,40,h), (0,41,h).  For example:
+  (12,2,1) 0-> (7,1,0) because there is no state (13,2,0).
+
+- Match Model.  The state is (c,b), initially (0,0), where c is 1 if
+  the context was previously seen, else 0, and b is the next bit in
+  this context.  The prediction is:
+
+    t_i := (2b - 1)Kc log(m + 1)
+
+  where m is the length of the context.  The update rule is c := 1,
+  b := y_j.  A match model can be implemented efficiently by storing
+  input in a buffer and storing pointers into the buffer into a hash
+  table indexed by context.  Then c is indicated by a hash table entry
+  and b can be retrieved from the buffer.
+
+
+CONTEXTS
+
+High compression is achieved by combining a large number of contexts.
+Most (not all) contexts start on a byte boundary and end on the bit
+immediately preceding the predicted bit.  The contexts below are
+modeled with both a run map and a nonstationary map unless indicated.
+
+- Order n.  The last n bytes, up to about 16.  For general purpose data.
+  Most of the compression occurs here for orders up to about 6.
+  An order 0 context includes only the 0-7 bits of the partially coded
+  byte and the number of these bits (255 possible values).
+
+- Sparse.  Usually 1 or 2 of the last 8 bytes preceding the byte containing
+  the predicted bit, e.g (2), (3),..., (8), (1,3), (1,4), (1,5), (1,6),
+  (2,3), (2,4), (3,6), (4,8).  The ordinary order 1 and 2 context, (1)
+  or (1,2) are included above.  Useful for binary data.
+
+- Text.  Contexts consists of whole words (a-z, converted to lower case
+  and skipping other values).  Contexts may be sparse, e.g (0,2) meaning
+  the current (partially coded) word and the second word preceding the
+  current one.  Useful contexts are (0), (0,1), (0,1,2), (0,2), (0,3),
+  (0,4).  The preceding byte may or may not be included as context in the
+  current word.
+
+- Formatted text.  The column number (determined by the position of
+  the last linefeed) is combined with other contexts: the charater to
+  the left and the character above it.
+
+- Fixed record length.  The record length is determined by searching for
+  byte sequences with a uniform stride length.  Once this is found, then
+  the record length is combined with the context of the bytes immediately
+  preceding it and the corresponding byte locations in the previous
+  one or two records (as with formatted text).
+
+- Context gap.  The distance to the previous occurrence of the order 1
+  or order 2 context is combined with other low order (1-2) contexts.
+
+- FAX.  For 2-level bitmapped images.  Contexts are the surrounding
+  pixels already seen.  Image width is assumed to be 1728 bits (as
+  in calgary/pic).
+
+- Image.  For uncompressed 24-bit color BMP, TIFF and TGA images.  Contexts
+  are the high order bits of the surrounding pixels and linear
+  combinations of those pixels, including other color planes.  The
+  image width is detected from the file header.  When an image is
+  detected, other models are turned off to improve speed.
+
+- JPEG.  Files are further compressed by partially uncompressing back
+  to the DCT coefficients to provide context for the next Huffman code.
+  Only baseline DCT-Huffman coded files are modeled.  (This ia about
+  90% of images, the others are usually progresssive coded).  JPEG images
+  embedded in other files (quite common) are detected by headers.  The
+  baseline JPEG coding process is:
+  - Convert to grayscale and 2 chroma colorspace.
+  - Sometimes downsample the chroma images 2:1 or 4:1 in X and/or Y.
+  - Divide each of the 3 images into 8x8 blocks.
+  - Convert using 2-D discrete cosine transform (DCT) to 64 12-bit signed
+    coefficients.
+  - Quantize the coefficients by integer division (lossy).
+  - Split the image into horizontal slices coded independently, separated
+    by restart codes.
+  - Scan each block starting with the DC (0,0) coefficient in zigzag order
+    to the (7,7) coefficient, interleaving the 3 color components in
+    order to scan the whole image left to right starting at the top.
+  - Subtract the previous DC component from the current in each color.
+  - Code the coefficients using RS codes, where R is a run of R zeros (0-15)
+    and S indicates 0-11 bits of a signed value to follow.  (There is a
+    special RS code (EOB) to indicate the rest of the 64 coefficients are 0).
+  - Huffman code the RS symbol, followed by S literal bits.
+  The most useful contexts are the current partially coded Huffman code
+  (including S following bits) combined with the coefficient position
+  (0-63), color (0-2), and last few RS codes.
+
+- Match.  When a context match of 400 bytes or longer is detected,
+  the next bit of the match is predicted and other models are turned
+  off to improve speed.
+
+- Exe.  When a x86 file (.exe, .obj, .dll) is detected, sparse contexts
+  with gaps of 1-12 selecting only the prefix, opcode, and the bits
+  of the modR/M byte that are relevant to parsing are selected.
+  This model is turned off otherwise.
+
+- Indirect.  The history of the last 1-3 bytes in the context of the
+  last 1-2 bytes is combined with this 1-2 byte context.
+
+- DMC. A bitwise n-th order context is built from a state machine using
+  DMC, described in http://plg.uwaterloo.ca/~ftp/dmc/dmc.c
+  The effect is to extend a single context, one bit at a time and predict
+  the next bit based on the history in this context.  The model here differs
+  in that two predictors are used.  One is a pair of counts as in the original
+  DMC.  The second predictor is a bit history state mapped adaptively to
+  a probability as as in a Nonstationary Map.
+
+ARCHITECTURE
+
+The context models are mixed by several of several hundred neural networks
+selected by a low-order context.  The outputs of these networks are
+combined using a second neural network, then fed through several stages of
+adaptive probability maps (APM) before arithmetic coding.
+
+For images, only one neural network is used and its context is fixed.
+
+An APM is a stationary map combining a context and an input probability.
+The input probability is stretched and divided into 32 segments to
+combine with other contexts.  The output is interpolated between two
+adjacent quantized values of stretch(p1).  There are 2 APM stages in series:
+
+  p1 := (p1 + 3 APM(order 0, p1)) / 4.
+  p1 := (APM(order 1, p1) + 2 APM(order 2, p1) + APM(order 3, p1)) / 4.
+
+PREPROCESSING
+
+paq8px uses preprocessing transforms on certain data types to improve
+compression.  To improve reliability, the decoding transform is
+tested during compression to ensure that the input file can be
+restored.  If the decoder output is not identical to the input file
+due to a bug, then the transform is abandoned and the data is compressed
+without a transform so that it will still decompress correctly.
+
+The input is split into blocks with the format <type> <decoded size> <data>
+where <type> is 1 byte (0 = no transform), <decoded size> is the size
+of the data after decoding, which may be different than the size of <data>.
+Blocks do not span file boundaries, and have a maximum size of 1 GB.
+Large files are split into blocks of this size.  The preprocessor has 3 parts:
+
+- Detector.  Splits the input into smaller blocks depending on data type.
+
+- Coder.  Input is a block to be compressed.  Output is a temporary
+  file.  The coder determines whether a transform is to be applied
+  based on file type, and if so, which one.  A coder may use lots
+  of resources (memory, time) and make multiple passes through the
+  input file.  The file type is stored (as one byte) during compression.
+
+- Decoder.  Performs the inverse transform of the coder.  It uses few
+  resorces (fast, low memory) and runs in a single pass (stream oriented).
+  It takes input either from a file or the arithmetic decoder.  Each call
+  to the decoder returns a single decoded byte.
+
+The following transforms are used:
+
+- EXE:  CALL (0xE8) and JMP (0xE9) address operands are converted from
+  relative to absolute address.  The transform is to replace the sequence
+  E8/E9 xx xx xx 00/FF by adding file offset modulo 2^25 (signed range,
+  little-endian format).  Data to transform is identified by trying the
+  transform and applying a crude compression test: testing whether the
+  byte following the E8/E8 (LSB of the address) occurred more recently
+  in the transformed data than the original and within 4KB 4 times in
+  a row.  The block ends when this does not happen for 4KB.
+
+- JPEG: detected by SOI and SOF and ending with EOI or any nondecodable
+  data.  No transform is applied.  The purpose is to separate images
+  embedded in execuables to block the EXE transform, and for a future
+  place to insert a transform.
+
+
+IMPLEMENTATION
+
+Hash tables are designed to minimize cache misses, which consume most
+of the CPU time.
+
+Most of the memory is used by the nonstationary context models.
+Contexts are represented by 32 bits, possibly a hash.  These are
+mapped to a bit history, represented by 1 byte.  The hash table is
+organized into 64-byte buckets on cache line boundaries.  Each bucket
+contains 7 x 7 bit histories, 7 16-bit checksums, and a 2 element LRU
+queue packed into one byte.  Each 7 byte element represents 7 histories
+for a context ending on a 3-bit boundary plus 0-2 more bits.  One
+element (for bits 0-1, which have 4 unused bytes) also contains a run model
+consisting of the last byte seen and a count (as 1 byte each).
+
+Run models use 4 byte hash elements consisting of a 2 byte checksum, a
+repeat count (0-255) and the byte value.  The count also serves as
+a priority.
+
+Stationary models are most appropriate for small contexts, so the
+context is used as a direct table lookup without hashing.
+
+The match model maintains a pointer to the last match until a mismatching
+bit is found.  At the start of the next byte, the hash table is referenced
+to find another match.  The hash table of pointers is updated after each
+whole byte.  There is no checksum.  Collisions are detected by comparing
+the current and matched context in a rotating buffer.
+
+The inner loops of the neural network prediction (1) and training (2)
+algorithms are implemented in MMX assembler, which computes 4 elements
+at a time.  Using assembler is 8 times faster than C++ for this code
+and 1/3 faster overall.  (However I found that SSE2 code on an AMD-64,
+which computes 8 elements at a time, is not any faster).
+
+
+DIFFERENCES FROM PAQ7
+
+An .exe model and filter are added.  Context maps are improved using 16-bit
+checksums to reduce collisions.  The state table uses probabilistic updates
+for large counts, more states that remember the last bit, and decreased
+discounting of the opposite count.  It is implemented as a fixed table.
+There are also many minor changes.
+
+DIFFERENCES FROM PAQ8A
+
+The user interface supports directory compression and drag and drop.
+The preprocessor segments the input into blocks and uses more robust
+EXE detection.  An indirect context model was added.  There is no
+dictionary preprocesor like PAQ8B/C/D/E.
+
+DIFFERENCES FROM PAQ8F
+
+Different models, usually from paq8hp*. Also changed rate from 8 to 7. A bug
+in Array was fixed that caused the program to silently crash upon exit.
+
+DIFFERENCES FROM PAQ8J
+
+1) Slightly improved sparse model.
+2) Added new family of sparse contexts. Each byte mapped to 3-bit value, where
+different values corresponds to different byte classes. For example, input
+byte 0x00 transformed into 0, all bytes that less then 16 -- into 5, all
+punctuation marks (ispunct(c)!=0) -- into 2 etc. Then this flags from 11
+previous bytes combined into 32-bit pseudo-context.
+
+All this improvements gives only 62 byte on BOOK1, but on binaries archive size
+reduced on 1-2%.
+
+DIFFERENCES FROM PAQ8JA
+
+Introduced distance model. Distance model uses distance to last occurence
+of some anchor char (0x00, space, newline, 0xff), combined with previous
+charactes as context. This slightly improves compression of files with
+variable-width record data.
+
+DIFFERENCES FROM PAQ8JB
+
+Restored recordModel(), broken in paq8hp*. Slightly tuned indirectModel().
+
+DIFFERENCES FROM PAQ8JC
+
+Changed the APMs in the Predictor. Up to a 0.2% improvement for some files.
+
+DIFFERENCES FROM PAQ8JD
+
+Added DMCModel.  Removed some redundant models from SparseModel and other
+minor tuneups.  Changes introduced in PAQ8K were not carried over.
+
+PAQ8L v.2
+
+Changed Mixer::p() to p() to fix a compiler error in Linux
+(patched by Indrek Kruusa, Apr. 15, 2007).
+
+DIFFERENCES FROM PAQ8L, PAQ8M
+
+Modified JPEG model by Jan Ondrus (paq8fthis2).  The new model improves
+compression by using decoded pixel values of current and adjacent blocks
+as context.  PAQ8M was an earlier version of the new JPEG model
+(from paq8fthis).
+
+DIFFERENCES FROM PAQ8N
+
+Improved bmp model. Slightly faster.
+
+DIFFERENCES FROM PAQ8O
+
+Modified JPEG model by Jan Ondrus (paq8fthis4).
+Added PGM (grayscale image) model form PAQ8I.
+Added grayscale BMP model to PGM model.
+Ver. 2 can be compiled using either old or new "for" loop scoping rules.
+Added APM and StateMap from LPAQ1
+Code optimizations from Enrico Zeidler
+Detection of BMP 4,8,24 bit and PGM 8 bit images before compress
+On non BMP,PGM,JPEG data mem is lower
+Fixed bug in BMP 8-bit detection in other files like .exe
+15. oct 2007
+Updates JPEG model by Jan Ondrus
+PGM detection bug fix
+22. oct 2007
+improved JPEG model by Jan Ondrus
+16. feb 2008
+fixed bmp detection bug
+added .rgb file support (uncompressed grayscale)
+
+DIFFERENCES FROM PAQ8O9
+
+Added wav Model. Slightly improved bmp model.
+
+DIFFERENCES FROM PAQ8P
+
+Added nestModel from paq8p3
+Modified wordModel from paq8p3
+Modified .pbm, .pgm, .ppm, .bmp, .rgb detection (from paq8p3)
+Modified WAV model (from paq8p_)
+Modified JPEG model (from paq8p2)
+Added im1bitModel (1-bit) (from paq8p3)
+Added compression of PPM, PBM images (from paq8p3)
+Removed pic model
+Modified EXE transformation (e8/e9)
+Changed image and audio data handling (separated in blocks)
+Added compression of (8-bit, 24-bit) TGA image data
+Improved TIFF image detection
+*/
+
+#define PROGNAME "paq8px"  // Please change this if you change the program.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <ctype.h>
+#define NDEBUG  // remove for debugging (turns on Array bound checks)
+#include <assert.h>
+
+#ifdef UNIX
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifdef WINDOWS
+#include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+#if !defined(UNIX) && !defined(WINDOWS)
+#define NOTHREADS
+#endif
+
+#if defined(UNIX) && !defined(NOTHREADS)
+#include <pthread.h>
+#endif
+
+#ifndef DEFAULT_OPTION
+#define DEFAULT_OPTION 5
+#endif
+
+// prefetch(p) hints that the cache line at p will be read soon.
+// Compile with -DNOPREFETCH to turn it off.
+#if defined(__GNUC__) && !defined(NOPREFETCH)
+#define prefetch(p) __builtin_prefetch(p)
+#else
+#define prefetch(p)
+#endif
+
+// Thread local storage.  Each thread running a Predictor keeps its own
+// copy of the global context.
+#ifdef NOTHREADS
+#define TLS
+#else
+#define TLS thread_local
+#endif
+
+// 8, 16, 32 bit unsigned types (adjust as appropriate)
+typedef unsigned char  U8;
+typedef unsigned short U16;
+typedef unsigned int   U32;
+typedef unsigned long long U64;
+
+// min, max functions
+#ifndef WINDOWS
+inline int min(int a, int b) {return a<b?a:b;}
+inline int max(int a, int b) {return a<b?b:a;}
+#endif
+
+// Error handler: print message if any, and exit
+void quit(const char* message=0) {
+  throw message;
+}
+
+// strings are equal ignoring case?
+int equals(const char* a, const char* b) {
+  assert(a && b);
+  while (*a && *b) {
+    int c1=*a;
+    if (c1>='A'&&c1<='Z') c1+='a'-'A';
+    int c2=*b;
+    if (c2>='A'&&c2<='Z') c2+='a'-'A';
+    if (c1!=c2) return 0;
+    ++a;
+    ++b;
+  }
+  return *a==*b;
+}
+
+//////////////////////////// Thread ////////////////////////////
+
+// Thread t(f, arg); runs f(arg) concurrently.  t.join() waits for it
+// to finish.  With NOTHREADS, f(arg) is run by join() instead.
+// Mutex mx; mx.lock() and mx.unlock() guard data shared by threads.
+
+#ifdef NOTHREADS
+
+class Thread {
+  void (*f)(void*);
+  void* arg;
+public:
+  Thread(void (*fn)(void*), void* a): f(fn), arg(a) {}
+  void join() {if (f) f(arg), f=0;}
+};
+
+class Mutex {
+public:
+  void lock() {}
+  void unlock() {}
+};
+
+#else
+#ifdef WINDOWS
+
+class Thread {
+  void (*f)(void*);
+  void* arg;
+  HANDLE h;
+  static DWORD WINAPI run(LPVOID t) {
+    ((Thread*)t)->f(((Thread*)t)->arg);
+    return 0;
+  }
+public:
+  Thread(void (*fn)(void*), void* a): f(fn), arg(a) {
+    h=CreateThread(0, 0, run, this, 0, 0);
+    if (!h) f(arg);  // run it here if out of threads
+  }
+  void join() {if (h) WaitForSingleObject(h, INFINITE), CloseHandle(h), h=0;}
+};
+
+class Mutex {
+  CRITICAL_SECTION cs;
+public:
+  Mutex() {InitializeCriticalSection(&cs);}
+  ~Mutex() {DeleteCriticalSection(&cs);}
+  void lock() {EnterCriticalSection(&cs);}
+  void unlock() {LeaveCriticalSection(&cs);}
+};
+
+#else  // UNIX
+
+class Thread {
+  void (*f)(void*);
+  void* arg;
+  pthread_t tid;
+  bool running;
+  static void* run(void* t) {
+    ((Thread*)t)->f(((Thread*)t)->arg);
+    return 0;
+  }
+public:
+  Thread(void (*fn)(void*), void* a): f(fn), arg(a) {
+    running=pthread_create(&tid, 0, run, this)==0;
+    if (!running) f(arg);  // run it here if out of threads
+  }
+  void join() {if (running) pthread_join(tid, 0), running=false;}
+};
+
+class Mutex {
+  pthread_mutex_t mx;
+public:
+  Mutex() {pthread_mutex_init(&mx, 0);}
+  ~Mutex() {pthread_mutex_destroy(&mx);}
+  void lock() {pthread_mutex_lock(&mx);}
+  void unlock() {pthread_mutex_unlock(&mx);}
+};
+
+#endif
+#endif
+
+//////////////////////// Program Checker /////////////////////
+
+// How a large table was allocated
+enum {HUGE_NONE, HUGE_THP, HUGE_TLB};
+
+#ifdef MIXERSTATS
+// Cost of Mixer training, counted by each thread and reported by
+// ProgramChecker when the Predictor is destroyed.
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+struct MixerStats {
+  U64 cycles;  // CPU cycles in Mixer::update()
+  U64 bits;    // bits coded
+  U64 rows, skipped;  // weight sets to train, of which err was 0
+};
+TLS MixerStats mixerStats;
+#endif
+
+// Track time and memory used
+class ProgramChecker {
+  double memused;  // bytes allocated by Array<T> now
+  double maxmem;   // most bytes allocated ever
+  clock_t start_time;  // in ticks
+  Mutex mx;     // Arrays may be allocated by several threads
+  int pages[3], pagemem[3];  // large tables, MB by page type
+#ifdef MIXERSTATS
+  MixerStats stats;  // totals of all threads
+#endif
+public:
+  void alloc(double n) {  // report memory allocated, may be negative
+    mx.lock();
+    memused+=n;
+    if (memused>maxmem) maxmem=memused;
+    mx.unlock();
+  }
+#ifdef MIXERSTATS
+  void add(MixerStats& s) {  // add and clear counts of a thread
+    mx.lock();
+    stats.cycles+=s.cycles, stats.bits+=s.bits;
+    stats.rows+=s.rows, stats.skipped+=s.skipped;
+    mx.unlock();
+    memset(&s, 0, sizeof(s));
+  }
+#endif
+  void large(int type, size_t n) {  // report a large table of n bytes
+    mx.lock();
+    ++pages[type], pagemem[type]+=n>>20;
+    mx.unlock();
+  }
+  ProgramChecker(): memused(0), maxmem(0) {
+    start_time=clock();
+    memset(pages, 0, sizeof(pages));
+    memset(pagemem, 0, sizeof(pagemem));
+#ifdef MIXERSTATS
+    memset(&stats, 0, sizeof(stats));
+#endif
+    assert(sizeof(U8)==1);
+    assert(sizeof(U16)==2);
+    assert(sizeof(U32)==4);
+    assert(sizeof(short)==2);
+    assert(sizeof(int)==4);
+  }
+  void print() const {  // print time and memory used
+    printf("Time %1.2f sec, used %1.0f bytes of memory\n",
+      double(clock()-start_time)/CLOCKS_PER_SEC, maxmem);
+    if (pages[0]+pages[1]+pages[2])
+      printf("Large tables: %d (%d MB) in huge pages, %d (%d MB) "
+        "transparent huge pages, %d (%d MB) normal pages\n",
+        pages[HUGE_TLB], pagemem[HUGE_TLB], pages[HUGE_THP],
+        pagemem[HUGE_THP], pages[HUGE_NONE], pagemem[HUGE_NONE]);
+#ifdef MIXERSTATS
+    if (stats.bits)
+      printf("Mixer training %1.0f cycles/bit, skipped %1.1f%% of %1.0f "
+        "weight sets\n", double(stats.cycles)/stats.bits,
+        100.0*stats.skipped/(stats.rows+1), double(stats.rows));
+#endif
+  }
+} programChecker;
+
+//////////////////////////// Array ////////////////////////////
+
+// allocate(n, mapped) returns n bytes of zeroed memory or 0 if out of
+// memory.  Blocks of at least 2 MB are mapped in huge pages (1 GB pages
+// for 1 GB or more) if the system has them reserved, else with a hint to
+// use transparent huge pages.  This reduces TLB misses in the big hash
+// tables.  mapped is set to the length to unmap, or 0 if the memory is
+// from calloc().  release(p, n, mapped) frees it.  Compile with
+// -DNOHUGEPAGES to always use calloc().
+//
+// While a BlockCache is active in a thread (blockCache points to it),
+// release() keeps blocks of at least CACHEMIN bytes in it instead of
+// freeing them, and allocate() clears and returns a kept block of the
+// same size if there is one.  This lets the library (-DPAQLIB) and the
+// server (-D) create a new Predictor for each job without allocating its
+// tables again.  A mapped block of at least DROPMIN bytes is cleared by
+// giving its pages back to the system (madvise(MADV_DONTNEED)), which
+// maps them to zero pages again as they are touched, so the next job
+// only pays for the pages it uses instead of a memset() of the whole
+// table.  Smaller blocks are cleared with memset(), since the models
+// fill most of them when they start anyway, and faulting the pages in
+// again would cost more.  (Blocks mapped from a Snapshot would read back
+// as the file, so a BlockCache is not used with a snapshot.)
+// trim() frees the blocks that were not reused since the last trim(),
+// so the cache holds about one Predictor.
+
+void freeMemory(void* p, size_t mapped);
+const size_t DROPMIN=1<<24;
+
+class BlockCache {
+  struct Block {
+    void* p;
+    size_t n, mapped;
+    bool fresh;  // released since the last trim()?
+    Block* next;
+  };
+  Block* list;
+public:
+  BlockCache(): list(0) {}
+  ~BlockCache() {trim(), trim();}
+  void* take(size_t n, size_t& mapped) {  // a cleared block, or 0
+    for (Block** b=&list; *b; b=&(*b)->next) {
+      if ((*b)->n==n) {
+        Block* t=*b;
+        void* p=t->p;
+        mapped=t->mapped;
+        *b=t->next;
+        free(t);
+#ifdef MADV_DONTNEED
+        if (mapped && n>=DROPMIN && madvise(p, mapped, MADV_DONTNEED)==0)
+          return p;
+#endif
+        return memset(p, 0, n);
+      }
+    }
+    return 0;
+  }
+  bool put(void* p, size_t n, size_t mapped) {  // keep p, false if not
+    Block* b=(Block*)malloc(sizeof(Block));
+    if (!b) return false;
+    b->p=p, b->n=n, b->mapped=mapped, b->fresh=true, b->next=list;
+    list=b;
+    return true;
+  }
+  void trim() {
+    for (Block** b=&list; *b;) {
+      Block* t=*b;
+      if (t->fresh) t->fresh=false, b=&t->next;
+      else *b=t->next, freeMemory(t->p, t->mapped), free(t);
+    }
+  }
+};
+
+TLS BlockCache* blockCache=0;
+const size_t CACHEMIN=1<<16;
+
+#if defined(UNIX) && defined(MAP_ANONYMOUS) && !defined(NOHUGEPAGES)
+#define HUGEPAGES
+#endif
+
+void* allocate(size_t n, size_t& mapped) {
+  mapped=0;
+  if (blockCache && n>=CACHEMIN) {
+    void* p=blockCache->take(n, mapped);
+    if (p) return p;
+  }
+#ifdef HUGEPAGES
+  const size_t HUGE=1<<21;
+  if (n>=HUGE) {
+    void* p=MAP_FAILED;
+    int type=HUGE_NONE;
+#ifdef MAP_HUGETLB
+#ifdef MAP_HUGE_1GB
+    const size_t GIANT=size_t(1)<<30;
+    if (n>=GIANT) {
+      mapped=(n+GIANT-1)&~(GIANT-1);
+      p=mmap(0, mapped, PROT_READ|PROT_WRITE,
+        MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB|MAP_HUGE_1GB, -1, 0);
+    }
+#endif
+    if (p==MAP_FAILED) {
+      mapped=(n+HUGE-1)&~(HUGE-1);
+      p=mmap(0, mapped, PROT_READ|PROT_WRITE,
+        MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+    }
+    if (p!=MAP_FAILED) type=HUGE_TLB;
+#endif
+    if (p==MAP_FAILED) {
+      mapped=(n+HUGE-1)&~(HUGE-1);
+      p=mmap(0, mapped, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS,
+        -1, 0);
+#ifdef MADV_HUGEPAGE
+      if (p!=MAP_FAILED && madvise(p, mapped, MADV_HUGEPAGE)==0)
+        type=HUGE_THP;
+#endif
+    }
+    if (p!=MAP_FAILED) {
+      programChecker.large(type, n);
+      return p;
+    }
+    mapped=0;
+  }
+#endif
+  return calloc(n, 1);
+}
+
+void release(void* p, size_t n, size_t mapped) {
+  if (blockCache && n>=CACHEMIN && blockCache->put(p, n, mapped)) return;
+  freeMemory(p, mapped);
+}
+
+void freeMemory(void* p, size_t mapped) {
+#ifdef UNIX
+  if (mapped) {
+    munmap(p, mapped);
+    return;
+  }
+#endif
+  free(p);
+}
+
+// While a Predictor is being created in a thread, recording points to a
+// Tables (see Snapshot) and recordTable(p, n, adopted) lists each Array
+// of n bytes at p created in that thread, except Arrays of pointers.
+// Before that, adoptTable(n, mapped) may return the memory for it mapped
+// from the snapshot file (setting mapped as allocate() does), or 0.
+
+class Tables;
+TLS Tables* recording=0;
+void recordTable(void* p, size_t n, bool adopted);
+void* adoptTable(size_t n, size_t& mapped);
+
+template <class T> struct IsPointer {enum {value=0};};
+template <class T> struct IsPointer<T*> {enum {value=1};};
+
+// Array<T, ALIGN> a(n); creates n elements of T initialized to 0 bits.
+// Constructors for T are not called.
+// Indexing is bounds checked if assertions are on.
+// While a Predictor is created, the memory may be mapped from a Snapshot.
+// a.size() returns n.
+// a.resize(n) changes size to n, padding with 0 bits or truncating.
+// a.push_back(x) appends x and increases size by 1, reserving up to size*2.
+// a.pop_back() decreases size by 1, does not free memory.
+// Copy and assignment are not supported.
+// Memory is aligned on a ALIGN byte boundary (power of 2), default is none.
+
+template <class T, int ALIGN=0> class Array {
+private:
+  size_t n;     // user size
+  size_t reserved;  // actual size
+  char *ptr; // allocated memory, zeroed
+  size_t mapped;  // length of ptr if from mmap, else 0
+  T* data;   // start of n elements of aligned data
+  void create(size_t i);  // create with size i
+public:
+  explicit Array(size_t i=0) {create(i);}
+  ~Array();
+  T& operator[](size_t i) {
+#ifndef NDEBUG
+    if (i>=n) fprintf(stderr, "%ld out of bounds %lu\n", long(i), (unsigned long)n), quit();
+#endif
+    return data[i];
+  }
+  const T& operator[](size_t i) const {
+#ifndef NDEBUG
+    if (i>=n) fprintf(stderr, "%ld out of bounds %lu\n", long(i), (unsigned long)n), quit();
+#endif
+    return data[i];
+  }
+  size_t size() const {return n;}
+  void resize(size_t i);  // change size to i
+  void pop_back() {if (n>0) --n;}  // decrement size
+  void push_back(const T& x);  // increment size, append x
+private:
+  Array(const Array&);  // no copy or assignment
+  Array& operator=(const Array&);
+};
+
+template<class T, int ALIGN> void Array<T, ALIGN>::resize(size_t i) {
+  if (i<=reserved) {
+    n=i;
+    return;
+  }
+  char *saveptr=ptr;
+  size_t savemapped=mapped;
+  T *savedata=data;
+  size_t saven=n, savereserved=reserved;
+  create(i);
+  if (saveptr) {
+    if (savedata) {
+      memcpy(data, savedata, sizeof(T)*(i<saven ? i : saven));
+      programChecker.alloc(-double(ALIGN+n*sizeof(T)));
+    }
+    release(saveptr, ALIGN+savereserved*sizeof(T), savemapped);
+  }
+}
+
+template<class T, int ALIGN> void Array<T, ALIGN>::create(size_t i) {
+  n=reserved=i;
+  mapped=0;
+  if (i==0) {
+    data=0;
+    ptr=0;
+    return;
+  }
+  const size_t sz=ALIGN+n*sizeof(T);
+  programChecker.alloc(sz);
+  const bool table=recording && !IsPointer<T>::value;  // of a Predictor
+  ptr = table ? (char*)adoptTable(n*sizeof(T), mapped) : 0;
+  if (ptr) {  // page aligned
+    data=(T*)ptr;
+    recordTable(data, n*sizeof(T), true);
+    return;
+  }
+  ptr = (char*)allocate(sz, mapped);
+  if (!ptr) quit("Out of memory");
+  data = (ALIGN ? (T*)(ptr+ALIGN-(((size_t)ptr)&(ALIGN-1))) : (T*)ptr);
+  assert((char*)data>=ptr && (char*)data<=ptr+ALIGN);
+  if (table) recordTable(data, n*sizeof(T), false);
+}
+
+template<class T, int ALIGN> Array<T, ALIGN>::~Array() {
+  programChecker.alloc(-double(ALIGN+n*sizeof(T)));
+  if (ptr) release(ptr, ALIGN+reserved*sizeof(T), mapped);
+}
+
+template<class T, int ALIGN> void Array<T, ALIGN>::push_back(const T& x) {
+  if (n==reserved) {
+    size_t saven=n;
+    resize(n ? n*2 : 1);
+    n=saven;
+  }
+  data[n++]=x;
+}
+
+//////////////////////////// Tables ////////////////////////////
+
+// Tables lists the Arrays of a Predictor (in the order they are created)
+// so that a Snapshot can save or restore them.  If priming() or savable
+// then a Tables starts recording (for the calling thread) when it is
+// created, so it must be created before the Arrays.  stop() ends
+// recording.  add(p, n, adopted) adds n bytes at p, mapped from the
+// snapshot if adopted.  size() is the number of tables, and data(i),
+// bytes(i) and adopted(i) give table i.
+
+bool priming();  // is a Snapshot made or used? (see Snapshot)
+TLS bool savable=false;  // will the state of the next Predictor be
+  // saved or restored? (see State)
+
+class Tables {
+  struct Table {
+    U8* p;
+    size_t n;
+    bool adopted;
+  };
+  Array<Table> t;
+public:
+  Tables() {if (priming() || savable) recording=this;}
+  void stop() {if (recording==this) recording=0;}
+  void add(void* p, size_t n, bool adopted=false) {
+    Tables* r=recording;
+    recording=0;  // t does not list itself
+    Table x={(U8*)p, n, adopted};
+    t.push_back(x);
+    recording=r;
+  }
+  int size() const {return t.size();}
+  U8* data(int i) const {return t[i].p;}
+  size_t bytes(int i) const {return t[i].n;}
+  bool adopted(int i) const {return t[i].adopted;}
+};
+
+void recordTable(void* p, size_t n, bool adopted) {
+  recording->add(p, n, adopted);
+}
+
+//////////////////////////// State ////////////////////////////
+
+// The state of a Predictor is its tables (see Tables) and the values its
+// models keep in their members and in the global context: contexts,
+// counters, positions, and pointers into the tables.  A State saves or
+// restores the second part.  Each model has a method state(s) that
+// passes each such member x to s(x) and each pointer p into a table to
+// s.ptr(p), in the same order when saving and restoring.  s(x) copies
+// the bytes of x (a number, an array of them or a struct of them).  A
+// pointer is stored as the number of its table and the offset in it, so
+// it can be restored in another Predictor with the same tables.
+// s.array(a) copies the elements of an Array that is not a table.
+// s.packed(p, n) copies the n bytes at p packed by LZ77: runs of bytes
+// that repeat bytes just before them at p (long runs of 0 and the patterns
+// the tables start with) are copied as their length and distance, and
+// only the other bytes as they are, so that mostly what the models have
+// learned takes space.  s.tables() copies the sizes of the tables and the
+// tables that way.
+//
+// State(t, f, save) saves to f if save, else it restores from f, with t
+// listing the tables.  sum() is a hash of the bytes copied so far.
+// Numbers are in the byte order of the machine, so a saved state is
+// only restored by the same build of the program.
+
+class State {
+  const Tables& t;
+  FILE* f;
+  const bool saving;
+  U32 h;  // FNV-1a hash of the bytes copied
+  Array<U32> last;  // hash of 4 bytes -> 1 + last position, for packed()
+  void io(void* p, size_t n);
+  void number(U32& x);
+public:
+  State(const Tables& tables, FILE* file, bool save):
+    t(tables), f(file), saving(save), h(2166136261u) {}
+  U32 sum() const {return h;}
+  template <class T> void operator()(T& x) {io(&x, sizeof(x));}
+  template <class T> void ptr(T*& p);
+  template <class T, int A> void ptrs(Array<T*, A>& a) {
+    for (size_t i=0; i<a.size(); ++i) ptr(a[i]);
+  }
+  template <class T, int A> void array(Array<T, A>& a) {
+    if (a.size()) io(&a[0], a.size()*sizeof(T));
+  }
+  void packed(void* p, size_t n);
+  void tables();
+};
+
+void State::io(void* p, size_t n) {
+  if (saving ? fwrite(p, 1, n, f)!=n : fread(p, 1, n, f)!=n)
+    quit(saving ? "write error" : "saved state truncated");
+  for (size_t i=0; i<n; ++i) h=(h^((U8*)p)[i])*16777619;
+}
+
+// Copy x as 1 to 5 bytes of 7 bits, low bits first, with the high bit
+// set in all but the last
+void State::number(U32& x) {
+  U8 b;
+  if (saving) {
+    for (U32 v=x; ; v>>=7) {
+      b=v>127 ? (v&127)|128 : v;
+      io(&b, 1);
+      if (b<128) return;
+    }
+  }
+  x=0;
+  for (int i=0; i<35; i+=7) {
+    io(&b, 1);
+    x|=U32(b&127)<<i;
+    if (b<128) return;
+  }
+  quit("saved state corrupted");
+}
+
+// Each match is copied as: the number of bytes before it since the last
+// match, those bytes, its length and its distance, or 0 for the distance
+// of the last match.  A length of 0 ends the copy.
+void State::packed(void* p, size_t n) {
+  const U32 MINLEN=8;  // shortest match
+  U8* q=(U8*)p;
+  U32 k, len, dist, d=0;  // literals, match, distance of the last match
+  if (saving) {
+    if (!last.size()) last.resize(1<<16);
+    memset(&last[0], 0, last.size()*sizeof(U32));
+    size_t i=0, lit=0;  // position, first literal
+    while (i+MINLEN<=n) {
+      U32 x;
+      memcpy(&x, q+i, 4);
+      U32& e=last[x*2654435761u>>16];
+      const U32 c[2]={d, e ? U32(i+1-e) : 0};  // distances to try
+      e=U32(i+1);
+      len=0, dist=0;
+      for (int j=0; j<2; ++j) {
+        if (!c[j] || c[j]>i) continue;
+        size_t l=0;
+        while (i+l<n && q[i+l]==q[i+l-c[j]]) ++l;
+        if (l>len) len=U32(l), dist=c[j];
+      }
+      if (len<MINLEN) {++i; continue;}
+      k=U32(i-lit);
+      number(k);
+      io(q+lit, k);
+      number(len);
+      U32 t=dist==d ? 0 : dist;
+      number(t);
+      d=dist, i+=len, lit=i;
+    }
+    k=U32(n-lit), len=0;
+    number(k);
+    io(q+lit, k);
+    number(len);
+    return;
+  }
+  for (size_t i=0; ; i+=len) {
+    number(k);
+    if (k>n-i) quit("saved state corrupted");
+    io(q+i, k);
+    i+=k;
+    number(len);
+    if (!len) {
+      if (i!=n) quit("saved state corrupted");
+      return;
+    }
+    number(dist);
+    if (dist) d=dist;
+    if (!d || d>i || len>n-i) quit("saved state corrupted");
+    for (size_t j=i; j<i+len; ++j) q[j]=q[j-d];
+  }
+}
+
+void State::tables() {
+  U32 n=t.size();
+  (*this)(n);
+  if (!saving && n!=U32(t.size())) quit("state saved by another version");
+  for (int i=0; i<t.size(); ++i) {
+    U32 k=t.bytes(i);
+    (*this)(k);
+    if (!saving && k!=t.bytes(i)) quit("state saved by another version");
+  }
+  for (int i=0; i<t.size(); ++i) packed(t.data(i), t.bytes(i));
+}
+
+template <class T> void State::ptr(T*& p) {
+  U32 x[2]={~0u, 0};  // table, offset, or ~0 if p is 0
+  if (saving && p) {
+    for (int i=0; i<t.size() && x[0]==~0u; ++i)
+      if ((U8*)p>=t.data(i) && (U8*)p<t.data(i)+t.bytes(i))
+        x[0]=i, x[1]=U32((U8*)p-t.data(i));
+    if (x[0]==~0u) quit("pointer outside the tables");
+  }
+  (*this)(x);
+  if (saving) return;
+  if (x[0]==~0u) p=0;
+  else if (x[0]<U32(t.size()) && x[1]<t.bytes(x[0]))
+    p=(T*)(t.data(x[0])+x[1]);
+  else quit("saved state corrupted");
+}
+
+/////////////////////////// String /////////////////////////////
+
+// A tiny subset of std::string
+// size() includes NUL terminator.
+
+class String: public Array<char> {
+public:
+  const char* c_str() const {return &(*this)[0];}
+  void operator=(const char* s) {
+    resize(strlen(s)+1);
+    strcpy(&(*this)[0], s);
+  }
+  void operator+=(const char* s) {
+    assert(s);
+    pop_back();
+    while (*s) push_back(*s++);
+    push_back(0);
+  }
+  String(const char* s=""): Array<char>(1) {
+    (*this)+=s;
+  }
+};
+
+
+//////////////////////////// rnd ///////////////////////////////
+
+// 32-bit pseudo random number generator
+class Random{
+  Array<U32> table;
+  int i;
+public:
+  Random(): table(64) {reset();}
+  void reset() {  // restart the sequence
+    table[0]=123456789;
+    table[1]=987654321;
+    for (int j=0; j<62; j++) table[j+2]=table[j+1]*11+table[j]*23/16;
+    i=0;
+  }
+  U32 operator()() {
+    return ++i, table[i&63]=table[(i-24)&63]^table[(i-55)&63];
+  }
+  void state(State& s) {s.array(table), s(i);}
+};
+TLS Random rnd;
+
+////////////////////////////// Buf /////////////////////////////
+
+// Buf(n) buf; creates an array of n bytes (must be a power of 2).
+// buf[i] returns a reference to the i'th byte with wrap (no out of bounds).
+// buf(i) returns i'th byte back from pos (i > 0)
+// buf.size() returns n.
+//
+// pos and the positions that models keep (as int or U32) wrap around at
+// 2^32 bytes.  Since buf is smaller than that, the distance pos-p back
+// to a position p still in buf is right after the wrap.
+
+TLS U32 pos;  // Number of input bytes in buf (not wrapped), mod 2^32
+
+class Buf {
+  Array<U8> b;
+public:
+  Buf(size_t i=0): b(i) {}
+  void setsize(size_t i) {
+    if (!i) return;
+    assert((i&(i-1))==0);
+    b.resize(i);
+  }
+  void reset() {  // fill with 0
+    if (b.size()) memset(&b[0], 0, b.size());
+  }
+  U8& operator[](U32 i) {
+    return b[i&(b.size()-1)];
+  }
+  int operator()(int i) const {
+    assert(i>0);
+    return b[(pos-i)&(b.size()-1)];
+  }
+  size_t size() const {
+    return b.size();
+  }
+};
+
+// IntBuf(n) is a buffer of n int (must be a power of 2).
+// intBuf[i] returns a reference to i'th element with wrap.
+
+class IntBuf {
+  Array<int> b;
+public:
+  IntBuf(int i=0): b(i) {}
+  int& operator[](int i) {
+    return b[i&(b.size()-1)];
+  }
+};
+
+/////////////////////// Global context /////////////////////////
+
+TLS int level=DEFAULT_OPTION;  // Compression level 0 to MAXLEVEL
+TLS int memlevel=DEFAULT_OPTION;  // Level that sets table sizes, <= level
+#define MEM (size_t(0x10000)<<memlevel)
+
+// Levels 9 and 10 use 4.5 and 8.9 GB, so they need a 64-bit build
+const int MAXLEVEL=sizeof(size_t)<8 ? 8 : 10;
+
+// Return the smallest level up to level whose tables are big enough
+// for n bytes of input.  The main ContextMap (MEM*32 bytes) then has
+// at least 512 bytes per input byte.
+int memoryLevel(int level, long n) {
+  int m=0;
+  while (m<level && (0x1000L<<m)<n) ++m;
+  return m;
+}
+
+// Memory budget (-m).  A thread uses about 85 (levels 0-3) or 132
+// (levels 4-10) bytes per byte of MEM for the tables, plus 52 MB that do
+// not depend on memlevel, with all models of the level in use.  17 of
+// them are the window and index of the Dedup (not used at level 0).  Since
+// the archive records memlevel, only the compressor looks at the budget.
+double budget=0;  // bytes each thread may use, 0 = no limit
+
+double memoryUsed(int level, int m) {
+  return (level<4 ? 85.0 : 132.0)*(0x10000<<m)+52e6;
+}
+
+// Return the largest memlevel up to level that fits in budget (or 0)
+int budgetLevel(int level) {
+  int m=level;
+  while (m>0 && budget>0 && memoryUsed(level, m)>budget) --m;
+  return m;
+}
+
+// Return the limit in the cgroup file name (memory.max in v2,
+// memory.limit_in_bytes in v1), or 0 if there is none
+double cgroupLimit(const char* name) {
+  FILE* f=fopen(name, "r");
+  if (!f) return 0;
+  char s[32]="";
+  const int r=fscanf(f, "%31s", s);
+  fclose(f);
+  if (r!=1 || !isdigit(s[0])) return 0;  // "max"
+  const double limit=strtod(s, 0);
+  return limit<1e18 ? limit : 0;  // v1 writes a huge number for none
+}
+
+// Return the bytes of memory this process may use: the smallest limit of
+// its cgroup and the cgroups above it (as in a container), else the
+// physical memory, or 0 if unknown
+double memoryLimit() {
+  double limit=0;
+#ifdef UNIX
+  // /proc/self/cgroup has a line "0::/path" (v2) or "N:memory:/path" (v1)
+  FILE* f=fopen("/proc/self/cgroup", "r");
+  char line[1024];
+  while (f && fgets(line, sizeof(line), f)) {
+    const char* v2=strncmp(line, "0::/", 4) ? 0 : line+3;
+    const char* v1=strstr(line, ":memory:/");
+    if (!v1) v1=strstr(line, ",memory:/");
+    if (v1) v1+=8;
+    const char* p=v2 ? v2 : v1;
+    if (!p) continue;
+    String path(v2 ? "/sys/fs/cgroup" : "/sys/fs/cgroup/memory");
+    path.pop_back();
+    int len=path.size();
+    for (; *p && *p!='\n'; ++p) path.push_back(*p);
+    path.push_back(0);
+    for (int i=path.size()-1;;) {  // path, its parents, then the mount
+      String name(path.c_str());
+      name+=v2 ? "/memory.max" : "/memory.limit_in_bytes";
+      const double l=cgroupLimit(name.c_str());
+      if (l>0 && (limit==0 || l<limit)) limit=l;
+      if (i<=len) break;
+      while (i>len && path[i]!='/') --i;
+      path.resize(i);
+      path.push_back(0);
+    }
+  }
+  if (f) fclose(f);
+  const double phys=double(sysconf(_SC_PHYS_PAGES))*sysconf(_SC_PAGESIZE);
+#elif defined(WINDOWS)
+  MEMORYSTATUSEX ms;
+  ms.dwLength=sizeof(ms);
+  const double phys=GlobalMemoryStatusEx(&ms) ? double(ms.ullTotalPhys) : 0;
+#else
+  const double phys=0;
+#endif
+  if (phys>0 && (limit==0 || phys<limit)) limit=phys;
+  return limit;
+}
+
+// Return the budget given by -m s: a number of bytes with an optional
+// suffix K, M or G, or "auto" for 7/8 of memoryLimit()
+double parseMemory(const char* s) {
+  if (equals(s, "auto")) {
+    const double limit=memoryLimit();
+    if (limit<=0) quit("-m auto: the memory limit is unknown");
+    return limit*7/8;
+  }
+  char* q;
+  double n=strtod(s, &q);
+  if (*q=='K' || *q=='k') n*=1024, ++q;
+  else if (*q=='M' || *q=='m') n*=1024*1024, ++q;
+  else if (*q=='G' || *q=='g') n*=1024*1024*1024, ++q;
+  if (q==s || *q || n<=0) quit("-m takes a number of bytes (or K, M, G) or auto");
+  return n;
+}
+TLS int y=0;  // Last bit, 0 or 1, set by encoder
+
+// Global context set by Predictor and available to all models.
+// It is reset when a Predictor is created.  A thread may run only one
+// Predictor at a time.
+TLS int c0=1; // Last 0-7 bits of the partial byte with a leading 1 bit (1-255)
+TLS U32 c4=0; // Last 4 whole bytes, packed.  Last byte is bits 0-7.
+TLS int bpos=0; // bits in c0 (0 to 7)
+TLS Buf buf;  // Rotating input queue set by Predictor
+TLS int blpos=0; // Relative position in block
+
+///////////////////////////// ilog //////////////////////////////
+
+// ilog(x) = round(log2(x) * 16), 0 <= x < 64K
+class Ilog {
+  Array<U8> t;
+public:
+  int operator()(U16 x) const {return t[x];}
+  Ilog();
+} ilog;
+
+// Compute lookup table by numerical integration of 1/x
+Ilog::Ilog(): t(65536) {
+  U32 x=14155776;
+  for (int i=2; i<65536; ++i) {
+    x+=774541002/(i*2-1);  // numerator is 2^29/ln 2
+    t[i]=x>>24;
+  }
+}
+
+// llog(x) accepts 32 bits
+inline int llog(U32 x) {
+  if (x>=0x1000000)
+    return 256+ilog(x>>16);
+  else if (x>=0x10000)
+    return 128+ilog(x>>8);
+  else
+    return ilog(x);
+}
+
+///////////////////////// state table ////////////////////////
+
+// State table:
+//   nex(state, 0) = next state if bit y is 0, 0 <= state < 256
+//   nex(state, 1) = next state if bit y is 1
+//   nex(state, 2) = number of zeros in bit history represented by state
+//   nex(state, 3) = number of ones represented
+//
+// States represent a bit history within some context.
+// State 0 is the starting state (no bits seen).
+// States 1-30 represent all possible sequences of 1-4 bits.
+// States 31-252 represent a pair of counts, (n0,n1), the number
+//   of 0 and 1 bits respectively.  If n0+n1 < 16 then there are
+//   two states for each pair, depending on if a 0 or 1 was the last
+//   bit seen.
+// If n0 and n1 are too large, then there is no state to represent this
+// pair, so another state with about the same ratio of n0/n1 is substituted.
+// Also, when a bit is observed and the count of the opposite bit is large,
+// then part of this count is discarded to favor newer data over old.
+
+#if 1 // change to #if 0 to generate this table at run time (4% slower)
+static const U8 State_table[256][4]={
+  {  1,  2, 0, 0},{  3,  5, 1, 0},{  4,  6, 0, 1},{  7, 10, 2, 0}, // 0-3
+  {  8, 12, 1, 1},{  9, 13, 1, 1},{ 11, 14, 0, 2},{ 15, 19, 3, 0}, // 4-7
+  { 16, 23, 2, 1},{ 17, 24, 2, 1},{ 18, 25, 2, 1},{ 20, 27, 1, 2}, // 8-11
+  { 21, 28, 1, 2},{ 22, 29, 1, 2},{ 26, 30, 0, 3},{ 31, 33, 4, 0}, // 12-15
+  { 32, 35, 3, 1},{ 32, 35, 3, 1},{ 32, 35, 3, 1},{ 32, 35, 3, 1}, // 16-19
+  { 34, 37, 2, 2},{ 34, 37, 2, 2},{ 34, 37, 2, 2},{ 34, 37, 2, 2}, // 20-23
+  { 34, 37, 2, 2},{ 34, 37, 2, 2},{ 36, 39, 1, 3},{ 36, 39, 1, 3}, // 24-27
+  { 36, 39, 1, 3},{ 36, 39, 1, 3},{ 38, 40, 0, 4},{ 41, 43, 5, 0}, // 28-31
+  { 42, 45, 4, 1},{ 42, 45, 4, 1},{ 44, 47, 3, 2},{ 44, 47, 3, 2}, // 32-35
+  { 46, 49, 2, 3},{ 46, 49, 2, 3},{ 48, 51, 1, 4},{ 48, 51, 1, 4}, // 36-39
+  { 50, 52, 0, 5},{ 53, 43, 6, 0},{ 54, 57, 5, 1},{ 54, 57, 5, 1}, // 40-43
+  { 56, 59, 4, 2},{ 56, 59, 4, 2},{ 58, 61, 3, 3},{ 58, 61, 3, 3}, // 44-47
+  { 60, 63, 2, 4},{ 60, 63, 2, 4},{ 62, 65, 1, 5},{ 62, 65, 1, 5}, // 48-51
+  { 50, 66, 0, 6},{ 67, 55, 7, 0},{ 68, 57, 6, 1},{ 68, 57, 6, 1}, // 52-55
+  { 70, 73, 5, 2},{ 70, 73, 5, 2},{ 72, 75, 4, 3},{ 72, 75, 4, 3}, // 56-59
+  { 74, 77, 3, 4},{ 74, 77, 3, 4},{ 76, 79, 2, 5},{ 76, 79, 2, 5}, // 60-63
+  { 62, 81, 1, 6},{ 62, 81, 1, 6},{ 64, 82, 0, 7},{ 83, 69, 8, 0}, // 64-67
+  { 84, 71, 7, 1},{ 84, 71, 7, 1},{ 86, 73, 6, 2},{ 86, 73, 6, 2}, // 68-71
+  { 44, 59, 5, 3},{ 44, 59, 5, 3},{ 58, 61, 4, 4},{ 58, 61, 4, 4}, // 72-75
+  { 60, 49, 3, 5},{ 60, 49, 3, 5},{ 76, 89, 2, 6},{ 76, 89, 2, 6}, // 76-79
+  { 78, 91, 1, 7},{ 78, 91, 1, 7},{ 80, 92, 0, 8},{ 93, 69, 9, 0}, // 80-83
+  { 94, 87, 8, 1},{ 94, 87, 8, 1},{ 96, 45, 7, 2},{ 96, 45, 7, 2}, // 84-87
+  { 48, 99, 2, 7},{ 48, 99, 2, 7},{ 88,101, 1, 8},{ 88,101, 1, 8}, // 88-91
+  { 80,102, 0, 9},{103, 69,10, 0},{104, 87, 9, 1},{104, 87, 9, 1}, // 92-95
+  {106, 57, 8, 2},{106, 57, 8, 2},{ 62,109, 2, 8},{ 62,109, 2, 8}, // 96-99
+  { 88,111, 1, 9},{ 88,111, 1, 9},{ 80,112, 0,10},{113, 85,11, 0}, // 100-103
+  {114, 87,10, 1},{114, 87,10, 1},{116, 57, 9, 2},{116, 57, 9, 2}, // 104-107
+  { 62,119, 2, 9},{ 62,119, 2, 9},{ 88,121, 1,10},{ 88,121, 1,10}, // 108-111
+  { 90,122, 0,11},{123, 85,12, 0},{124, 97,11, 1},{124, 97,11, 1}, // 112-115
+  {126, 57,10, 2},{126, 57,10, 2},{ 62,129, 2,10},{ 62,129, 2,10}, // 116-119
+  { 98,131, 1,11},{ 98,131, 1,11},{ 90,132, 0,12},{133, 85,13, 0}, // 120-123
+  {134, 97,12, 1},{134, 97,12, 1},{136, 57,11, 2},{136, 57,11, 2}, // 124-127
+  { 62,139, 2,11},{ 62,139, 2,11},{ 98,141, 1,12},{ 98,141, 1,12}, // 128-131
+  { 90,142, 0,13},{143, 95,14, 0},{144, 97,13, 1},{144, 97,13, 1}, // 132-135
+  { 68, 57,12, 2},{ 68, 57,12, 2},{ 62, 81, 2,12},{ 62, 81, 2,12}, // 136-139
+  { 98,147, 1,13},{ 98,147, 1,13},{100,148, 0,14},{149, 95,15, 0}, // 140-143
+  {150,107,14, 1},{150,107,14, 1},{108,151, 1,14},{108,151, 1,14}, // 144-147
+  {100,152, 0,15},{153, 95,16, 0},{154,107,15, 1},{108,155, 1,15}, // 148-151
+  {100,156, 0,16},{157, 95,17, 0},{158,107,16, 1},{108,159, 1,16}, // 152-155
+  {100,160, 0,17},{161,105,18, 0},{162,107,17, 1},{108,163, 1,17}, // 156-159
+  {110,164, 0,18},{165,105,19, 0},{166,117,18, 1},{118,167, 1,18}, // 160-163
+  {110,168, 0,19},{169,105,20, 0},{170,117,19, 1},{118,171, 1,19}, // 164-167
+  {110,172, 0,20},{173,105,21, 0},{174,117,20, 1},{118,175, 1,20}, // 168-171
+  {110,176, 0,21},{177,105,22, 0},{178,117,21, 1},{118,179, 1,21}, // 172-175
+  {110,180, 0,22},{181,115,23, 0},{182,117,22, 1},{118,183, 1,22}, // 176-179
+  {120,184, 0,23},{185,115,24, 0},{186,127,23, 1},{128,187, 1,23}, // 180-183
+  {120,188, 0,24},{189,115,25, 0},{190,127,24, 1},{128,191, 1,24}, // 184-187
+  {120,192, 0,25},{193,115,26, 0},{194,127,25, 1},{128,195, 1,25}, // 188-191
+  {120,196, 0,26},{197,115,27, 0},{198,127,26, 1},{128,199, 1,26}, // 192-195
+  {120,200, 0,27},{201,115,28, 0},{202,127,27, 1},{128,203, 1,27}, // 196-199
+  {120,204, 0,28},{205,115,29, 0},{206,127,28, 1},{128,207, 1,28}, // 200-203
+  {120,208, 0,29},{209,125,30, 0},{210,127,29, 1},{128,211, 1,29}, // 204-207
+  {130,212, 0,30},{213,125,31, 0},{214,137,30, 1},{138,215, 1,30}, // 208-211
+  {130,216, 0,31},{217,125,32, 0},{218,137,31, 1},{138,219, 1,31}, // 212-215
+  {130,220, 0,32},{221,125,33, 0},{222,137,32, 1},{138,223, 1,32}, // 216-219
+  {130,224, 0,33},{225,125,34, 0},{226,137,33, 1},{138,227, 1,33}, // 220-223
+  {130,228, 0,34},{229,125,35, 0},{230,137,34, 1},{138,231, 1,34}, // 224-227
+  {130,232, 0,35},{233,125,36, 0},{234,137,35, 1},{138,235, 1,35}, // 228-231
+  {130,236, 0,36},{237,125,37, 0},{238,137,36, 1},{138,239, 1,36}, // 232-235
+  {130,240, 0,37},{241,125,38, 0},{242,137,37, 1},{138,243, 1,37}, // 236-239
+  {130,244, 0,38},{245,135,39, 0},{246,137,38, 1},{138,247, 1,38}, // 240-243
+  {140,248, 0,39},{249,135,40, 0},{250, 69,39, 1},{ 80,251, 1,39}, // 244-247
+  {140,252, 0,40},{249,135,41, 0},{250, 69,40, 1},{ 80,251, 1,40}, // 248-251
+  {140,252, 0,41}};  // 252, 253-255 are reserved
+
+#define nex(state,sel) State_table[state][sel]
+inline const U8* stateTable() {return &State_table[0][0];}  // state*4+sel
+
+// The code used to generate the above table at run time (4% slower).
+// To print the table, uncomment the 4 lines of print statements below.
+// In this code x,y = n0,n1 is the number of 0,1 bits represented by a state.
+#else
+
+class StateTable {
+  Array<U8> ns;  // state*4 -> next state if 0, if 1, n0, n1
+  enum {B=5, N=64}; // sizes of b, t
+  static const int b[B];  // x -> max y, y -> max x
+  static U8 t[N][N][2];  // x,y -> state number, number of states
+  int num_states(int x, int y);  // compute t[x][y][1]
+  void discount(int& x);  // set new value of x after 1 or y after 0
+  void next_state(int& x, int& y, int b);  // new (x,y) after bit b
+public:
+  int operator()(int state, int sel) {return ns[state*4+sel];}
+  const U8* table() const {return &ns[0];}
+  StateTable();
+} nex;
+
+inline const U8* stateTable() {return nex.table();}  // state*4+sel
+
+const int StateTable::b[B]={42,41,13,6,5};  // x -> max y, y -> max x
+U8 StateTable::t[N][N][2];
+
+int StateTable::num_states(int x, int y) {
+  if (x<y) return num_states(y, x);
+  if (x<0 || y<0 || x>=N || y>=N || y>=B || x>=b[y]) return 0;
+
+  // States 0-30 are a history of the last 0-4 bits
+  if (x+y<=4) {  // x+y choose x = (x+y)!/x!y!
+    int r=1;
+    for (int i=x+1; i<=x+y; ++i) r*=i;
+    for (int i=2; i<=y; ++i) r/=i;
+    return r;
+  }
+
+  // States 31-255 represent a 0,1 count and possibly the last bit
+  // if the state is reachable by either a 0 or 1.
+  else
+    return 1+(y>0 && x+y<16);
+}
+
+// New value of count x if the opposite bit is observed
+void StateTable::discount(int& x) {
+  if (x>2) x=ilog(x)/6-1;
+}
+
+// compute next x,y (0 to N) given input b (0 or 1)
+void StateTable::next_state(int& x, int& y, int b) {
+  if (x<y)
+    next_state(y, x, 1-b);
+  else {
+    if (b) {
+      ++y;
+      discount(x);
+    }
+    else {
+      ++x;
+      discount(y);
+    }
+    while (!t[x][y][1]) {
+      if (y<2) --x;
+      else {
+        x=(x*(y-1)+(y/2))/y;
+        --y;
+      }
+    }
+  }
+}
+
+// Initialize next state table ns[state*4] -> next if 0, next if 1, x, y
+StateTable::StateTable(): ns(1024) {
+
+  // Assign states
+  int state=0;
+  for (int i=0; i<256; ++i) {
+    for (int y=0; y<=i; ++y) {
+      int x=i-y;
+      int n=num_states(x, y);
+      if (n) {
+        t[x][y][0]=state;
+        t[x][y][1]=n;
+        state+=n;
+      }
+    }
+  }
+
+  // Print/generate next state table
+  state=0;
+  for (int i=0; i<N; ++i) {
+    for (int y=0; y<=i; ++y) {
+      int x=i-y;
+      for (int k=0; k<t[x][y][1]; ++k) {
+        int x0=x, y0=y, x1=x, y1=y;  // next x,y for input 0,1
+        int ns0=0, ns1=0;
+        if (state<15) {
+          ++x0;
+          ++y1;
+          ns0=t[x0][y0][0]+state-t[x][y][0];
+          ns1=t[x1][y1][0]+state-t[x][y][0];
+          if (x>0) ns1+=t[x-1][y+1][1];
+          ns[state*4]=ns0;
+          ns[state*4+1]=ns1;
+          ns[state*4+2]=x;
+          ns[state*4+3]=y;
+        }
+        else if (t[x][y][1]) {
+          next_state(x0, y0, 0);
+          next_state(x1, y1, 1);
+          ns[state*4]=ns0=t[x0][y0][0];
+          ns[state*4+1]=ns1=t[x1][y1][0]+(t[x1][y1][1]>1);
+          ns[state*4+2]=x;
+          ns[state*4+3]=y;
+        }
+          // uncomment to print table above
+//        printf("{%3d,%3d,%2d,%2d},", ns[state*4], ns[state*4+1],
+//          ns[state*4+2], ns[state*4+3]);
+//        if (state%4==3) printf(" // %d-%d\n  ", state-3, state);
+        assert(state>=0 && state<256);
+        assert(t[x][y][1]>0);
+        assert(t[x][y][0]<=state);
+        assert(t[x][y][0]+t[x][y][1]>state);
+        assert(t[x][y][1]<=6);
+        assert(t[x0][y0][1]>0);
+        assert(t[x1][y1][1]>0);
+        assert(ns0-t[x0][y0][0]<t[x0][y0][1]);
+        assert(ns0-t[x0][y0][0]>=0);
+        assert(ns1-t[x1][y1][0]<t[x1][y1][1]);
+        assert(ns1-t[x1][y1][0]>=0);
+        ++state;
+      }
+    }
+  }
+//  printf("%d states\n", state); exit(0);  // uncomment to print table above
+}
+
+#endif
+
+///////////////////////////// Squash //////////////////////////////
+
+// return p = 1/(1 + exp(-d)), d scaled by 8 bits, p scaled by 12 bits
+int squash(int d) {
+  static const int t[33]={
+    1,2,3,6,10,16,27,45,73,120,194,310,488,747,1101,
+    1546,2047,2549,2994,3348,3607,3785,3901,3975,4022,
+    4050,4068,4079,4085,4089,4092,4093,4094};
+  if (d>2047) return 4095;
+  if (d<-2047) return 0;
+  int w=d&127;
+  d=(d>>7)+16;
+  return (t[d]*(128-w)+t[(d+1)]*w+64) >> 7;
+}
+
+//////////////////////////// Stretch ///////////////////////////////
+
+// Inverse of squash. d = ln(p/(1-p)), d scaled by 8 bits, p by 12 bits.
+// d has range -2047 to 2047 representing -8 to 8.  p has range 0 to 4095.
+
+class Stretch {
+  Array<short> t;
+public:
+  Stretch();
+  int operator()(int p) const {
+    assert(p>=0 && p<4096);
+    return t[p];
+  }
+  const short* table() const {return &t[0];}  // t[4096] pads t[4095]
+} stretch;
+
+Stretch::Stretch(): t(4097) {
+  int pi=0;
+  for (int x=-2047; x<=2047; ++x) {  // invert squash()
+    int i=squash(x);
+    for (int j=pi; j<=i; ++j)
+      t[j]=x;
+    pi=i+1;
+  }
+  t[4095]=t[4096]=2047;
+}
+
+//////////////////////////// Mixer /////////////////////////////
+
+// Mixer m(N, M, S=1, w=0) combines models using M neural networks with
+//   N inputs each, of which up to S may be selected.  If S > 1 then
+//   the outputs of these neural networks are combined using another
+//   neural network (with parameters S, 1, 1).  If S = 1 then the
+//   output is direct.  The weights are initially w (+-32K).
+//   It is used as follows:
+// m.update() trains the network where the expected output is the
+//   last bit (in the global variable y).
+// m.add(stretch(p)) inputs prediction from one of N models.  The
+//   prediction should be positive to predict a 1 bit, negative for 0,
+//   nominally +-256 to +-2K.  The maximum allowed value is +-32K but
+//   using such large values may cause overflow if N is large.
+// m.set(cxt, range) selects cxt as one of 'range' neural networks to
+//   use.  0 <= cxt < range.  Should be called up to S times such
+//   that the total of the ranges is <= M.
+// m.p() returns the output prediction that the next bit is 1 as a
+//   12 bit number (0 to 4095).
+
+// dot_product returns dot product t*w of n elements.  n is rounded
+// up to a multiple of 8.  Result is scaled down by 8 bits.
+#ifdef NOASM  // no assembly language
+int dot_product(short *t, short *w, int n) {
+  int sum=0;
+  n=(n+7)&-8;
+  for (int i=0; i<n; i+=2)
+    sum+=(t[i]*w[i]+t[i+1]*w[i+1]) >> 8;
+  return sum;
+}
+#else  // The NASM version uses MMX and is about 8 times faster.
+extern "C" int dot_product(short *t, short *w, int n);  // in NASM
+#endif
+
+// Train neural network weights w[n] given inputs t[n] and err.
+// w[i] += t[i]*err, i=0..n-1.  t, w, err are signed 16 bits (+- 32K).
+// err is scaled 16 bits (representing +- 1/2).  w[i] is clamped to +- 32K
+// and rounded.  n is rounded up to a multiple of 8.
+#ifdef NOASM
+void train(short *t, short *w, int n, int err) {
+  n=(n+7)&-8;
+  for (int i=0; i<n; ++i) {
+    int wt=w[i]+(((t[i]*err*2>>16)+1)>>1);
+    if (wt<-32768) wt=-32768;
+    if (wt>32767) wt=32767;
+    w[i]=wt;
+  }
+}
+#else
+extern "C" void train(short *t, short *w, int n, int err);  // in NASM
+#endif
+
+// The Mixer kernels below use AVX2 (16 shorts at a time) or AVX-512BW
+// (32 shorts at a time) if the CPU supports them, else dot_product()
+// and train() above.  The results are the same in every case.
+// ContextMap uses them the same way (see predictStates()).
+// Compile with -DNOAVX to use only dot_product() and train().
+#if !defined(NOAVX) && defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define AVX
+#include <immintrin.h>
+#define TARGET(x) __attribute__((target(x)))
+#endif
+
+enum {SIMD_NONE, SIMD_AVX2, SIMD_AVX512};  // Mixer and ContextMap instruction sets
+
+// Return the best instruction set supported by the CPU and OS
+int simdLevel() {
+#ifdef AVX
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512bw")) return SIMD_AVX512;
+  if (__builtin_cpu_supports("avx2")) return SIMD_AVX2;
+#endif
+  return SIMD_NONE;
+}
+const int simd=simdLevel();
+
+#ifdef AVX
+
+// Sum of 8 ints in x
+TARGET("avx2") inline int hsum(__m256i x) {
+  __m128i s=_mm_add_epi32(_mm256_castsi256_si128(x),
+    _mm256_extracti128_si256(x, 1));
+  s=_mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4e));
+  s=_mm_add_epi32(s, _mm_shuffle_epi32(s, 0xb1));
+  return _mm_cvtsi128_si32(s);
+}
+
+// r[j] = dot_product(t, w[j], n) for j=0..K-1, in one pass over t.
+// n is a multiple of 8.
+template <int K> TARGET("avx2")
+void dot_rows_avx2(const short* t, short* const* w, int n, int* r) {
+  __m256i sum[K];
+  int j, i=0;
+  for (j=0; j<K; ++j) sum[j]=_mm256_setzero_si256();
+  for (; i+16<=n; i+=16) {
+    const __m256i x=_mm256_loadu_si256((const __m256i*)(t+i));
+    for (j=0; j<K; ++j)
+      sum[j]=_mm256_add_epi32(sum[j], _mm256_srai_epi32(_mm256_madd_epi16(x,
+        _mm256_loadu_si256((const __m256i*)(w[j]+i))), 8));
+  }
+  if (i<n) {  // 8 left, added to the low half with the high half 0
+    const __m128i x=_mm_loadu_si128((const __m128i*)(t+i));
+    for (j=0; j<K; ++j)
+      sum[j]=_mm256_add_epi32(sum[j], _mm256_inserti128_si256(
+        _mm256_setzero_si256(), _mm_srai_epi32(_mm_madd_epi16(x,
+        _mm_loadu_si128((const __m128i*)(w[j]+i))), 8), 0));
+  }
+  for (j=0; j<K; ++j) r[j]=hsum(sum[j]);
+}
+
+// GCC 12 headers give the unmasked AVX-512 intrinsics an undefined
+// source operand that -Wall reports as uninitialized, so those warnings
+// are off in the AVX-512 functions.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+template <int K> TARGET("avx512bw")
+void dot_rows_avx512(const short* t, short* const* w, int n, int* r) {
+  __m512i sum[K];
+  int j, i=0;
+  for (j=0; j<K; ++j) sum[j]=_mm512_setzero_si512();
+  for (; i+32<=n; i+=32) {
+    const __m512i x=_mm512_loadu_si512((const void*)(t+i));
+    for (j=0; j<K; ++j)
+      sum[j]=_mm512_add_epi32(sum[j], _mm512_srai_epi32(_mm512_madd_epi16(x,
+        _mm512_loadu_si512((const void*)(w[j]+i))), 8));
+  }
+  for (; i<n; i+=8) {  // 8, 16 or 24 left, added to the low 128 bits
+    const __m128i x=_mm_loadu_si128((const __m128i*)(t+i));
+    for (j=0; j<K; ++j)
+      sum[j]=_mm512_add_epi32(sum[j], _mm512_inserti32x4(
+        _mm512_setzero_si512(), _mm_srai_epi32(_mm_madd_epi16(x,
+        _mm_loadu_si128((const __m128i*)(w[j]+i))), 8), 0));
+  }
+  for (j=0; j<K; ++j)
+    r[j]=hsum(_mm256_add_epi32(_mm512_extracti64x4_epi64(sum[j], 0),
+      _mm512_extracti64x4_epi64(sum[j], 1)));
+}
+#pragma GCC diagnostic pop
+
+// train() on 16 or 32 weights at a time.  The same operations as the
+// MMX version so that the weights are rounded the same way.
+TARGET("avx2") void train_avx2(const short* t, short* w, int n, int err) {
+  const __m256i e=_mm256_set1_epi16(err), one=_mm256_set1_epi16(1);
+  int i=0;
+  for (; i+16<=n; i+=16) {
+    __m256i x=_mm256_loadu_si256((const __m256i*)(t+i));
+    x=_mm256_adds_epi16(x, x);
+    x=_mm256_mulhi_epi16(x, e);
+    x=_mm256_srai_epi16(_mm256_adds_epi16(x, one), 1);
+    __m256i* p=(__m256i*)(w+i);
+    _mm256_storeu_si256(p, _mm256_adds_epi16(_mm256_loadu_si256(p), x));
+  }
+  if (i<n) {
+    __m128i x=_mm_loadu_si128((const __m128i*)(t+i));
+    x=_mm_adds_epi16(x, x);
+    x=_mm_mulhi_epi16(x, _mm256_castsi256_si128(e));
+    x=_mm_srai_epi16(_mm_adds_epi16(x, _mm256_castsi256_si128(one)), 1);
+    __m128i* p=(__m128i*)(w+i);
+    _mm_storeu_si128(p, _mm_adds_epi16(_mm_loadu_si128(p), x));
+  }
+}
+
+TARGET("avx512bw") void train_avx512(const short* t, short* w, int n,
+    int err) {
+  const __m512i e=_mm512_set1_epi16(err), one=_mm512_set1_epi16(1);
+  int i=0;
+  for (; i+32<=n; i+=32) {
+    __m512i x=_mm512_loadu_si512((const void*)(t+i));
+    x=_mm512_adds_epi16(x, x);
+    x=_mm512_mulhi_epi16(x, e);
+    x=_mm512_srai_epi16(_mm512_adds_epi16(x, one), 1);
+    short* p=w+i;
+    _mm512_storeu_si512((void*)p, _mm512_adds_epi16(
+      _mm512_loadu_si512((const void*)p), x));
+  }
+  if (i<n) train_avx2(t+i, w+i, n-i, err);
+}
+
+// w[j][i] += t[i]*err[j] as in train() for j=0..K-1, in one pass over t
+template <int K> TARGET("avx2")
+void train_rows_avx2(const short* t, short* const* w, const int* err, int n) {
+  __m256i e[K];
+  const __m256i one=_mm256_set1_epi16(1);
+  int j, i=0;
+  for (j=0; j<K; ++j) e[j]=_mm256_set1_epi16(err[j]);
+  for (; i+16<=n; i+=16) {
+    __m256i x=_mm256_loadu_si256((const __m256i*)(t+i));
+    x=_mm256_adds_epi16(x, x);
+    for (j=0; j<K; ++j) {
+      __m256i d=_mm256_mulhi_epi16(x, e[j]);
+      d=_mm256_srai_epi16(_mm256_adds_epi16(d, one), 1);
+      __m256i* p=(__m256i*)(w[j]+i);
+      _mm256_storeu_si256(p, _mm256_adds_epi16(_mm256_loadu_si256(p), d));
+    }
+  }
+  if (i<n)
+    for (j=0; j<K; ++j) train_avx2(t+i, w[j]+i, n-i, err[j]);
+}
+
+template <int K> TARGET("avx512bw")
+void train_rows_avx512(const short* t, short* const* w, const int* err,
+    int n) {
+  __m512i e[K];
+  const __m512i one=_mm512_set1_epi16(1);
+  int j, i=0;
+  for (j=0; j<K; ++j) e[j]=_mm512_set1_epi16(err[j]);
+  for (; i+32<=n; i+=32) {
+    __m512i x=_mm512_loadu_si512((const void*)(t+i));
+    x=_mm512_adds_epi16(x, x);
+    for (j=0; j<K; ++j) {
+      __m512i d=_mm512_mulhi_epi16(x, e[j]);
+      d=_mm512_srai_epi16(_mm512_adds_epi16(d, one), 1);
+      short* p=w[j]+i;
+      _mm512_storeu_si512((void*)p, _mm512_adds_epi16(
+        _mm512_loadu_si512((const void*)p), d));
+    }
+  }
+  if (i<n)
+    for (j=0; j<K; ++j) train_avx2(t+i, w[j]+i, n-i, err[j]);
+}
+
+#endif
+
+// r[j] = dot_product(t, w+cxt[j]*stride, n) for j=0..k-1.
+// n is rounded up to a multiple of 8.
+void dot_products(short* t, short* w, int stride, const int* cxt, int k,
+    int n, int* r) {
+  n=(n+7)&-8;
+#ifdef AVX
+  if (simd!=SIMD_NONE) {
+    while (k>0) {
+      short* wp[4];
+      const int m=min(k, 4);  // rows in one pass
+      for (int j=0; j<m; ++j) wp[j]=w+cxt[j]*stride;
+      if (simd==SIMD_AVX512) switch (m) {
+        case 1: dot_rows_avx512<1>(t, wp, n, r); break;
+        case 2: dot_rows_avx512<2>(t, wp, n, r); break;
+        case 3: dot_rows_avx512<3>(t, wp, n, r); break;
+        default: dot_rows_avx512<4>(t, wp, n, r); break;
+      }
+      else switch (m) {
+        case 1: dot_rows_avx2<1>(t, wp, n, r); break;
+        case 2: dot_rows_avx2<2>(t, wp, n, r); break;
+        case 3: dot_rows_avx2<3>(t, wp, n, r); break;
+        default: dot_rows_avx2<4>(t, wp, n, r); break;
+      }
+      cxt+=m, r+=m, k-=m;
+    }
+    return;
+  }
+#endif
+  for (int j=0; j<k; ++j)
+    r[j]=dot_product(t, w+cxt[j]*stride, n);
+}
+
+// train(t, w+cxt[j]*stride, n, err[j]) for j=0..k-1 where err[j] is not 0.
+// The rows are updated in order, 4 at a time in one pass over t.
+void train_rows(short* t, short* w, int stride, const int* cxt,
+    const int* err, int k, int n) {
+  n=(n+7)&-8;
+  short* wp[4];
+  int e[4], m=0;
+  for (int j=0; j<k; ++j) {
+#ifdef MIXERSTATS
+    ++mixerStats.rows;
+    if (!err[j]) ++mixerStats.skipped;
+#endif
+    if (err[j]) wp[m]=w+cxt[j]*stride, e[m++]=err[j];
+    if (m<4 && (j<k-1 || m==0)) continue;
+#ifdef AVX
+    if (simd==SIMD_AVX512) switch (m) {
+      case 1: train_rows_avx512<1>(t, wp, e, n); break;
+      case 2: train_rows_avx512<2>(t, wp, e, n); break;
+      case 3: train_rows_avx512<3>(t, wp, e, n); break;
+      default: train_rows_avx512<4>(t, wp, e, n); break;
+    }
+    else if (simd==SIMD_AVX2) switch (m) {
+      case 1: train_rows_avx2<1>(t, wp, e, n); break;
+      case 2: train_rows_avx2<2>(t, wp, e, n); break;
+      case 3: train_rows_avx2<3>(t, wp, e, n); break;
+      default: train_rows_avx2<4>(t, wp, e, n); break;
+    }
+    else
+#endif
+    for (int i=0; i<m; ++i) train(t, wp[i], n, e[i]);
+    m=0;
+  }
+}
+
+class Mixer {
+  const int N, M, S;   // max inputs, max contexts, max context sets
+  Array<short, 16> tx; // N inputs from add()
+  Array<short, 16> wx; // N*M weights
+  Array<int> cxt;  // S contexts
+  int ncxt;        // number of contexts (0 to S)
+  int base;        // offset of next context
+  int nx;          // Number of inputs in tx, 0 to N
+  Array<int> pr;   // last result (scaled 12 bits)
+  Array<int> err;  // S training errors
+  Mixer* mp;       // points to a Mixer to combine results
+public:
+  Mixer(int n, int m, int s=1, int w=0);
+
+  // Adjust weights to minimize coding cost of last prediction
+  void update() {
+#ifdef MIXERSTATS
+    const U64 start=__rdtsc();
+#endif
+    for (int i=0; i<ncxt; ++i) {
+      err[i]=((y<<12)-pr[i])*7;
+      assert(err[i]>=-32768 && err[i]<32768);
+    }
+    train_rows(&tx[0], &wx[0], N, &cxt[0], &err[0], ncxt, nx);
+    nx=base=ncxt=0;
+#ifdef MIXERSTATS
+    mixerStats.cycles+=__rdtsc()-start;
+#endif
+  }
+
+  // Input x (call up to N times)
+  void add(int x) {
+    assert(nx<N);
+    tx[nx++]=x;
+  }
+
+  // Set a context (call S times, sum of ranges <= M)
+  void set(int cx, int range) {
+    assert(range>=0);
+    assert(ncxt<S);
+    assert(cx>=0);
+    assert(base+cx<M);
+    cxt[ncxt++]=base+cx;
+    base+=range;
+  }
+
+  // predict next bit
+  int p() {
+    while (nx&7) tx[nx++]=0;  // pad
+    if (mp) {  // combine outputs
+      mp->update();
+      dot_products(&tx[0], &wx[0], N, &cxt[0], ncxt, nx, &pr[0]);
+      for (int i=0; i<ncxt; ++i) {
+        pr[i]=squash(pr[i]>>5);
+        mp->add(stretch(pr[i]));
+      }
+      mp->set(0, 1);
+      return mp->p();
+    }
+    else {  // S=1 context
+      const int c=0;
+      dot_products(&tx[0], &wx[0], N, &c, 1, nx, &pr[0]);
+      return pr[0]=squash(pr[0]>>8);
+    }
+  }
+  void state(State& s) {
+    s(ncxt), s(base), s(nx);
+    if (mp) mp->state(s);
+  }
+  ~Mixer();
+};
+
+Mixer::~Mixer() {
+  delete mp;
+}
+
+
+Mixer::Mixer(int n, int m, int s, int w):
+    N((n+7)&-8), M(m), S(s), tx(N), wx(N*M),
+    cxt(S), ncxt(0), base(0), nx(0), pr(S), err(S), mp(0) {
+  assert(n>0 && N>0 && (N&7)==0 && M>0);
+  int i;
+  for (i=0; i<S; ++i)
+    pr[i]=2048;
+  for (i=0; i<N*M; ++i)
+    wx[i]=w;
+  if (S>1) mp=new Mixer(S, 1, 1);
+}
+
+//////////////////////////// APM1 //////////////////////////////
+
+// APM1 maps a probability and a context into a new probability
+// that bit y will next be 1.  After each guess it updates
+// its state to improve future guesses.  Methods:
+//
+// APM1 a(N) creates with N contexts, uses 66*N bytes memory.
+// a.p(pr, cx, rate=7) returned adjusted probability in context cx (0 to
+//   N-1).  rate determines the learning rate (smaller = faster, default 7).
+//   Probabilities are scaled 12 bits (0-4095).
+
+class APM1 {
+  int index;     // last p, context
+  const int N;   // number of contexts
+  Array<U16> t;  // [N][33]:  p, context -> p
+public:
+  APM1(int n);
+  int p(int pr=2048, int cxt=0, int rate=7) {
+    assert(pr>=0 && pr<4096 && cxt>=0 && cxt<N && rate>0 && rate<32);
+    pr=stretch(pr);
+    int g=(y<<16)+(y<<rate)-y-y;
+    t[index] += (g-t[index]) >> rate;
+    t[index+1] += (g-t[index+1]) >> rate;
+    const int w=pr&127;  // interpolation weight (33 points)
+    index=((pr+2048)>>7)+cxt*33;
+    return (t[index]*(128-w)+t[index+1]*w) >> 11;
+  }
+  void state(State& s) {s(index);}
+};
+
+// maps p, cxt -> p initially
+APM1::APM1(int n): index(0), N(n), t(n*33) {
+  for (int j=0; j<33; ++j)
+    t[j]=squash((j-16)*128)*16;
+  for (int i=33; i<N*33; ++i)  // copy to the other contexts
+    t[i]=t[i-33];
+}
+
+//////////////////////////// StateMap, APM //////////////////////////
+
+// A StateMap maps a context to a probability.  Methods:
+//
+// Statemap sm(n) creates a StateMap with n contexts using 4*n bytes memory.
+// sm.p(y, cx, limit) converts state cx (0..n-1) to a probability (0..4095).
+//     that the next y=1, updating the previous prediction with y (0..1).
+//     limit (1..1023, default 1023) is the maximum count for computing a
+//     prediction.  Larger values are better for stationary sources.
+
+// dt[i] = 16K/(i+3), shared by all threads
+class DivTable {
+  int t[1024];
+public:
+  DivTable() {
+    for (int i=0; i<1024; ++i)
+      t[i]=16384/(i+i+3);
+  }
+  int operator[](int i) const {return t[i];}
+  const int* table() const {return t;}
+} dt;
+
+class StateMap {
+protected:
+  const int N;  // Number of contexts
+  int cxt;      // Context of last prediction
+  Array<U32> t;       // cxt -> prediction in high 22 bits, count in low 10 bits
+  inline void update(int limit) {
+    assert(cxt>=0 && cxt<N);
+    U32 *p=&t[cxt], p0=p[0];
+    int n=p0&1023, pr=p0>>10;  // count, prediction
+    if (n<limit) ++p0;
+    else p0=(p0&0xfffffc00)|limit;
+    p0+=(((y<<22)-pr)>>3)*dt[n]&0xfffffc00;
+    p[0]=p0;
+  }
+
+public:
+  StateMap(int n=256);
+
+  // update bit y (0..1), predict next bit in context cx
+  int p(int cx, int limit=1023) {
+    assert(cx>=0 && cx<N);
+    assert(limit>0 && limit<1024);
+    update(limit);
+    return t[cxt=cx]>>20;
+  }
+  void state(State& s) {s(cxt);}
+};
+
+StateMap::StateMap(int n): N(n), cxt(0), t(n) {
+  for (int i=0; i<N; ++i)
+    t[i]=1<<31;
+}
+
+// An APM maps a probability and a context to a new probability.  Methods:
+//
+// APM a(n) creates with n contexts using 96*n bytes memory.
+// a.pp(y, pr, cx, limit) updates and returns a new probability (0..4095)
+//     like with StateMap.  pr (0..4095) is considered part of the context.
+//     The output is computed by interpolating pr into 24 ranges nonlinearly
+//     with smaller ranges near the ends.  The initial output is pr.
+//     y=(0..1) is the last bit.  cx=(0..n-1) is the other context.
+//     limit=(0..1023) defaults to 255.
+
+class APM: public StateMap {
+public:
+  APM(int n);
+  int p(int pr, int cx, int limit=255) {
+   // assert(y>>1==0);
+    assert(pr>=0 && pr<4096);
+    assert(cx>=0 && cx<N/24);
+    assert(limit>0 && limit<1024);
+    update(limit);
+    pr=(stretch(pr)+2048)*23;
+    int wt=pr&0xfff;  // interpolation weight of next element
+    cx=cx*24+(pr>>12);
+    assert(cx>=0 && cx<N-1);
+    cxt=cx+(wt>>11);
+    pr=((t[cx]>>13)*(0x1000-wt)+(t[cx+1]>>13)*wt)>>19;
+    return pr;
+  }
+};
+
+APM::APM(int n): StateMap(n*24) {
+  for (int i=0; i<N; ++i) {
+    int p=((i%24*2+1)*4096)/48-2048;
+    t[i]=(U32(squash(p))<<20)+6;
+  }
+}
+
+
+//////////////////////////// hash //////////////////////////////
+
+// Hash 2-5 ints.
+inline U32 hash(U32 a, U32 b, U32 c=0xffffffff, U32 d=0xffffffff,
+    U32 e=0xffffffff) {
+  U32 h=a*200002979u+b*30005491u+c*50004239u+d*70004807u+e*110002499u;
+  return h^h>>9^a>>2^b>>3^c>>4^d>>5^e>>6;
+}
+
+///////////////////////////// BH ////////////////////////////////
+
+// A BH maps a 32 bit hash to an array of B bytes (checksum and B-2 values)
+//
+// BH bh(N); creates N element table with B bytes each.
+//   N must be a power of 2.  The first byte of each element is
+//   reserved for a checksum to detect collisions.  The remaining
+//   B-1 bytes are values, prioritized by the first value.  This
+//   byte is 0 to mark an unused element.
+//
+// bh[i] returns a pointer to the i'th element, such that
+//   bh[i][0] is a checksum of i, bh[i][1] is the priority, and
+//   bh[i][2..B-1] are other values (0-255).
+//   The low lg(n) bits as an index into the table.
+//   If a collision is detected, up to M nearby locations in the same
+//   cache line are tested and the first matching checksum or
+//   empty element is returned.
+//   If no match or empty element is found, then the lowest priority
+//   element is replaced.
+
+// 2 byte checksum with LRU replacement (except last 2 by priority)
+template <int B> class BH {
+  enum {M=8};  // search limit
+  Array<U8, 64> t; // elements
+  U32 n; // size-1
+public:
+  BH(size_t i): t(i*B), n(i-1) {
+    assert(B>=2 && i>0 && (i&(i-1))==0); // size a power of 2?
+  }
+  U8* operator[](U32 i);
+};
+
+template <int B>
+inline  U8* BH<B>::operator[](U32 i) {
+  U16 chk=(i>>16^i)&0xffff;
+  i=i*M&n;
+  U8 *p;
+  U16 *cp;
+  int j;
+  for (j=0; j<M; ++j) {
+    p=&t[(i+j)*B];
+    cp=(U16*)p;
+    if (p[2]==0) {*cp=chk;break;}
+    if (*cp==chk) break;  // found
+  }
+  if (j==0) return p+1;  // front
+  U8 tmp[B];  // element to move to front
+  if (j==M) {
+    --j;
+    memset(tmp, 0, B);
+    memmove(tmp, &chk, 2);
+    if (M>2 && t[(i+j)*B+2]>t[(i+j-1)*B+2]) --j;
+  }
+  else memcpy(tmp, cp, B);
+  memmove(&t[(i+1)*B], &t[i*B], j*B);
+  memcpy(&t[i*B], tmp, B);
+  return &t[i*B+1];
+}
+
+/////////////////////////// ContextMap /////////////////////////
+//
+// A ContextMap maps contexts to a bit histories and makes predictions
+// to a Mixer.  Methods common to all classes:
+//
+// ContextMap cm(M, C); creates using about M bytes of memory (a power
+//   of 2) for C contexts.
+// cm.set(cx);  sets the next context to cx, called up to C times
+//   cx is an arbitrary 32 bit value that identifies the context.
+//   It should be called before predicting the first bit of each byte.
+// cm.mix(m) updates Mixer m with the next prediction.  Returns 1
+//   if context cx is found, else 0.  Then it extends all the contexts with
+//   global bit y.  It should be called for every bit:
+//
+//     if (bpos==0)
+//       for (int i=0; i<C; ++i) cm.set(cxt[i]);
+//     cm.mix(m);
+//
+// The different types are as follows:
+//
+// - RunContextMap.  The bit history is a count of 0-255 consecutive
+//     zeros or ones.  Uses 4 bytes per whole byte context.  C=1.
+//     The context should be a hash.
+// - SmallStationaryContextMap.  0 <= cx < M/512.
+//     The state is a 16-bit probability that is adjusted after each
+//     prediction.  C=1.
+// - ContextMap.  For large contexts, C >= 1.  Context need not be hashed.
+
+// Each context of a ContextMap predicts to the mixer from its bit history
+// state s, mapped to a probability p1 by a StateMap for that context, and
+// from its run prediction.
+// The last 3 sets of inputs are shared by all ContextMaps of a Predictor.
+struct Mix2State {
+  int va[2], vb[2], vc[2];  // stretch(p1)>>2 and runs of the last 3 contexts
+  int threeCount;
+};
+TLS Mix2State mix2state;
+
+// Update the StateMaps of n contexts with y and compute their mixer inputs.
+// Context i has StateMap t[i*256..i*256+255], last predicted in state cx[i]
+// and now in state s[i].  v[k*S+i] (k=0..6) are its inputs, v[7*S+i] is
+// set by the caller.  The StateMap update is the same as StateMap::p().
+void predictStates(U32* t, int* cx, const int* s, int* v, int S, int n) {
+  for (int i=0; i<n; ++i, t+=256) {
+    U32 p0=t[cx[i]];
+    const int k=p0&1023, pr=p0>>10;  // count, prediction
+    if (k<1023) ++p0;
+    else p0=(p0&0xfffffc00)|1023;
+    p0+=(((y<<22)-pr)>>3)*dt[k]&0xfffffc00;
+    t[cx[i]]=p0;
+    cx[i]=s[i];
+    int p1=t[s[i]]>>20;
+    const int n0=-!nex(s[i],2), n1=-!nex(s[i],3);
+    const int st=stretch(p1)>>2;
+    p1>>=4;
+    const int q0=255-p1;
+    v[i]=st;
+    v[S+i]=p1-q0;
+    v[2*S+i]=st*(n1-n0);
+    v[3*S+i]=(p1&n0)-(q0&n1);
+    v[4*S+i]=(p1&n1)-(q0&n0);
+    v[5*S+i]=v[S+i]-v[3*S+i];
+    v[6*S+i]=v[S+i]-v[4*S+i];
+  }
+}
+
+#ifdef AVX
+
+// predictStates() for 8 contexts at a time.  AVX2 has no scatter, so the
+// StateMaps are written back one at a time.
+TARGET("avx2")
+void predictStates_avx2(U32* t, int* cx, const int* s, int* v, int S, int n) {
+  const __m256i lane=_mm256_setr_epi32(0, 256, 512, 768, 1024, 1280, 1536, 1792);
+  const __m256i yv=_mm256_set1_epi32(y<<22), hi=_mm256_set1_epi32(0xfffffc00);
+  const __m256i m1023=_mm256_set1_epi32(1023), m255=_mm256_set1_epi32(255);
+  const __m256i zero=_mm256_setzero_si256();
+  const int* dtab=dt.table();
+  const short* stab=stretch.table();
+  const U8* stab4=stateTable();  // 4 bytes per state
+  int i=0;
+  for (; i+8<=n; i+=8) {
+    const __m256i base=_mm256_add_epi32(_mm256_set1_epi32(i*256), lane);
+    const __m256i idx=_mm256_add_epi32(base,
+      _mm256_loadu_si256((const __m256i*)(cx+i)));
+    __m256i p0=_mm256_i32gather_epi32((const int*)t, idx, 4);
+    const __m256i k=_mm256_and_si256(p0, m1023);
+    const __m256i pr=_mm256_srli_epi32(p0, 10);
+    p0=_mm256_blendv_epi8(_mm256_or_si256(_mm256_and_si256(p0, hi), m1023),
+      _mm256_add_epi32(p0, _mm256_set1_epi32(1)), _mm256_cmpgt_epi32(m1023, k));
+    const __m256i d=_mm256_mullo_epi32(_mm256_srai_epi32(
+      _mm256_sub_epi32(yv, pr), 3), _mm256_i32gather_epi32(dtab, k, 4));
+    p0=_mm256_add_epi32(p0, _mm256_and_si256(d, hi));
+    alignas(32) U32 np[8];
+    alignas(32) int ni[8];
+    _mm256_store_si256((__m256i*)np, p0);
+    _mm256_store_si256((__m256i*)ni, idx);
+    for (int j=0; j<8; ++j) t[ni[j]]=np[j];
+    const __m256i sv=_mm256_loadu_si256((const __m256i*)(s+i));
+    _mm256_storeu_si256((__m256i*)(cx+i), sv);
+    __m256i p1=_mm256_srli_epi32(_mm256_i32gather_epi32((const int*)t,
+      _mm256_add_epi32(base, sv), 4), 20);
+    const __m256i row=_mm256_i32gather_epi32((const int*)stab4, sv, 4);
+    const __m256i n0=_mm256_cmpeq_epi32(_mm256_and_si256(
+      _mm256_srli_epi32(row, 16), m255), zero);
+    const __m256i n1=_mm256_cmpeq_epi32(_mm256_srli_epi32(row, 24), zero);
+    const __m256i st=_mm256_srai_epi32(_mm256_slli_epi32(
+      _mm256_i32gather_epi32((const int*)stab, p1, 2), 16), 18);
+    p1=_mm256_srli_epi32(p1, 4);
+    const __m256i q0=_mm256_sub_epi32(m255, p1);
+    const __m256i v1=_mm256_sub_epi32(p1, q0);
+    const __m256i v3=_mm256_sub_epi32(_mm256_and_si256(p1, n0),
+      _mm256_and_si256(q0, n1));
+    const __m256i v4=_mm256_sub_epi32(_mm256_and_si256(p1, n1),
+      _mm256_and_si256(q0, n0));
+    _mm256_storeu_si256((__m256i*)(v+i), st);
+    _mm256_storeu_si256((__m256i*)(v+S+i), v1);
+    _mm256_storeu_si256((__m256i*)(v+2*S+i),
+      _mm256_mullo_epi32(st, _mm256_sub_epi32(n1, n0)));
+    _mm256_storeu_si256((__m256i*)(v+3*S+i), v3);
+    _mm256_storeu_si256((__m256i*)(v+4*S+i), v4);
+    _mm256_storeu_si256((__m256i*)(v+5*S+i), _mm256_sub_epi32(v1, v3));
+    _mm256_storeu_si256((__m256i*)(v+6*S+i), _mm256_sub_epi32(v1, v4));
+  }
+  predictStates(t+i*256, cx+i, s+i, v+i, S, n-i);
+}
+
+// predictStates() for 16 contexts at a time, the last group masked.
+// (GCC 12 warnings about the AVX-512 shifts are off as for dot_rows_avx512.)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+TARGET("avx512f")
+void predictStates_avx512(U32* t, int* cx, const int* s, int* v, int S, int n) {
+  const __m512i lane=_mm512_mullo_epi32(_mm512_set1_epi32(256),
+    _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+  const __m512i yv=_mm512_set1_epi32(y<<22), hi=_mm512_set1_epi32(0xfffffc00);
+  const __m512i m1023=_mm512_set1_epi32(1023), m255=_mm512_set1_epi32(255);
+  const __m512i zero=_mm512_setzero_si512(), ones=_mm512_set1_epi32(-1);
+  const int* dtab=dt.table();
+  const short* stab=stretch.table();
+  const U8* stab4=stateTable();  // 4 bytes per state
+  for (int i=0; i<n; i+=16) {
+    const __mmask16 mk=n-i>=16 ? 0xffff : (1<<(n-i))-1;
+    const __m512i base=_mm512_add_epi32(_mm512_set1_epi32(i*256), lane);
+    const __m512i idx=_mm512_add_epi32(base, _mm512_maskz_loadu_epi32(mk, cx+i));
+    __m512i p0=_mm512_mask_i32gather_epi32(zero, mk, idx, t, 4);
+    const __m512i k=_mm512_and_si512(p0, m1023);
+    const __m512i pr=_mm512_srli_epi32(p0, 10);
+    p0=_mm512_mask_add_epi32(_mm512_or_si512(_mm512_and_si512(p0, hi), m1023),
+      _mm512_cmplt_epi32_mask(k, m1023), p0, _mm512_set1_epi32(1));
+    const __m512i d=_mm512_mullo_epi32(_mm512_srai_epi32(
+      _mm512_sub_epi32(yv, pr), 3),
+      _mm512_mask_i32gather_epi32(zero, mk, k, dtab, 4));
+    p0=_mm512_add_epi32(p0, _mm512_and_si512(d, hi));
+    _mm512_mask_i32scatter_epi32(t, mk, idx, p0, 4);
+    const __m512i sv=_mm512_maskz_loadu_epi32(mk, s+i);
+    _mm512_mask_storeu_epi32(cx+i, mk, sv);
+    __m512i p1=_mm512_srli_epi32(_mm512_mask_i32gather_epi32(zero, mk,
+      _mm512_add_epi32(base, sv), t, 4), 20);
+    const __m512i row=_mm512_mask_i32gather_epi32(zero, mk, sv, stab4, 4);
+    const __m512i n0=_mm512_maskz_mov_epi32(_mm512_cmpeq_epi32_mask(
+      _mm512_and_si512(_mm512_srli_epi32(row, 16), m255), zero), ones);
+    const __m512i n1=_mm512_maskz_mov_epi32(_mm512_cmpeq_epi32_mask(
+      _mm512_srli_epi32(row, 24), zero), ones);
+    const __m512i st=_mm512_srai_epi32(_mm512_slli_epi32(
+      _mm512_mask_i32gather_epi32(zero, mk, p1, stab, 2), 16), 18);
+    p1=_mm512_srli_epi32(p1, 4);
+    const __m512i q0=_mm512_sub_epi32(m255, p1);
+    const __m512i v1=_mm512_sub_epi32(p1, q0);
+    const __m512i v3=_mm512_sub_epi32(_mm512_and_si512(p1, n0),
+      _mm512_and_si512(q0, n1));
+    const __m512i v4=_mm512_sub_epi32(_mm512_and_si512(p1, n1),
+      _mm512_and_si512(q0, n0));
+    _mm512_mask_storeu_epi32(v+i, mk, st);
+    _mm512_mask_storeu_epi32(v+S+i, mk, v1);
+    _mm512_mask_storeu_epi32(v+2*S+i, mk,
+      _mm512_mullo_epi32(st, _mm512_sub_epi32(n1, n0)));
+    _mm512_mask_storeu_epi32(v+3*S+i, mk, v3);
+    _mm512_mask_storeu_epi32(v+4*S+i, mk, v4);
+    _mm512_mask_storeu_epi32(v+5*S+i, mk, _mm512_sub_epi32(v1, v3));
+    _mm512_mask_storeu_epi32(v+6*S+i, mk, _mm512_sub_epi32(v1, v4));
+  }
+}
+#pragma GCC diagnostic pop
+
+#endif
+
+// A RunContextMap maps a context into the next byte and a repeat
+// count up to M.  Size should be a power of 2.  Memory usage is 3M/4.
+class RunContextMap {
+  BH<4> t;
+  U8* cp;
+public:
+  RunContextMap(size_t m): t(m/4) {cp=t[0]+1;}
+  void set(U32 cx) {  // update count
+    if (cp[0]==0 || cp[1]!=buf(1)) cp[0]=1, cp[1]=buf(1);
+    else if (cp[0]<255) ++cp[0];
+    cp=t[cx]+1;
+  }
+  int p() {  // predict next bit
+    if ((cp[1]+256)>>(8-bpos)==c0)
+      return ((cp[1]>>(7-bpos)&1)*2-1)*ilog(cp[0]+1)*8;
+    else
+      return 0;
+  }
+  int mix(Mixer& m) {  // return run length
+    m.add(p());
+    return cp[0]!=0;
+  }
+  void state(State& s) {s.ptr(cp);}
+};
+
+// Context is looked up directly.  m=size is power of 2 in bytes.
+// Context should be < m/512.  High bits are discarded.
+class SmallStationaryContextMap {
+  Array<U16> t;
+  int cxt;
+  U16 *cp;
+public:
+  SmallStationaryContextMap(int m): t(m/2), cxt(0) {
+    assert((m/2&m/2-1)==0); // power of 2?
+    for (int i=0; i<int(t.size()); ++i)
+      t[i]=32768;
+    cp=&t[0];
+  }
+  void set(U32 cx) {
+    cxt=cx*256&(t.size()-256);
+  }
+  void mix(Mixer& m, int rate=7) {
+    *cp += ((y<<16)-(*cp)+(1<<(rate-1))) >> rate;
+    cp=&t[cxt+c0];
+    m.add(stretch((*cp)>>4));
+  }
+  void state(State& s) {s(cxt), s.ptr(cp);}
+};
+
+// Context map for large contexts.  Most modeling uses this type of context
+// map.  It includes a built in RunContextMap to predict the last byte seen
+// in the same context, and also bit-level contexts that map to a bit
+// history state.
+//
+// Bit histories are stored in a hash table.  The table is organized into
+// 64-byte buckets alinged on cache page boundaries.  Each bucket contains
+// a hash chain of 7 elements, plus a 2 element queue (packed into 1 byte)
+// of the last 2 elements accessed for LRU replacement.  Each element has
+// a 2 byte checksum for detecting collisions, and an array of 7 bit history
+// states indexed by the last 0 to 2 bits of context.  The buckets are indexed
+// by a context ending after 0, 2, or 5 bits of the current byte.  Thus, each
+// byte modeled results in 3 main memory accesses per context, with all other
+// accesses to cache.
+//
+// On bits 0, 2 and 5, the context is updated and a new bucket is selected.
+// The most recently accessed element is tried first, by comparing the
+// 16 bit checksum, then the 7 elements are searched linearly (or all at
+// once with SSE4.1, see E::probe()).  If no match is found, then the
+// element with the lowest priority among the 5 elements
+// not in the LRU queue is replaced.  After a replacement, the queue is
+// emptied (so that consecutive misses favor a LFU replacement policy).
+// In all cases, the found/replaced element is put in the front of the queue.
+//
+// The priority is the state number of the first element (the one with 0
+// additional bits of context).  The states are sorted by increasing n0+n1
+// (number of bits seen), implementing a LFU replacement policy.
+//
+// When the context ends on a byte boundary (bit 0), only 3 of the 7 bit
+// history states are used.  The remaining 4 bytes implement a run model
+// as follows: <count:7,d:1> <b1> <unused> <unused> where <b1> is the last byte
+// seen, possibly repeated.  <count:7,d:1> is a 7 bit count and a 1 bit
+// flag (represented by count * 2 + d).  If d=0 then <count> = 1..127 is the
+// number of repeats of <b1> and no other bytes have been seen.  If d is 1 then
+// other byte values have been seen in this context prior to the last <count>
+// copies of <b1>.
+//
+// The bucket for bit 0 is prefetched when the context is set.  The bucket
+// for bit 2 (or 5) depends on the next bit, so after bit 1 (or 4) both
+// candidates are prefetched.  The memory access then overlaps with the
+// work of the other models.  The decompressor does the same, since it
+// does not know the later bytes.  (Computing the order 0-14 contexts of
+// the byte 2 bytes ahead from the input when compressing, to prefetch
+// its buckets earlier, did not make -8 faster.)
+//
+// As an optimization, the last two hash elements of each byte (representing
+// contexts with 2-7 bits) are not updated until a context is seen for
+// a second time.  This is indicated by <count,d> = <1,0> (2).  After update,
+// <count,d> is updated to <2,0> or <1,1> (4 or 3).
+
+#ifdef CMBENCH
+// With -DCMBENCH, ContextMaps record their E::get() calls to cmTrace if
+// it is open, and the program replays them (see ContextMap benchmark).
+// The priorities before each call are recorded too, since they are
+// changed by bit history updates and not by get().  With them, a replay
+// sees the same checksums, LRU queue and priorities as the original.
+struct TraceRecord {
+  U32 index;    // bucket, or table size for NEWMAP
+  U16 chk;      // checksum
+  U16 map;      // ContextMap id
+  U8 slot;      // element returned (0-6), NEWMAP or FREEMAP
+  U8 pri[7];    // bh[0..6][0] before the call
+};
+enum {NEWMAP=254, FREEMAP=255};
+FILE* cmTrace=0;
+int traceMaps=0;  // number of ContextMaps created
+
+void trace(U32 index, U16 chk, int map, int slot, const U8* pri=0) {
+  TraceRecord r={index, chk, U16(map), U8(slot), {0}};
+  if (pri) for (int i=0; i<7; ++i) r.pri[i]=pri[i*7];
+  if (fwrite(&r, sizeof(r), 1, cmTrace)!=1) quit("trace write error");
+}
+#endif
+
+class ContextMap {
+  const int C;  // max number of contexts
+  const bool ThreeWay;
+  class E {  // hash element, 64 bytes
+    U16 chk[7];  // byte context checksums
+    U8 last;     // last 2 accesses (0-6) in low, high nibble
+  public:
+    U8 bh[7][7]; // byte context, 3-bit context -> bit history state
+      // bh[][0] = 1st bit, bh[][1,2] = 2nd bit, bh[][3..6] = 3rd bit
+      // bh[][0] is also a replacement priority, 0 = empty
+    U8* get(U16 chk);  // Find element (0-6) matching checksum.
+      // If not found, insert or replace lowest priority (not last).
+    U8* scan(U16 chk);   // get() after the last element, one at a time
+    U8* probe(U16 chk);  // scan() with all elements at once (SSE4.1)
+#ifdef CMBENCH
+    friend double replayTrace(const U8* p, long n, bool simd);
+#endif
+  };
+  Array<E, 64> t;  // bit histories for bits 0-1, 2-4, 5-7
+    // For 0-1, also contains a run count in bh[][4] and value in bh[][5]
+    // and pending update count in bh[7]
+  Array<U8*> cp;   // C pointers to current bit history
+  Array<U8*> cp0;  // First element of 7 element array containing cp[i]
+  Array<U32> cxt;  // C whole byte contexts (hashes)
+  Array<U8*> runp; // C [0..3] = count, value, unused, unused
+  const int S;     // C rounded up to a multiple of 16
+  Array<U32> sm;   // C StateMaps of state -> p, 256 each
+  Array<int> smcx; // C last states predicted by sm
+  Array<int> st;   // C current states
+  Array<int> v;    // 8 x S mixer inputs, v[k*S+i] for context i
+  int cn;          // Next context to set by set()
+#ifdef CMBENCH
+  int id;          // number of this map in the trace
+  friend double replayTrace(const U8* p, long n, bool simd);
+#endif
+  U8* get(U32 i, U16 chk);  // t[i].get(chk), i wrapped to the table size
+  void update(U32 cx, int c);  // train model that context cx predicts c
+  int mix1(Mixer& m, int cc, int bp, int c1, int y1);
+    // mix() with global context passed as arguments to improve speed.
+public:
+  ContextMap(size_t m, int c=1, bool isThree=false);  // m = memory in bytes, a power of 2, C = c
+#ifdef CMBENCH
+  ~ContextMap();
+#endif
+  void set(U32 cx, int next=-1);   // set next whole byte context to cx
+    // if next is 0 then set order does not matter
+  int mix(Mixer& m) {return mix1(m, c0, bpos, buf(1), y);}
+  void state(State& s) {s.ptrs(cp), s.ptrs(cp0), s.ptrs(runp), s(cn);}
+};
+
+// Find or create hash element matching checksum ch
+inline U8* ContextMap::E::get(U16 ch) {
+  if (chk[last&15]==ch) return &bh[last&15][0];
+#ifdef AVX
+  if (simd!=SIMD_NONE) return probe(ch);
+#endif
+  return scan(ch);
+}
+
+U8* ContextMap::E::scan(U16 ch) {
+  int b=0xffff, bi=0;
+  for (int i=0; i<7; ++i) {
+    if (chk[i]==ch) return last=last<<4|i, (U8*)&bh[i][0];
+    int pri=bh[i][0];
+    if (pri<b && (last&15)!=i && last>>4!=i) b=pri, bi=i;
+  }
+  return last=0xf0|bi, chk[bi]=ch, (U8*)memset(&bh[bi][0], 0, 7);
+}
+
+#ifdef AVX
+// The 7 checksums are compared in one instruction and the first match is
+// taken.  Otherwise PHMINPOSUW finds the first lowest priority, with the
+// last 2 elements and lane 7 set to 0xffff so they are never chosen.
+TARGET("sse4.1") U8* ContextMap::E::probe(U16 ch) {
+  const int hit=_mm_movemask_epi8(_mm_cmpeq_epi16(
+    _mm_loadu_si128((const __m128i*)chk), _mm_set1_epi16(ch)))&0x3fff;
+  if (hit) {
+    const int i=__builtin_ctz(hit)>>1;
+    return last=last<<4|i, &bh[i][0];
+  }
+  const __m128i lane=_mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7);
+  const __m128i pri=_mm_setr_epi16(bh[0][0], bh[1][0], bh[2][0], bh[3][0],
+    bh[4][0], bh[5][0], bh[6][0], -1);
+  const __m128i skip=_mm_or_si128(
+    _mm_cmpeq_epi16(lane, _mm_set1_epi16(last&15)),
+    _mm_cmpeq_epi16(lane, _mm_set1_epi16(last>>4)));
+  const int bi=_mm_extract_epi16(_mm_minpos_epu16(
+    _mm_or_si128(pri, skip)), 1);
+  return last=0xf0|bi, chk[bi]=ch, (U8*)memset(&bh[bi][0], 0, 7);
+}
+#else
+U8* ContextMap::E::probe(U16 ch) {
+  return scan(ch);
+}
+#endif
+
+// Construct using m bytes of memory for c contexts
+ContextMap::ContextMap(size_t m, int c, bool isThree): ThreeWay(isThree), C(c), t(m>>6), cp(c), cp0(c),
+    cxt(c), runp(c), S((c+15)&-16), sm(c*256), smcx(c), st(c), v(S*8), cn(0) {
+  assert(m>=64 && (m&m-1)==0);  // power of 2?
+  assert(sizeof(E)==64);
+  for (int i=0; i<C*256; ++i)
+    sm[i]=1<<31;
+  for (int i=0; i<C; ++i) {
+    cp0[i]=cp[i]=&t[0].bh[0][0];
+    runp[i]=cp[i]+3;
+  }
+#ifdef CMBENCH
+  id=traceMaps++;
+  if (cmTrace) trace(t.size(), 0, id, NEWMAP);
+#endif
+}
+
+#ifdef CMBENCH
+ContextMap::~ContextMap() {
+  if (cmTrace) trace(0, 0, id, FREEMAP);
+}
+#endif
+
+inline U8* ContextMap::get(U32 i, U16 ch) {
+  E& e=t[i&(t.size()-1)];
+#ifdef CMBENCH
+  if (cmTrace) {
+    U8 pri[49];
+    memcpy(pri, &e.bh[0][0], 49);
+    U8* p=e.get(ch);
+    trace(&e-&t[0], ch, id, (p-&e.bh[0][0])/7, pri);
+    return p;
+  }
+#endif
+  return e.get(ch);
+}
+
+// Set the i'th context to cx
+inline void ContextMap::set(U32 cx, int next) {
+  int i=cn++;
+  i&=next;
+  assert(i>=0 && i<C);
+  cx=cx*987654323+i;  // permute (don't hash) cx to spread the distribution
+  cx=cx<<16|cx>>16;
+  cxt[i]=cx*123456791+i;
+  prefetch(&t[(cxt[i]+1)&(t.size()-1)]);
+}
+
+// Update the model with bit y1, and predict next bit to mixer m.
+// Context: cc=c0, bp=bpos, c1=buf(1), y1=y.
+int ContextMap::mix1(Mixer& m, int cc, int bp, int c1, int y1) {
+
+  // Update model with y
+  int result=0;
+  for (int i=0; i<cn; ++i) {
+    if (cp[i]) {
+      assert(cp[i]>=&t[0].bh[0][0] && cp[i]<=&t[t.size()-1].bh[6][6]);
+      assert((long(cp[i])&63)>=15);
+      int ns=nex(*cp[i], y1);
+      if (ns>=204 && rnd() << ((452-ns)>>3)) ns-=4;  // probabilistic increment
+      *cp[i]=ns;
+    }
+
+    // Update context pointers
+    if (bpos>1 && runp[i][0]==0)
+    {
+     cp[i]=0;
+    }
+    else
+    {
+     switch(bpos)
+     {
+      case 1: case 4:  // prefetch buckets for bits 2, 5
+       prefetch(&t[(cxt[i]+cc*2)&(t.size()-1)]);
+       prefetch(&t[(cxt[i]+cc*2+1)&(t.size()-1)]);
+       if (bpos==4) cp[i]=cp0[i]+3+(cc&3);
+       else cp[i]=cp0[i]+1+(cc&1);
+       break;
+      case 3: case 6: cp[i]=cp0[i]+1+(cc&1); break;
+      case 7: cp[i]=cp0[i]+3+(cc&3); break;
+      case 2: case 5: cp0[i]=cp[i]=get(cxt[i]+cc, cxt[i]>>16); break;
+      default:
+      {
+       cp0[i]=cp[i]=get(cxt[i]+cc, cxt[i]>>16);
+       // Update pending bit histories for bits 2-7
+       if (cp0[i][3]==2) {
+         const int c=cp0[i][4]+256;
+         U8 *p=get(cxt[i]+(c>>6), cxt[i]>>16);
+         p[0]=1+((c>>5)&1);
+         p[1+((c>>5)&1)]=1+((c>>4)&1);
+         p[3+((c>>4)&3)]=1+((c>>3)&1);
+         p=get(cxt[i]+(c>>3), cxt[i]>>16);
+         p[0]=1+((c>>2)&1);
+         p[1+((c>>2)&1)]=1+((c>>1)&1);
+         p[3+((c>>1)&3)]=1+(c&1);
+         cp0[i][6]=0;
+       }
+       // Update run count of previous context
+       if (runp[i][0]==0)  // new context
+         runp[i][0]=2, runp[i][1]=c1;
+       else if (runp[i][1]!=c1)  // different byte in context
+         runp[i][0]=1, runp[i][1]=c1;
+       else if (runp[i][0]<254)  // same byte in context
+         runp[i][0]+=2;
+       else if (runp[i][0]==255)
+         runp[i][0]=128;
+       runp[i]=cp0[i]+3;
+      } break;
+     }
+    }
+
+    int runs;
+    // predict from last byte in context
+    if ((runp[i][1]+256)>>(8-bp)==cc) {
+      int rc=runp[i][0];  // count*2, +1 if 2 different bytes seen
+      int b=(runp[i][1]>>(7-bp)&1)*2-1;  // predicted bit + for 1, - for 0
+      int c=ilog(rc+1)<<(2+(~rc&1));
+      runs=b*c;
+    }
+    else
+      runs=0;
+    v[7*S+i]=runs;
+    st[i]=cp[i] ? *cp[i] : 0;
+  }
+
+  // predict from bit contexts, all at once
+#ifdef AVX
+  if (simd==SIMD_AVX512) predictStates_avx512(&sm[0], &smcx[0], &st[0], &v[0], S, cn);
+  else if (simd==SIMD_AVX2) predictStates_avx2(&sm[0], &smcx[0], &st[0], &v[0], S, cn);
+  else
+#endif
+  predictStates(&sm[0], &smcx[0], &st[0], &v[0], S, cn);
+
+  // Input to mixer in context order
+  int *va=mix2state.va, *vb=mix2state.vb, *vc=mix2state.vc;
+  for (int i=0; i<cn; ++i) {
+    result+=st[i]>0;
+    if (ThreeWay) {
+      vc[0]=vb[0], vb[0]=va[0], va[0]=v[i];
+      vc[1]=vb[1], vb[1]=va[1], va[1]=v[7*S+i];
+      if (++mix2state.threeCount==3) {
+        m.add(va[0]+vb[0]-vc[0]);
+        m.add(vb[0]+vc[0]-va[0]);
+        m.add(vc[0]+va[0]-vb[0]);
+        m.add(va[1]+vb[1]-vc[1]);
+        m.add(vb[1]+vc[1]-va[1]);
+        m.add(vc[1]+va[1]-vb[1]);
+        mix2state.threeCount=0;
+      }
+    }
+    else {
+      m.add(v[7*S+i]);
+      m.add(v[5*S+i]);
+      m.add(v[6*S+i]);
+      m.add(v[i]);
+      m.add(v[2*S+i]);
+    }
+    m.add(v[3*S+i]);
+    m.add(v[4*S+i]);
+  }
+  if (!ThreeWay)
+    for (int i=max(cn-3, 0); i<cn; ++i) {
+      vc[0]=vb[0], vb[0]=va[0], va[0]=v[i];
+      vc[1]=vb[1], vb[1]=va[1], va[1]=v[7*S+i];
+    }
+  if (bp==7) cn=0;
+  return result;
+}
+
+//////////////////////////// Models //////////////////////////////
+
+// All of the models below take a Mixer as a parameter and write
+// predictions to it.
+
+//////////////////////////// matchModel ///////////////////////////
+
+// matchModel.p(m) finds the longest matching context and returns its length
+
+class MatchModel {
+  Array<int> t;  // hash table of pointers to contexts
+  int h;  // hash of last 7 bytes
+  int ptr;  // points to next byte of match if any
+  int len;  // length of match, or 0 if no match
+  int result;
+  SmallStationaryContextMap scm1;
+public:
+  MatchModel(): t(MEM), h(0), ptr(0), len(0), result(0), scm1(0x20000) {}
+  int p(Mixer& m);
+  void state(State& s) {s(h), s(ptr), s(len), s(result), scm1.state(s);}
+};
+
+int MatchModel::p(Mixer& m) {
+  const int MAXLEN=65534;  // longest allowed match + 1
+
+  if (!bpos) {
+    h=(h*997*8+buf(1)+1)&(t.size()-1);  // update context hash
+    if (len) ++len, ++ptr;
+    else {  // find match
+      ptr=t[h];
+      if (ptr && pos-ptr<buf.size())
+        while (buf(len+1)==buf[ptr-len-1] && len<MAXLEN) ++len;
+    }
+    t[h]=pos;  // update hash table
+    result=len;
+//    if (result>0 && !(result&0xfff)) printf("pos=%d len=%d ptr=%d\n", pos, len, ptr);
+    scm1.set(pos);
+  }
+
+  // predict
+  if (len)
+  {
+   if (buf(1)==buf[ptr-1] && c0==(buf[ptr]+256)>>(8-bpos))
+   {
+    if (len>MAXLEN) len=MAXLEN;
+    if (buf[ptr]>>(7-bpos)&1)
+    {
+     m.add(ilog(len)<<2);
+     m.add(min(len, 32)<<6);
+    }
+    else
+    {
+     m.add(-(ilog(len)<<2));
+     m.add(-(min(len, 32)<<6));
+    }
+   }
+   else
+   {
+    len=0;
+    m.add(0);
+    m.add(0);
+   }
+  }
+  else
+  {
+   m.add(0);
+   m.add(0);
+  }
+
+  scm1.mix(m);
+  return result;
+}
+
+//////////////////////////// wordModel /////////////////////////
+
+// Model English text (words and columns/end of line)
+class WordModel {
+  U32 frstchar, spafdo, spaces, spacecount, words, wordcount, wordlen, wordlen1;
+  U32 word0, word1, word2, word3, word4, word5;  // hashes
+  U32 number0, number1;  // hashes
+  U32 text0;  // hash stream of letters
+  ContextMap cm;
+  int nl1, nl;  // previous, current newline position
+public:
+  WordModel(): frstchar(0), spafdo(0), spaces(0), spacecount(0), words(0),
+    wordcount(0), wordlen(0), wordlen1(0), word0(0), word1(0), word2(0),
+    word3(0), word4(0), word5(0), number0(0), number1(0), text0(0),
+    cm(MEM*16, 20+3+3+6+1+1+1+1+1+1+2+1+1+1+1), nl1(-3), nl(-2) {}
+  void mix(Mixer& m);
+  void state(State& s) {
+    s(frstchar), s(spafdo), s(spaces), s(spacecount), s(words);
+    s(wordcount), s(wordlen), s(wordlen1), s(word0), s(word1), s(word2);
+    s(word3), s(word4), s(word5), s(number0), s(number1), s(text0);
+    cm.state(s), s(nl1), s(nl);
+  }
+};
+
+void WordModel::mix(Mixer& m) {
+  // Update word hashes
+  if (bpos==0) {
+    int c=c4&255;
+    if (spaces&0x80000000) --spacecount;
+    if (words&0x80000000) --wordcount;
+    spaces=spaces*2;
+    words=words*2;
+
+    if (c>='A' && c<='Z') c+='a'-'A';
+    if ((c>='a' && c<='z') || c>=128) {
+      ++words, ++wordcount;
+      word0=word0*263*32+c;
+      text0=text0*997*16+c;
+      wordlen++;
+      wordlen=min(wordlen,45);
+    }
+    else if (word0) {
+      word5=word4*23;
+      word4=word3*19;
+      word3=word2*17;
+      word2=word1*13;
+      word1=word0*11;
+      wordlen1=wordlen;
+      word0=wordlen=0;
+    }
+    if (c>='0' && c<='9') {
+      number0=number0*263*32+c;
+    }
+    else if (number0) {
+      number1=number0*11;
+      number0=0;
+    }
+    if (c=='.' || c=='!' || c=='?' || c==',' || c==';' || c==':') spafdo=0; else { ++spafdo; spafdo=min(63,spafdo); }
+    if (c==32 || c==10) { ++spaces, ++spacecount; if (c==10) nl1=nl, nl=pos-1;}
+    int col=min(255, pos-nl), above=buf[nl1+col]; // text column context
+    if (col<=2) frstchar=(col==2?min(c,96):0);
+    cm.set(spafdo|col<<8);
+    cm.set(spafdo|spaces<<8);
+    cm.set(frstchar<<11|c);
+    cm.set(col<<8|frstchar);
+    cm.set(spaces<<8|(words&255));
+
+    cm.set(number0+word2*31);
+    cm.set(number0+word1*31);
+    cm.set(number0*31+c);
+    cm.set(number0+number1*31);
+    cm.set(word0+number1*31);
+
+    cm.set(frstchar<<7);
+    cm.set(wordlen<<16|c);
+    cm.set(wordlen1<<8|col);
+    cm.set(c*64+spacecount/2);
+    U32 h=wordcount*64+spacecount;
+    cm.set((c<<13)+h);
+    cm.set(h);
+    cm.set(h+spafdo*8);
+
+    U32 d=c4&0xffff;
+    cm.set(d<<9|frstchar);
+
+    h=word0*271+buf(1);
+    cm.set(h);
+    cm.set(word0);
+    cm.set(h+word1);
+    cm.set(word0+word1*31);
+    cm.set(h+word1+word2*29);
+    cm.set(text0&0xffffff);
+    cm.set(text0&0xfffff);
+
+    cm.set(h+word2);
+    cm.set(h+word3);
+    cm.set(h+word4);
+    cm.set(h+word5);
+    cm.set(buf(1)|buf(3)<<8|buf(5)<<16);
+    cm.set(buf(2)|buf(4)<<8|buf(6)<<16);
+
+    cm.set(h+word1+word3);
+    cm.set(h+word2+word3);
+
+    // Text column models
+    cm.set(col<<16|buf(1)<<8|above);
+    cm.set(buf(1)<<8|above);
+    cm.set(col<<8|buf(1));
+    cm.set(col*(c==32));
+    cm.set(col);
+  }
+  cm.mix(m);
+}
+
+//////////////////////////// recordModel ///////////////////////
+
+// Model 2-D data with fixed record length.  Also order 1-2 models
+// that include the distance to the last match.
+
+class RecordModel {
+  Array<int> cpos1, cpos2, cpos3, cpos4;
+  Array<int> wpos1; // buf(1..2) -> last position
+  int rlen, rlen1, rlen2;  // run length and 2 candidates
+  int rcount1, rcount2;  // candidate counts
+  ContextMap cm, cn, co, cp;
+public:
+  RecordModel(): cpos1(256), cpos2(256), cpos3(256), cpos4(256),
+    wpos1(0x10000), rlen(2), rlen1(3), rlen2(4), rcount1(0), rcount2(0),
+    cm(32768, 3), cn(32768/2, 3), co(32768*2, 3), cp(MEM, 3) {}
+  void mix(Mixer& m);
+  void state(State& s) {
+    s(rlen), s(rlen1), s(rlen2), s(rcount1), s(rcount2);
+    cm.state(s), cn.state(s), co.state(s), cp.state(s);
+  }
+};
+
+void RecordModel::mix(Mixer& m) {
+  // Find record length
+  if (!bpos) {
+    int w=c4&0xffff, c=w&255, d=w>>8;
+    int r=pos-cpos1[c];
+    if (r>1 && r==cpos1[c]-cpos2[c]
+        && r==cpos2[c]-cpos3[c] && r==cpos3[c]-cpos4[c]
+        && (r>15 || ((c==buf(r*5+1)) && c==buf(r*6+1)))) {
+      if (r==rlen1) ++rcount1;
+      else if (r==rlen2) ++rcount2;
+      else if (rcount1>rcount2) rlen2=r, rcount2=1;
+      else rlen1=r, rcount1=1;
+    }
+    if (rcount1>15 && rlen!=rlen1) rlen=rlen1, rcount1=rcount2=0;
+    if (rcount2>15 && rlen!=rlen2) rlen=rlen2, rcount1=rcount2=0;
+
+    // Set 2 dimensional contexts
+    assert(rlen>0);
+    cm.set(c<<8| (min(255, pos-cpos1[c])/4));
+    cm.set(w<<9| llog(pos-wpos1[w])>>2);
+
+    cm.set(rlen|buf(rlen)<<10|buf(rlen*2)<<18);
+    cn.set(w|rlen<<8);
+    cn.set(d|rlen<<16);
+    cn.set(c|rlen<<8);
+
+    co.set(buf(1)<<8|min(255, pos-cpos1[buf(1)]));
+    co.set(buf(1)<<17|buf(2)<<9|llog(pos-wpos1[w])>>2);
+    int col=pos%rlen;
+    co.set(buf(1)<<8|buf(rlen));
+
+    //cp.set(w*16);
+    //cp.set(d*32);
+    //cp.set(c*64);
+    cp.set(rlen|buf(rlen)<<10|col<<18);
+    cp.set(rlen|buf(1)<<10|col<<18);
+    cp.set(col|rlen<<12);
+
+    // update last context positions
+    cpos4[c]=cpos3[c];
+    cpos3[c]=cpos2[c];
+    cpos2[c]=cpos1[c];
+    cpos1[c]=pos;
+    wpos1[w]=pos;
+  }
+  cm.mix(m);
+  cn.mix(m);
+  co.mix(m);
+  cp.mix(m);
+}
+
+
+//////////////////////////// sparseModel ///////////////////////
+
+// Model order 1-2 contexts with gaps.
+
+class SparseModel {
+  ContextMap cm;
+public:
+  SparseModel(): cm(MEM*2, 40) {}
+  void mix(Mixer& m, int seenbefore, int howmany);
+  void state(State& s) {cm.state(s);}
+};
+
+void SparseModel::mix(Mixer& m, int seenbefore, int howmany) {
+  if (bpos==0) {
+    cm.set(seenbefore);
+    cm.set(howmany);
+    cm.set(buf(1)|buf(5)<<8);
+    cm.set(buf(1)|buf(6)<<8);
+    cm.set(buf(3)|buf(6)<<8);
+    cm.set(buf(4)|buf(8)<<8);
+    cm.set(c4&0x00f0f0ff);
+    cm.set(c4&0x00ff00ff);
+    cm.set(c4&0xff0000ff);
+    cm.set(c4&0x00f8f8f8);
+    cm.set(c4&0xf8f8f8f8);
+    cm.set(c4&0x00f0f0f0);
+    cm.set(c4&0xf0f0f0f0);
+    cm.set(c4&0x00e0e0e0);
+    cm.set(c4&0xe0e0e0e0);
+    cm.set(c4&0x810000c1);
+    cm.set(c4&0xC3CCC38C);
+    cm.set(c4&0x0081CC81);
+    cm.set(c4&0x00c10081);
+    for (int i=1; i<8; ++i) {
+      cm.set(seenbefore|buf(i)<<8);
+      cm.set((buf(i+2)<<8)|buf(i+1));
+      cm.set((buf(i+3)<<8)|buf(i+1));
+    }
+  }
+  cm.mix(m);
+}
+
+//////////////////////////// distanceModel ///////////////////////
+
+// Model for modelling distances between symbols
+
+class DistanceModel {
+  ContextMap cr;
+  int pos00, pos20, posnl;
+public:
+  DistanceModel(): cr(MEM, 3), pos00(0), pos20(0), posnl(0) {}
+  void mix(Mixer& m);
+  void state(State& s) {cr.state(s), s(pos00), s(pos20), s(posnl);}
+};
+
+void DistanceModel::mix(Mixer& m) {
+  if (bpos == 0) {
+    int c=c4&0xff;
+    if (c==0x00) pos00=pos;
+    if (c==0x20) pos20=pos;
+    if (c==0xff||c=='\r'||c=='\n') posnl=pos;
+    cr.set(min(pos-pos00,255)|(c<<8));
+    cr.set(min(pos-pos20,255)|(c<<8));
+    cr.set(min(pos-posnl,255)|((c<<8)+234567));
+  }
+  cr.mix(m);
+}
+
+
+//////////////////////////// im24bitModel /////////////////////////////////
+
+// Model for 24-bit image data
+
+// Square buf(i)
+inline int sqrbuf(int i) {
+  assert(i>0);
+  return buf(i)*buf(i);
+}
+
+class Im24bitModel {
+  enum {SC=0x20000};
+  SmallStationaryContextMap scm1, scm2, scm3, scm4, scm5, scm6, scm7, scm8,
+    scm9, scm10;
+  ContextMap cm;
+  int col;
+public:
+  Im24bitModel(): scm1(SC), scm2(SC), scm3(SC), scm4(SC), scm5(SC), scm6(SC),
+    scm7(SC), scm8(SC), scm9(SC*2), scm10(512), cm(MEM*4, 13), col(0) {}
+  void mix(Mixer& m, int w);
+  void state(State& s) {
+    scm1.state(s), scm2.state(s), scm3.state(s), scm4.state(s);
+    scm5.state(s), scm6.state(s), scm7.state(s), scm8.state(s);
+    scm9.state(s), scm10.state(s), cm.state(s), s(col);
+  }
+};
+
+void Im24bitModel::mix(Mixer& m, int w) {
+
+  // Select nearby pixels as context
+  if (!bpos) {
+    assert(w>3);
+    int color=pos%3;
+    int mean=buf(3)+buf(w-3)+buf(w)+buf(w+3);
+    const int var=(sqrbuf(3)+sqrbuf(w-3)+sqrbuf(w)+sqrbuf(w+3)-mean*mean/4)>>2;
+    mean>>=2;
+    const int logvar=ilog(var);
+    int i=color<<4;
+    cm.set(hash(++i, buf(3)));
+    cm.set(hash(++i, buf(3), buf(1)));
+    cm.set(hash(++i, buf(3), buf(1), buf(2)));
+    cm.set(hash(++i, buf(w)));
+    cm.set(hash(++i, buf(w), buf(1)));
+    cm.set(hash(++i, buf(w), buf(1), buf(2)));
+    cm.set(hash(++i, (buf(3)+buf(w))>>3, buf(1)>>4, buf(2)>>4));
+    cm.set(hash(++i, buf(1), buf(2)));
+    cm.set(hash(++i, buf(3), buf(1)-buf(4)));
+    cm.set(hash(++i, buf(3)+buf(1)-buf(4)));
+    cm.set(hash(++i, buf(w), buf(1)-buf(w+1)));
+    cm.set(hash(++i, buf(w)+buf(1)-buf(w+1)));
+    cm.set(hash(++i, mean, logvar>>4));
+    scm1.set(buf(3)+buf(w)-buf(w+3));
+    scm2.set(buf(3)+buf(w-3)-buf(w));
+    scm3.set(buf(3)*2-buf(6));
+    scm4.set(buf(w)*2-buf(w*2));
+    scm5.set(buf(w+3)*2-buf(w*2+6));
+    scm6.set(buf(w-3)*2-buf(w*2-6));
+    scm7.set(buf(w-3)+buf(1)-buf(w-2));
+    scm8.set(buf(w)+buf(w-3)-buf(w*2-3));
+    scm9.set(mean>>1|(logvar<<1&0x180));
+  }
+
+  // Predict next bit
+  scm1.mix(m);
+  scm2.mix(m);
+  scm3.mix(m);
+  scm4.mix(m);
+  scm5.mix(m);
+  scm6.mix(m);
+  scm7.mix(m);
+  scm8.mix(m);
+  scm9.mix(m);
+  scm10.mix(m);
+  cm.mix(m);
+  if (++col>=24) col=0;
+  m.set(2, 8);
+  m.set(col, 24);
+  m.set((buf(1)>>4)*3+(pos%3), 48);
+  m.set(c0, 256);
+}
+
+//////////////////////////// im8bitModel /////////////////////////////////
+
+// Model for 8-bit image data
+
+class Im8bitModel {
+  enum {SC=0x20000};
+  SmallStationaryContextMap scm1, scm2, scm3, scm4, scm5, scm6, scm7;
+  ContextMap cm;
+  int col;
+public:
+  Im8bitModel(): scm1(SC), scm2(SC), scm3(SC), scm4(SC), scm5(SC),
+    scm6(SC*2), scm7(SC), cm(MEM*4, 32), col(0) {}
+  void mix(Mixer& m, int w);
+  void state(State& s) {
+    scm1.state(s), scm2.state(s), scm3.state(s), scm4.state(s);
+    scm5.state(s), scm6.state(s), scm7.state(s), cm.state(s), s(col);
+  }
+};
+
+void Im8bitModel::mix(Mixer& m, int w) {
+
+  // Select nearby pixels as context
+  if (!bpos) {
+    assert(w>3);
+    int mean=buf(1)+buf(w-1)+buf(w)+buf(w+1);
+    const int var=(sqrbuf(1)+sqrbuf(w-1)+sqrbuf(w)+sqrbuf(w+1)-mean*mean/4)>>2;
+    mean>>=2;
+    const int logvar=ilog(var);
+    int i=0;
+    // 2 x
+    cm.set(hash(++i, buf(1)>>2, buf(w)>>2));
+    cm.set(hash(++i, buf(1)>>2, buf(2)>>2));
+    cm.set(hash(++i, buf(w)>>2, buf(w*2)>>2));
+    cm.set(hash(++i, buf(1)>>2, buf(w-1)>>2));
+    cm.set(hash(++i, buf(w)>>2, buf(w+1)>>2));
+    cm.set(hash(++i, buf(w+1)>>2, buf(w+2)>>2));
+    cm.set(hash(++i, buf(w+1)>>2, buf(w*2+2)>>2));
+    cm.set(hash(++i, buf(w-1)>>2, buf(w*2-2)>>2));
+    cm.set(hash(++i, (buf(1)+buf(w))>>1));
+    cm.set(hash(++i, (buf(1)+buf(2))>>1));
+    cm.set(hash(++i, (buf(w)+buf(w*2))>>1));
+    cm.set(hash(++i, (buf(1)+buf(w-1))>>1));
+    cm.set(hash(++i, (buf(w)+buf(w+1))>>1));
+    cm.set(hash(++i, (buf(w+1)+buf(w+2))>>1));
+    cm.set(hash(++i, (buf(w+1)+buf(w*2+2))>>1));
+    cm.set(hash(++i, (buf(w-1)+buf(w*2-2))>>1));
+    // 3 x
+    cm.set(hash(++i, buf(w)>>2, buf(1)>>2, buf(w-1)>>2));
+    cm.set(hash(++i, buf(w-1)>>2, buf(w)>>2, buf(w+1)>>2));
+    cm.set(hash(++i, buf(1)>>2, buf(w-1)>>2, buf(w*2-1)>>2));
+    // mixed
+    cm.set(hash(++i, (buf(3)+buf(w))>>1, buf(1)>>2, buf(2)>>2));
+    cm.set(hash(++i, (buf(2)+buf(1))>>1,(buf(w)+buf(w*2))>>1,buf(w-1)>>2));
+    cm.set(hash(++i, (buf(2)+buf(1))>>2,(buf(w-1)+buf(w))>>2));
+    cm.set(hash(++i, (buf(2)+buf(1))>>1,(buf(w)+buf(w*2))>>1));
+    cm.set(hash(++i, (buf(2)+buf(1))>>1,(buf(w-1)+buf(w*2-2))>>1));
+    cm.set(hash(++i, (buf(2)+buf(1))>>1,(buf(w+1)+buf(w*2+2))>>1));
+    cm.set(hash(++i, (buf(w)+buf(w*2))>>1,(buf(w-1)+buf(w*2+2))>>1));
+    cm.set(hash(++i, (buf(w-1)+buf(w))>>1,(buf(w)+buf(w+1))>>1));
+    cm.set(hash(++i, (buf(1)+buf(w-1))>>1,(buf(w)+buf(w*2))>>1));
+    cm.set(hash(++i, (buf(1)+buf(w-1))>>2,(buf(w)+buf(w+1))>>2));
+    cm.set(hash(++i, (((buf(1)-buf(w-1))>>1)+buf(w))>>2));
+    cm.set(hash(++i, (((buf(w-1)-buf(w))>>1)+buf(1))>>2));
+    cm.set(hash(++i, (-buf(1)+buf(w-1)+buf(w))>>2));
+    scm1.set((buf(1)+buf(w))>>1);
+    scm2.set((buf(1)+buf(w)-buf(w+1))>>1);
+    scm3.set((buf(1)*2-buf(2))>>1);
+    scm4.set((buf(w)*2-buf(w*2))>>1);
+    scm5.set((buf(1)+buf(w)-buf(w-1))>>1);
+    scm6.set(mean>>1|(logvar<<1&0x180));
+  }
+
+  // Predict next bit
+  scm1.mix(m);
+  scm2.mix(m);
+  scm3.mix(m);
+  scm4.mix(m);
+  scm5.mix(m);
+  scm6.mix(m);
+  scm7.mix(m); // Amazingly but improves compression!
+  cm.mix(m);
+  if (++col>=8) col=0; // reset after every 24 columns?
+  m.set(2, 8);
+  m.set(col, 8);
+  m.set((buf(w)+buf(1))>>4, 32);
+  m.set(c0, 256);
+}
+
+//////////////////////////// im1bitModel /////////////////////////////////
+
+// Model for 1-bit image data
+
+class Im1bitModel {
+  enum {N=4+1+1+1+1+1};  // number of contexts
+  U32 r0, r1, r2, r3;  // last 4 rows, bit 8 is over current pixel
+  Array<U8> t;  // model: cxt -> state
+  int cxt[N];  // contexts
+  StateMap sm[N];
+public:
+  Im1bitModel(): r0(0), r1(0), r2(0), r3(0), t(0x10200) {
+    memset(cxt, 0, sizeof(cxt));
+  }
+  void mix(Mixer& m, int w);
+  void state(State& s) {
+    s(r0), s(r1), s(r2), s(r3), s(cxt);
+    for (int i=0; i<N; ++i) sm[i].state(s);
+  }
+};
+
+void Im1bitModel::mix(Mixer& m, int w) {
+  // update the model
+  int i;
+  for (i=0; i<N; ++i)
+    t[cxt[i]]=nex(t[cxt[i]],y);
+
+  // update the contexts (pixels surrounding the predicted one)
+  r0+=r0+y;
+  r1+=r1+((buf(w-1)>>(7-bpos))&1);
+  r2+=r2+((buf(w+w-1)>>(7-bpos))&1);
+  r3+=r3+((buf(w+w+w-1)>>(7-bpos))&1);
+  cxt[0]=(r0&0x7)|(r1>>4&0x38)|(r2>>3&0xc0);
+  cxt[1]=0x100+((r0&1)|(r1>>4&0x3e)|(r2>>2&0x40)|(r3>>1&0x80));
+  cxt[2]=0x200+((r0&0x3f)^(r1&0x3ffe)^(r2<<2&0x7f00)^(r3<<5&0xf800));
+  cxt[3]=0x400+((r0&0x3e)^(r1&0x0c0c)^(r2&0xc800));
+  cxt[4]=0x800+(((r1&0x30)^(r3&0x0c0c))|(r0&3));
+  cxt[5]=0x1000+((!r0&0x444)|(r1&0xC0C)|(r2&0xAE3)|(r3&0x51C));
+  cxt[6]=0x2000+((r0&1)|(r1>>4&0x1d)|(r2>>1&0x60)|(r3&0xC0));
+  cxt[7]=0x4000+((r0>>4&0x2AC)|(r1&0xA4)|(r2&0x349)|(!r3&0x14D));
+
+  // predict
+  for (i=0; i<N; ++i) m.add(stretch(sm[i].p(t[cxt[i]])));
+}
+
+//////////////////////////// jpegModel /////////////////////////
+
+// Model JPEG. Return 1 if a JPEG file is detected or else 0.
+// Only the baseline and 8 bit extended Huffman coded DCT modes are
+// supported.  The model partially decodes the JPEG image to provide
+// context for the Huffman coded symbols.
+
+// Print a JPEG segment at buf[p...] for debugging
+/*
+void dump(const char* msg, int p) {
+  printf("%s:", msg);
+  int len=buf[p+2]*256+buf[p+3];
+  for (int i=0; i<len+2; ++i)
+    printf(" %02X", buf[p+i]);
+  printf("\n");
+}
+*/
+
+// Detect invalid JPEG data.  The proper response is to silently
+// fall back to a non-JPEG model.
+#define jassert(x) if (!(x)) { \
+/*  printf("JPEG error at %d, line %d: %s\n", pos, __LINE__, #x); */ \
+  jpeg=0; \
+  return next_jpeg;}
+
+struct HUF {U32 min, max; int val;}; // Huffman decode tables
+  // huf[Tc][Th][m] is the minimum, maximum+1, and pointer to codes for
+  // coefficient type Tc (0=DC, 1=AC), table Th (0-3), length m+1 (m=0-15)
+
+class JpegModel {
+  // State of parser
+  enum {SOF0=0xc0, SOF1, SOF2, SOF3, DHT, RST0=0xd0, SOI=0xd8, EOI, SOS, DQT,
+    DNL, DRI, APP0=0xe0, COM=0xfe, FF};  // Second byte of 2 byte codes
+  int jpeg;  // 1 if JPEG is header detected, 2 if image data
+  int next_jpeg;  // updated with jpeg on next byte boundary
+  int app;  // Bytes remaining to skip in APPx or COM field
+  int sof, sos, data;  // pointers to buf
+  Array<int> ht;  // pointers to Huffman table headers
+  int htsize;  // number of pointers in ht
+
+  // Huffman decode state
+  U32 huffcode;  // Current Huffman code including extra bits
+  int huffbits;  // Number of valid bits in huffcode
+  int huffsize;  // Number of bits without extra bits
+  int rs;  // Decoded huffcode without extra bits.  It represents
+    // 2 packed 4-bit numbers, r=run of zeros, s=number of extra bits for
+    // first nonzero code.  huffcode is complete when rs >= 0.
+    // rs is -1 prior to decoding incomplete huffcode.
+  int mcupos;  // position in MCU (0-639).  The low 6 bits mark
+    // the coefficient in zigzag scan order (0=DC, 1-63=AC).  The high
+    // bits mark the block within the MCU, used to select Huffman tables.
+
+  // Decoding tables
+  Array<HUF> huf;  // Tc*64+Th*16+m -> min, max, val
+  int mcusize;  // number of coefficients in an MCU
+  int linesize; // width of image in MCU
+  int hufsel[2][10];  // DC/AC, mcupos/64 -> huf decode table
+  Array<U8> hbuf;  // Tc*1024+Th*256+hufcode -> RS
+
+  // Image state
+  Array<int> color;  // block -> component (0-3)
+  Array<int> pred;  // component -> last DC value
+  int dc;  // DC value of the current block
+  int width;  // Image width in MCU
+  int row, column;  // in MCU (column 0 to width-1)
+  Buf cbuf; // Rotating buffer of coefficients, coded as:
+    // DC: level shifted absolute value, low 4 bits discarded, i.e.
+    //   [-1023...1024] -> [0...255].
+    // AC: as an RS code: a run of R (0-15) zeros followed by an S (0-15)
+    //   bit number, or 00 for end of block (in zigzag order).
+    //   However if R=0, then the format is ssss11xx where ssss is S,
+    //   xx is the first 2 extra bits, and the last 2 bits are 1 (since
+    //   this never occurs in a valid RS code).
+  int cpos;  // position in cbuf
+  U32 huff1, huff2, huff3, huff4;  // hashes of last codes
+  int rs1, rs2, rs3, rs4;  // last 4 RS codes
+  int ssum, ssum1, ssum2, ssum3;
+    // sum of S in RS codes in block and sum of S in first component
+
+  IntBuf cbuf2;
+  Array<int> adv_pred, sumu, sumv;
+  Array<int> ls;  // block -> distance to previous block
+  Array<int> lcp, zpos;
+
+    //for parsing Quantization tables
+  int dqt_state, dqt_end, qnum;
+  Array<U8> qtab; // table
+  Array<int> qmap; // block -> table number
+
+  // Context model
+  enum {N=28}; // size of t, number of contexts
+  BH<9> t;  // context hash -> bit history
+    // As a cache optimization, the context does not include the last 1-2
+    // bits of huffcode if the length (huffbits) is not a multiple of 3.
+    // The 7 mapped values are for context+{"", 0, 00, 01, 1, 10, 11}.
+  Array<U32> cxt;  // context hashes
+  Array<U8*> cp;  // context pointers
+  StateMap sm[N];
+  Mixer m1;
+  APM a1, a2;
+  int hbcount;
+public:
+  JpegModel(): jpeg(0), next_jpeg(0), app(0), sof(0), sos(0), data(0), ht(8),
+    htsize(0), huffcode(0), huffbits(0), huffsize(0), rs(-1), mcupos(0),
+    huf(128), mcusize(0), linesize(0), hbuf(2048), color(10), pred(4), dc(0),
+    width(0), row(0), column(0), cbuf(0x20000), cpos(0), huff1(0), huff2(0),
+    huff3(0), huff4(0), rs1(0), rs2(0), rs3(0), rs4(0), ssum(0), ssum1(0),
+    ssum2(0), ssum3(0), cbuf2(0x20000), adv_pred(7), sumu(8), sumv(8), ls(10),
+    lcp(4), zpos(64), dqt_state(-1), dqt_end(0), qnum(0), qtab(256), qmap(10),
+    t(MEM), cxt(N), cp(N), m1(32, 770, 3), a1(0x8000), a2(0x10000),
+    hbcount(2) {
+    memset(hufsel, 0, sizeof(hufsel));
+  }
+  int mix(Mixer& m);
+  void state(State& s);
+};
+
+void JpegModel::state(State& s) {
+  s(jpeg), s(next_jpeg), s(app), s(sof), s(sos), s(data), s(htsize);
+  s(huffcode), s(huffbits), s(huffsize), s(rs), s(mcupos), s(mcusize);
+  s(linesize), s(hufsel), s(dc), s(width), s(row), s(column), s(cpos);
+  s(huff1), s(huff2), s(huff3), s(huff4), s(rs1), s(rs2), s(rs3), s(rs4);
+  s(ssum), s(ssum1), s(ssum2), s(ssum3), s(dqt_state), s(dqt_end), s(qnum);
+  s.ptrs(cp);
+  for (int i=0; i<N; ++i) sm[i].state(s);
+  m1.state(s), a1.state(s), a2.state(s), s(hbcount);
+}
+
+int JpegModel::mix(Mixer& m) {
+  const static U8 zzu[64]={  // zigzag coef -> u,v
+    0,1,0,0,1,2,3,2,1,0,0,1,2,3,4,5,4,3,2,1,0,0,1,2,3,4,5,6,7,6,5,4,
+    3,2,1,0,1,2,3,4,5,6,7,7,6,5,4,3,2,3,4,5,6,7,7,6,5,4,5,6,7,7,6,7};
+  const static U8 zzv[64]={
+    0,0,1,2,1,0,0,1,2,3,4,3,2,1,0,0,1,2,3,4,5,6,5,4,3,2,1,0,0,1,2,3,
+    4,5,6,7,7,6,5,4,3,2,1,2,3,4,5,6,7,7,6,5,4,3,4,5,6,7,7,6,5,6,7,7};
+
+  // Be sure to quit on a byte boundary
+  if (!bpos) next_jpeg=jpeg>1;
+  if (bpos && !jpeg) return next_jpeg;
+  if (!bpos && app>=0) --app;
+  if (app>0) return next_jpeg;
+  if (!bpos) {
+
+    // Parse.  Baseline DCT-Huffman JPEG syntax is:
+    // SOI APPx... misc... SOF0 DHT... SOS data EOI
+    // SOI (= FF D8) start of image.
+    // APPx (= FF Ex) len ... where len is always a 2 byte big-endian length
+    //   including the length itself but not the 2 byte preceding code.
+    //   Application data is ignored.  There may be more than one APPx.
+    // misc codes are DQT, DNL, DRI, COM (ignored).
+    // SOF0 (= FF C0) len 08 height width Nf [C HV Tq]...
+    //   where len, height, width (in pixels) are 2 bytes, Nf is the repeat
+    //   count (1 byte) of [C HV Tq], where C is a component identifier
+    //   (color, 0-3), HV is the horizontal and vertical dimensions
+    //   of the MCU (high, low bits, packed), and Tq is the quantization
+    //   table ID (not used).  An MCU (minimum compression unit) consists
+    //   of 64*H*V DCT coefficients for each color.
+    // DHT (= FF C4) len [TcTh L1...L16 V1,1..V1,L1 ... V16,1..V16,L16]...
+    //   defines Huffman table Th (1-4) for Tc (0=DC (first coefficient)
+    //   1=AC (next 63 coefficients)).  L1..L16 are the number of codes
+    //   of length 1-16 (in ascending order) and Vx,y are the 8-bit values.
+    //   A V code of RS means a run of R (0-15) zeros followed by S (0-15)
+    //   additional bits to specify the next nonzero value, negative if
+    //   the first additional bit is 0 (e.g. code x63 followed by the
+    //   3 bits 1,0,1 specify 7 coefficients: 0, 0, 0, 0, 0, 0, 5.
+    //   Code 00 means end of block (remainder of 63 AC coefficients is 0).
+    // SOS (= FF DA) len Ns [Cs TdTa]... 0 3F 00
+    //   Start of scan.  TdTa specifies DC/AC Huffman tables (0-3, packed
+    //   into one byte) for component Cs matching C in SOF0, repeated
+    //   Ns (1-4) times.
+    // EOI (= FF D9) is end of image.
+    // Huffman coded data is between SOI and EOI.  Codes may be embedded:
+    // RST0-RST7 (= FF D0 to FF D7) mark the start of an independently
+    //   compressed region.
+    // DNL (= FF DC) 04 00 height
+    //   might appear at the end of the scan (ignored).
+    // FF 00 is interpreted as FF (to distinguish from RSTx, DNL, EOI).
+
+    // Detect JPEG (SOI, APPx)
+    if (!jpeg && buf(4)==FF && buf(3)==SOI && buf(2)==FF && buf(1)>>4==0xe) {
+      jpeg=1;
+      sos=sof=htsize=data=mcusize=linesize=0, app=2;
+      huffcode=huffbits=huffsize=mcupos=cpos=0, rs=-1;
+      memset(&huf[0], 0, huf.size()*sizeof(HUF));
+      memset(&pred[0], 0, pred.size()*sizeof(int));
+    }
+
+    // Detect end of JPEG when data contains a marker other than RSTx
+    // or byte stuff (00).
+    if (jpeg && data && buf(2)==FF && buf(1) && (buf(1)&0xf8)!=RST0) {
+      jassert(buf(1)==EOI);
+      jpeg=0;
+    }
+    if (!jpeg) return next_jpeg;
+
+    // Detect APPx or COM field
+    if (!data && !app && buf(4)==FF && (buf(3)>>4==0xe || buf(3)==COM))
+      app=buf(2)*256+buf(1)+2;
+
+    // Save pointers to sof, ht, sos, data,
+    if (buf(5)==FF && buf(4)==SOS) {
+      int len=buf(3)*256+buf(2);
+      if (len==6+2*buf(1) && buf(1) && buf(1)<=4)  // buf(1) is Ns
+        sos=pos-5, data=sos+len+2, jpeg=2;
+    }
+    if (buf(4)==FF && buf(3)==DHT && htsize<8) ht[htsize++]=pos-4;
+    if (buf(4)==FF && buf(3)==SOF0) sof=pos-4;
+
+    // Parse Quantizazion tables
+    if (buf(4)==FF && buf(3)==DQT)
+      dqt_end=pos+buf(2)*256+buf(1)-1, dqt_state=0;
+    else if (dqt_state>=0) {
+      if (int(pos-dqt_end)>=0)  // pos wraps past 2^32
+        dqt_state = -1;
+      else {
+        if (dqt_state%65==0)
+          qnum = buf(1);
+        else {
+          jassert(buf(1)>0);
+          jassert(qnum>=0 && qnum<4);
+          qtab[qnum*64+((dqt_state%65)-1)]=buf(1)-1;
+        }
+        dqt_state++;
+      }
+    }
+
+    // Restart
+    if (buf(2)==FF && (buf(1)&0xf8)==RST0) {
+      huffcode=huffbits=huffsize=mcupos=0, rs=-1;
+      memset(&pred[0], 0, pred.size()*sizeof(int));
+    }
+  }
+
+  {
+    // Build Huffman tables
+    // huf[Tc][Th][m] = min, max+1 codes of length m, pointer to byte values
+    if (int(pos)==data && bpos==1) {
+      jassert(htsize>0);
+      int i;
+      for (i=0; i<htsize; ++i) {
+        int p=ht[i]+4;  // pointer to current table after length field
+        int end=p+buf[p-2]*256+buf[p-1]-2;  // end of Huffman table
+        int count=0;  // sanity check
+        while (p<end && int(end-pos)<0 && end<p+2100 && ++count<10) {
+          int tc=buf[p]>>4, th=buf[p]&15;
+          if (tc>=2 || th>=4) break;
+          jassert(tc>=0 && tc<2 && th>=0 && th<4);
+          HUF* h=&huf[tc*64+th*16]; // [tc][th][0];
+          int val=p+17;  // pointer to values
+          int hval=tc*1024+th*256;  // pointer to RS values in hbuf
+          int j;
+          for (j=0; j<256; ++j) // copy RS codes
+            hbuf[hval+j]=buf[val+j];
+          int code=0;
+          for (j=0; j<16; ++j) {
+            h[j].min=code;
+            h[j].max=code+=buf[p+j+1];
+            h[j].val=hval;
+            val+=buf[p+j+1];
+            hval+=buf[p+j+1];
+            code*=2;
+          }
+          p=val;
+          jassert(hval>=0 && hval<2048);
+        }
+        jassert(p==end);
+      }
+      huffcode=huffbits=huffsize=0, rs=-1;
+
+      // Build Huffman table selection table (indexed by mcupos).
+      // Get image width.
+      if (!sof && sos) return next_jpeg;
+      int ns=buf[sos+4];
+      int nf=buf[sof+9];
+      jassert(ns<=4 && nf<=4);
+      mcusize=0;  // blocks per MCU
+      int hmax=0;  // MCU horizontal dimension
+      for (i=0; i<ns; ++i) {
+        for (int j=0; j<nf; ++j) {
+          if (buf[sos+2*i+5]==buf[sof+3*j+10]) { // Cs == C ?
+            int hv=buf[sof+3*j+11];  // packed dimensions H x V
+            if (hv>>4>hmax) hmax=hv>>4;
+            hv=(hv&15)*(hv>>4);  // number of blocks in component C
+            jassert(hv>=1 && hv+mcusize<=10);
+            while (hv) {
+              jassert(mcusize<10);
+              hufsel[0][mcusize]=buf[sos+2*i+6]>>4&15;
+              hufsel[1][mcusize]=buf[sos+2*i+6]&15;
+              jassert (hufsel[0][mcusize]<4 && hufsel[1][mcusize]<4);
+              color[mcusize]=i;
+              int tq=buf[sof+3*j+12];  // quantization table index (0..3)
+              jassert(tq>=0 && tq<4);
+              qmap[mcusize]=tq; // quantizazion table mapping
+              --hv;
+              ++mcusize;
+            }
+          }
+        }
+      }
+      jassert(hmax>=1 && hmax<=10);
+      int j;
+      for (j=0; j<mcusize; ++j) {
+        ls[j]=0;
+        for (int i=1; i<mcusize; ++i) if (color[(j+i)%mcusize]==color[j]) ls[j]=i;
+        ls[j]=(mcusize-ls[j])<<6;
+      }
+      for (j=0; j<64; ++j) zpos[zzu[j]+8*zzv[j]]=j;
+      width=buf[sof+7]*256+buf[sof+8];  // in pixels
+      width=(width-1)/(hmax*8)+1;  // in MCU
+      jassert(width>0);
+      mcusize*=64;  // coefficients per MCU
+      row=column=0;
+    }
+  }
+
+
+  // Decode Huffman
+  {
+    if (mcusize && buf(1+(!bpos))!=FF) {  // skip stuffed byte
+      jassert(huffbits<=32);
+      huffcode+=huffcode+y;
+      ++huffbits;
+      if (rs<0) {
+        jassert(huffbits>=1 && huffbits<=16);
+        const int ac=(mcupos&63)>0;
+        jassert(mcupos>=0 && (mcupos>>6)<10);
+        jassert(ac==0 || ac==1);
+        const int sel=hufsel[ac][mcupos>>6];
+        jassert(sel>=0 && sel<4);
+        const int i=huffbits-1;
+        jassert(i>=0 && i<16);
+        const HUF *h=&huf[ac*64+sel*16]; // [ac][sel];
+        jassert(h[i].min<=h[i].max && h[i].val<2048 && huffbits>0);
+        if (huffcode<h[i].max) {
+          jassert(huffcode>=h[i].min);
+          int k=h[i].val+huffcode-h[i].min;
+          jassert(k>=0 && k<2048);
+          rs=hbuf[k];
+          huffsize=huffbits;
+        }
+      }
+      if (rs>=0) {
+        if (huffsize+(rs&15)==huffbits) { // done decoding
+          huff4=huff3;
+          huff3=huff2;
+          huff2=huff1;
+          huff1=hash(huffcode, huffbits);
+          rs4=rs3;
+          rs3=rs2;
+          rs2=rs1;
+          rs1=rs;
+          int x=0;  // decoded extra bits
+          if (mcupos&63) {  // AC
+            if (rs==0) { // EOB
+              mcupos=(mcupos+63)&-64;
+              jassert(mcupos>=0 && mcupos<=mcusize && mcupos<=640);
+              while (cpos&63) {
+                cbuf2[cpos]=0;
+                cbuf[cpos++]=0;
+              }
+            }
+            else {  // rs = r zeros + s extra bits for the next nonzero value
+                    // If first extra bit is 0 then value is negative.
+              jassert((rs&15)<=10);
+              const int r=rs>>4;
+              const int s=rs&15;
+              jassert(mcupos>>6==(mcupos+r)>>6);
+              mcupos+=r+1;
+              x=huffcode&((1<<s)-1);
+              if (s && !(x>>(s-1))) x-=(1<<s)-1;
+              for (int i=r; i>=1; --i) {
+                cbuf2[cpos]=0;
+                cbuf[cpos++]=i<<4|s;
+              }
+              cbuf2[cpos]=x;
+              cbuf[cpos++]=(s<<4)|(huffcode<<2>>s&3)|12;
+              ssum+=s;
+            }
+          }
+          else {  // DC: rs = 0S, s<12
+            jassert(rs<12);
+            ++mcupos;
+            x=huffcode&((1<<rs)-1);
+            if (rs && !(x>>(rs-1))) x-=(1<<rs)-1;
+            jassert(mcupos>=0 && mcupos>>6<10);
+            const int comp=color[mcupos>>6];
+            jassert(comp>=0 && comp<4);
+            dc=pred[comp]+=x;
+            jassert((cpos&63)==0);
+            cbuf2[cpos]=dc;
+            cbuf[cpos++]=(dc+1023)>>3;
+            if ((mcupos>>6)==0) {
+              ssum1=0;
+              ssum2=ssum3;
+            } else {
+              if (color[(mcupos>>6)-1]==color[0]) ssum1+=(ssum3=ssum);
+              ssum2=ssum1;
+            }
+            ssum=rs;
+          }
+          jassert(mcupos>=0 && mcupos<=mcusize);
+          if (mcupos>=mcusize) {
+            mcupos=0;
+            if (++column==width) column=0, ++row;
+          }
+          huffcode=huffsize=huffbits=0, rs=-1;
+
+          // UPDATE_ADV_PRED !!!!
+          {
+            const int acomp=mcupos>>6, q=64*qmap[acomp];
+            const int zz=mcupos&63, cpos_dc=cpos-zz;
+            if (zz==0) {
+              for (int i=0; i<8; ++i) sumu[i]=sumv[i]=0;
+              int cpos_dc_ls_acomp = cpos_dc-ls[acomp];
+              int cpos_dc_mcusize_width = cpos_dc-mcusize*width;
+              for (int i=0; i<64; ++i) {
+                sumu[zzu[i]]+=(zzv[i]&1?-1:1)*(zzv[i]?16*(16+zzv[i]):181)*(qtab[q+i]+1)*cbuf2[cpos_dc_mcusize_width+i];
+                sumv[zzv[i]]+=(zzu[i]&1?-1:1)*(zzu[i]?16*(16+zzu[i]):181)*(qtab[q+i]+1)*cbuf2[cpos_dc_ls_acomp+i];
+              }
+            }
+            else {
+              sumu[zzu[zz-1]]-=(zzv[zz-1]?16*(16+zzv[zz-1]):181)*(qtab[q+zz-1]+1)*cbuf2[cpos-1];
+              sumv[zzv[zz-1]]-=(zzu[zz-1]?16*(16+zzu[zz-1]):181)*(qtab[q+zz-1]+1)*cbuf2[cpos-1];
+            }
+
+            for (int i=0; i<3; ++i)
+              for (int st=0; st<8; ++st) {
+                const int zz2=min(zz+st, 63);
+                int p=(sumu[zzu[zz2]]*i+sumv[zzv[zz2]]*(2-i))/2;
+                p/=(qtab[q+zz2]+1)*181*(16+zzv[zz2])*(16+zzu[zz2])/256;
+                if (zz2==0) p-=cbuf2[cpos_dc-ls[acomp]];
+                p=(p<0?-1:+1)*ilog(10*abs(p)+1)/10;
+                if (st==0) {
+                  adv_pred[i]=p;
+                  adv_pred[i+4]=p/4;
+                }
+                else if (abs(p)>abs(adv_pred[i])+1) {
+                  adv_pred[i]+=(st*2+(p>0))<<6;
+                  if (abs(p/4)>abs(adv_pred[i+4])+1) adv_pred[i+4]+=(st*2+(p>0))<<6;
+                  break;
+                }
+              }
+            x=2*sumu[zzu[zz]]+2*sumv[zzv[zz]];
+            for (int i=0; i<8; ++i) x-=(zzu[zz]<i)*sumu[i]+(zzv[zz]<i)*sumv[i];
+            x/=(qtab[q+zz]+1)*181;
+            if (zz==0) x-=cbuf2[cpos_dc-ls[acomp]];
+            adv_pred[3]=(x<0?-1:+1)*ilog(10*abs(x)+1)/10;
+
+            for (int i=0; i<4; ++i) {
+              const int a=(i&1?zzv[zz]:zzu[zz]), b=(i&2?2:1);
+              if (a<b) x=255;
+              else {
+                const int zz2=zpos[zzu[zz]+8*zzv[zz]-(i&1?8:1)*b];
+                x=(qtab[q+zz2]+1)*cbuf2[cpos_dc+zz2]/(qtab[q+zz]+1);
+                x=(x<0?-1:+1)*ilog(10*abs(x)+1)/10;
+              }
+              lcp[i]=x;
+            }
+            if (column==0) adv_pred[1]=adv_pred[2], adv_pred[0]=1;
+            if (row==0) adv_pred[1]=adv_pred[0], adv_pred[2]=1;
+          } // !!!!
+
+        }
+      }
+    }
+  }
+
+  // Estimate next bit probability
+  if (!jpeg || !data) return next_jpeg;
+  if (buf(1+(!bpos))==FF) {
+    m.add(128);
+    m.set(1, 8);
+    m.set(0, 257);
+    m.set(buf(1), 256);
+    return 1;
+  }
+
+  // Update model
+  if (cp[N-1]) {
+    for (int i=0; i<N; ++i)
+      *cp[i]=nex(*cp[i],y);
+  }
+  m1.update();
+
+  // Update context
+  const int comp=color[mcupos>>6];
+  const int coef=(mcupos&63)|comp<<6;
+  const int hc=(huffcode*4+((mcupos&63)==0)*2+(comp==0))|1<<(huffbits+2);
+  if (++hbcount>2 || huffbits==0) hbcount=0;
+  jassert(coef>=0 && coef<256);
+  const int zu=zzu[mcupos&63], zv=zzv[mcupos&63];
+  if (hbcount==0) {
+    int n=0;
+    cxt[0]=hash(++n, hc, coef, adv_pred[2], ssum2>>6);
+    cxt[1]=hash(++n, hc, coef, adv_pred[0], ssum2>>6);
+    cxt[2]=hash(++n, hc, coef, adv_pred[1], ssum2>>6);
+    cxt[3]=hash(++n, hc, rs1, adv_pred[2]);
+    cxt[4]=hash(++n, hc, rs1, adv_pred[0]);
+    cxt[5]=hash(++n, hc, rs1, adv_pred[1]);
+    cxt[6]=hash(++n, hc, adv_pred[2], adv_pred[0]);
+    cxt[7]=hash(++n, hc, cbuf[cpos-width*mcusize], adv_pred[3]);
+    cxt[8]=hash(++n, hc, cbuf[cpos-ls[mcupos>>6]], adv_pred[3]);
+    cxt[9]=hash(++n, hc, lcp[0], lcp[1], adv_pred[1]);
+    cxt[10]=hash(++n, hc, lcp[0], lcp[1], mcupos&63);
+    cxt[11]=hash(++n, hc, zu, lcp[0], lcp[2]/3);
+    cxt[12]=hash(++n, hc, zv, lcp[1], lcp[3]/3);
+    cxt[13]=hash(++n, hc, mcupos>>1);
+    cxt[14]=hash(++n, hc, mcupos&63, column>>1);
+    cxt[15]=hash(++n, hc, column>>3, lcp[0]+256*(lcp[2]/4), lcp[1]+256*(lcp[3]/4));
+    cxt[16]=hash(++n, hc, ssum>>3, mcupos&63);
+    cxt[17]=hash(++n, hc, rs1, mcupos&63);
+    cxt[18]=hash(++n, hc, mcupos>>3, ssum2>>5, adv_pred[3]);
+    cxt[19]=hash(++n, hc, lcp[0]/4, lcp[1]/4, adv_pred[5]);
+    cxt[20]=hash(++n, hc, cbuf[cpos-width*mcusize], adv_pred[6]);
+    cxt[21]=hash(++n, hc, cbuf[cpos-ls[mcupos>>6]], adv_pred[4]);
+    cxt[22]=hash(++n, hc, adv_pred[2]);
+    cxt[23]=hash(n, hc, adv_pred[0]);
+    cxt[24]=hash(n, hc, adv_pred[1]);
+    cxt[25]=hash(++n, hc, zv, lcp[1], adv_pred[6]);
+    cxt[26]=hash(++n, hc, zu, lcp[0], adv_pred[4]);
+    cxt[27]=hash(++n, hc, lcp[0], lcp[1], adv_pred[3]);
+  }
+
+  // Predict next bit
+  m1.add(128);
+  assert(hbcount<=2);
+ switch(hbcount)
+  {
+   case 0: for (int i=0; i<N; ++i) cp[i]=t[cxt[i]]+1, m1.add(stretch(sm[i].p(*cp[i]))); break;
+   case 1: { int hc=1+(huffcode&1)*3; for (int i=0; i<N; ++i) cp[i]+=hc, m1.add(stretch(sm[i].p(*cp[i]))); } break;
+   default: { int hc=1+(huffcode&1); for (int i=0; i<N; ++i) cp[i]+=hc, m1.add(stretch(sm[i].p(*cp[i]))); } break;
+  }
+
+  m1.set(column==0, 2);
+  m1.set(coef, 256);
+  m1.set(hc&511, 512);
+  int pr=m1.p();
+  m.add(stretch(pr));
+  pr=a1.p(pr, (hc&511)|((adv_pred[1]==0?0:(abs(adv_pred[1])-4)&63)<<9), 1023);
+  pr=a2.p(pr, (hc&255)|(coef<<8), 255);
+  m.add(stretch(pr));
+  m.set(1, 8);
+  m.set(1+(hc&255), 257);
+  m.set(buf(1), 256);
+  return 1;
+}
+
+//////////////////////////// wavModel /////////////////////////////////
+
+// Model a 16/8-bit stereo/mono uncompressed .wav file.
+// Based on 'An asymptotically Optimal Predictor for Stereo Lossless Audio Compression'
+// by Florin Ghido.
+
+inline int s2(int i) { return int(short(buf(i)+256*buf(i-1))); }
+inline int t2(int i) { return int(short(buf(i-1)+256*buf(i))); }
+
+class WavModel {
+  enum {SC=0x20000};
+  int S, D;
+  int wmode;
+  int pr[3][2], n[2], counter[2];
+  double F[49][49][2], L[49][49];
+  SmallStationaryContextMap scm1, scm2, scm3, scm4, scm5, scm6, scm7;
+  ContextMap cm;
+  int bits, channels, w;
+  int z1, z2, z3, z4, z5, z6, z7;
+  int col;
+  int X1(int i);
+  int X2(int i);
+public:
+  WavModel(): S(0), D(0), wmode(0), scm1(SC), scm2(SC), scm3(SC), scm4(SC),
+    scm5(SC), scm6(SC), scm7(SC), cm(MEM*4, 10), bits(0), channels(0), w(0),
+    z1(0), z2(0), z3(0), z4(0), z5(0), z6(0), z7(0), col(0) {
+    memset(pr, 0, sizeof(pr));
+    memset(n, 0, sizeof(n));
+    memset(counter, 0, sizeof(counter));
+    memset(F, 0, sizeof(F));
+    memset(L, 0, sizeof(L));
+  }
+  void mix(Mixer& m, int info);
+  void state(State& s);
+};
+
+void WavModel::state(State& s) {
+  s(S), s(D), s(wmode), s(pr), s(n), s(counter), s(F), s(L);
+  scm1.state(s), scm2.state(s), scm3.state(s), scm4.state(s);
+  scm5.state(s), scm6.state(s), scm7.state(s), cm.state(s);
+  s(bits), s(channels), s(w), s(z1), s(z2), s(z3), s(z4), s(z5), s(z6);
+  s(z7), s(col);
+}
+
+inline int WavModel::X1(int i) {
+  switch (wmode) {
+    case 0: return buf(i)-128;
+    case 1: return buf(i<<1)-128;
+    case 2: return s2(i<<1);
+    case 3: return s2(i<<2);
+    case 4: return (buf(i)^128)-128;
+    case 5: return (buf(i<<1)^128)-128;
+    case 6: return t2(i<<1);
+    case 7: return t2(i<<2);
+    default: return 0;
+  }
+}
+
+inline int WavModel::X2(int i) {
+  switch (wmode) {
+    case 0: return buf(i+S)-128;
+    case 1: return buf((i<<1)-1)-128;
+    case 2: return s2((i+S)<<1);
+    case 3: return s2((i<<2)-2);
+    case 4: return (buf(i+S)^128)-128;
+    case 5: return (buf((i<<1)-1)^128)-128;
+    case 6: return t2((i+S)<<1);
+    case 7: return t2((i<<2)-2);
+    default: return 0;
+  }
+}
+
+void WavModel::mix(Mixer& m, int info) {
+  int j,k,l,i=0;
+  long double sum;
+  const double a=0.996,a2=1/a;
+
+  if (!bpos && !blpos) {
+    bits=((info%4)/2)*8+8;
+    channels=info%2+1;
+    w=channels*(bits>>3);
+    wmode=info;
+    if (channels==1) S=48,D=0; else S=36,D=12;
+    for (int j=0; j<channels; j++) {
+      for (k=0; k<=S+D; k++) for (l=0; l<=S+D; l++) F[k][l][j]=0, L[k][l]=0;
+      F[1][0][j]=1;
+      n[j]=counter[j]=pr[2][j]=pr[1][j]=pr[0][j]=0;
+      z1=z2=z3=z4=z5=z6=z7=0;
+    }
+  }
+  // Select previous samples and predicted sample as context
+  if (!bpos && blpos>=w) {
+    const int ch=blpos%w;
+    const int msb=ch%(bits>>3);
+    const int chn=ch/(bits>>3);
+    if (!msb) {
+      z1=X1(1), z2=X1(2), z3=X1(3), z4=X1(4), z5=X1(5);
+      k=X1(1);
+      for (l=0; l<=min(S,counter[chn]-1); l++) { F[0][l][chn]*=a; F[0][l][chn]+=X1(l+1)*k; }
+      for (l=1; l<=min(D,counter[chn]); l++) { F[0][l+S][chn]*=a; F[0][l+S][chn]+=X2(l+1)*k; }
+      if (channels==2) {
+        k=X2(2);
+        for (l=1; l<=min(D,counter[chn]); l++) { F[S+1][l+S][chn]*=a; F[S+1][l+S][chn]+=X2(l+1)*k; }
+        for (l=1; l<=min(S,counter[chn]-1); l++) { F[l][S+1][chn]*=a; F[l][S+1][chn]+=X1(l+1)*k; }
+        z6=X2(1)+X1(1)-X2(2), z7=X2(1);
+      } else z6=2*X1(1)-X1(2), z7=X1(1);
+      if (++n[chn]==(256>>min(level, 8))) {
+        if (channels==1) for (k=1; k<=S+D; k++) for (l=k; l<=S+D; l++) F[k][l][chn]=(F[k-1][l-1][chn]-X1(k)*X1(l))*a2;
+        else for (k=1; k<=S+D; k++) if (k!=S+1) for (l=k; l<=S+D; l++) if (l!=S+1) F[k][l][chn]=(F[k-1][l-1][chn]-(k-1<=S?X1(k):X2(k-S))*(l-1<=S?X1(l):X2(l-S)))*a2;
+        for (i=1; i<=S+D; i++) {
+           sum=F[i][i][chn];
+           for (k=1; k<i; k++) sum-=L[i][k]*L[i][k];
+           sum=floor(sum+0.5);
+           sum=1/sum;
+           if (sum>0) {
+             L[i][i]=sqrt(sum);
+             for (j=(i+1); j<=S+D; j++) {
+               sum=F[i][j][chn];
+               for (k=1; k<i; k++) sum-=L[j][k]*L[i][k];
+               sum=floor(sum+0.5);
+               L[j][i]=sum*L[i][i];
+             }
+           } else break;
+        }
+        if (i>S+D && counter[chn]>S+1) {
+          for (k=1; k<=S+D; k++) {
+            F[k][0][chn]=F[0][k][chn];
+            for (j=1; j<k; j++) F[k][0][chn]-=L[k][j]*F[j][0][chn];
+            F[k][0][chn]*=L[k][k];
+          }
+          for (k=S+D; k>0; k--) {
+            for (j=k+1; j<=S+D; j++) F[k][0][chn]-=L[j][k]*F[j][0][chn];
+            F[k][0][chn]*=L[k][k];
+          }
+        }
+        n[chn]=0;
+      }
+      sum=0;
+      for (l=1; l<=S+D; l++) sum+=F[l][0][chn]*(l<=S?X1(l):X2(l-S));
+      pr[2][chn]=pr[1][chn];
+      pr[1][chn]=pr[0][chn];
+      pr[0][chn]=int(floor(sum));
+      counter[chn]++;
+    }
+    const int y1=pr[0][chn], y2=pr[1][chn], y3=pr[2][chn];
+    int x1=buf(1), x2=buf(2), x3=buf(3);
+    if (wmode==4 || wmode==5) x1^=128, x2^=128;
+    if (bits==8) x1-=128, x2-=128;
+    const int t=((bits==8) || ((!msb)^(wmode<6)));
+    i=ch<<4;
+    if ((msb)^(wmode<6)) {
+      cm.set(hash(++i, y1&0xff));
+      cm.set(hash(++i, y1&0xff, ((z1-y2+z2-y3)>>1)&0xff));
+      cm.set(hash(++i, x1, y1&0xff));
+      cm.set(hash(++i, x1, x2>>3, x3));
+      cm.set(hash(++i, (y1+z1-y2)&0xff));
+      cm.set(hash(++i, x1));
+      cm.set(hash(++i, x1, x2));
+      cm.set(hash(++i, z1&0xff));
+      cm.set(hash(++i, (z1*2-z2)&0xff));
+      cm.set(hash(++i, z6&0xff));
+    } else {
+      cm.set(hash(++i, (y1-x1+z1-y2)>>8));
+      cm.set(hash(++i, (y1-x1)>>8));
+      cm.set(hash(++i, (y1-x1+z1*2-y2*2-z2+y3)>>8));
+      cm.set(hash(++i, (y1-x1)>>8, (z1-y2+z2-y3)>>9));
+      cm.set(hash(++i, z1>>12));
+      cm.set(hash(++i, x1));
+      cm.set(hash(++i, x1>>7, x2, x3>>7));
+      cm.set(hash(++i, z1>>8));
+      cm.set(hash(++i, (z1*2-z2)>>8));
+      cm.set(hash(++i, y1>>8));
+    }
+    scm1.set(t*ch);
+    scm2.set(t*((z1-x1+y1)>>9)&0xff);
+    scm3.set(t*((z1*2-z2-x1+y1)>>8)&0xff);
+    scm4.set(t*((z1*3-z2*3+z3-x1)>>7)&0xff);
+    scm5.set(t*((z1+z7-x1+y1*2)>>10)&0xff);
+    scm6.set(t*((z1*4-z2*6+z3*4-z4-x1)>>7)&0xff);
+    scm7.set(t*((z1*5-z2*10+z3*10-z4*5+z5-x1+y1)>>9)&0xff);
+  }
+
+  // Predict next bit
+  scm1.mix(m);
+  scm2.mix(m);
+  scm3.mix(m);
+  scm4.mix(m);
+  scm5.mix(m);
+  scm6.mix(m);
+  scm7.mix(m);
+  cm.mix(m);
+  if (++col>=w*8) col=0;
+  m.set(3, 8);
+  m.set(col%bits<8, 2);
+  m.set(col%bits, bits);
+  m.set(col, w*8);
+  m.set(c0, 256);
+}
+
+//////////////////////////// exeModel /////////////////////////
+
+// Model x86 code.  The contexts are sparse containing only those
+// bits relevant to parsing (2 prefixes, opcode, and mod and r/m fields
+// of modR/M byte).
+
+inline int pref(int i) { return (buf(i)==0x0f)+2*(buf(i)==0x66)+3*(buf(i)==0x67); }
+
+// Get context at buf(i) relevant to parsing 32-bit x86 code
+U32 execxt(int i, int x=0) {
+  int prefix=0, opcode=0, modrm=0;
+  if (i) prefix+=4*pref(i--);
+  if (i) prefix+=pref(i--);
+  if (i) opcode+=buf(i--);
+  if (i) modrm+=buf(i)&0xc7;
+  return prefix|opcode<<4|modrm<<12|x<<20;
+}
+
+class ExeModel {
+  enum {N=14};
+  ContextMap cm;
+public:
+  ExeModel(): cm(MEM, N) {}
+  void mix(Mixer& m);
+  void state(State& s) {cm.state(s);}
+};
+
+void ExeModel::mix(Mixer& m) {
+  if (!bpos) {
+    for (int i=0; i<N; ++i) cm.set(execxt(i+1, buf(1)*(i>6)));
+  }
+  cm.mix(m);
+}
+
+//////////////////////////// indirectModel /////////////////////
+
+// The context is a byte string history that occurs within a
+// 1 or 2 byte context.
+
+class IndirectModel {
+  ContextMap cm;
+  Array<U32> t1;
+  Array<U16> t2, t3;
+public:
+  IndirectModel(): cm(MEM, 9), t1(256), t2(0x10000), t3(0x8000) {}
+  void mix(Mixer& m);
+  void state(State& s) {cm.state(s);}
+};
+
+void IndirectModel::mix(Mixer& m) {
+  if (!bpos) {
+    U32 d=c4&0xffff, c=d&255, d2=(buf(1)&31)+32*(buf(2)&31)+1024*(buf(3)&31);
+    U32& r1=t1[d>>8];
+    r1=r1<<8|c;
+    U16& r2=t2[c4>>8&0xffff];
+    r2=r2<<8|c;
+    U16& r3=t3[(buf(2)&31)+32*(buf(3)&31)+1024*(buf(4)&31)];
+    r3=r3<<8|c;
+    const U32 t=c|t1[c]<<8;
+    const U32 t0=d|t2[d]<<16;
+    const U32 ta=d2|t3[d2]<<16;
+    cm.set(t);
+    cm.set(t0);
+    cm.set(ta);
+    cm.set(t&0xff00);
+    cm.set(t0&0xff0000);
+    cm.set(ta&0xff0000);
+    cm.set(t&0xffff);
+    cm.set(t0&0xffffff);
+    cm.set(ta&0xffffff);
+  }
+  cm.mix(m);
+}
+
+//////////////////////////// dmcModel //////////////////////////
+
+// Model using DMC.  The bitwise context is represented by a state graph,
+// initilaized to a bytewise order 1 model as in
+// http://plg.uwaterloo.ca/~ftp/dmc/dmc.c but with the following difference:
+// - It uses integer arithmetic.
+// - The threshold for cloning a state increases as memory is used up.
+// - Each state maintains both a 0,1 count and a bit history (as in a
+//   context model).  The 0,1 count is best for stationary data, and the
+//   bit history for nonstationary data.  The bit history is mapped to
+//   a probability adaptively using a StateMap.  The two computed probabilities
+//   are combined.
+// - When memory is used up the state graph is reinitialized to a bytewise
+//   order 1 context as in the original DMC.  However, the bit histories
+//   are not cleared.
+
+struct DMCNode {  // 12 bytes
+  unsigned int nx[2];  // next pointers
+  U8 state;  // bit history
+  unsigned int c0:12, c1:12;  // counts * 256
+};
+
+class DmcModel {
+  int top, curr;  // allocated, current node
+  Array<DMCNode> t;  // state graph
+  StateMap sm;
+  int threshold;
+public:
+  DmcModel(): top(0), curr(0), t(MEM*2), threshold(256) {}
+  void mix(Mixer& m);
+  void state(State& s) {s(top), s(curr), sm.state(s), s(threshold);}
+};
+
+void DmcModel::mix(Mixer& m) {
+
+  // clone next state
+  if (top>0 && top<int(t.size())) {
+    int next=t[curr].nx[y];
+    int n=y?t[curr].c1:t[curr].c0;
+    int nn=t[next].c0+t[next].c1;
+    if (n>=threshold*2 && nn-n>=threshold*3) {
+      int r=n*4096/nn;
+      assert(r>=0 && r<=4096);
+      t[next].c0 -= t[top].c0 = t[next].c0*r>>12;
+      t[next].c1 -= t[top].c1 = t[next].c1*r>>12;
+      t[top].nx[0]=t[next].nx[0];
+      t[top].nx[1]=t[next].nx[1];
+      t[top].state=t[next].state;
+      t[curr].nx[y]=top;
+      ++top;
+      if (top==int(MEM*2)) threshold=512;
+      if (top==int(MEM*3)) threshold=768;
+    }
+  }
+
+  // Initialize to a bytewise order 1 model at startup or when flushing memory
+  if (top==int(t.size()) && bpos==1) top=0;
+  if (top==0) {
+    assert(t.size()>=65536);
+    for (int i=0; i<256; ++i) {
+      for (int j=0; j<256; ++j) {
+        if (i<127) {
+          t[j*256+i].nx[0]=j*256+i*2+1;
+          t[j*256+i].nx[1]=j*256+i*2+2;
+        }
+        else {
+          t[j*256+i].nx[0]=(i-127)*256;
+          t[j*256+i].nx[1]=(i+1)*256;
+        }
+        t[j*256+i].c0=128;
+        t[j*256+i].c1=128;
+      }
+    }
+    top=65536;
+    curr=0;
+    threshold=256;
+  }
+
+  // update count, state
+  if (y) {
+    if (t[curr].c1<3800) t[curr].c1+=256;
+  }
+  else if (t[curr].c0<3800) t[curr].c0+=256;
+  t[curr].state=nex(t[curr].state, y);
+  curr=t[curr].nx[y];
+
+  // predict
+  const int pr1=sm.p(t[curr].state);
+  const int n1=t[curr].c1;
+  const int n0=t[curr].c0;
+  const int pr2=(n1+5)*4096/(n0+n1+10);
+  m.add(stretch(pr1));
+  m.add(stretch(pr2));
+}
+
+//////////////////////////// nestModel ///////////////////////////
+
+// Model nesting of brackets, quotes and tags in text.
+
+class NestModel {
+  int ic, bc, pc, vc, qc, lvc, wc;
+  ContextMap cm;
+  U32 mask;
+public:
+  NestModel(): ic(0), bc(0), pc(0), vc(0), qc(0), lvc(0), wc(0), cm(MEM, 14),
+    mask(0) {}
+  void mix(Mixer& m);
+  void state(State& s) {
+    s(ic), s(bc), s(pc), s(vc), s(qc), s(lvc), s(wc), cm.state(s), s(mask);
+  }
+};
+
+void NestModel::mix(Mixer& m) {
+  if (bpos==0) {
+    int c=c4&255, matched=1, vv;
+    const int lc = (c >= 'A' && c <= 'Z'?c+'a'-'A':c);
+    if (lc == 'a' || lc == 'e' || lc == 'i' || lc == 'o' || lc == 'u') vv = 1; else
+    if (lc >= 'a' && lc <= 'z') vv = 2; else
+    if (lc == ' ' || lc == '.' || lc == ',' || lc == '\n') vv = 3; else
+    if (lc >= '0' && lc <= '9') vv = 4; else
+    if (lc == 'y') vv = 5; else
+    if (lc == '\'') vv = 6; else vv=(c&32)?7:0;
+    vc = (vc << 3) | vv;
+    if (vv != lvc) {
+      wc = (wc << 3) | vv;
+      lvc = vv;
+    }
+    switch(c) {
+      case ' ': qc = 0; break;
+      case '(': ic += 513; break;
+      case ')': ic -= 513; break;
+      case '[': ic += 17; break;
+      case ']': ic -= 17; break;
+      case '<': ic += 23; qc += 34; break;
+      case '>': ic -= 23; qc /= 5; break;
+      case ':': pc = 20; break;
+      case '{': ic += 22; break;
+      case '}': ic -= 22; break;
+      case '|': pc += 223; break;
+      case '"': pc += 0x40; break;
+      case '\'': pc += 0x42; break;
+      case '\n': pc = qc = 0; break;
+      case '.': pc = 0; break;
+      case '!': pc = 0; break;
+      case '?': pc = 0; break;
+      case '#': pc += 0x08; break;
+      case '%': pc += 0x76; break;
+      case '$': pc += 0x45; break;
+      case '*': pc += 0x35; break;
+      case '-': pc += 0x3; break;
+      case '@': pc += 0x72; break;
+      case '&': qc += 0x12; break;
+      case ';': qc /= 3; break;
+      case '\\': pc += 0x29; break;
+      case '/': pc += 0x11;
+                if (buf.size() > 1 && buf(1) == '<') qc += 74;
+                break;
+      case '=': pc += 87; break;
+      default: matched = 0;
+    }
+    if (matched) bc = 0; else bc += 1;
+    if (bc > 300) bc = ic = pc = qc = 0;
+
+    int fl = 0;
+    if ((c4&0xff) != 0) {
+      if (isalpha(c4&0xff)) fl = 1;
+      else if (ispunct(c4&0xff)) fl = 2;
+      else if (isspace(c4&0xff)) fl = 3;
+      else if ((c4&0xff) == 0xff) fl = 4;
+      else if ((c4&0xff) < 16) fl = 5;
+      else if ((c4&0xff) < 64) fl = 6;
+      else fl = 7;
+    }
+    mask = (mask<<3)|fl;
+
+    cm.set((3*vc+77*pc+373*ic+qc)&0xffff);
+    cm.set((31*vc+27*pc+281*qc)&0xffff);
+    cm.set((13*vc+271*ic+qc+bc)&0xffff);
+    cm.set((17*pc+7*ic)&0xffff);
+    cm.set((13*vc+ic)&0xffff);
+    cm.set((vc/3+pc)&0xffff);
+    cm.set((7*wc+qc)&0xffff);
+    cm.set((vc&0xffff)|((c4&0xff)<<16));
+    cm.set(((3*pc)&0xffff)|((c4&0xff)<<16));
+    cm.set((ic&0xffff)|((c4&0xff)<<16));
+    cm.set(mask);
+    cm.set((mask<<8)|buf(1));
+    cm.set((mask<<17)|(buf(2)<<8)|buf(3));
+    cm.set((mask&0x1ff)|((c4&0xf0f0f0f0)<<9));
+  }
+  cm.mix(m);
+}
+
+//////////////////////////// contextModel //////////////////////
+
+
+typedef enum {DEFAULT, JPEG, HDR, IMAGE1, IMAGE8, IMAGE24, AUDIO, EXE, CD, STORED, DEDUP} Filetype;
+
+
+// Allocate model x on first use, so that memory is only used by
+// the models that the input needs.
+template <class T> inline T& lazy(T*& x) {
+  if (!x) x=new T;
+  return *x;
+}
+
+// A ContextModel combines all the context models with a Mixer.
+// p() returns the mixed prediction for the next bit.  All of the
+// model state is owned by the ContextModel so that several of them
+// may run at the same time in different threads.
+
+class ContextModel {
+  ContextMap cm;
+  RunContextMap rcm7, rcm9, rcm10;
+  Mixer m;
+  U32 cxt1[16];  // order 0-11 contexts
+  U32 cxt3[16];  // order 0-11 contexts
+  U32 cxt2[16];  // order 0-11 contexts
+  Filetype ft2, filetype;
+  int size;  // bytes remaining in block
+  int info;  // image width or audio type
+  MatchModel matchModel;
+  SparseModel* sparse;  // allocated when first used
+  DistanceModel* distance;
+  RecordModel* record;
+  WordModel* word;
+  IndirectModel* indirect;
+  DmcModel* dmc;
+  NestModel* nest;
+  ExeModel* exe;
+  Im1bitModel* im1bit;
+  Im8bitModel* im8bit;
+  Im24bitModel* im24bit;
+  WavModel* wav;
+  JpegModel* jpeg;
+public:
+  ContextModel();
+  ~ContextModel();
+  void allocateAll();
+  void state(State& s);
+  int p();
+};
+
+ContextModel::ContextModel(): cm(MEM*32, 9*3, true), rcm7(MEM), rcm9(MEM),
+    rcm10(MEM), m(1800, 3095, 7), ft2(DEFAULT), filetype(DEFAULT), size(0),
+    info(0), sparse(0), distance(0), record(0), word(0), indirect(0), dmc(0),
+    nest(0), exe(0), im1bit(0), im8bit(0), im24bit(0), wav(0), jpeg(0) {
+  memset(cxt1, 0, sizeof(cxt1));
+  memset(cxt2, 0, sizeof(cxt2));
+  memset(cxt3, 0, sizeof(cxt3));
+  if (recording) allocateAll();
+}
+
+// Allocate every model that p() may use at this level, so that the
+// tables of a Snapshot are the same whatever the input was.
+void ContextModel::allocateAll() {
+  lazy(im1bit), lazy(im8bit), lazy(im24bit), lazy(wav), lazy(jpeg);
+  if (level<4) return;
+  lazy(sparse), lazy(distance), lazy(record), lazy(word), lazy(indirect);
+  lazy(dmc), lazy(nest), lazy(exe);
+}
+
+// The lazy models are saved if allocated, which is the same for all
+// Predictors with a Tables (see allocateAll()).
+void ContextModel::state(State& s) {
+  cm.state(s), rcm7.state(s), rcm9.state(s), rcm10.state(s), m.state(s);
+  s(cxt1), s(cxt2), s(cxt3), s(ft2), s(filetype), s(size), s(info);
+  matchModel.state(s);
+  if (sparse) sparse->state(s);
+  if (distance) distance->state(s);
+  if (record) record->state(s);
+  if (word) word->state(s);
+  if (indirect) indirect->state(s);
+  if (dmc) dmc->state(s);
+  if (nest) nest->state(s);
+  if (exe) exe->state(s);
+  if (im1bit) im1bit->state(s);
+  if (im8bit) im8bit->state(s);
+  if (im24bit) im24bit->state(s);
+  if (wav) wav->state(s);
+  if (jpeg) jpeg->state(s);
+}
+
+ContextModel::~ContextModel() {
+  delete sparse;
+  delete distance;
+  delete record;
+  delete word;
+  delete indirect;
+  delete dmc;
+  delete nest;
+  delete exe;
+  delete im1bit;
+  delete im8bit;
+  delete im24bit;
+  delete wav;
+  delete jpeg;
+}
+
+int ContextModel::p() {
+
+  // Parse filetype and size
+  if (bpos==0) {
+    --size;
+    ++blpos;
+    if (size==-1) ft2=(Filetype)buf(1);
+    if (size==-5 && ft2!=IMAGE1 && ft2!=IMAGE8 && ft2!=IMAGE24 && ft2!=AUDIO
+        && ft2!=DEDUP) {
+      size=buf(4)<<24|buf(3)<<16|buf(2)<<8|buf(1);
+      if (ft2==CD || ft2==STORED) size=0;  // data not seen here
+      blpos=0;
+    }
+    if (size==-9) {
+      size=buf(8)<<24|buf(7)<<16|buf(6)<<8|buf(5);
+      info=buf(4)<<24|buf(3)<<16|buf(2)<<8|buf(1);
+      if (ft2==DEDUP) size=0;  // data not seen here
+      blpos=0;
+    }
+    if (!blpos) filetype=ft2;
+    if (size==0) filetype=DEFAULT;
+  }
+
+  m.update();
+  m.add(256);
+
+  // Test for special file types
+  int ismatch=ilog(matchModel.p(m));  // Length of longest matching context
+  if (filetype==IMAGE1) lazy(im1bit).mix(m, info);
+  if (filetype==IMAGE8) return lazy(im8bit).mix(m, info), m.p();
+  if (filetype==IMAGE24) return lazy(im24bit).mix(m, info), m.p();
+  if (filetype==AUDIO) {
+    lazy(wav).mix(m, info);
+    if (level>=4) lazy(record).mix(m);
+    return m.p();
+  }
+  if (filetype==JPEG) if (lazy(jpeg).mix(m)) return m.p();
+
+  // Normal model
+  if (bpos==0) {
+    int i;
+    for (i=15; i>0; --i){  // update order 0-11 context hashes
+      cxt1[i]=cxt1[i-1]*257+(c4&252)+1;
+      cxt2[i]=cxt2[i-1]*257+(c4&227)+1;
+      cxt3[i]=cxt3[i-1]*257+(c4&31)+1;
+    }
+    for (i=0; i<7; ++i){
+      cm.set(cxt1[i]);
+      cm.set(cxt2[i]);
+      cm.set(cxt3[i]);
+    }
+    rcm7.set(cxt1[7]);
+    cm.set(cxt1[8]);
+    cm.set(cxt2[8]);
+    cm.set(cxt3[8]);
+    rcm9.set(cxt1[10]);
+    rcm10.set(cxt1[12]);
+    cm.set(cxt1[14]);
+    cm.set(cxt2[14]);
+    cm.set(cxt3[14]);
+  }
+  int order=cm.mix(m);
+
+  rcm7.mix(m);
+  rcm9.mix(m);
+  rcm10.mix(m);
+
+  if (level>=4 && filetype!=IMAGE1) {
+    lazy(sparse).mix(m,ismatch,order);
+    lazy(distance).mix(m);
+    lazy(record).mix(m);
+    lazy(word).mix(m);
+    lazy(indirect).mix(m);
+    lazy(dmc).mix(m);
+    lazy(nest).mix(m);
+    if (filetype==EXE) lazy(exe).mix(m);
+  }
+
+
+  order = order-2;
+  if (order<0) order=0;
+
+  U32 c1=buf(1), c2=buf(2), c3=buf(3), c;
+
+  m.set(c1+8, 264);
+  m.set(c0, 256);
+  m.set(order+8*(c4>>6&3)+32*(bpos==0)+64*(c1==c2)+128*(filetype==EXE), 256);
+  m.set(c2, 256);
+  m.set(c3, 256);
+  m.set(ismatch, 256);
+
+  if (bpos)
+  {
+    c=c0<<(8-bpos); if (bpos==1)c+=c3/2;
+    c=(min(bpos,5))*256+c1/32+8*(c2/32)+(c&192);
+  }
+  else c=c3/128+(c4>>31)*2+4*(c2/64)+(c1&240);
+  m.set(c, 1536);
+  int pr=m.p();
+  return pr;
+}
+
+
+//////////////////////////// Predictor /////////////////////////
+
+// A Predictor estimates the probability that the next bit of
+// uncompressed data is 1.  Methods:
+// p() returns P(1) as a 12 bit number (0-4095).
+// update(y) trains the predictor with the actual bit (0 or 1).
+
+// The global context (buf, pos, c0...) is reset when a Predictor is
+// created, so a thread may only run one Predictor at a time.
+// If a Snapshot is used, its tables are loaded into the new Predictor.
+// If priming() or savable, tables() lists its tables (see Tables), and
+// state(s) saves or restores the rest of its state and of the global
+// context with State s.  save(f, rest, sums) writes a Snapshot of the
+// tables to f and returns its hash (see Snapshot::save()).
+
+void loadSnapshot(const Tables& t);  // see Snapshot
+
+class Predictor {
+  Tables list;  // created first, to list the Arrays of the models
+  int pr;  // next prediction
+  ContextModel cm;
+  APM1 a, a1, a2, a3, a4, a5, a6;
+public:
+  Predictor();
+#ifdef MIXERSTATS
+  ~Predictor() {programChecker.add(mixerStats);}
+#endif
+  int p() const {assert(pr>=0 && pr<4096); return pr;}
+  void update();
+  const Tables& tables() const {return list;}
+  void state(State& s);
+  U32 save(FILE* f, bool rest=false, Array<U64>* sums=0) const;
+};
+
+// Reset the global context of the calling thread
+void resetContext() {
+  if (pos) buf.reset();
+  buf.setsize(MEM*8);
+  y=0, c0=1, c4=0, bpos=0, pos=0, blpos=0;
+  rnd.reset();
+  memset(&mix2state, 0, sizeof(mix2state));
+}
+
+Predictor::Predictor(): pr(2048), a(256), a1(0x10000), a2(0x10000),
+    a3(0x10000), a4(0x10000), a5(0x10000), a6(0x10000) {
+  list.stop();
+  resetContext();
+  if (priming() || savable) list.add(&buf[0], buf.size());
+  if (priming()) loadSnapshot(list);
+}
+
+void Predictor::state(State& s) {
+  s(y), s(c0), s(c4), s(bpos), s(pos), s(blpos), s(mix2state);
+  rnd.state(s);
+  s(pr);
+  cm.state(s);
+  a.state(s), a1.state(s), a2.state(s), a3.state(s), a4.state(s);
+  a5.state(s), a6.state(s);
+}
+
+void Predictor::update() {
+#ifdef MIXERSTATS
+  ++mixerStats.bits;
+#endif
+
+  // Update global context: pos, bpos, c0, c4, buf
+  c0+=c0+y;
+  if (c0>=256) {
+    buf[pos++]=c0;
+    c4=(c4<<8)+c0-256;
+    c0=1;
+  }
+  bpos=(bpos+1)&7;
+
+  // Filter the context model with APMs
+  int pr0=cm.p();
+
+  pr=a.p(pr0, c0);
+
+  int pr1=a1.p(pr0, c0+256*buf(1));
+  int pr2=a2.p(pr0, (c0^hash(buf(1), buf(2)))&0xffff);
+  int pr3=a3.p(pr0, (c0^hash(buf(1), buf(2), buf(3)))&0xffff);
+  pr0=(pr0+pr1+pr2+pr3+2)>>2;
+
+  pr1=a4.p(pr, c0+256*buf(1));
+  pr2=a5.p(pr, (c0^hash(buf(1), buf(2)))&0xffff);
+  pr3=a6.p(pr, (c0^hash(buf(1), buf(2), buf(3)))&0xffff);
+  pr=(pr+pr1+pr2+pr3+2)>>2;
+
+  pr=(pr+pr0+1)>>1;
+}
+
+//////////////////////////// Input ////////////////////////////
+
+// An Input is a read-only view of n bytes in memory with a current
+// position, used instead of a FILE* to read data to be compressed.
+// get() returns the next byte or EOF, read(p, k) copies up to k bytes
+// to p and returns how many, tell() and seek(i) get and set the position
+// like ftell() and fseek(SEEK_SET).  Seeking before the start is ignored.
+
+class Input {
+  const U8* p;  // data
+  long n, i;    // size, position
+public:
+  Input(const U8* data, long size): p(data), n(size), i(0) {}
+  int get() {return i<n ? p[i++] : EOF;}
+  int read(U8* q, int k) {
+    if (k>n-i) k=i<n ? n-i : 0;
+    memcpy(q, p+i, k);
+    i+=k;
+    return k;
+  }
+  long tell() const {return i;}
+  void seek(long j) {if (j>=0) i=j;}
+  long size() const {return n;}
+  const U8* data() const {return p;}
+};
+
+// An Output writes to the n bytes of memory at p.  put(c) stores byte c
+// if there is room.  size() returns the number of bytes put so far,
+// including any that did not fit.
+
+class Output {
+  U8* p;
+  long n, i;  // size, position
+public:
+  Output(U8* data, long size): p(data), n(size), i(0) {}
+  void put(int c) {
+    if (i<n) p[i]=c;
+    ++i;
+  }
+  long size() const {return i;}
+};
+
+// MappedFile m(f) maps all of open file f into memory for reading, so
+// that detect(), the transforms, and the encoder read it through an
+// Input without stdio or extra copies.  MappedFile m(f, off, len) maps
+// only the len bytes from offset off (fewer if the file ends first).
+// Pending writes to f are flushed first.  If the file can't be mapped
+// then those bytes are read into memory.  m.data() points to the
+// m.size() bytes.  f must stay open and unchanged until m is destroyed.
+//
+// Input files can be larger than the address space of a 32-bit build,
+// so they are mapped (or read) at most MAPWINDOW bytes at a time.
+
+const long MAPWINDOW=1L<<28;
+
+class MappedFile {
+  U8* p;
+  long n;
+  U8* view;   // start of the mapping, before p to align it
+  long vlen;  // length of the mapping
+  Array<U8> copy;  // if not mapped
+#ifdef WINDOWS
+  HANDLE h;
+#endif
+public:
+  MappedFile(FILE* f, long off=0, long len=-1);
+  ~MappedFile();
+  const U8* data() const {return p;}
+  long size() const {return n;}
+};
+
+MappedFile::MappedFile(FILE* f, long off, long len):
+    p(0), n(0), view(0), vlen(0) {
+  fflush(f);
+  fseek(f, 0, SEEK_END);
+  n=ftell(f)-off;
+  if (len>=0 && n>len) n=len;
+  if (n<=0 || off<0) {
+    n=0;
+    return;
+  }
+  const long a=off&~0xffffL;  // a multiple of pages (and of 64 KB for Windows)
+  vlen=off-a+n;
+#ifdef UNIX
+  void* m=mmap(0, vlen, PROT_READ, MAP_PRIVATE, fileno(f), a);
+  if (m!=MAP_FAILED) {
+    view=(U8*)m, p=view+(off-a);
+    return;
+  }
+#endif
+#ifdef WINDOWS
+  h=CreateFileMapping((HANDLE)_get_osfhandle(_fileno(f)), 0, PAGE_READONLY,
+    0, 0, 0);
+  if (h && (view=(U8*)MapViewOfFile(h, FILE_MAP_READ, DWORD(U64(a)>>32),
+      DWORD(a), vlen))!=0) {
+    p=view+(off-a);
+    return;
+  }
+  if (h) CloseHandle(h), h=0;
+#endif
+  copy.resize(n);
+  fseek(f, off, SEEK_SET);
+  if (fread(&copy[0], 1, n, f)!=size_t(n)) quit("read error");
+  p=&copy[0];
+}
+
+MappedFile::~MappedFile() {
+  if (!view) return;
+#ifdef UNIX
+  munmap(view, vlen);
+#endif
+#ifdef WINDOWS
+  UnmapViewOfFile(view);
+  CloseHandle(h);
+#endif
+}
+
+//////////////////////////// Snapshot ////////////////////////////
+
+// A snapshot holds the tables of a Predictor that was trained on a
+// corpus (made with -P), so that compression and decompression can start
+// from them (with -p) instead of from empty tables.  This helps most with
+// small inputs, which are otherwise coded while the tables still learn.
+// The tables are the Arrays of the Predictor and its models, in the order
+// they are created, except Arrays of pointers, and then buf.  While a
+// snapshot is made or used, every model is allocated (see
+// ContextModel::allocateAll()), so the tables depend only on the level
+// and memlevel.  pos is restored too, so that the MatchModel finds
+// matches in the corpus, but the rest of the state of the models
+// (contexts, counters, pointers) starts as in a new Predictor.
+//
+// A snapshot file starts with a header of:
+//
+//   "paq8px snapshot" 0 (16 bytes)
+//   level, memlevel, rest, 0 (1 byte each)
+//   hash (4 bytes): FNV-1a hash of the tables, stored in archives
+//   pos (4 bytes)
+//   number of tables n (4 bytes)
+//   size of each table in bytes (4 bytes each)
+//
+// Numbers are MSB first.  The header and then each table are padded
+// with 0 to a multiple of PAGE bytes, so that the tables can be mapped.
+// If rest is 1, then the rest of the state follows the tables (see
+// State and Checkpoints), and hash is the hash of their block sums
+// instead: the sums of each BLOCK bytes of each table.
+//
+// In Unix, a table of at least MAPMIN bytes is not allocated: the Array
+// adopts the table mapped from the file with MAP_PRIVATE.  Pages that
+// are only read are shared through the page cache by all the processes
+// and threads using the snapshot, and a page is copied when it is first
+// written.  This saves memory when many programs start from the same
+// snapshot, and it saves clearing and copying the tables.  Smaller
+// tables (and all tables in other systems) are copied from the file.
+// The snapshot file must not be changed while it is in use.
+//
+// Snapshot(name) opens snapshot file name.  Snapshot(level, memlevel)
+// is used while making one, and then adopt() and load() do nothing.
+// fits() is true if the calling thread's level and memlevel are those of
+// the snapshot, so that a new Predictor uses it.  adopt(i, k, mapped)
+// returns table i mapped if it has k bytes and is big enough, or 0.
+// load(t, remap) loads the tables into the Arrays listed in t, which must
+// have the same sizes.  If remap, adopted tables are mapped again in the
+// same place, dropping what the constructors of the models wrote in
+// them, else they are copied.  rest() is the offset of the rest of the
+// state in the file, or 0 if there is none, and sum() is the hash of the
+// block sums of the tables in the file.
+// save(t, f, rest, sums) writes a snapshot of the Arrays in t to f and
+// returns its hash.  If sums is not 0, then the hash is that of the block
+// sums, which are stored in *sums, and a block is skipped rather than
+// written if its sum is the one in *sums, so f must hold what the last
+// call with sums wrote (or sums must be empty).
+
+const long PAGE=4096;
+const size_t MAPMIN=1<<16;  // smallest table to map
+const size_t BLOCK=1<<16;  // bytes per block sum
+
+// Sum of the n bytes at p
+U64 blockSum(const U8* p, size_t n) {
+  U64 s=n, w;
+  size_t i;
+  for (i=0; i+8<=n; i+=8) memcpy(&w, p+i, 8), s=(s+w)*0x9E3779B97F4A7C15ull;
+  for (; i<n; ++i) s=(s+p[i])*0x9E3779B97F4A7C15ull;
+  return s^s>>29;
+}
+
+// Add block sum s to hash h
+inline U32 addSum(U32 h, U64 s) {
+  return (((h^U32(s))*16777619)^U32(s>>32))*16777619;
+}
+
+inline long pageAlign(long n) {return (n+PAGE-1)&~(PAGE-1);}
+
+class Snapshot {
+  FILE* file;       // snapshot file, or 0 if one is being made
+  MappedFile* map;  // of file
+  int lev, memlev;  // level and memlevel of the tables
+  U32 h;            // hash of the tables
+  int p;            // pos
+  int n;            // number of tables
+  const U8* sizes;  // table sizes in the header
+  Array<long> offset;  // of each table in file
+  long end;         // of the tables, if the rest of the state follows
+  static U32 get(const U8* q) {return q[0]<<24|q[1]<<16|q[2]<<8|q[3];}
+  static void header(const Tables& t, U32 h, bool rest, FILE* f);
+public:
+  Snapshot(const char* name);
+  Snapshot(int level, int memlevel): file(0), map(0), lev(level),
+    memlev(memlevel), h(0), p(0), n(0), sizes(0), end(0) {}
+  ~Snapshot() {delete map; if (file) fclose(file);}
+  int getLevel() const {return lev;}
+  int getMemlevel() const {return memlev;}
+  U32 hash() const {return h;}
+  bool fits() const {return level==lev && memlevel==memlev;}
+  long rest() const {return end;}
+  U32 sum() const;
+  void* adopt(int i, size_t k, size_t& mapped) const;
+  void load(const Tables& t, bool remap=true) const;
+  static U32 save(const Tables& t, FILE* f, bool rest=false,
+    Array<U64>* sums=0);
+};
+
+Snapshot* snapshot=0;  // used by each new Predictor that fits, or 0
+
+bool priming() {
+  return snapshot && snapshot->fits();
+}
+
+void loadSnapshot(const Tables& t) {
+  snapshot->load(t);
+}
+
+void* adoptTable(size_t n, size_t& mapped) {
+  return priming() ? snapshot->adopt(recording->size(), n, mapped) : 0;
+}
+
+Snapshot::Snapshot(const char* name): map(0) {
+  file=fopen(name, "rb");
+  if (!file) perror(name), quit();
+  map=new MappedFile(file);
+  const U8* q=map->data();
+  const long len=map->size();
+  if (len<PAGE || memcmp(q, PROGNAME " snapshot", 16))
+    printf("%s: not a %s snapshot\n", name, PROGNAME), quit();
+  lev=q[16], memlev=q[17];
+  h=get(q+20), p=get(q+24), n=get(q+28);
+  sizes=q+32;
+  if (lev<1 || lev>MAXLEVEL || memlev>lev || q[18]>1 || n<0
+      || n>(len-32)/4)
+    printf("%s: snapshot corrupted\n", name), quit();
+  end=pageAlign(32+4L*n);
+  offset.resize(n);
+  for (int i=0; i<n; ++i) offset[i]=end, end+=pageAlign(get(sizes+4*i));
+  if (q[18] ? end>len : end!=len)
+    printf("%s: snapshot truncated\n", name), quit();
+  if (!q[18]) end=0;
+}
+
+U32 Snapshot::sum() const {
+  U32 s=2166136261u;
+  for (int i=0; i<n; ++i) {
+    const size_t k=get(sizes+4*i);
+    for (size_t j=0; j<k; j+=BLOCK)
+      s=addSum(s, blockSum(map->data()+offset[i]+j, k-j<BLOCK ? k-j : BLOCK));
+  }
+  return s;
+}
+
+void* Snapshot::adopt(int i, size_t k, size_t& mapped) const {
+#ifdef UNIX
+  if (!file || i>=n || k<MAPMIN || get(sizes+4*i)!=k) return 0;
+  void* m=mmap(0, pageAlign(k), PROT_READ|PROT_WRITE, MAP_PRIVATE,
+    fileno(file), offset[i]);
+  if (m==MAP_FAILED) return 0;
+  mapped=pageAlign(k);
+  return m;
+#else
+  return 0;
+#endif
+}
+
+void Snapshot::load(const Tables& t, bool remap) const {
+  if (!file) return;
+  if (t.size()!=n) quit("snapshot was made by another version");
+  for (int i=0; i<n; ++i) {
+    const size_t k=get(sizes+4*i);
+    if (k!=t.bytes(i)) quit("snapshot was made by another version");
+#ifdef UNIX
+    if (t.adopted(i) && remap) {
+      if (mmap(t.data(i), pageAlign(k), PROT_READ|PROT_WRITE,
+          MAP_PRIVATE|MAP_FIXED, fileno(file), offset[i])==MAP_FAILED)
+        quit("cannot map snapshot");
+      continue;
+    }
+#endif
+    memcpy(t.data(i), map->data()+offset[i], k);
+  }
+  pos=p;
+}
+
+void Snapshot::header(const Tables& t, U32 h, bool rest, FILE* f) {
+  Array<U8> header(pageAlign(32+4L*t.size()));
+  memcpy(&header[0], PROGNAME " snapshot", 16);
+  header[16]=level, header[17]=memlevel, header[18]=rest;
+  const U32 x[3]={h, U32(pos), U32(t.size())};
+  for (int i=0; i<3+t.size(); ++i) {
+    const U32 v=i<3 ? x[i] : U32(t.bytes(i-3));
+    for (int j=0; j<4; ++j) header[20+i*4+j]=v>>(24-j*8);
+  }
+  fwrite(&header[0], 1, header.size(), f);
+}
+
+U32 Snapshot::save(const Tables& t, FILE* f, bool rest, Array<U64>* sums) {
+  U32 h=2166136261u;
+  if (!sums)
+    for (int i=0; i<t.size(); ++i)
+      for (size_t j=0; j<t.bytes(i); ++j) h=(h^t.data(i)[j])*16777619;
+  const long start=ftell(f);
+  header(t, h, rest, f);
+  const U8 zero[PAGE]={0};
+  size_t b=0;  // block number
+  for (int i=0; i<t.size(); ++i) {
+    const size_t k=t.bytes(i);
+    if (!sums) fwrite(t.data(i), 1, k, f);
+    for (size_t j=0; sums && j<k; j+=BLOCK, ++b) {
+      const size_t m=k-j<BLOCK ? k-j : BLOCK;
+      const U64 s=blockSum(t.data(i)+j, m);
+      h=addSum(h, s);
+      if (b<sums->size() && (*sums)[b]==s) fseek(f, m, SEEK_CUR);
+      else {
+        fwrite(t.data(i)+j, 1, m, f);
+        if (b<sums->size()) (*sums)[b]=s;
+        else sums->push_back(s);
+      }
+    }
+    fwrite(zero, 1, pageAlign(k)-k, f);
+  }
+  if (sums) {  // the header with the hash
+    const long end=ftell(f);
+    fseek(f, start, SEEK_SET);
+    header(t, h, rest, f);
+    fseek(f, end, SEEK_SET);
+  }
+  if (ferror(f)) quit("write error");
+  return h;
+}
+
+U32 Predictor::save(FILE* f, bool rest, Array<U64>* sums) const {
+  return Snapshot::save(list, f, rest, sums);
+}
+
+//////////////////////////// Dedup ////////////////////////////
+
+// Long repeats are removed from the input before modeling.  At the top
+// level, compressRecursive() looks for strings of at least DEDUPMIN bytes
+// that occurred within the last MEM*16 bytes of input, in the same file
+// or in earlier files coded by the same Encoder.  Each one is coded as
+// a block <DEDUP> <length> <distance> and is not seen by the models.
+// The compressor and the decompressor keep the same window of past input
+// in a Dedup, which takes MEM*17 bytes (272 MB at -8).  Level 0 does not
+// look for repeats.
+//
+// Repeats are found from anchors: positions where a gear hash of the last
+// 32 bytes is below 2^24, about 1 in 256.  They depend only on content,
+// so a repeated string has the same anchors as the original.  The index
+// keeps the last position of each anchor hash.
+
+const int DEDUPMIN=1<<12;
+
+// Gear hash: g=(g<<1)+gear[c] depends on the last 32 bytes c
+class Gear {
+  U32 t[256];
+public:
+  Gear() {
+    U32 x=123456789;
+    for (int i=0; i<256; ++i)
+      t[i]=x=(x*1103515245+12345)^(x>>16);
+  }
+  U32 operator[](int i) const {return t[i];}
+} gear;
+
+class Dedup {
+  Array<U8> h;       // h[i&(h.size()-1)] is input byte i
+  Array<U32> index;  // anchor hash -> position after the anchor
+  U32 n;             // number of input bytes, mod 2^32
+  U32 used;          // bytes of h written, up to window()
+  int shift;         // index bits = 32-shift
+public:
+  Dedup(): n(0), used(0), shift(32) {}
+  void init();       // allocate if not yet done
+  U32 window() const {return h.size();}
+  U32 size() const {return n;}
+  U32 filled() const {return used;}  // bytes that back() may reach
+  void put(int c) {
+    h[n++&(h.size()-1)]=c;
+    if (used<U32(h.size())) ++used;
+  }
+  void put(const U8* p, long k);
+  int back(U32 d) const {  // input byte d (1..filled()) bytes back
+    assert(d>0 && d<=used);
+    return h[(n-d)&(h.size()-1)];
+  }
+  U32& anchor(U32 g) {return index[g*2654435761u>>shift];}
+  void state(State& s);  // save or restore it (see State)
+};
+
+void Dedup::state(State& s) {
+  U8 allocated=h.size()>0;
+  s(allocated);
+  if (!allocated) return;
+  init();
+  s(n), s(used);
+  s.packed(&h[0], h.size());
+  s.packed(&index[0], index.size()*sizeof(U32));
+}
+
+void Dedup::init() {
+  if (h.size()) return;
+  h.resize(MEM*16);
+  index.resize(MEM/4);
+  for (shift=32; (size_t(1)<<(32-shift))<index.size(); --shift);
+}
+
+// Add the k bytes at p.  Only the last window() of them are kept.
+void Dedup::put(const U8* p, long k) {
+  const int mask=h.size()-1;
+  if (k>mask) p+=k-mask-1, n+=k-mask-1, k=mask+1;
+  for (long i=0; i<k; ++i) h[n++&mask]=p[i];
+  used=used+k<U32(mask+1) ? used+k : mask+1;
+}
+
+//////////////////////////// Checkpoints ////////////////////////////
+
+// A solid compression of at least CHECKPOINTMIN bytes saves its whole
+// state every CHECKPOINTTIME seconds, so that if it is interrupted,
+// running the same command with -r added continues from the last
+// checkpoint instead of from the start.  The state is saved by the
+// Encoder (see Encoder::pass()) to archive.ck0 and archive.ck1 in turn,
+// so that the last complete one is kept while the next is written.
+// Each file is a Snapshot of the tables of the Predictor with the rest
+// of the state after them:
+//
+//   hash of the tables (4 bytes), as in the header
+//   the State of the Predictor (see Predictor::state())
+//   Encoder: x1, x2, archive offset, order0, bytes coded, their hash
+//
+// and then bytes coded (2 x 4 bytes), the size of the above and its
+// FNV-1a hash (4 bytes each), in the byte order of the machine.  Only the
+// blocks of the tables that changed since the file was last written are
+// written again (see Snapshot::save()).  The archive is written through
+// to the disk before a checkpoint, and the checkpoint after it.
+//
+// To resume, the newest file whose tables, state and hashes agree is
+// loaded when the input reaches the bytes it has coded, and the archive
+// is cut there.  The input before it is read again, but only the front
+// end runs on it (detect(), the transforms and the Dedup window, which
+// is rebuilt this way), which is much faster than modeling it.  If the
+// hash of that input is not the one saved, then the files have changed
+// and it quits.  Both files are removed when the compression finishes.
+//
+// The files are about the size of the tables (2.2 GB at -8).  While
+// saving, every model is allocated (see ContextModel::allocateAll()), as
+// for a Snapshot, which takes about 10% more memory.
+//
+// Checkpoints(archive) names the files of archive.  find() selects the
+// newest complete one and returns the bytes it has coded, or 0 if there
+// is none.  remove() deletes them.
+
+const int CHECKPOINTTIME=1800;  // seconds between checkpoints
+const long CHECKPOINTMIN=1<<24;  // smallest input to checkpoint
+
+void truncateFile(FILE* f, long n);
+void syncFile(FILE* f);
+
+struct Checkpoints {
+  String name[2];      // archive.ck0, archive.ck1
+  Array<U64> sums[2];  // block sums of the tables in each file
+  int next;            // file to write next, the other one to resume from
+  time_t last;         // time of the last checkpoint
+  U64 target;          // bytes coded by the file to resume from, or 0
+  Checkpoints(const char* archive);
+  U64 find();
+  void remove() {::remove(name[0].c_str()), ::remove(name[1].c_str());}
+};
+
+Checkpoints::Checkpoints(const char* archive):
+    next(0), last(time(0)), target(0) {
+  for (int i=0; i<2; ++i)
+    name[i]=archive, name[i]+=i ? ".ck1" : ".ck0";
+}
+
+U64 Checkpoints::find() {
+  for (int i=0; i<2; ++i) {
+    FILE* f=fopen(name[i].c_str(), "rb");
+    if (!f) continue;
+    fclose(f);
+    try {
+      Snapshot s(name[i].c_str());
+      f=fopen(name[i].c_str(), "rb");
+      fseek(f, 0, SEEK_END);
+      const long len=ftell(f)-s.rest()-16;
+      U32 x[4]={0};  // bytes coded, size and hash of the state
+      Array<U8> rest(len>=4 ? len : 0);
+      fseek(f, s.rest(), SEEK_SET);
+      const bool ok=s.rest() && len>=4
+        && fread(&rest[0], 1, len, f)==size_t(len) && fread(x, 1, 16, f)==16;
+      fclose(f);
+      U32 h=2166136261u, t;
+      for (long j=0; j<len; ++j) h=(h^rest[j])*16777619;
+      if (ok) memcpy(&t, &rest[0], 4);
+      const U64 n=U64(x[0])<<32|x[1];
+      if (ok && x[2]==U32(len) && x[3]==h && t==s.hash() && n>target
+          && s.sum()==s.hash())
+        target=n, next=!i;
+    }
+    catch (const char*) {}  // not a checkpoint
+  }
+  return target;
+}
+
+//////////////////////////// Encoder ////////////////////////////
+
+// An Encoder does arithmetic encoding.  Methods:
+// Encoder(COMPRESS, f) creates encoder for compression to archive f, which
+//   must be open past any header for writing in binary mode.
+// Encoder(DECOMPRESS, f) creates encoder for decompression from archive f,
+//   which must be open past any header for reading in binary mode.
+// Encoder(DECOMPRESS, f, n) reads at most n bytes of f, as if f ended there.
+// Encoder(COMPRESS, a) compresses to memory, appending to Array<U8> a.
+// Encoder(DECOMPRESS, p, n) decompresses from the n bytes in memory at p.
+// code(i) in COMPRESS mode compresses bit i (0 or 1) to file f.
+// code() in DECOMPRESS mode returns the next decompressed bit from file f.
+//   Global y is set to the last bit coded or decoded by code().
+// compress(c) in COMPRESS mode compresses one byte.
+// decompress() in DECOMPRESS mode decompresses and returns one byte.
+// flush() should be called exactly once after compression is done and
+//   before closing f.  It does nothing in DECOMPRESS mode.
+// sync() in COMPRESS mode writes the buffered output to f or a, so it can
+//   be read before compression is done.  The destructor also calls it.
+// size() returns current length of archive (in COMPRESS mode), or the
+//   position after the bytes used so far (in DECOMPRESS mode).
+// setInput(in) sets alternate source to Input* in for decompress() in
+//   COMPRESS mode (for testing transforms).
+// restart(n) in DECOMPRESS mode from a file starts decoding another
+//   arithmetic code at the current position of f, reading at most n
+//   bytes, with the model as it is.
+// writeState(f) writes the state of the model, order0 and the Dedup to
+//   f, and readState(f) reads it back (see compressChained()).  The
+//   Predictor must have been created with savable.
+// setCheckpoints(ck) makes an Encoder in COMPRESS mode to a file save
+//   checkpoints to ck and, if ck->target, resume from one (see
+//   Checkpoints).  The Predictor must have been created with savable.
+//   replaying() is true until the checkpoint is reached.
+// history() returns the Dedup of the input coded so far.
+// If level (global) is 0, then data is stored without arithmetic coding.
+//
+// The archive is read and written through a buffer of ENCODERBUF bytes
+// rather than with putc() and getc() on every byte.  In DECOMPRESS mode
+// the Encoder reads ahead, so f should not be read by anything else.
+//
+// The decoder reads 3 bytes past the end of valid data (the range x
+// holds 4 bytes, and flush() writes 1), and none at level 0.  Reading
+// more means that the input was cut short, so it quits rather than
+// decode garbage (and, with a large enough input, run on for a long time).
+
+const int ENCODERBUF=1<<16;
+
+typedef enum {COMPRESS, DECOMPRESS} Mode;
+class Encoder {
+private:
+  Predictor predictor;
+  const Mode mode;       // Compress or decompress?
+  FILE* archive;         // Compressed data file, or 0 if in memory
+  Array<U8>* sink;       // Compressed data if in memory in COMPRESS mode
+  Array<U8> io;          // Buffered part of archive
+  U8 *out, *outend;      // COMPRESS: next free byte and end of io
+  const U8 *in, *inend;  // DECOMPRESS: next byte and end of input
+  long base;             // archive offset of io (COMPRESS) or of inend
+  long left;             // bytes of archive fill() may read, or -1 if all
+  U32 x1, x2;            // Range, initially [0, 1), scaled by 2^32
+  U32 x;                 // Decompress mode: last 4 input bytes of archive
+  int pastEnd;           // Decompress mode: bytes read past the end
+  Input *alt;            // decompress() source in COMPRESS mode
+  U32 order0[256];       // c0 -> p(1) and count for STORED data, as in StateMap
+  Dedup dedup;           // past input for DEDUP blocks
+  Checkpoints* ck;       // where the state is saved, or 0
+  U64 coded;             // bytes compressed, if ck
+  U32 sum;               // FNV-1a hash of them
+  U64 replay;            // bytes to skip before restoring ck, or 0
+
+  void init();
+  bool pass(int c);  // count byte c, false if it is skipped
+  void save();  // save a checkpoint
+  void restore();  // restore the checkpoint to resume from
+
+  // Write c to the archive
+  void put(int c) {
+    if (out==outend) sync();
+    *out++=c;
+  }
+
+  // Return the next byte of the archive, or EOF a few times at its end
+  int get() {
+    if (in==inend && !fill()) {
+      if (++pastEnd>(level>0 ? 3 : 0)) quit("archive truncated");
+      return EOF;
+    }
+    return *in++;
+  }
+  bool fill();
+
+  // Compress bit i or return decompressed bit with probability p (0..4095)
+  // that it is 1
+  int codeBit(int p, int i=0) {
+    assert(p>=0 && p<4096);
+    p+=p<2048;
+    U32 xmid=x1 + ((x2-x1)>>12)*p + (((x2-x1)&0xfff)*p>>12);
+    assert(xmid>=x1 && xmid<x2);
+    if (mode==DECOMPRESS) i=x<=xmid;
+    i ? (x2=xmid) : (x1=xmid+1);
+    while (((x1^x2)&0xff000000)==0) {  // pass equal leading bytes of range
+      if (mode==COMPRESS) put(x2>>24);
+      x1<<=8;
+      x2=(x2<<8)+255;
+      if (mode==DECOMPRESS) x=(x<<8)+(get()&255);  // EOF is OK
+    }
+    return i;
+  }
+
+  // Compress bit y or return decompressed bit
+  int code(int i=0) {
+    y=codeBit(predictor.p(), i);
+    predictor.update();
+    return y;
+  }
+
+  // Compress byte c or return decompressed byte of STORED data, using
+  // order0 instead of the predictor
+  int codeStored(int c=0) {
+    int cx=1;
+    for (int i=7; i>=0; --i) {
+      U32& p=order0[cx];
+      const int b=codeBit(p>>20, c>>i&1), n=p&1023, pr=p>>10;
+      if (n<1023) ++p;
+      p+=(((b<<22)-pr)>>3)*dt[n]&0xfffffc00;
+      cx+=cx+b;
+    }
+    return cx&255;
+  }
+
+public:
+  Encoder(Mode m, FILE* f, long n=-1);
+  Encoder(Mode m, Array<U8>& a);
+  Encoder(Mode m, const U8* p, long n);
+  ~Encoder() {if (mode==COMPRESS) sync();}
+  Mode getMode() const {return mode;}
+  long size() const {  // length of archive so far
+    return mode==COMPRESS ? base+(out-&io[0]) : base-(inend-in);
+  }
+  void flush();  // call this when compression is finished
+  void sync();  // write buffered output
+  void setInput(Input* in) {alt=in;}
+  void restart(long n);
+  void writeState(FILE* f);
+  void readState(FILE* f);
+  void setCheckpoints(Checkpoints* c) {ck=c, replay=c->target;}
+  bool replaying() const {return replay>0;}
+  Dedup& history() {return dedup;}
+  void saveModel(FILE* f) const {predictor.save(f);}  // see Snapshot
+
+  // Compress one byte
+  void compress(int c) {
+    assert(mode==COMPRESS);
+    if (ck && !pass(c)) return;
+    if (level==0)
+      put(c);
+    else
+      for (int i=7; i>=0; --i)
+        code((c>>i)&1);
+  }
+
+  // Compress one byte of a STORED block.  The predictor does not see it.
+  void compressStored(int c) {
+    assert(mode==COMPRESS);
+    if (ck && !pass(c)) return;
+    if (level==0) put(c);
+    else codeStored(c);
+  }
+
+  // Decompress and return one byte of a STORED block
+  int decompressStored() {
+    assert(mode==DECOMPRESS);
+    return level==0 ? get() : codeStored();
+  }
+
+  // Decompress and return one byte
+  int decompress() {
+    if (mode==COMPRESS) {
+      assert(alt);
+      return alt->get();
+    }
+    else if (level==0)
+      return get();
+    else {
+      int c=0;
+      for (int i=0; i<8; ++i)
+        c+=c+code();
+      return c;
+    }
+  }
+};
+
+Encoder::Encoder(Mode m, FILE* f, long n):
+    mode(m), archive(f), sink(0), io(ENCODERBUF), in(0), inend(0),
+    base(ftell(f)), left(n), x1(0), x2(0xffffffff), x(0), alt(0) {
+  assert(n<0 || mode==DECOMPRESS);
+  if (base<0) base=0;  // a pipe
+  init();
+}
+
+Encoder::Encoder(Mode m, Array<U8>& a):
+    mode(m), archive(0), sink(&a), io(ENCODERBUF), in(0), inend(0),
+    base(a.size()), left(0), x1(0), x2(0xffffffff), x(0), alt(0) {
+  assert(mode==COMPRESS);
+  init();
+}
+
+Encoder::Encoder(Mode m, const U8* p, long n):
+    mode(m), archive(0), sink(0), io(0), in(p), inend(p+n), base(n),
+    left(0), x1(0), x2(0xffffffff), x(0), alt(0) {
+  assert(mode==DECOMPRESS);
+  init();
+}
+
+void Encoder::init() {
+  pastEnd=0;
+  ck=0, coded=0, sum=2166136261u, replay=0;
+  for (int i=0; i<256; ++i) order0[i]=1<<31;
+  out=outend=0;
+  if (mode==COMPRESS) out=&io[0], outend=out+io.size();
+  if (level>0 && mode==DECOMPRESS) {  // x = first 4 bytes of archive
+    for (int i=0; i<4; ++i)
+      x=(x<<8)+(get()&255);
+  }
+}
+
+// Read more of the archive into io.  Return false at EOF.
+bool Encoder::fill() {
+  if (!archive || left==0) return false;
+  const size_t k=left>0 && left<long(io.size()) ? left : io.size();
+  const int n=fread(&io[0], 1, k, archive);
+  in=&io[0], inend=in+n;
+  base+=n;
+  if (left>0) left-=n;
+  return n>0;
+}
+
+void Encoder::sync() {
+  assert(mode==COMPRESS);
+  const int n=out-&io[0];
+  if (archive) fwrite(&io[0], 1, n, archive);
+  else for (int i=0; i<n; ++i) sink->push_back(io[i]);
+  base+=n;
+  out=&io[0];
+}
+
+void Encoder::flush() {
+  if (mode==COMPRESS) {
+    if (level>0) put(x1>>24);  // Flush first unequal byte of range
+    sync();
+  }
+}
+
+void Encoder::restart(long n) {
+  assert(mode==DECOMPRESS && archive);
+  base=ftell(archive), left=n, in=inend=0;
+  x1=0, x2=0xffffffff, x=0, pastEnd=0;
+  if (level>0)
+    for (int i=0; i<4; ++i)
+      x=(x<<8)+(get()&255);
+}
+
+void Encoder::writeState(FILE* f) {
+  State s(predictor.tables(), f, true);
+  s.tables();
+  predictor.state(s);
+  s(order0);
+  dedup.state(s);
+  U32 h=s.sum();
+  s(h);
+}
+
+void Encoder::readState(FILE* f) {
+  State s(predictor.tables(), f, false);
+  s.tables();
+  predictor.state(s);
+  s(order0);
+  dedup.state(s);
+  const U32 h=s.sum();
+  U32 t;
+  s(t);
+  if (t!=h) quit("saved state corrupted");
+}
+
+// Checkpoint before byte c if it is time, or restore one when it is
+// reached.  Return false while replaying the bytes before it.
+bool Encoder::pass(int c) {
+  if (replay && coded==replay) restore();
+  else if (!replay && (coded&0xffff)==0 && coded
+      && time(0)-ck->last>=CHECKPOINTTIME)
+    save();
+  sum=(sum^U8(c))*16777619;
+  ++coded;
+  return !replay;
+}
+
+void Encoder::save() {
+  sync();
+  syncFile(archive);
+  const char* name=ck->name[ck->next].c_str();
+  FILE* f=fopen(name, "rb+");
+  if (!f) f=fopen(name, "wb+");
+  if (!f) perror(name), quit();
+  U32 h=predictor.save(f, true, &ck->sums[ck->next]);
+  const long start=ftell(f);
+  State s(predictor.tables(), f, true);
+  U64 b=base;
+  s(h);
+  predictor.state(s);
+  s(x1), s(x2), s(b), s(order0), s(coded), s(sum);
+  const U32 x[4]={U32(coded>>32), U32(coded), U32(ftell(f)-start), s.sum()};
+  fwrite(x, 1, 16, f);
+  if (ferror(f)) quit("write error");
+  truncateFile(f, ftell(f));
+  syncFile(f);
+  fclose(f);
+  ck->next=!ck->next;
+  ck->last=time(0);
+}
+
+void Encoder::restore() {
+  const char* name=ck->name[!ck->next].c_str();
+  Snapshot snap(name);
+  if (!snap.fits() || !snap.rest())
+    quit("cannot resume: archive was made with other options");
+  snap.load(predictor.tables(), false);
+  FILE* f=fopen(name, "rb");
+  if (!f) perror(name), quit();
+  fseek(f, snap.rest(), SEEK_SET);
+  State s(predictor.tables(), f, false);
+  U32 h;
+  U64 b, n;
+  U32 t;
+  s(h);
+  predictor.state(s);
+  s(x1), s(x2), s(b), s(order0), s(n), s(t);
+  fclose(f);
+  if (h!=snap.hash() || n!=coded || t!=sum)
+    quit("cannot resume: the files have changed");
+  truncateFile(archive, b);
+  fseek(archive, b, SEEK_SET);
+  base=b, out=&io[0];
+  replay=0;
+  printf("\nResumed at byte %.0f of the input from %s\n", double(coded), name);
+}
+
+/////////////////////////// Filters /////////////////////////////////
+//
+// Before compression, data is encoded in blocks with the following format:
+//
+//   <type> <size> <encoded-data>
+//
+// Type is 1 byte (type Filetype): DEFAULT=0, JPEG, EXE, ... STORED, DEDUP.
+// STORED data is not seen by the predictor (see encode_default()).
+// A DEDUP block has no encoded data but a 4 byte distance back into the
+// Dedup window of the Encoder (see compressRecursive()).
+// Size is 4 bytes in big-endian format.
+// Encoded-data decodes to <size> bytes.  The encoded size might be
+// different.  Encoded data is designed to be more compressible.
+//
+//   void encode(Input& in, FILE* out, int n);
+//
+// Reads n bytes of in and encodes one or more blocks to temporary
+// file out (open in "wb+" mode).  The position of in is advanced n
+// bytes.  The file pointer of out is positioned after the last byte
+// written.
+//
+//   en.setInput(Input* out);
+//   int decode(Encoder& en);
+//
+// Decodes and returns one byte.  Input is from en.decompress(), which
+// reads from out (mapped with MappedFile) if in COMPRESS mode.  During compression, n calls
+// to decode() must exactly match n bytes of in, or else it is compressed
+// as type 0 without encoding.
+//
+//   Filetype detect(Input& in, int n, Filetype type);
+//
+// Reads n bytes of in, and detects when the type changes to
+// something else.  If it does, then the file pointer is repositioned
+// to the start of the change and the new type is returned.  If the type
+// does not change, then it repositions the file pointer n bytes ahead
+// and returns the old type.
+//
+// For each type X there are the following 2 functions:
+//
+//   void encode_X(FILE* in, FILE* out, int n, ...);
+//
+// encodes n bytes from in to out.
+//
+//   int decode_X(Encoder& en);
+//
+// decodes one byte from en and returns it.  decode() and decode_X()
+// maintain state information using static variables.
+#define bswap(x) \
++   ((((x) & 0xff000000) >> 24) | \
++    (((x) & 0x00ff0000) >>  8) | \
++    (((x) & 0x0000ff00) <<  8) | \
++    (((x) & 0x000000ff) << 24))
+
+#define IMG_DET(type,start_pos,header_len,width,height) return dett=(type),\
+deth=(header_len),detd=(width)*(height),info=(width),\
+in.seek(start+(start_pos)),HDR
+
+#define AUD_DET(type,start_pos,header_len,data_len,wmode) return dett=(type),\
+deth=(header_len),detd=(data_len),info=(wmode),\
+in.seek(start+(start_pos)),HDR
+
+
+// Function ecc_compute(), edc_compute() and eccedc_init() taken from 
+// ** UNECM - Decoder for ECM (Error Code Modeler) format.
+// ** Version 1.0
+// ** Copyright (C) 2002 Neill Corlett
+
+/* LUTs used for computing ECC/EDC */
+static U8 ecc_f_lut[256];
+static U8 ecc_b_lut[256];
+static U32 edc_lut[256];
+static int luts_init=0;
+
+void eccedc_init(void) {
+  if (luts_init) return;
+  U32 i, j, edc;
+  for(i = 0; i < 256; i++) {
+    j = (i << 1) ^ (i & 0x80 ? 0x11D : 0);
+    ecc_f_lut[i] = j;
+    ecc_b_lut[i ^ j] = i;
+    edc = i;
+    for(j = 0; j < 8; j++) edc = (edc >> 1) ^ (edc & 1 ? 0xD8018001 : 0);
+    edc_lut[i] = edc;
+  }
+  luts_init=1;
+}
+
+void ecc_compute(U8 *src, U32 major_count, U32 minor_count, U32 major_mult, U32 minor_inc, U8 *dest) {
+  U32 size = major_count * minor_count;
+  U32 major, minor;
+  for(major = 0; major < major_count; major++) {
+    U32 index = (major >> 1) * major_mult + (major & 1);
+    U8 ecc_a = 0;
+    U8 ecc_b = 0;
+    for(minor = 0; minor < minor_count; minor++) {
+      U8 temp = src[index];
+      index += minor_inc;
+      if(index >= size) index -= size;
+      ecc_a ^= temp;
+      ecc_b ^= temp;
+      ecc_a = ecc_f_lut[ecc_a];
+    }
+    ecc_a = ecc_b_lut[ecc_f_lut[ecc_a] ^ ecc_b];
+    dest[major              ] = ecc_a;
+    dest[major + major_count] = ecc_a ^ ecc_b;
+  }
+}
+
+U32 edc_compute(const U8  *src, int size) {
+  U32 edc = 0;
+  while(size--) edc = (edc >> 8) ^ edc_lut[(edc ^ (*src++)) & 0xFF];
+  return edc;
+}
+
+int expand_cd_sector(U8 *data, int a, int test) {
+  U8 d2[2352];
+  eccedc_init();
+  d2[0]=d2[11]=0;
+  for (int i=1; i<11; i++) d2[i]=255;
+  int mode=(data[15]!=1?2:1);
+  int form=(data[15]==3?2:1);
+  if (a==-1) for (int i=12; i<15; i++) d2[i]=data[i]; else {
+    int c1=(a&15)+((a>>4)&15)*10;
+    int c2=((a>>8)&15)+((a>>12)&15)*10;
+    int c3=((a>>16)&15)+((a>>20)&15)*10;
+    c1=(c1+1)%75;
+    if (c1==0) {
+      c2=(c2+1)%60;
+      if (c2==0) c3++;
+    }
+    d2[12]=(c3%10)+16*(c3/10);
+    d2[13]=(c2%10)+16*(c2/10);
+    d2[14]=(c1%10)+16*(c1/10);
+  }
+  d2[15]=mode;
+  if (mode==2) for (int i=16; i<24; i++) d2[i]=data[i-4*(i>=20)];
+  if (form==1) {
+    if (mode==2) {
+      d2[1]=d2[12],d2[2]=d2[13],d2[3]=d2[14];
+      d2[12]=d2[13]=d2[14]=d2[15]=0;
+    } else {
+      for(int i=2068; i<2076; i++) d2[i]=0;
+    }
+    for (int i=16+8*(mode==2); i<2064+8*(mode==2); i++) d2[i]=data[i];
+    U32 edc=edc_compute(d2+16*(mode==2), 2064-8*(mode==2));
+    for (int i=0; i<4; i++) d2[2064+8*(mode==2)+i]=(edc>>(8*i))&0xff;
+    ecc_compute(d2+12, 86, 24,  2, 86, d2+2076);
+    ecc_compute(d2+12, 52, 43, 86, 88, d2+2248);
+    if (mode==2) {
+      d2[12]=d2[1],d2[13]=d2[2],d2[14]=d2[3],d2[15]=2;
+      d2[1]=d2[2]=d2[3]=255;
+    }
+  }
+  for (int i=0; i<2352; i++) if (d2[i]!=data[i] && test) form=2;
+  if (form==2) {
+    for (int i=24; i<2348; i++) d2[i]=data[i];
+    U32 edc=edc_compute(d2+16, 2332);
+    for (int i=0; i<4; i++) d2[2348+i]=(edc>>(8*i))&0xff;
+  }
+  for (int i=0; i<2352; i++) if (d2[i]!=data[i] && test) return 0; else data[i]=d2[i];
+  return mode+form-1;
+}
+
+// Detect EXE or JPEG data
+Filetype detect(Input& in, int n, Filetype type, int &info) {
+  U32 buf1=0, buf0=0;  // last 8 bytes
+  long start=in.tell();
+
+  // For EXE detection
+  Array<int> abspos(256),  // CALL/JMP abs. addr. low byte -> last offset
+    relpos(256);    // CALL/JMP relative addr. low byte -> last offset
+  int e8e9count=0;  // number of consecutive CALL/JMPs
+  int e8e9pos=0;    // offset of first CALL or JMP instruction
+  int e8e9last=0;   // offset of most recent CALL or JMP
+
+  int soi=0, sof=0, sos=0, app=0;  // For JPEG detection - position where found
+  int wavi=0,wavsize=0,wavch=0,wavbps=0,wavm=0;  // For WAVE detection
+  int aiff=0,aiffm=0,aiffs=0;  // For AIFF detection
+  int s3mi=0,s3mno=0,s3mni=0;  // For S3M detection
+  int bmp=0,imgbpp=0,bmpx=0,bmpy=0,bmpof=0;  // For BMP detection
+  int rgbi=0,rgbx=0,rgby=0;  // For RGB detection
+  int tga=0,tgax=0,tgay=0,tgaz=0,tgat=0;  // For TGA detection
+  int pgm=0,pgmcomment=0,pgmw=0,pgmh=0,pgm_ptr=0,pgmc=0,pgmn=0;  // For PBM, PGM, PPM detection
+  char pgm_buf[32];
+  int cdi=0,cda=0,cdm=0;  // For CD sectors detection
+  U32 cdf=0;
+
+  // For image detection
+  static TLS int deth=0,detd=0;  // detected header/data size in bytes
+  static TLS Filetype dett;  // detected block type
+  if (deth) return in.seek(start+deth),deth=0,dett;
+  else if (detd) return in.seek(start+detd),detd=0,DEFAULT;
+
+  for (int i=0; i<n; ++i) {
+    int c=in.get();
+    if (c==EOF) return (Filetype)(-1);
+    buf1=buf1<<8|buf0>>24;
+    buf0=buf0<<8|c;
+
+    // CD sectors detection (mode 1 and mode 2 form 1+2 - 2352 bytes)
+    if (buf1==0x00ffffff && buf0==0xffffffff && !cdi) cdi=i,cda=-1,cdm=0;
+    if (cdi && i>cdi) {
+      const int p=(i-cdi)%2352;
+      if (p==8 && (buf1!=0xffffff00 || ((buf0&0xff)!=1 && (buf0&0xff)!=2))) cdi=0;
+      else if (p==16 && i+2336<n) {
+        U8 data[2352];
+        long savedpos=in.tell();
+        in.seek(start+i-23);
+        in.read(data, 2352);
+        in.seek(savedpos);
+        int t=expand_cd_sector(data, cda, 1);
+        if (t!=cdm) cdm=t*(i-cdi<2352);
+        if (cdm && cda!=10 && (cdm==1 || buf0==buf1)) {
+          if (type!=CD) return info=cdm,in.seek(start+cdi-7), CD;
+          cda=(data[12]<<16)+(data[13]<<8)+data[14];
+          if (cdm!=1 && i-cdi>2352 && buf0!=cdf) cda=10;
+          if (cdm!=1) cdf=buf0;
+        } else cdi=0;
+      }
+      if (!cdi && type==CD) return in.seek(start+i-p-7), DEFAULT;
+    }
+    if (type==CD) continue;
+
+    // Detect JPEG by code SOI APPx (FF D8 FF Ex) followed by
+    // SOF0 (FF C0 xx xx 08) and SOS (FF DA) within a reasonable distance.
+    // Detect end by any code other than RST0-RST7 (FF D9-D7) or
+    // a byte stuff (FF 00).
+
+    if (!soi && i>=3 && (buf0&0xfffffff0)==0xffd8ffe0) soi=i, app=i+2, sos=sof=0;
+    if (soi) {
+      if (app==i && (buf0>>24)==0xff &&
+         ((buf0>>16)&0xff)>0xc0 && ((buf0>>16)&0xff)<0xff) app=i+(buf0&0xffff)+2;
+      if (app<i && (buf1&0xff)==0xff && (buf0&0xff0000ff)==0xc0000008) sof=i;
+      if (sof && sof>soi && i-sof<0x1000 && (buf0&0xffff)==0xffda) {
+        sos=i;
+        if (type!=JPEG) return in.seek(start+soi-3), JPEG;
+      }
+      if (i-soi>0x40000 && !sos) soi=0;
+    }
+    if (type==JPEG && sos && i>sos && (buf0&0xff00)==0xff00
+        && (buf0&0xff)!=0 && (buf0&0xf8)!=0xd0) return DEFAULT;
+
+    // Detect .wav file header
+    if (buf0==0x52494646) wavi=i,wavm=0;
+    if (wavi) {
+      const int p=i-wavi;
+      if (p==4) wavsize=bswap(buf0);
+      else if (p==8 && buf0!=0x57415645) wavi=0;
+      else if (p==16 && (buf1!=0x666d7420 || bswap(buf0)!=16)) wavi=0;
+      else if (p==22) wavch=bswap(buf0)&0xffff;
+      else if (p==34) wavbps=bswap(buf0)&0xffff;
+      else if (p==40+wavm && buf1!=0x64617461) wavm+=bswap(buf0)+8,wavi=(wavm>0xfffff?0:wavi);
+      else if (p==40+wavm) {
+        int wavd=bswap(buf0);
+        if ((wavch==1 || wavch==2) && (wavbps==8 || wavbps==16) && wavd>0 && wavsize>=wavd+36
+           && wavd%((wavbps/8)*wavch)==0) AUD_DET(AUDIO,wavi-3,44+wavm,wavd,wavch+wavbps/4-3);
+        wavi=0;
+      }
+    }
+
+    // Detect .aiff file header
+    if (buf0==0x464f524d) aiff=i,aiffs=0; // FORM
+    if (aiff) {
+      const int p=i-aiff;
+      if (p==12 && (buf1!=0x41494646 || buf0!=0x434f4d4d)) aiff=0; // AIFF COMM
+      else if (p==24) {
+        const int bits=buf0&0xffff, chn=buf1>>16;
+        if ((bits==8 || bits==16) && (chn==1 || chn==2)) aiffm=chn+bits/4+1; else aiff=0;
+      } else if (p==42+aiffs && buf1!=0x53534e44) aiffs+=(buf0+8)+(buf0&1),aiff=(aiffs>0x400?0:aiff);
+      else if (p==42+aiffs) AUD_DET(AUDIO,aiff-3,54+aiffs,buf0-8,aiffm);
+    }
+
+    // Detect .mod file header 
+    if ((buf0==0x4d2e4b2e || buf0==0x3643484e || buf0==0x3843484e  // M.K. 6CHN 8CHN
+       || buf0==0x464c5434 || buf0==0x464c5438) && (buf1&0xc0c0c0c0)==0 && i>=1083) {
+      long savedpos=in.tell();
+      const int chn=((buf0>>24)==0x36?6:(((buf0>>24)==0x38 || (buf0&0xff)==0x38)?8:4));
+      int len=0; // total length of samples
+      int numpat=1; // number of patterns
+      for (int j=0; j<31; j++) {
+        in.seek(start+i-1083+42+j*30);
+        const int i1=in.get();
+        const int i2=in.get();
+        len+=i1*512+i2*2;
+      }
+      in.seek(start+i-131);
+      for (int j=0; j<128; j++) {
+        int x=in.get();
+        if (x+1>numpat) numpat=x+1;
+      }
+      if (numpat<65) AUD_DET(AUDIO,i-1083,1084+numpat*256*chn,len,4);
+      in.seek(savedpos);
+    }
+
+    // Detect .s3m file header 
+    if (buf0==0x1a100000) s3mi=i,s3mno=s3mni=0;
+    if (s3mi) {
+      const int p=i-s3mi;
+      if (p==4) s3mno=bswap(buf0)&0xffff,s3mni=(bswap(buf0)>>16);
+      else if (p==16 && (((buf1>>16)&0xff)!=0x13 || buf0!=0x5343524d)) s3mi=0;
+      else if (p==16) {
+        long savedpos=in.tell();
+        int b[31],sam_start=(1<<16),sam_end=0,ok=1;
+        for (int j=0;j<s3mni;j++) {
+          in.seek(start+s3mi-31+0x60+s3mno+j*2);
+          int i1=in.get();
+          i1+=in.get()*256;
+          in.seek(start+s3mi-31+i1*16);
+          i1=in.get();
+          if (i1==1) { // type: sample
+            for (int k=0;k<31;k++) b[k]=in.get();
+            int len=b[15]+(b[16]<<8);
+            int ofs=b[13]+(b[14]<<8);
+            if (b[30]>1) ok=0;
+            if (ofs*16<sam_start) sam_start=ofs*16;
+            if (ofs*16+len>sam_end) sam_end=ofs*16+len;
+          }
+        }
+        if (ok && sam_start<(1<<16)) AUD_DET(AUDIO,s3mi-31,sam_start,sam_end-sam_start,0);
+        s3mi=0;
+        in.seek(savedpos);
+      }
+    }
+
+    // Detect .bmp image
+    if ((buf0&0xffff)==16973) imgbpp=bmpx=bmpy=bmpof=0,bmp=i;  //possible 'BM'
+    if (bmp) {
+      const int p=i-bmp;
+      if (p==12) bmpof=bswap(buf0);
+      else if (p==16 && buf0!=0x28000000) bmp=0; //windows bmp?
+      else if (p==20) bmpx=bswap(buf0),bmp=((bmpx==0||bmpx>0x30000)?0:bmp); //width
+      else if (p==24) bmpy=abs((int)bswap(buf0)),bmp=((bmpy==0||bmpy>0x10000)?0:bmp); //height
+      else if (p==27) imgbpp=c,bmp=((imgbpp!=1 && imgbpp!=8 && imgbpp!=24)?0:bmp);
+      else if (p==31) {
+        if (imgbpp!=0 && buf0==0) {
+          if (imgbpp==1) IMG_DET(IMAGE1,bmp-1,bmpof,(((bmpx-1)>>5)+1)*4,bmpy);
+          else if (imgbpp==8) IMG_DET(IMAGE8,bmp-1,bmpof,(bmpx+3)&-4,bmpy);
+          else if (imgbpp==24) IMG_DET(IMAGE24,bmp-1,bmpof,((bmpx*3)+3)&-4,bmpy);
+        }
+        bmp=0;
+      }
+    }
+
+    // Detect .pbm .pgm .ppm image
+    if ((buf0&0xfff0ff)==0x50300a) {
+      pgmn=(buf0&0xf00)>>8;
+      if (pgmn>=4 && pgmn <=6) pgm=i,pgm_ptr=pgmw=pgmh=pgmc=pgmcomment=0;
+    }
+    if (pgm) {
+      if (i-pgm==1 && c==0x23) pgmcomment=1; //pgm comment
+      if (!pgmcomment && pgm_ptr) {
+        int s=0;
+        if (c==0x20 && !pgmw) s=1;
+        else if (c==0x0a && !pgmh) s=2;
+        else if (c==0x0a && !pgmc && pgmn!=4) s=3;
+        if (s) {
+          pgm_buf[pgm_ptr++]=0;
+          int v=atoi(pgm_buf);
+          if (s==1) pgmw=v; else if (s==2) pgmh=v; else if (s==3) pgmc=v;
+          if (v==0 || (s==3 && v>255)) pgm=0; else pgm_ptr=0;
+        }
+      }
+      if (!pgmcomment) pgm_buf[pgm_ptr++]=c;
+      if (pgm_ptr>=32) pgm=0;
+      if (pgmcomment && c==0x0a) pgmcomment=0;
+      if (pgmw && pgmh && !pgmc && pgmn==4) IMG_DET(IMAGE1,pgm-2,i-pgm+3,(pgmw+7)/8,pgmh);
+      if (pgmw && pgmh && pgmc && pgmn==5) IMG_DET(IMAGE8,pgm-2,i-pgm+3,pgmw,pgmh);
+      if (pgmw && pgmh && pgmc && pgmn==6) IMG_DET(IMAGE24,pgm-2,i-pgm+3,pgmw*3,pgmh);
+    }
+
+    // Detect .rgb image
+    if ((buf0&0xffff)==0x01da) rgbi=i,rgbx=rgby=0;
+    if (rgbi) {
+      const int p=i-rgbi;
+      if (p==1 && c!=0) rgbi=0;
+      else if (p==2 && c!=1) rgbi=0;
+      else if (p==4 && (buf0&0xffff)!=1 && (buf0&0xffff)!=2 && (buf0&0xffff)!=3) rgbi=0;
+      else if (p==6) rgbx=buf0&0xffff,rgbi=(rgbx==0?0:rgbi);
+      else if (p==8) rgby=buf0&0xffff,rgbi=(rgby==0?0:rgbi);
+      else if (p==10) {
+        int z=buf0&0xffff;
+        if (rgbx && rgby && (z==1 || z==3 || z==4)) IMG_DET(IMAGE8,rgbi-1,512,rgbx,rgby*z);
+        rgbi=0;
+      }
+    }
+
+    // Detect .tiff file header (2/8/24 bit color, not compressed).
+    if (buf1==0x49492a00 && n>i+(int)bswap(buf0)) {
+      long savedpos=in.tell();
+      in.seek(start+i+bswap(buf0)-7);
+
+      // read directory
+      int dirsize=in.get();
+      int tifx=0,tify=0,tifz=0,tifzb=0,tifc=0,tifofs=0,tifofval=0,b[12];
+      if (in.get()==0) {
+        for (int i=0; i<dirsize; i++) {
+          for (int j=0; j<12; j++) b[j]=in.get();
+          if (b[11]==EOF) break;
+          int tag=b[0]+(b[1]<<8);
+          int tagfmt=b[2]+(b[3]<<8);
+          int taglen=b[4]+(b[5]<<8)+(b[6]<<16)+(b[7]<<24);
+          int tagval=b[8]+(b[9]<<8)+(b[10]<<16)+(b[11]<<24);
+          if (tagfmt==3||tagfmt==4) {
+            if (tag==256) tifx=tagval;
+            else if (tag==257) tify=tagval;
+            else if (tag==258) tifzb=taglen==1?tagval:8; // bits per component
+            else if (tag==259) tifc=tagval; // 1 = no compression
+            else if (tag==273 && tagfmt==4) tifofs=tagval,tifofval=(taglen<=1);
+            else if (tag==277) tifz=tagval; // components per pixel
+          }
+        }
+      }
+      if (tifx && tify && tifzb && (tifz==1 || tifz==3) && (tifc==1) && (tifofs && tifofs+i<n)) {
+        if (!tifofval) {
+          in.seek(start+i+tifofs-7);
+          for (int j=0; j<4; j++) b[j]=in.get();
+          tifofs=b[0]+(b[1]<<8)+(b[2]<<16)+(b[3]<<24);
+        }
+        if (tifofs && tifofs<(1<<18) && tifofs+i<n) {
+          if (tifz==1 && tifzb==1) IMG_DET(IMAGE1,i-7,tifofs,((tifx-1)>>3)+1,tify);
+          else if (tifz==1 && tifzb==8) IMG_DET(IMAGE8,i-7,tifofs,tifx,tify);
+          else if (tifz==3 && tifzb==8) IMG_DET(IMAGE24,i-7,tifofs,tifx*3,tify);
+        }
+      }
+      in.seek(savedpos);
+    }
+
+    // Detect .tga image (8-bit 256 colors or 24-bit uncompressed)
+    if (buf1==0x00010100 && buf0==0x00000118) tga=i,tgax=tgay,tgaz=8,tgat=1;
+    else if (buf1==0x00000200 && buf0==0x00000000) tga=i,tgax=tgay,tgaz=24,tgat=2;
+    else if (buf1==0x00000300 && buf0==0x00000000) tga=i,tgax=tgay,tgaz=8,tgat=3;
+    if (tga) {
+      if (i-tga==8) tga=(buf1==0?tga:0),tgax=(bswap(buf0)&0xffff),tgay=(bswap(buf0)>>16);
+      else if (i-tga==10) {
+        if (tgaz==(int)((buf0&0xffff)>>8) && tgax && tgay) {
+          if (tgat==1) IMG_DET(IMAGE8,tga-7,18+256*3,tgax,tgay);
+          else if (tgat==2) IMG_DET(IMAGE24,tga-7,18,tgax*3,tgay);
+          else if (tgat==3) IMG_DET(IMAGE8,tga-7,18,tgax,tgay);
+        }
+        tga=0;
+      }
+    }
+
+    // Detect EXE if the low order byte (little-endian) XX is more
+    // recently seen (and within 4K) if a relative to absolute address
+    // conversion is done in the context CALL/JMP (E8/E9) XX xx xx 00/FF
+    // 4 times in a row.  Detect end of EXE at the last
+    // place this happens when it does not happen for 64KB.
+
+    if (((buf1&0xfe)==0xe8 || (buf1&0xfff0)==0x0f80) && ((buf0+1)&0xfe)==0) {
+      int r=buf0>>24;  // relative address low 8 bits
+      int a=((buf0>>24)+i)&0xff;  // absolute address low 8 bits
+      int rdist=i-relpos[r];
+      int adist=i-abspos[a];
+      if (adist<rdist && adist<0x800 && abspos[a]>5) {
+        e8e9last=i;
+        ++e8e9count;
+        if (e8e9pos==0 || e8e9pos>abspos[a]) e8e9pos=abspos[a];
+      }
+      else e8e9count=0;
+      if (type==DEFAULT && e8e9count>=4 && e8e9pos>5)
+        return in.seek(start+e8e9pos-5), EXE;
+      abspos[a]=i;
+      relpos[r]=i;
+    }
+    if (i-e8e9last>0x4000) {
+      if (type==EXE) return in.seek(start+e8e9last), DEFAULT;
+      e8e9count=e8e9pos=0;
+    }
+  }
+  return type;
+}
+
+typedef enum {FDECOMPRESS, FCOMPARE, FDISCARD} FMode;
+
+// Print progress: n is the number of bytes compressed or decompressed
+// Threads that set quiet do not print progress
+TLS bool quiet=false;
+
+void printStatus(long n, long size) {
+  if (quiet) return;
+  printf("%6.2f%%\b\b\b\b\b\b\b", float(100)*n/(size+1)), fflush(stdout);
+}
+
+// decode_X() writes to a FILE* or Output (FDECOMPRESS) or compares with a
+// FILE* or, when a transform is tested, with the Input it was made from
+// (FCOMPARE).
+inline int next(FILE* f) {return getc(f);}
+inline int next(Input* in) {return in->get();}
+inline int next(Output* out) {assert(0); return EOF;}
+inline void put(FILE* f, int c) {putc(c, f);}
+inline void put(Input* in, int c) {assert(0);}
+inline void put(Output* out, int c) {out->put(c);}
+inline void put(FILE* f, const U8* p, int n) {fwrite(p, 1, n, f);}
+inline void put(Input* in, const U8* p, int n) {}
+inline void put(Output* out, const U8* p, int n) {
+  for (int i=0; i<n; ++i) out->put(p[i]);
+}
+
+void encode_cd(Input& in, FILE* out, int len, int info) {
+  const int BLOCK=2352;
+  U8 blk[BLOCK];
+  fputc((len%BLOCK)>>8,out);
+  fputc(len%BLOCK,out);
+  for (int offset=0; offset<len; offset+=BLOCK) {
+    if (offset+BLOCK > len) {
+      in.read(&blk[0], len-offset);
+      fwrite(&blk[0], 1, len-offset, out);
+    } else {
+      in.read(&blk[0], BLOCK);
+      if (info==3) blk[15]=3;
+      if (offset==0) fwrite(&blk[12], 1, 4+4*(blk[15]!=1), out);
+      fwrite(&blk[16+8*(blk[15]!=1)], 1, 2048+276*(info==3), out);
+      if (offset+BLOCK*2 > len && blk[15]!=1) fwrite(&blk[16], 1, 4, out);
+    }
+  }
+}
+
+template <class O>
+int decode_cd(Input& in, int size, O out, FMode mode, int &diffFound) {
+  const int BLOCK=2352;
+  U8 blk[BLOCK];
+  long i=0, i2=0;
+  int a=-1, bsize=0, q=in.get();
+  q=(q<<8)+in.get();
+  size-=2;
+  while (i<size) {
+    if (size-i==q) {
+      in.read(blk, q);
+      put(out, blk, q);
+      i+=q;
+      i2+=q;
+    } else if (i==0) {
+      in.read(blk+12, 4);
+      if (blk[15]!=1) in.read(blk+16, 4);
+      bsize=2048+(blk[15]==3)*276;
+      i+=4*(blk[15]!=1)+4;
+    } else {
+      a=(blk[12]<<16)+(blk[13]<<8)+blk[14];
+    }
+    in.read(blk+16+(blk[15]!=1)*8, bsize);
+    i+=bsize;
+    if (bsize>2048) blk[15]=3;
+    if (blk[15]!=1 && size-q-i==4) {
+      in.read(blk+16, 4);
+      i+=4;
+    }
+    expand_cd_sector(blk, a, 0);
+    if (mode==FDECOMPRESS) put(out, blk, BLOCK);
+    else if (mode==FCOMPARE) for (int j=0; j<BLOCK; ++j) if (blk[j]!=next(out) && !diffFound) diffFound=i2+j+1;
+    i2+=BLOCK;
+  }
+  return i2;
+}
+
+
+// 24-bit image data transform:
+// simple color transform (b, g, r) -> (g, g-r, g-b)
+
+void encode_bmp(Input& in, FILE* out, int len, int width) {
+  int r,g,b;
+  for (int i=0; i<len/width; i++) {
+    for (int j=0; j<width/3; j++) {
+      b=in.get(), g=in.get(), r=in.get();
+      fputc(g, out);
+      fputc(g-r, out);
+      fputc(g-b, out);
+    }
+    for (int j=0; j<width%3; j++) fputc(in.get(), out);
+  }
+}
+
+template <class O>
+int decode_bmp(Encoder& en, int size, int width, O out, FMode mode, int &diffFound) {
+  int r,g,b,p;
+  for (int i=0; i<size/width; i++) {
+    p=i*width;
+    for (int j=0; j<width/3; j++) {
+      b=en.decompress(), g=en.decompress(), r=en.decompress();
+      if (mode==FDECOMPRESS) {
+        put(out, b-r);
+        put(out, b);
+        put(out, b-g);
+      }
+      else if (mode==FCOMPARE) {
+        if (((b-r)&255)!=next(out) && !diffFound) diffFound=p+1;
+        if (b!=next(out) && !diffFound) diffFound=p+2;
+        if (((b-g)&255)!=next(out) && !diffFound) diffFound=p+3;
+        p+=3;
+      }
+    }
+    for (int j=0; j<width%3; j++) {
+      if (mode==FDECOMPRESS) {
+        put(out, en.decompress());
+      }
+      else if (mode==FCOMPARE) {
+        if (en.decompress()!=next(out) && !diffFound) diffFound=p+j+1;
+      }
+    }
+  }
+  return size;
+}
+
+// EXE transform: <encoded-size> <begin> <block>...
+// Encoded-size is 4 bytes, MSB first.
+// begin is the offset of the start of the input file, 4 bytes, MSB first.
+// Each block applies the e8e9 transform to strings falling entirely
+// within the block starting from the end and working backwards.
+// The 5 byte pattern is E8/E9 xx xx xx 00/FF (x86 CALL/JMP xxxxxxxx)
+// where xxxxxxxx is a relative address LSB first.  The address is
+// converted to an absolute address by adding the offset mod 2^25
+// (in range +-2^24).
+
+void encode_exe(Input& in, FILE* out, int len, int begin) {
+  const int BLOCK=0x10000;
+  Array<U8> blk(BLOCK);
+  fprintf(out, "%c%c%c%c", begin>>24, begin>>16, begin>>8, begin);
+
+  // Transform
+  for (int offset=0; offset<len; offset+=BLOCK) {
+    int size=min(len-offset, BLOCK);
+    int bytesRead=in.read(&blk[0], size);
+    if (bytesRead!=size) quit("encode_exe read error");
+    for (int i=bytesRead-1; i>=5; --i) {
+      if ((blk[i-4]==0xe8 || blk[i-4]==0xe9 || (blk[i-5]==0x0f && (blk[i-4]&0xf0)==0x80))
+         && (blk[i]==0||blk[i]==0xff)) {
+        int a=(blk[i-3]|blk[i-2]<<8|blk[i-1]<<16|blk[i]<<24)+offset+begin+i+1;
+        a<<=7;
+        a>>=7;
+        blk[i]=a>>24;
+        blk[i-1]=a^176;
+        blk[i-2]=(a>>8)^176;
+        blk[i-3]=(a>>16)^176;
+      }
+    }
+    fwrite(&blk[0], 1, bytesRead, out);
+  }
+}
+
+template <class O>
+int decode_exe(Encoder& en, int size, O out, FMode mode, int &diffFound, long s1=0, long s2=0) {
+  const int BLOCK=0x10000;  // block size
+  int begin, offset=6, a, showstatus=(s2!=0);
+  U8 c[6];
+  begin=en.decompress()<<24;
+  begin|=en.decompress()<<16;
+  begin|=en.decompress()<<8;
+  begin|=en.decompress();
+  size-=4;
+  for (int i=4; i>=0; i--) c[i]=en.decompress();  // Fill queue
+
+  while (offset<size+6) {
+    memmove(c+1, c, 5);
+    if (offset<=size) c[0]=en.decompress();
+    // E8E9 transform: E8/E9 xx xx xx 00/FF -> subtract location from x
+    if ((c[0]==0x00 || c[0]==0xFF) && (c[4]==0xE8 || c[4]==0xE9 || (c[5]==0x0F && (c[4]&0xF0)==0x80))
+     && (((offset-1)^(offset-6))&-BLOCK)==0 && offset<=size) { // not crossing block boundary
+      a=((c[1]^176)|(c[2]^176)<<8|(c[3]^176)<<16|c[0]<<24)-offset-begin;
+      a<<=7;
+      a>>=7;
+      c[3]=a;
+      c[2]=a>>8;
+      c[1]=a>>16;
+      c[0]=a>>24;
+    }
+    if (mode==FDECOMPRESS) put(out, c[5]);
+    else if (mode==FCOMPARE && c[5]!=next(out) && !diffFound) diffFound=offset-6+1;
+    if (showstatus && !(offset&0xfff)) printStatus(s1+offset-6, s2);
+    offset++;
+  }
+  return size;
+}
+
+//////////////////// Compress, Decompress ////////////////////////////
+
+void direct_encode_block(Filetype type, Input& in, int len, Encoder &en, long s1, long s2, int info=-1) {
+  en.compress(type);
+  en.compress(len>>24);
+  en.compress(len>>16);
+  en.compress(len>>8);
+  en.compress(len);
+  if (info!=-1) {
+    en.compress(info>>24);
+    en.compress(info>>16);
+    en.compress(info>>8);
+    en.compress(info);
+  }
+  if (!quiet) printf("Compressing... ");
+  const long total=s1+len+s2;
+  for (long j=s1; j<s1+len; ++j) {
+    if (!(j&0xfff)) printStatus(j, total);
+    if (type==STORED) en.compressStored(in.get());
+    else en.compress(in.get());
+  }
+  if (!quiet) printf("\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b");
+}
+
+// A DEFAULT block is split into parts that are modeled and STORED parts
+// that would not compress, judged in windows of STOREWINDOW bytes.  A
+// window is STORED if its order 0 entropy is near 8 bits per byte and
+// a hashed order 2 context rarely predicts the next byte.  STORED data
+// is coded with an order 0 model in the Encoder and costs about as much
+// as copying it.
+const int STOREWINDOW=1<<15;
+
+// Would the n bytes at p not compress?
+bool incompressible(const U8* p, int n) {
+  if (n<STOREWINDOW/8) return false;
+  int count[256]={0}, hits=0;
+  U8 last[4096]={0};  // order 2 hash -> last byte seen
+  for (int i=0; i<n; ++i) {
+    ++count[p[i]];
+    if (i>=2) {
+      U8& b=last[(p[i-2]<<4^p[i-1])&4095];
+      hits+=b==p[i];
+      b=p[i];
+    }
+  }
+  double e=0;  // order 0 entropy of the n bytes in bits
+  for (int c=0; c<256; ++c)
+    if (count[c]) e-=count[c]*log(double(count[c])/n);
+  return e>n*7.9*log(2.0) && hits<n/64;
+}
+
+// Compress a DEFAULT block of len bytes of in as DEFAULT and STORED blocks
+void encode_default(Input& in, int len, Encoder& en, long s1, long s2) {
+  const long begin=in.tell();
+  const U8* p=in.data()+begin;
+  bool stored=level>0 && incompressible(p, min(len, STOREWINDOW)), next;
+  for (int i=0, j; i<len; i=j, stored=next) {
+    j=i;
+    do {  // find the end of windows like the first
+      j=min(j+STOREWINDOW, len);
+      next=level>0 && incompressible(p+j, min(len-j, STOREWINDOW));
+    } while (j<len && next==stored);
+    if (!quiet && stored)
+      printf(" %-11s | %-9s |%10d bytes [%ld - %ld]\n", "", "stored", j-i,
+        begin+i, begin+j-1);
+    direct_encode_block(stored ? STORED : DEFAULT, in, j-i, en, s1+i,
+      s2+len-j);
+  }
+}
+
+// Blocks are at most MAXBLOCK bytes, so that their lengths fit in the 4
+// bytes of a block header and in an int.  Larger files are cut into
+// blocks of this size, and larger detected blocks are coded as DEFAULT.
+const long MAXBLOCK=1L<<30;
+
+// Compress n bytes of in as blocks of detected types
+void compressBlocks(Input& in, long n, Encoder &en, char *blstr, int it=0, long s1=0, long s2=0) {
+  static const char* typenames[11]={"default", "jpeg", "hdr",
+    "1b-image", "8b-image", "24b-image", "audio", "exe", "cd", "stored",
+    "dedup"};
+  static const char* audiotypes[4]={"8b mono", "8b stereo", "16b mono",
+    "16b stereo"};
+  Filetype type=DEFAULT;
+  int blnum=0, info;  // image width or audio type
+  long begin=in.tell(), end0=begin+n;
+  FILE* tmp;
+  char b2[32];
+  strcpy(b2, blstr);
+  if (b2[0]) strcat(b2, "-");
+  if (it==5) {
+    direct_encode_block(DEFAULT, in, n, en, s1, s2);
+    return;
+  }
+  s2+=n;
+
+  // Transform and test in blocks
+  while (n>0) {
+    Filetype nextType=detect(in, n<MAXBLOCK ? n : MAXBLOCK, type, info);
+    long end=in.tell();
+    in.seek(begin);
+    if (end>end0) {  // if some detection reports longer then actual size file is
+      end=begin+1;
+      type=DEFAULT;
+    }
+    else if (end-begin>MAXBLOCK)  // too large to transform
+      end=begin+MAXBLOCK, type=nextType=DEFAULT;
+    int len=int(end-begin);
+    if (len>0) {
+      s2-=len;
+      sprintf(blstr,"%s%d",b2,blnum++);
+      if (!quiet) {
+        printf(" %-11s | %-9s |%10d bytes [%ld - %ld]",blstr,typenames[type],len,begin,end-1);
+        if (type==AUDIO) printf(" (%s)", audiotypes[info%4]);
+        else if (type==IMAGE1 || type==IMAGE8 || type==IMAGE24) printf(" (width: %d)", info);
+        else if (type==CD) printf(" (m%d/f%d)", info==1?1:2, info!=3?1:2);
+        printf("\n");
+      }
+      if (type==EXE || type==CD || type==IMAGE24) {
+        tmp=tmpfile();  // temporary encoded file
+        if (!tmp) perror("tmpfile"), quit();
+        if (type==IMAGE24) encode_bmp(in, tmp, len, info);
+        else if (type==EXE) encode_exe(in, tmp, len, begin);
+        else if (type==CD) encode_cd(in, tmp, len, info);
+        const long tmpsize=ftell(tmp);
+        {
+          MappedFile map(tmp);
+          Input t(map.data(), map.size());
+          en.setInput(&t);
+          in.seek(begin);
+          int diffFound=0;
+          if (type==IMAGE24) decode_bmp(en, tmpsize, info, &in, FCOMPARE, diffFound);
+          else if (type==EXE) decode_exe(en, tmpsize, &in, FCOMPARE, diffFound);
+          else if (type==CD) decode_cd(t, tmpsize, &in, FCOMPARE, diffFound);
+
+          // Test fails, compress without transform
+          if (diffFound || t.get()!=EOF) {
+            if (!quiet) printf("Transform fails at %d, skipping...\n", diffFound-1);
+            in.seek(begin);
+            encode_default(in, len, en, s1, s2);
+          } else {
+            t.seek(0);
+            if (type==CD) {
+              en.compress(type), en.compress(tmpsize>>24), en.compress(tmpsize>>16);
+              en.compress(tmpsize>>8), en.compress(tmpsize);
+              compressBlocks(t, tmpsize, en, blstr, it+1, s1, s2);
+            } else if (type==EXE) {
+              direct_encode_block(type, t, tmpsize, en, s1, s2);
+            } else if (type==IMAGE24) {
+              direct_encode_block(type, t, tmpsize, en, s1, s2, info);
+            }
+          }
+          in.seek(begin+len);
+        }
+        fclose(tmp);  // deletes
+      } else if (type==DEFAULT) {
+        encode_default(in, len, en, s1, s2);
+      } else {
+        const int i1=(type==IMAGE1 || type==IMAGE8 || type==AUDIO)?info:-1;
+        direct_encode_block(type, in, len, en, s1, s2, i1);
+      }
+      s1+=len;
+    }
+    n-=len;
+    type=nextType;
+    begin=end;
+  }
+}
+
+// Compress n bytes of in.  Repeats found with the history of en are
+// coded as DEDUP blocks and the rest by compressBlocks().
+void compressRecursive(Input& in, long n, Encoder& en, char* blstr) {
+  if (level==0) return compressBlocks(in, n, en, blstr);
+  Dedup& d=en.history();
+  d.init();
+  const U8* p=in.data()+in.tell();
+  const long k=in.size()-in.tell()<n ? in.size()-in.tell() : n;  // at p
+  const U32 base=d.size();  // input position of p[0]
+  long done=0;  // bytes coded
+  U32 g=0;  // gear hash
+  for (long i=0; i<k; ++i) {
+    g=(g<<1)+gear[p[i]];
+    if (g>=1u<<24 || i<31) continue;
+
+    // Find where the last 32 bytes were last seen
+    const U32 pos=base+i+1;
+    U32& a=d.anchor(g);
+    const U32 dist=pos-a;
+    a=pos;
+    const long avail=d.filled()+i+1;  // bytes before pos that can be read
+    if (dist==0 || dist>d.window() || dist>avail) continue;
+
+    // Extend the match back to done and forward to k, up to MAXBLOCK
+    // bytes.  Byte j of p is p[j] if j>=0, else in the history.
+    long b=0, f=0;
+#define DEDUPBYTE(j) ((j)>=0 ? p[j] : d.back(U32(-(j))))
+    while (i+1-b>done && dist+b<avail && b<MAXBLOCK
+        && DEDUPBYTE(i-long(dist)-b)==p[i-b])
+      ++b;
+    while (i+1+f<k && b+f<MAXBLOCK && DEDUPBYTE(i+1-long(dist)+f)==p[i+1+f])
+      ++f;
+#undef DEDUPBYTE
+    if (b+f<DEDUPMIN) continue;
+
+    // Code the bytes before it, then the repeat
+    const long start=i+1-b, len=b+f;
+    if (start>done) compressBlocks(in, start-done, en, blstr, 0, done, n-start);
+    if (!quiet)
+      printf(" %-11s | %-9s |%10ld bytes [%ld - %ld] (%u bytes back)\n", "",
+        "dedup", len, in.tell(), in.tell()+len-1, dist);
+    en.compress(DEDUP);
+    for (int j=24; j>=0; j-=8) en.compress(len>>j);
+    for (int j=24; j>=0; j-=8) en.compress(dist>>j);
+    in.seek(in.tell()+len);
+    done=start+len;
+    g=0;
+    for (i=done>32 ? done-32 : 0; i<done; ++i) g=(g<<1)+gear[p[i]];
+    --i;
+  }
+  if (done<n) compressBlocks(in, n-done, en, blstr, 0, done, 0);
+  d.put(p, k);
+  for (long i=k; i<n; ++i) d.put(255);  // EOF was coded
+}
+
+// Compress n bytes of f starting at offset off, MAPWINDOW bytes at a time
+void compressFile(FILE* f, long off, long n, Encoder& en) {
+  for (long w=0; w<n; w+=MAPWINDOW) {
+    const long len=n-w<MAPWINDOW ? n-w : MAPWINDOW;
+    MappedFile map(f, off+w, len);
+    Input in(map.data(), map.size());
+    char blstr[32]="";
+    compressRecursive(in, len, en, blstr);
+  }
+}
+
+// Compress a file. Split filesize bytes into blocks by type.
+// For each block, output
+// <type> <size> and call encode_X to convert to type X.
+// Test transform and compress.
+void compress(const char* filename, long filesize, Encoder& en) {
+  assert(en.getMode()==COMPRESS);
+  assert(filename && filename[0]);
+  FILE *f=fopen(filename, "rb");
+  if (!f) perror(filename), quit();
+  long start=en.size();
+  printf("Block segmentation:\n");
+  compressFile(f, 0, filesize, en);
+  fclose(f);
+  printf("Compressed from %ld to %ld bytes.\n",filesize,en.size()-start);
+}
+
+// Try to make a directory, return true if successful
+bool makedir(const char* dir) {
+#ifdef WINDOWS
+  return CreateDirectory(dir, 0)==TRUE;
+#else
+#ifdef UNIX
+  return mkdir(dir, 0777)==0;
+#else
+  return false;
+#endif
+#endif
+}
+
+
+template <class O>
+long decompressBlocks(O out, long size, Encoder& en, FMode mode, int it=0, long s1=0, long s2=0) {
+  Filetype type;
+  long len, i=0, diffFound=0;
+  int df=0, info;  // df is 1 + the first difference in a transformed block
+  FILE *tmp;
+  s2+=size;
+  while (i<size) {
+    type=(Filetype)en.decompress();
+    len=en.decompress()<<24;
+    len|=en.decompress()<<16;
+    len|=en.decompress()<<8;
+    len|=en.decompress();
+
+    if (type==IMAGE1 || type==IMAGE8 || type==IMAGE24 || type==AUDIO
+        || type==DEDUP) {
+      info=0; for (int i=0; i<4; ++i) { info<<=8; info+=en.decompress(); }
+    }
+    if (type==IMAGE24) len=decode_bmp(en, len, info, out, mode, df);
+    else if (type==EXE) len=decode_exe(en, len, out, mode, df, s1, s2);
+    else if (type==CD) {
+      tmp=tmpfile();
+      if (!tmp) perror("tmpfile"), quit();
+      decompressBlocks(tmp, len, en, FDECOMPRESS, it+1, s1+i, s2-len);
+      if (mode!=FDISCARD) {
+        MappedFile map(tmp);
+        Input t(map.data(), map.size());
+        len=decode_cd(t, len, out, mode, df);
+      }
+      fclose(tmp);
+    } else if (type==DEDUP) {  // repeat, info bytes back
+      Dedup& d=en.history();
+      if (it || info<=0 || U32(info)>d.filled() || len<0)
+        quit("archive corrupted");
+      for (long j=0; j<len; ++j) put(out, d.back(info));
+    } else {
+      for (long j=i+s1; j<i+s1+len; ++j) {
+        if (!(j&0xfff)) printStatus(j, s2);
+        const int c=type==STORED ? en.decompressStored() : en.decompress();
+        if (mode==FDECOMPRESS) put(out, c);
+        else if (mode==FCOMPARE) {
+          if (c!=next(out) && !diffFound) {
+            mode=FDISCARD;
+            diffFound=j+1;
+          }
+        }
+      }
+    }
+    if (df && !diffFound) diffFound=i+df;
+    df=0;
+    i+=len;
+  }
+  return diffFound;
+}
+
+// Output of decompressRecursive() for level>0.  Bytes are added to the
+// history of the Encoder and are written to out or compared with it as
+// mode says.  diffFound is 1 + the position of the first difference.
+template <class O> struct Tee {
+  O out;
+  FMode mode;
+  Dedup& d;
+  long pos;
+  long diffFound;
+  Tee(O o, FMode m, Dedup& dd): out(o), mode(m), d(dd), pos(0), diffFound(0) {}
+};
+template <class O> inline int next(Tee<O>* t) {assert(0); return EOF;}
+template <class O> inline void put(Tee<O>* t, int c) {
+  t->d.put(c);
+  if (t->mode==FDECOMPRESS) put(t->out, c);
+  else if (t->mode==FCOMPARE && c!=next(t->out))
+    t->mode=FDISCARD, t->diffFound=t->pos+1;
+  ++t->pos;
+}
+template <class O> inline void put(Tee<O>* t, const U8* p, int n) {
+  for (int i=0; i<n; ++i) put(t, p[i]);
+}
+
+// Decompress size bytes to out, or compare with it (mode FCOMPARE).
+// Return 1 + the position of the first difference, or 0.
+template <class O>
+long decompressRecursive(O out, long size, Encoder& en, FMode mode) {
+  if (level==0) return decompressBlocks(out, size, en, mode);
+  Dedup& d=en.history();
+  d.init();
+  Tee<O> t(out, mode, d);
+  decompressBlocks(&t, size, en, FDECOMPRESS);
+  return t.diffFound;
+}
+
+// Open a file for extraction.  If it exists then open it for comparing.
+// Set mode to FDECOMPRESS, FCOMPARE, or FDISCARD if it can't be created.
+FILE* openOutput(const char* filename, FMode& mode) {
+  assert(filename && filename[0]);
+  mode=FDECOMPRESS;
+
+  // Test if output file exists.  If so, then compare.
+  FILE* f=fopen(filename, "rb");
+  if (f) mode=FCOMPARE,printf("Comparing");
+  else {
+    // Create file
+    f=fopen(filename, "wb");
+    if (!f) {  // Try creating directories in path and try again
+      String path(filename);
+      for (int i=0; path[i]; ++i) {
+        if (path[i]=='/' || path[i]=='\\') {
+          char savechar=path[i];
+          path[i]=0;
+          if (makedir(path.c_str()))
+            printf("Created directory %s\n", path.c_str());
+          path[i]=savechar;
+        }
+      }
+      f=fopen(filename, "wb");
+    }
+    if (!f) mode=FDISCARD,printf("Skipping"); else printf("Extracting");
+  }
+  return f;
+}
+
+// Decompress a file.  Return true if it now holds the data (it was
+// written, or compared identical).
+bool decompress(const char* filename, long filesize, Encoder& en) {
+  FMode mode;
+  assert(en.getMode()==DECOMPRESS);
+  FILE* f=openOutput(filename, mode);
+  printf(" %s %ld -> ", filename, filesize);
+
+  // Decompress/Compare
+  long r=decompressRecursive(f, filesize, en, mode);
+  bool ok=mode==FDECOMPRESS;
+  if (mode==FCOMPARE && !r && getc(f)!=EOF) printf("file is longer\n");
+  else if (mode==FCOMPARE && r) printf("differ at %ld\n",r-1);
+  else if (mode==FCOMPARE) printf("identical\n"), ok=true;
+  else printf("done   \n");
+  if (f) fclose(f);
+  return ok;
+}
+
+// Extract (or compare) a file of filesize bytes read from open file in,
+// which holds the data of file from (or of filename itself if from is 0).
+void copyFile(FILE* in, const char* from, const char* filename,
+    long filesize) {
+  FMode mode;
+  FILE* f=openOutput(filename, mode);
+  printf(" %s %ld -> ", filename, filesize);
+  long diffFound=0;
+  for (long i=0; i<filesize; ++i) {
+    int c=getc(in);
+    if (c==EOF) quit("copy source is too short");
+    if (mode==FDECOMPRESS) putc(c, f);
+    else if (mode==FCOMPARE && !diffFound && c!=getc(f)) diffFound=i+1;
+  }
+  if (mode==FCOMPARE && !diffFound && getc(f)!=EOF) printf("file is longer\n");
+  else if (mode==FCOMPARE && diffFound) printf("differ at %ld\n", diffFound-1);
+  else if (mode==FCOMPARE) printf("identical\n");
+  else if (from) printf("copied from %s\n", from);
+  else printf("done   \n");
+  if (f) fclose(f);
+}
+
+//////////////////////////// Segments ////////////////////////////
+
+// In parallel mode (-tN) the input files are treated as one stream
+// which is cut into segments.  Each segment is compressed by its own
+// thread with a fresh Predictor, so the segments can also be
+// decompressed in parallel.  Cuts are made between the blocks found by
+// detect() or inside long DEFAULT blocks, so that images, audio, etc.
+// are not split.  Up to N segments are compressed or decompressed at the
+// same time, which uses N times as much memory as -N alone.
+//
+// A non-solid archive (-n) is also cut at the end of each file once the
+// segment has MINSEGMENT bytes, so that one file can be extracted by
+// decoding only the segments that hold it.  Each segment uses tables
+// sized for its own length (by memoryLevel()) rather than for the total.
+// Segments are at most MAXSEGMENT bytes, so that a large file is also cut.
+//
+// Each segment is a checkpoint.  Its index entry is written as soon as
+// it is on disk, so an interrupted compression can be resumed
+// with -r from the first segment without an entry.  The model is empty
+// at the start of a segment, so no model state needs to be saved.
+
+struct Segment {
+  long begin, usize;  // range of the input stream
+  long offset, csize;  // range of the archive
+  FILE* tmp;  // compressed (or decompressed) data
+  Thread* thread;
+  const char* error;  // message thrown by the thread, if any
+};
+
+// Shared by all the threads
+struct SegmentJob {
+  Array<Segment> seg;
+  const Array<const char*>* fname;
+  const Array<long>* fsize;
+  const char* archiveName;
+  int level, memlevel;
+  int threads;  // at most this many segments at once
+  bool nonsolid;  // cut at file ends, size tables for each segment?
+  bool wide;  // sizes in the index are 8 bytes?
+  SegmentJob(): seg(0), fname(0), fsize(0), archiveName(0), level(0),
+    memlevel(0), threads(1), nonsolid(false), wide(false) {}
+  int segmentLevel(const Segment& s) const {  // memlevel for s
+    if (snapshot) return memlevel;  // the tables of the snapshot
+    return nonsolid ? min(memlevel, memoryLevel(level, s.usize)) : memlevel;
+  }
+};
+
+struct SegmentArg {
+  SegmentJob* job;
+  int i;  // segment number
+};
+
+const int MINSEGMENT=1<<16;  // smallest segment size in bytes
+const long MAXSEGMENT=1L<<28;  // largest segment size in a non-solid archive
+
+// Choose cut points so that the total of n bytes in the files is split
+// into segments of about n/threads bytes, and if job.nonsolid, also at
+// the end of each file that ends a segment of MINSEGMENT bytes or more.
+// The first kept segments in job.seg are kept, and their files not read.
+void planSegments(SegmentJob& job, long n, int kept=0) {
+  const Array<const char*>& fname=*job.fname;
+  const Array<long>& fsize=*job.fsize;
+  int nseg=kept;
+  long start=0, p=0;  // start of current segment, of current file
+  for (int i=0; i<kept; ++i) start+=job.seg[i].usize;
+  const long old=start;  // bytes in kept segments
+  long target=(n-start)/job.threads+1;
+  if (target<MINSEGMENT) target=MINSEGMENT;
+  if (job.nonsolid && target>MAXSEGMENT) target=MAXSEGMENT;
+  job.seg.resize(nseg);
+  for (int i=0; i<int(fname.size()); p+=fsize[i++]) {
+    if (p+fsize[i]<=old) continue;  // in a kept segment
+    FILE* f=fopen(fname[i], "rb");
+    if (!f) perror(fname[i]), quit();
+    for (long w=0; w<fsize[i]; w+=MAPWINDOW) {  // q is the offset of in
+      const long q=p+w, len=fsize[i]-w<MAPWINDOW ? fsize[i]-w : MAPWINDOW;
+      MappedFile map(f, w, len);
+      Input in(map.data(), map.size());
+      Filetype type=DEFAULT;
+      long begin=0, left=len;
+      int info;
+      while (left>0) {
+        Filetype nextType=detect(in, left<MAXBLOCK ? left : MAXBLOCK, type, info);
+        long end=in.tell();
+        if (end>len) end=begin+1, type=DEFAULT;
+        else if (end-begin>MAXBLOCK) end=begin+MAXBLOCK, type=nextType=DEFAULT;
+        if (type==DEFAULT)
+          while (q+end-start>target) {
+            long cut=start+target;
+            job.seg.resize(++nseg), job.seg[nseg-1].begin=start;
+            job.seg[nseg-1].usize=cut-start;
+            start=cut;
+          }
+        else if (q+end-start>=target) {
+          job.seg.resize(++nseg), job.seg[nseg-1].begin=start;
+          job.seg[nseg-1].usize=q+end-start;
+          start=q+end;
+        }
+        in.seek(end);
+        left-=end-begin;
+        begin=end;
+        type=nextType;
+      }
+    }
+    fclose(f);
+    if (job.nonsolid && p+fsize[i]-start>=MINSEGMENT) {
+      job.seg.resize(++nseg), job.seg[nseg-1].begin=start;
+      job.seg[nseg-1].usize=p+fsize[i]-start;
+      start=p+fsize[i];
+    }
+  }
+  if (start<n || nseg==0) {
+    job.seg.resize(++nseg), job.seg[nseg-1].begin=start;
+    job.seg[nseg-1].usize=n-start;
+  }
+  for (int i=kept; i<nseg; ++i) {
+    Segment& s=job.seg[i];
+    s.offset=s.csize=0, s.tmp=0, s.thread=0, s.error=0;
+  }
+}
+
+// Call f(i, offset, len) for each piece of segment s, which may span
+// several files.
+template <class F> void forEachPiece(SegmentJob& job, Segment& s, F& f) {
+  const Array<long>& fsize=*job.fsize;
+  long p=0;
+  for (int i=0; i<int(fsize.size()); p+=fsize[i++]) {
+    long a=p>s.begin?p:s.begin;
+    long b=p+fsize[i]<s.begin+s.usize?p+fsize[i]:s.begin+s.usize;
+    if (a<b) f(i, a-p, b-a);
+  }
+}
+
+struct CompressPiece {
+  SegmentJob& job;
+  Encoder& en;
+  CompressPiece(SegmentJob& j, Encoder& e): job(j), en(e) {}
+  void operator()(int i, long off, long len) {
+    const char* filename=(*job.fname)[i];
+    FILE* f=fopen(filename, "rb");
+    if (!f) perror(filename), quit();
+    compressFile(f, off, len, en);
+    fclose(f);
+  }
+};
+
+struct DecompressPiece {
+  Encoder& en;
+  FILE* out;
+  DecompressPiece(Encoder& e, FILE* f): en(e), out(f) {}
+  void operator()(int i, long off, long len) {
+    decompressRecursive(out, len, en, FDECOMPRESS);
+  }
+};
+
+// Thread: compress segment arg->i to a temporary file
+void compressSegment(void* arg) {
+  SegmentJob& job=*((SegmentArg*)arg)->job;
+  Segment& s=job.seg[((SegmentArg*)arg)->i];
+  try {
+    level=job.level;
+    memlevel=job.segmentLevel(s);
+    quiet=true;
+    s.tmp=tmpfile();
+    if (!s.tmp) quit("tmpfile failed");
+    Encoder en(COMPRESS, s.tmp);
+    CompressPiece f(job, en);
+    forEachPiece(job, s, f);
+    en.flush();
+    s.csize=en.size();
+  }
+  catch (const char* e) {
+    s.error=e?e:"";
+  }
+}
+
+// Thread: decompress segment arg->i to a temporary file.  The Encoder
+// reads only the bytes of the segment from the archive as it needs them,
+// so past its end it gets EOF as at the end of an archive, not the start
+// of the next segment.
+void decompressSegment(void* arg) {
+  SegmentJob& job=*((SegmentArg*)arg)->job;
+  Segment& s=job.seg[((SegmentArg*)arg)->i];
+  FILE* archive=0;
+  try {
+    level=job.level;
+    memlevel=job.segmentLevel(s);
+    quiet=true;
+    archive=fopen(job.archiveName, "rb");
+    if (!archive) quit("cannot reopen archive");
+    if (fseek(archive, 0, SEEK_END) || ftell(archive)<s.offset+s.csize)
+      quit("archive truncated");
+    s.tmp=tmpfile();
+    if (!s.tmp) quit("tmpfile failed");
+    fseek(archive, s.offset, SEEK_SET);
+    Encoder en(DECOMPRESS, archive, s.csize);
+    DecompressPiece f(en, s.tmp);
+    forEachPiece(job, s, f);
+    rewind(s.tmp);
+  }
+  catch (const char* e) {
+    s.error=e?e:"";
+  }
+  if (archive) fclose(archive);
+}
+
+// Runs segments in order with at most job.threads of them at once.
+// next() waits for the next segment to finish and returns it.
+class SegmentRunner {
+  SegmentJob& job;
+  void (*f)(void*);
+  Array<SegmentArg> arg;
+  int started, done;
+  void start() {
+    arg[started].job=&job;
+    arg[started].i=started;
+    job.seg[started].thread=new Thread(f, &arg[started]);
+    ++started;
+  }
+public:
+  SegmentRunner(SegmentJob& j, void (*fn)(void*), int first=0):
+      job(j), f(fn), arg(j.seg.size()), started(first), done(first) {
+    while (started<int(job.seg.size()) && started-done<job.threads) start();
+  }
+  ~SegmentRunner() {  // wait for any threads still running
+    while (done<started) {
+      Segment& s=job.seg[done++];
+      s.thread->join();
+      delete s.thread;
+      if (s.tmp) fclose(s.tmp);
+    }
+  }
+  Segment& next() {
+    assert(done<started);
+    Segment& s=job.seg[done++];
+    s.thread->join();
+    delete s.thread;
+    s.thread=0;
+    if (started<int(job.seg.size())) start();
+    if (s.error) quit(s.error[0]?s.error:0);
+    return s;
+  }
+};
+
+void put4(U32 x, FILE* f) {
+  putc(x>>24, f), putc(x>>16, f), putc(x>>8, f), putc(x, f);
+}
+
+U32 get4(FILE* f) {
+  U32 x=0;
+  for (int i=0; i<4; ++i) x=x<<8|(getc(f)&255);
+  return x;
+}
+
+// Sizes in the segment index are 4 bytes, or 8 if wide
+void putSize(long x, bool wide, FILE* f) {
+  if (wide) put4(U32(x>>16>>16), f);
+  put4(U32(x), f);
+}
+
+long getSize(bool wide, FILE* f) {
+  long x=0;
+  if (wide) x=long(get4(f))<<16<<16;
+  return x|get4(f);
+}
+
+// Truncate open file f to n bytes
+void truncateFile(FILE* f, long n) {
+  fflush(f);
+#ifdef UNIX
+  if (ftruncate(fileno(f), n)) perror("ftruncate");
+#endif
+#ifdef WINDOWS
+  if (_chsize(_fileno(f), n)) perror("chsize");
+#endif
+}
+
+// Write open file f through to the disk
+void syncFile(FILE* f) {
+  fflush(f);
+#ifdef UNIX
+  if (fsync(fileno(f))) perror("fsync");
+#endif
+#ifdef WINDOWS
+  if (_commit(_fileno(f))) perror("commit");
+#endif
+}
+
+// Copy n bytes from in to out
+void copyBytes(FILE* in, FILE* out, long n) {
+  char buf[1<<16];
+  while (n>0) {
+    const size_t k=n<long(sizeof(buf)) ? n : sizeof(buf);
+    if (fread(buf, 1, k, in)!=k) quit("archive truncated");
+    if (fwrite(buf, 1, k, out)!=k) quit("write error");
+    n-=k;
+  }
+}
+
+// Compress the files in segments and append them to archive, which is
+// positioned after the file list.  The archive gets an index:
+//   <threads> <number of segments> (<usize> <csize>)...
+// in bytes 1, 4, 4, 4 (big-endian), or 1, 4, 8, 8 if job.wide, followed
+// by the compressed segments.
+// The entry of a segment is written (and csize is not 0) once the segment
+// is in the archive.  If resume then the archive is an interrupted one
+// with the same header and file list, and its finished segments are kept.
+// If from is not 0 then job.seg has the segments of archive from (read
+// by readSegments()), which are copied, and only the files after them
+// are compressed.
+void compressSegments(SegmentJob& job, long total_size, FILE* archive,
+    bool resume=false, FILE* from=0) {
+  printf("\nSegmentation:\n");
+  const int kept=from ? job.seg.size() : 0;
+  planSegments(job, total_size, kept);
+  const int nseg=job.seg.size();
+  const long index=ftell(archive);
+  const int entry=job.wide ? 16 : 8;  // bytes per segment in the index
+  long offset=index+5+nseg*entry;  // of the next segment
+  int first=0;  // segments already in the archive
+  const bool resumed=resume;  // archive may have bytes past the end
+  if (resume) {  // unless it was interrupted before the index was written
+    fseek(archive, 0, SEEK_END);
+    resume=ftell(archive)>=offset;
+    fseek(archive, index, SEEK_SET);
+  }
+  if (resume) {
+    if (getc(archive)!=job.threads || get4(archive)!=U32(nseg))
+      quit("cannot resume: archive was made with other options");
+    for (int i=0; i<nseg; ++i) {
+      Segment& s=job.seg[i];
+      const long usize=getSize(job.wide, archive);
+      const long csize=getSize(job.wide, archive);
+      if (csize && usize!=s.usize) quit("cannot resume: archive index differs");
+      if (csize && first==i) s.offset=offset, s.csize=csize, offset+=csize, ++first;
+    }
+    fseek(archive, 0, SEEK_END);
+    if (ftell(archive)<offset) quit("cannot resume: archive truncated");
+    printf("Resuming after %d of %d segment(s)\n", first, nseg);
+  }
+  else {
+    putc(job.threads, archive);
+    put4(nseg, archive);
+    for (int i=0; i<nseg; ++i) {  // filled in later except if kept
+      putSize(i<kept ? job.seg[i].usize : 0, job.wide, archive);
+      putSize(i<kept ? job.seg[i].csize : 0, job.wide, archive);
+    }
+    for (int i=0; i<kept; ++i) {
+      Segment& s=job.seg[i];
+      fseek(from, s.offset, SEEK_SET);
+      copyBytes(from, archive, s.csize);
+      s.offset=offset, offset+=s.csize;
+    }
+    if (kept) printf("Copied %d segment(s)\n", kept);
+    first=kept;
+    fflush(archive);
+  }
+  for (int i=first; i<nseg; ++i)
+    printf(" %-11d |%10ld bytes [%ld - %ld]\n", i, job.seg[i].usize,
+      job.seg[i].begin, job.seg[i].begin+job.seg[i].usize-1);
+  printf("Compressing %d segment(s) with %d thread(s)...\n",
+    nseg-first, min(nseg-first, job.threads));
+  SegmentRunner r(job, compressSegment, first);
+  for (int i=first; i<nseg; ++i) {
+    Segment& s=r.next();
+    rewind(s.tmp);
+    fseek(archive, offset, SEEK_SET);
+    s.offset=offset;
+    copyBytes(s.tmp, archive, s.csize);
+    fclose(s.tmp);
+    s.tmp=0;
+    offset+=s.csize;
+
+    // Checkpoint: the segment is on disk before its entry says so
+    syncFile(archive);
+    fseek(archive, index+5+i*entry, SEEK_SET);
+    putSize(s.usize, job.wide, archive);
+    putSize(s.csize, job.wide, archive);
+    fflush(archive);
+    printf(" %-11d | compressed from %ld to %ld bytes\n", i, s.usize, s.csize);
+  }
+  if (resumed) truncateFile(archive, offset);
+  fseek(archive, 0, SEEK_END);
+}
+
+// A chained archive (made with -a) is a segmented archive whose segments
+// are coded one after another by the same model: the first holds the
+// files the archive was made with, and each later one the files of one
+// -a.  Each segment is a separate arithmetic code, so that the old ones
+// are copied without decoding them, but the model, order0 and the Dedup
+// window go on from one to the next.  After the last segment, the
+// archive holds their state (see Encoder::writeState()), which -a loads
+// to compress the new files as if they followed the old ones.  Segments
+// end at file ends.  Extraction decodes the segments in order with one
+// Encoder, restarting its code at each, and does not read the state.
+
+// Compress the files after those in the segments of job.seg (read from
+// archive from by readSegments(), or none if from is 0) to one new
+// segment of a chained archive, which is positioned after the file
+// list, and write the index, the segments and then the state.  The model
+// starts from the state in from.  n is the number of bytes in the files.
+void compressChained(SegmentJob& job, long n, FILE* archive, FILE* from) {
+  const Array<const char*>& fname=*job.fname;
+  const Array<long>& fsize=*job.fsize;
+  const int kept=job.seg.size();
+  const long old=kept ? job.seg[kept-1].begin+job.seg[kept-1].usize : 0;
+  const long index=ftell(archive);
+  const int entry=job.wide ? 16 : 8;
+  putc(1, archive);
+  put4(kept+1, archive);
+  for (int i=0; i<=kept; ++i) {  // the new one is filled in later
+    putSize(i<kept ? job.seg[i].usize : 0, job.wide, archive);
+    putSize(i<kept ? job.seg[i].csize : 0, job.wide, archive);
+  }
+  for (int i=0; i<kept; ++i) {
+    fseek(from, job.seg[i].offset, SEEK_SET);
+    copyBytes(from, archive, job.seg[i].csize);
+  }
+  if (kept) printf("Copied %d segment(s)\n", kept);
+  const long offset=ftell(archive);
+  savable=true;
+  Encoder en(COMPRESS, archive);
+  savable=false;
+  if (from) {
+    fseek(from, job.seg[kept-1].offset+job.seg[kept-1].csize, SEEK_SET);
+    en.readState(from);
+  }
+  long p=0;  // start of file i
+  for (int i=0; i<int(fname.size()); p+=fsize[i++]) {
+    if (p<old || fsize[i]==0) continue;  // in an old segment or a copy
+    printf("\n%d/%d  Filename: %s (%ld bytes)\n", i+1, int(fname.size()),
+      fname[i], fsize[i]);
+    compress(fname[i], fsize[i], en);
+  }
+  en.flush();
+  const long csize=en.size()-offset;
+  en.writeState(archive);
+  const long end=ftell(archive);
+  fseek(archive, index+5+kept*entry, SEEK_SET);
+  putSize(n-old, job.wide, archive);
+  putSize(csize, job.wide, archive);
+  fseek(archive, 0, SEEK_END);
+  printf("\nNew segment: %ld bytes compressed to %ld bytes, state %ld bytes\n",
+    n-old, csize, end-offset-csize);
+}
+
+// Return archive f with the header and file list in tmp replaced by the
+// same bytes at the start of the existing archive name, positioned after
+// them, for compressSegments() to resume.  tmp is closed.
+FILE* resumeArchive(FILE* tmp, const char* name) {
+  FILE* f=fopen(name, "rb+");
+  if (!f) perror(name), quit();
+  const long n=ftell(tmp);
+  rewind(tmp);
+  for (long i=0; i<n; ++i)
+    if (getc(tmp)!=getc(f))
+      quit("cannot resume: archive was made with other options or files");
+  fclose(tmp);
+  return f;
+}
+
+// Reads the index written by compressSegments() and sets the segment
+// offsets.  Returns the number of threads used to compress.
+int readSegments(SegmentJob& job, FILE* archive) {
+  int threads=getc(archive);
+  int nseg=get4(archive);
+  if (threads<1 || nseg<1) quit("archive index corrupted");
+  job.seg.resize(nseg);
+  long begin=0, offset=ftell(archive)+nseg*(job.wide ? 16 : 8);
+  for (int i=0; i<nseg; ++i) {
+    Segment& s=job.seg[i];
+    s.usize=getSize(job.wide, archive);
+    s.csize=getSize(job.wide, archive);
+    s.begin=begin, s.offset=offset;
+    begin+=s.usize, offset+=s.csize;
+    s.tmp=0, s.thread=0, s.error=0;
+  }
+  return threads;
+}
+
+// Drop the segments that hold no byte of the files i with want[i], so
+// that only the rest are decompressed.
+void keepSegments(SegmentJob& job, const Array<U8>& want) {
+  const Array<long>& fsize=*job.fsize;
+  int n=0, i=0;
+  long p=0;  // start of file i, the first file not before the segment
+  for (int j=0; j<int(job.seg.size()); ++j) {
+    const Segment& s=job.seg[j];
+    while (i<int(fsize.size()) && p+fsize[i]<=s.begin) p+=fsize[i++];
+    bool keep=false;
+    long q=p;
+    for (int k=i; k<int(fsize.size()) && q<s.begin+s.usize && !keep; q+=fsize[k++])
+      keep=want[k] && fsize[k]>0;
+    if (keep) job.seg[n++]=s;
+  }
+  job.seg.resize(n);
+}
+
+// Decoded bytes of the segments in order.  tell() is the position in
+// the input of the next byte.  skip(p) moves forward to position p,
+// which must be in a segment not yet read.
+class SegmentReader {
+  SegmentRunner r;
+  FILE* in;  // current segment
+  long left, total;  // bytes left in current segment, all segments
+  long pos;  // position of the next byte in the input
+  void load() {  // start the next segment
+    if (in) fclose(in);
+    Segment& s=r.next();
+    in=s.tmp, s.tmp=0, left=s.usize, pos=s.begin;
+  }
+public:
+  SegmentReader(SegmentJob& job): r(job, decompressSegment), in(0),
+      left(0), total(0), pos(0) {
+    for (int i=0; i<int(job.seg.size()); ++i) total+=job.seg[i].usize;
+  }
+  long tell() const {return pos;}
+  int get() {
+    while (left==0) {
+      if (total==0) return EOF;
+      load();
+    }
+    --left, --total, ++pos;
+    return getc(in);
+  }
+  void skip(long p) {
+    while (pos<p || left==0) {
+      if (total==0) quit("archive truncated");
+      if (left==0) load();
+      if (pos>p) quit("archive index corrupted");
+      const long k=p-pos<left ? p-pos : left;
+      if (k && fseek(in, k, SEEK_CUR)) quit("seek error");
+      left-=k, total-=k, pos+=k;
+      if (pos==p && left) break;
+    }
+  }
+  ~SegmentReader() {if (in) fclose(in);}
+};
+
+// Extract (or compare) a file of filesize bytes from the segments.
+// Return true if it now holds the data, as decompress() does.
+bool decompressFile(const char* filename, long filesize, SegmentReader& r) {
+  FMode mode;
+  FILE* f=openOutput(filename, mode);
+  printf(" %s %ld -> ", filename, filesize);
+  long diffFound=0;
+  for (long i=0; i<filesize; ++i) {
+    int c=r.get();
+    if (c==EOF) quit("archive truncated");
+    if (mode==FDECOMPRESS) putc(c, f);
+    else if (mode==FCOMPARE && !diffFound && c!=getc(f)) diffFound=i+1;
+  }
+  bool ok=mode==FDECOMPRESS;
+  if (mode==FCOMPARE && !diffFound && getc(f)!=EOF) printf("file is longer\n");
+  else if (mode==FCOMPARE && diffFound) printf("differ at %ld\n", diffFound-1);
+  else if (mode==FCOMPARE) printf("identical\n"), ok=true;
+  else printf("done   \n");
+  if (f) fclose(f);
+  return ok;
+}
+
+//////////////////////////// Streams ////////////////////////////
+
+// With -s, standard input is compressed to standard output (or extracted
+// with -s -d) without knowing its length and without seeking, so that
+// a pipe can be compressed without staging it on disk.  The input is
+// read in windows of up to STREAMWINDOW bytes.  Each window is coded as
+// <length> <blocks> where length (4 bytes, big-endian) is the number of
+// input bytes in the blocks, and a length of 0 ends the stream.  The
+// model is kept from one window to the next.  Memory does not grow with
+// the length of the stream.
+//
+// detect() needs to see the whole block, so a window is compressed only
+// up to the start of a block that might continue past its end, or up to
+// STREAMLOOKBACK bytes before its end where a header may not have been
+// recognized yet.  The rest is moved to the front of the next window.
+
+const int STREAMWINDOW=1<<24, STREAMLOOKBACK=1<<12;
+
+// Return how many of the n bytes at p can be compressed without
+// splitting a block that continues past p+n.
+int streamCut(const U8* p, int n) {
+  Input in(p, n);
+  Filetype type=DEFAULT, prevType=DEFAULT;
+  int begin=0, prev=0;  // start of current and previous block
+  int cut=n, info;
+  while (begin<n) {
+    Filetype nextType=detect(in, n-begin, type, info);
+    const int end=in.tell();
+    if (end>=n) {  // last block, maybe incomplete
+      if (type==DEFAULT) cut=max(begin, n-STREAMLOOKBACK);
+      else if (prevType==DEFAULT) cut=max(prev, begin-STREAMLOOKBACK);
+      else cut=begin;
+      break;
+    }
+    in.seek(end);
+    prev=begin, prevType=type;
+    begin=end, type=nextType;
+  }
+  return cut>0?cut:n;
+}
+
+// Compress in to a stream archive (header and data) written to out
+void compressStream(FILE* in, FILE* out) {
+  Array<U8> win(STREAMWINDOW);
+  int n=fread(&win[0], 1, STREAMWINDOW, in);  // bytes in win
+  bool eof=n<STREAMWINDOW;
+  memlevel=min(eof?memoryLevel(level, n):level, budgetLevel(level));
+  fprintf(out, PROGNAME "%c%c", 4+2*(memlevel<level), '0'+level);
+  if (memlevel<level) putc('0'+memlevel, out);
+  Encoder en(COMPRESS, out);
+  while (n>0) {
+    const int len=eof?n:streamCut(&win[0], n);
+    en.compress(len>>24), en.compress(len>>16);
+    en.compress(len>>8), en.compress(len);
+    Input w(&win[0], len);
+    char blstr[32]="";
+    compressRecursive(w, len, en, blstr);
+    n-=len;
+    memmove(&win[0], &win[len], n);
+    if (!eof) {
+      const int r=fread(&win[n], 1, STREAMWINDOW-n, in);
+      eof=r<STREAMWINDOW-n;
+      n+=r;
+    }
+    en.sync();
+    fflush(out);
+  }
+  for (int i=0; i<4; ++i) en.compress(0);
+  en.flush();
+  fflush(out);
+  if (ferror(in) || ferror(out)) quit("stream I/O error");
+}
+
+// Extract a stream archive from in to out
+void decompressStream(FILE* in, FILE* out) {
+  const int len=strlen(PROGNAME);
+  char header[16];
+  if (fread(header, 1, len+2, in)!=size_t(len+2)
+      || strncmp(header, PROGNAME, len) || (header[len]&~2)!=4)
+    quit("not a " PROGNAME " stream");
+  level=header[len+1]-'0';
+  memlevel=header[len]&2 ? getc(in)-'0' : level;
+  if (level<0 || level>MAXLEVEL || memlevel<0 || memlevel>level)
+    quit("stream header corrupted");
+  Encoder en(DECOMPRESS, in);
+  for (;;) {
+    int n=en.decompress()<<24;
+    n|=en.decompress()<<16;
+    n|=en.decompress()<<8;
+    n|=en.decompress();
+    if (n==0) break;
+    if (n<0 || n>STREAMWINDOW) quit("stream corrupted");
+    decompressRecursive(out, n, en, FDECOMPRESS);
+    fflush(out);
+  }
+  if (ferror(in) || ferror(out)) quit("stream I/O error");
+}
+
+//////////////////////////// Library ////////////////////////////
+
+// With -DPAQLIB there is no main().  Instead the functions declared in
+// paq8px.h compress and decompress buffers in memory.  Compressed data
+// has the header:
+//   paq8px <flags> <level> [<memlevel>] <size>
+// where flags is 8, plus 2 if memlevel follows as for an archive, and
+// size (4 bytes, big-endian) is the length of the input.  Then come its
+// blocks, coded as for one file.  Tables are sized for the input.
+//
+// A context owns a BlockCache, which is made active while a call runs.
+// The Predictor is created for each call as usual, and its tables come
+// from the cache, so they are cleared rather than allocated each time.
+
+#ifdef PAQLIB
+#include "paq8px.h"
+
+struct paq8px_ctx {
+  BlockCache cache;
+  Array<U8> out;  // compressed data
+  int level;
+  const char* error;  // last error
+  paq8px_ctx(int lev): level(lev), error("") {}
+};
+
+// Parse the header of the n bytes at p.  Return its length, or 0 if it
+// is not valid, and set lev, mem, size.
+int parseHeader(const U8* p, size_t n, int& lev, int& mem, long& size) {
+  const int len=strlen(PROGNAME);
+  if (n<size_t(len+6) || memcmp(p, PROGNAME, len) || (p[len]&~2)!=8)
+    return 0;
+  int i=len+1;
+  lev=p[i++]-'0';
+  mem=p[len]&2 ? p[i++]-'0' : lev;
+  if (lev<0 || lev>MAXLEVEL || mem<0 || mem>lev || n<size_t(i+4)) return 0;
+  size=0;
+  for (int j=0; j<4; ++j) size=size<<8|p[i++];
+  return size<0 ? 0 : i;
+}
+
+// Make ctx active in this thread while it is in scope
+class Activate {
+  BlockCache* savedCache;
+  bool savedQuiet;
+public:
+  Activate(paq8px_ctx* ctx): savedCache(blockCache), savedQuiet(quiet) {
+    blockCache=&ctx->cache;
+    quiet=true;
+    ctx->error="";
+  }
+  ~Activate() {
+    blockCache->trim();
+    blockCache=savedCache;
+    quiet=savedQuiet;
+  }
+};
+
+Mutex initMutex;
+bool initDone=false;
+
+paq8px_ctx* paq8px_new(int level) {
+  if (level<0 || level>MAXLEVEL) return 0;
+  initMutex.lock();
+  if (!initDone) eccedc_init(), initDone=true;
+  initMutex.unlock();
+  try {
+    return new paq8px_ctx(level);
+  }
+  catch (...) {
+    return 0;
+  }
+}
+
+void paq8px_free(paq8px_ctx* ctx) {
+  delete ctx;
+}
+
+long paq8px_compress(paq8px_ctx* ctx, const void* in, size_t n,
+    void* out, size_t outsize) {
+  Activate a(ctx);
+  try {
+    if (n>0x7fffffff) quit("input too large");
+    level=ctx->level;
+    memlevel=memoryLevel(level, n);
+    Array<U8>& c=ctx->out;
+    c.resize(0);
+    for (const char* p=PROGNAME; *p; ++p) c.push_back(*p);
+    c.push_back(8+2*(memlevel<level));
+    c.push_back('0'+level);
+    if (memlevel<level) c.push_back('0'+memlevel);
+    for (int i=24; i>=0; i-=8) c.push_back(n>>i);
+    {
+      Encoder en(COMPRESS, c);
+      Input input((const U8*)in, n);
+      char blstr[32]="";
+      compressRecursive(input, n, en, blstr);
+      en.flush();
+    }
+    if (size_t(c.size())>outsize) quit("output buffer too small");
+    memcpy(out, &c[0], c.size());
+    return c.size();
+  }
+  catch (const char* s) {
+    ctx->error=s?s:"error";
+  }
+  return -1;
+}
+
+long paq8px_decompress(paq8px_ctx* ctx, const void* in, size_t n,
+    void* out, size_t outsize) {
+  Activate a(ctx);
+  try {
+    const U8* p=(const U8*)in;
+    long size;
+    const int len=parseHeader(p, n, level, memlevel, size);
+    if (!len) quit("not compressed by " PROGNAME);
+    if (size_t(size)>outsize) quit("output buffer too small");
+    Encoder en(DECOMPRESS, p+len, n-len);
+    Output o((U8*)out, size);
+    decompressRecursive(&o, size, en, FDECOMPRESS);
+    if (o.size()!=size) quit("data corrupted");
+    return size;
+  }
+  catch (const char* s) {
+    ctx->error=s?s:"error";
+  }
+  return -1;
+}
+
+long paq8px_size(const void* in, size_t n) {
+  int lev, mem;
+  long size;
+  return parseHeader((const U8*)in, n, lev, mem, size) ? size : -1;
+}
+
+const char* paq8px_error(const paq8px_ctx* ctx) {
+  return ctx->error;
+}
+
+#elif defined(CMBENCH)
+
+//////////////////////////// ContextMap benchmark ////////////////////////////
+
+// With -DCMBENCH, main() records or replays traces of ContextMap lookups:
+//   paq8px_cmbench -N file trace   compress file at level N, recording
+//   paq8px_cmbench trace           replay trace with E::scan(), E::probe()
+// The replay starts from empty tables as the maps did and sets the
+// recorded priorities before each lookup, so each one must return the
+// recorded element.  Only the lookups are timed.  A trace takes 16 bytes
+// per lookup, a few MB per KB of input.
+
+// Replay the trace of n bytes at p with probe() if simd, else scan().
+// Return the time in seconds.
+double replayTrace(const U8* p, long n, bool simd) {
+  typedef Array<ContextMap::E, 64> Table;
+  Array<Table*> maps(65536);
+  const TraceRecord* r=(const TraceRecord*)p;
+  clock_t time=0, start=clock();
+  for (long i=n/sizeof(TraceRecord); i>0; --i, ++r) {
+    Table*& t=maps[r->map];
+    if (r->slot>=NEWMAP) {
+      time+=clock()-start;
+      delete t;
+      t=r->slot==NEWMAP ? new Table(r->index) : 0;
+      start=clock();
+      continue;
+    }
+    if (!t || r->index>=U32(t->size()) || r->slot>6) quit("bad trace");
+    ContextMap::E& e=(*t)[r->index];
+    for (int j=0; j<7; ++j) e.bh[j][0]=r->pri[j];
+    U8* q=e.chk[e.last&15]==r->chk ? &e.bh[e.last&15][0]
+      : simd ? e.probe(r->chk) : e.scan(r->chk);
+    if (q!=&e.bh[r->slot][0]) quit("replay differs from trace");
+  }
+  time+=clock()-start;
+  for (int i=0; i<int(maps.size()); ++i) delete maps[i];
+  return double(time)/CLOCKS_PER_SEC;
+}
+
+int main(int argc, char** argv) {
+  try {
+    if (argc==4 && argv[1][0]=='-') {
+      level=atoi(argv[1]+1);
+      if (level<0 || level>MAXLEVEL) quit("level must be 0 to 8 (10 in a 64-bit build)");
+      FILE* f=fopen(argv[2], "rb");
+      if (!f) perror(argv[2]), quit();
+      MappedFile m(f);
+      cmTrace=fopen(argv[3], "wb");
+      if (!cmTrace) perror(argv[3]), quit();
+      eccedc_init();
+      quiet=true;
+      memlevel=memoryLevel(level, m.size());
+      Array<U8> c;
+      {
+        Encoder en(COMPRESS, c);
+        Input in(m.data(), m.size());
+        char blstr[32]="";
+        compressRecursive(in, m.size(), en, blstr);
+        en.flush();
+      }
+      printf("%s: %ld -> %d bytes, %ld lookups in %d maps\n", argv[2],
+        m.size(), c.size(), ftell(cmTrace)/long(sizeof(TraceRecord)),
+        traceMaps);
+      fclose(cmTrace);
+      fclose(f);
+    }
+    else if (argc==2) {
+      FILE* f=fopen(argv[1], "rb");
+      if (!f) perror(argv[1]), quit();
+      MappedFile m(f);
+      const long n=m.size()/sizeof(TraceRecord);
+      if (!n || m.size()%sizeof(TraceRecord)) quit("not a trace");
+      const double t1=replayTrace(m.data(), m.size(), false);
+      const double t2=replayTrace(m.data(), m.size(), true);
+      printf("%ld lookups: scan %1.2f ns, probe %1.2f ns per lookup%s\n",
+        n, t1*1e9/n, t2*1e9/n, simd==SIMD_NONE ? " (no SSE4.1)" : "");
+      fclose(f);
+    }
+    else {
+      printf("To record: %s -N file trace\n"
+             "To replay: %s trace\n", argv[0], argv[0]);
+      return 1;
+    }
+  }
+  catch (const char* s) {
+    if (s) fprintf(stderr, "%s\n", s);
+    return 1;
+  }
+  return 0;
+}
+
+#else
+
+//////////////////////////// User Interface ////////////////////////////
+
+
+// int expand(String& archive, String& s, const char* fname, int base) {
+// Given file name fname, print its length and base name (beginning
+// at fname+base) to archive in format "%ld\t%s\r\n" and append the
+// full name (including path) to String s in format "%s\n".  If fname
+// is a directory then substitute all of its regular files and recursively
+// expand any subdirectories.  Base initially points to the first
+// character after the last / in fname, but in subdirectories includes
+// the path from the topmost directory.  Return the number of files
+// whose names are appended to s and archive.
+
+// Same as expand() except fname is an ordinary file
+int putsize(String& archive, const char* fname, int base) {
+  int result=0;
+  FILE *f=fopen(fname, "rb");
+  if (f) {
+    fseek(f, 0, SEEK_END);
+    long len=ftell(f);
+    if (len<0) printf("%s: 2 GB or more, which needs a 64-bit build\n", fname);
+    else {
+      static char blk[24];
+      sprintf(blk, "%ld\t", len);
+      archive+=blk;
+      archive+=(fname+base);
+      archive+="\n";
+      ++result;
+    }
+    fclose(f);
+  }
+  return result;
+}
+
+#ifdef WINDOWS
+
+int expand(String& archive, const char* fname, int base) {
+  int result=0;
+  DWORD attr=GetFileAttributes(fname);
+  if ((attr != 0xFFFFFFFF) && (attr & FILE_ATTRIBUTE_DIRECTORY)) {
+    WIN32_FIND_DATA ffd;
+    String fdir(fname);
+    fdir+="/*";
+    HANDLE h=FindFirstFile(fdir.c_str(), &ffd);
+    while (h!=INVALID_HANDLE_VALUE) {
+      if (!equals(ffd.cFileName, ".") && !equals(ffd.cFileName, "..")) {
+        String d(fname);
+        d+="/";
+        d+=ffd.cFileName;
+        result+=expand(archive, d.c_str(), base);
+      }
+      if (FindNextFile(h, &ffd)!=TRUE) break;
+    }
+    FindClose(h);
+  }
+  else // ordinary file
+    result=putsize(archive, fname, base);
+  return result;
+}
+
+#else
+#ifdef UNIX
+
+int expand(String& archive, const char* fname, int base) {
+  int result=0;
+  struct stat sb;
+  if (stat(fname, &sb)<0) return 0;
+
+  // If a regular file and readable, get file size
+  if (sb.st_mode & S_IFREG && sb.st_mode & 0400)
+    result+=putsize(archive, fname, base);
+
+  // If a directory with read and execute permission, traverse it
+  else if (sb.st_mode & S_IFDIR && sb.st_mode & 0400 && sb.st_mode & 0100) {
+    DIR *dirp=opendir(fname);
+    if (!dirp) {
+      perror("opendir");
+      return result;
+    }
+    dirent *dp;
+    while(errno=0, (dp=readdir(dirp))!=0) {
+      if (!equals(dp->d_name, ".") && !equals(dp->d_name, "..")) {
+        String d(fname);
+        d+="/";
+        d+=dp->d_name;
+        result+=expand(archive, d.c_str(), base);
+      }
+    }
+    if (errno) perror("readdir");
+    closedir(dirp);
+  }
+  else printf("%s is not a readable file or directory\n", fname);
+  return result;
+}
+
+#else  // Not WINDOWS or UNIX, ignore directories
+
+int expand(String& archive, const char* fname, int base) {
+  return putsize(archive, fname, base);
+}
+
+#endif
+#endif
+
+// Return a hash of the contents of file fname
+U32 fileHash(const char* fname) {
+  FILE* f=fopen(fname, "rb");
+  if (!f) perror(fname), quit();
+  U32 h=0;
+  U8 buf[1<<16];
+  for (size_t n; (n=fread(buf, 1, sizeof(buf), f))>0;)
+    for (size_t i=0; i<n; ++i) h=(h^buf[i])*16777619;
+  fclose(f);
+  return h;
+}
+
+// Return true if files a and b have the same contents
+bool sameFile(const char* a, const char* b) {
+  FILE* fa=fopen(a, "rb");
+  FILE* fb=fopen(b, "rb");
+  bool result=false;
+  if (fa && fb) {
+    U8 ba[1<<16], bb[1<<16];
+    size_t na, nb;
+    do {
+      na=fread(ba, 1, sizeof(ba), fa);
+      nb=fread(bb, 1, sizeof(bb), fb);
+    } while (na==nb && na>0 && !memcmp(ba, bb, na));
+    result=na==0 && nb==0;
+  }
+  if (fa) fclose(fa);
+  if (fb) fclose(fb);
+  return result;
+}
+
+// Read the line at p of a file list (made by expand()), which is
+// "size\tname\n", or "size=k\tname\n" for a copy of file k (counting
+// from 1).  Set dup to k-1, or -1 if not a copy.  The line is cut at the
+// tab and the newline, so that name ends there.  Return the next line.
+char* readFileLine(char* p, long& size, int& dup, const char*& name) {
+  size=strtol(p, &p, 10);
+  dup=*p=='=' ? strtol(p+1, &p, 10)-1 : -1;
+  while (*p && *p!='\t') ++p;
+  if (*p) *p++=0;
+  name=p;
+  while (*p && *p!='\n') ++p;
+  if (*p) *p++=0;
+  return p;
+}
+
+// Mark the files in list (made by expand()) that are identical to an
+// earlier file: "size\tname\n" becomes "size=k\tname\n" where k is the
+// number of the first copy, counting from 1.  Only files of equal size
+// are hashed, and equal hashes are compared.  The first files of list
+// are already in an archive (see -a) and are not read or changed.
+// Return the number of copies in list.
+int markDuplicates(String& list, int first=0) {
+  String s(list.c_str());
+  int files=0;
+  for (int i=0; s[i]; ++i) files+=s[i]=='\n';
+  Array<const char*> name(files);
+  Array<long> size(files);
+  Array<U32> h(files);
+  Array<U8> hashed(files);
+  Array<int> dup(files);
+  char* p=&s[0];
+  int result=0;
+  for (int i=0; i<files; ++i) {
+    p=readFileLine(p, size[i], dup[i], name[i]);
+    result+=dup[i]>=0;
+  }
+  const int copies=result;
+  for (int i=first; i<files; ++i) {
+    for (int j=first; j<i && dup[i]<0 && size[i]>0; ++j) {
+      if (dup[j]>=0 || size[j]!=size[i]) continue;
+      if (!hashed[j]) h[j]=fileHash(name[j]), hashed[j]=1;
+      if (!hashed[i]) h[i]=fileHash(name[i]), hashed[i]=1;
+      if (h[j]==h[i] && sameFile(name[j], name[i])) dup[i]=j, ++result;
+    }
+  }
+  if (result==copies) return result;
+  list="";
+  for (int i=0; i<files; ++i) {
+    char blk[32];
+    if (dup[i]<0) sprintf(blk, "%ld\t", size[i]);
+    else sprintf(blk, "%ld=%d\t", size[i], dup[i]+1);
+    list+=blk;
+    list+=name[i];
+    list+="\n";
+  }
+  return result;
+}
+
+// Open archive name for reading and check its header.  Set level and
+// memlevel, flags (see ARCHIVE FILE FORMAT), and with flag 1, listsize.
+// The archive must have been made with the snapshot in use, if any.
+// Return the archive positioned at the file list.
+FILE* openArchive(const char* name, int& flags, long& listsize) {
+  FILE* archive=fopen(name, "rb+");
+  if (!archive) perror(name), quit();
+
+  // Check for proper format and get option
+  String header;
+  int len=strlen(PROGNAME)+2, c, i=0;
+  header.resize(len+1);
+  while (i<len && (c=getc(archive))!=EOF) {
+    header[i]=c;
+    i++;
+  }
+  header[i]=0;
+  flags=U8(header[strlen(PROGNAME)]);
+  if (!strncmp(header.c_str(), PROGNAME, strlen(PROGNAME)) && flags&4
+      && flags<8)
+    quit("This is a stream archive, extract it with -s -d < archive");
+  if (strncmp(header.c_str(), PROGNAME, strlen(PROGNAME)) || flags&~251
+      || (flags&32 && !(flags&1)) || (flags&128 && !(flags&1))
+      || (flags&8 && (flags&33)!=1))
+    printf("%s: not a %s file\n", name, PROGNAME), quit();
+  if (flags&128 && sizeof(long)<8)
+    quit("archive has files of 2 GB or more, which need a 64-bit build");
+  level=header[strlen(PROGNAME)+1]-'0';
+  if (level<0||level>MAXLEVEL) quit("archive header corrupted, or made at level 9 or 10 (which need a 64-bit build)");
+  memlevel=level;
+  if (flags&2) memlevel=getc(archive)-'0';
+  if (memlevel<0||memlevel>level) quit("archive header corrupted");
+  if (flags&64) {  // made with a snapshot
+    const U32 h=get4(archive);
+    if (!snapshot || snapshot->hash()!=h || !snapshot->fits())
+      printf("%s needs the snapshot with hash %08X (-p)\n", name, h), quit();
+  }
+  else if (snapshot) printf("%s was made without -p\n", name), quit();
+  if (flags&1) listsize=get4(archive);
+  return archive;
+}
+
+// Decompress the file list from en to list (with the terminating 0,
+// which is compressed too).  Return the number of files, or -1 if it is
+// not a file list.
+int readFileList(Encoder& en, String& list) {
+  if (en.decompress()!=0) return -1;
+  int len=0, files=0;
+  len+=en.decompress()<<24;
+  len+=en.decompress()<<16;
+  len+=en.decompress()<<8;
+  len+=en.decompress();
+  if (len<1) return -1;
+  list.resize(len);
+  for (int i=0; i<len; i++) {
+    list[i]=en.decompress();
+    if (list[i]=='\n') files++;
+  }
+  return list[len-1] ? -1 : files;  // ends with 0 as written
+}
+
+// Set want[i] for each file i in fname that is name or is in directory
+// name.  Return the number of them.
+int findFiles(const Array<const char*>& fname, const char* name,
+    Array<U8>& want) {
+  String s(name);
+  int len=strlen(name), result=0;
+  for (int j=0; j<len; ++j)  // change \ to /
+    if (s[j]=='\\') s[j]='/';
+  while (len>0 && s[len-1]=='/') s[--len]=0;  // remove trailing /
+  for (int i=0; i<int(fname.size()); ++i) {
+    if (!strncmp(fname[i], s.c_str(), len)
+        && (fname[i][len]==0 || fname[i][len]=='/'))
+      want[i]=1, ++result;
+  }
+  return result;
+}
+
+//////////////////////////// Server ////////////////////////////
+
+// paq8px -N -D socket [-tN] serves requests on a Unix domain socket.  A
+// client connects and sends 'c' (compress) or 'd' (decompress), then
+// its input, and shuts down its side of the connection for writing.  The
+// reply is the output of paq8px -s -N (a stream archive) or of
+// paq8px -s -d, sent as it is made in chunks, each as its length
+// (4 bytes, big-endian) followed by its bytes.  A length of 0 ends a
+// reply.  After an error (such as a compressed input that is cut short)
+// the reply ends instead with the length 0xFFFFFFFF and the error
+// message, and the connection is closed.  N threads (default 1) serve
+// connections at the same time.  Each thread keeps the tables of its
+// last job in a BlockCache, so that a job does not allocate them again,
+// and the tables set up once per process (State_table, stretch(), dt...)
+// are not set up again.
+
+#ifdef UNIX
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <signal.h>
+
+// Write the n bytes at p to socket fd.  Return false on error.
+bool sendAll(int fd, const void* p, size_t n) {
+  while (n>0) {
+    const ssize_t r=write(fd, p, n);
+    if (r<0 && errno==EINTR) continue;
+    if (r<=0) return false;
+    p=(const char*)p+r, n-=r;
+  }
+  return true;
+}
+
+// Write the n bytes at p to socket *(int*)fd as a chunk
+long sendChunk(void* fd, const char* p, long n) {
+  const U8 len[4]={U8(n>>24), U8(n>>16), U8(n>>8), U8(n)};
+  if (n<=0) return 0;
+  if (!sendAll(*(int*)fd, len, 4) || !sendAll(*(int*)fd, p, n)) return -1;
+  return n;
+}
+
+// Return a FILE* that writes chunks to socket *fd, or 0
+FILE* openChunks(int* fd) {
+  FILE* f=0;
+#if defined(__GLIBC__)
+  cookie_io_functions_t io={0, (cookie_write_function_t*)sendChunk, 0, 0};
+  f=fopencookie(fd, "w", io);
+#elif defined(__APPLE__) || defined(BSD) || defined(__FreeBSD__)
+  f=funopen(fd, 0, (int(*)(void*, const char*, int))sendChunk, 0, 0);
+#endif
+  if (f) setvbuf(f, 0, _IOFBF, 1<<16);
+  return f;
+}
+
+struct ServerArg {
+  int listener;  // socket
+  int level;
+};
+
+// Serve connections on the listening socket of a ServerArg until it fails
+void serve(void* arg) {
+  const int listener=((ServerArg*)arg)->listener;
+  const int lev=((ServerArg*)arg)->level;
+  BlockCache cache;
+  blockCache=&cache;
+  quiet=true;
+  for (;;) {
+    const int fd=accept(listener, 0, 0);
+    if (fd<0) {
+      if (errno==EINTR || errno==ECONNABORTED) continue;
+      perror("accept");
+      break;
+    }
+    int outfd=fd;
+    FILE* in=fdopen(fd, "rb");
+    FILE* out=openChunks(&outfd);
+    try {
+      if (!in || !out) quit("cannot open connection");
+      level=lev;
+      const int c=getc(in);
+      if (c=='c') compressStream(in, out);
+      else if (c=='d') decompressStream(in, out);
+      else quit("request is not 'c' or 'd'");
+      if (fflush(out)) quit("write error");
+      sendAll(fd, "\0\0\0\0", 4);  // end of reply
+    }
+    catch (const char* s) {
+      if (!s) s="error";
+      fprintf(stderr, "%s\n", s);
+      outfd=-1;  // drop the output still buffered in out
+      if (sendAll(fd, "\377\377\377\377", 4)) sendAll(fd, s, strlen(s));
+    }
+    if (out) fclose(out);
+    if (in) fclose(in);
+    else close(fd);
+    cache.trim();
+  }
+  blockCache=0;
+}
+
+// Listen on socket name and serve connections in threads
+void runServer(const char* name, int threads) {
+  signal(SIGPIPE, SIG_IGN);  // a client may disconnect early
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family=AF_UNIX;
+  if (strlen(name)>=sizeof(addr.sun_path)) quit("socket name too long");
+  strcpy(addr.sun_path, name);
+  struct stat st;
+  if (stat(name, &st)==0 && S_ISSOCK(st.st_mode))
+    unlink(name);  // left by an earlier server
+  int listener=socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener<0 || bind(listener, (sockaddr*)&addr, sizeof(addr))
+      || listen(listener, 64))
+    perror(name), quit();
+  fprintf(stderr, "Serving %s at level %d with %d thread(s)\n", name,
+    level, threads);
+  ServerArg arg={listener, level};
+  Array<Thread*> t(threads);
+  for (int i=0; i<threads; ++i) t[i]=new Thread(serve, &arg);
+  for (int i=0; i<threads; ++i) t[i]->join(), delete t[i];
+  close(listener);
+}
+#endif
+
+// To compress to file1.paq8px: paq8px [-n] file1 [file2...]
+// To decompress: paq8px file1.paq8px [output_dir] [files...]
+int main(int argc, char** argv) {
+  bool pause=argc<=2;  // Pause when done?
+  eccedc_init();  // before any threads use it
+  bool doStream=false;  // -s option
+  try {
+
+    // Get options
+    bool doExtract=false;  // -d option
+    bool doList=false;  // -l option
+    bool nonsolid=false;  // -n option
+    bool resume=false;  // -r option
+    bool append=false;  // -a option
+    const char* primeName=0;  // -p option: snapshot to use
+    const char* trainName=0;  // -P option: snapshot to make
+    const char* serverName=0;  // -D option: socket to serve
+    int threads=0;  // -t option, 0 if not parallel
+    while (argc>1 && argv[1][0]=='-' && argv[1][1]) {
+      if (isdigit(argv[1][1]) && (!argv[1][2] || (argv[1][1]=='1'
+          && argv[1][2]=='0' && !argv[1][3]))) {
+        level=atoi(argv[1]+1);
+        if (level>MAXLEVEL) quit("-9 and -10 need a 64-bit build");
+      }
+      else if (argv[1][1]=='d' && !argv[1][2])
+        doExtract=true;
+      else if (argv[1][1]=='l' && !argv[1][2])
+        doList=true;
+      else if (argv[1][1]=='n' && !argv[1][2])
+        nonsolid=true;
+      else if (argv[1][1]=='r' && !argv[1][2])
+        resume=true;
+      else if (argv[1][1]=='a' && !argv[1][2])
+        append=true;
+      else if (argv[1][1]=='p' && !argv[1][2] && argc>2)
+        primeName=argv[2], --argc, ++argv;
+      else if (argv[1][1]=='P' && !argv[1][2] && argc>2)
+        trainName=argv[2], --argc, ++argv;
+      else if (argv[1][1]=='D' && !argv[1][2] && argc>2)
+        serverName=argv[2], --argc, ++argv;
+      else if (argv[1][1]=='m' && !argv[1][2] && argc>2)
+        budget=parseMemory(argv[2]), --argc, ++argv;
+      else if (argv[1][1]=='s' && !argv[1][2])
+        doStream=true;
+      else if (argv[1][1]=='t' && (threads=atoi(argv[1]+2))>=1
+          && threads<=255)
+        ;
+      else
+        quit("Valid options are -0 through -10, -a, -d, -D socket, -l, -m bytes, -n, -p snapshot, -P snapshot, -r, -s, -t1 through -t255\n");
+      --argc;
+      ++argv;
+      pause=false;
+    }
+
+    // The budget of -m is shared by the threads
+    if (threads) budget/=threads;
+
+    // Serve requests on a socket: paq8px -N -D socket [-tN]
+    if (serverName) {
+      if (argc>1 || doExtract || doList || nonsolid || resume || append
+          || doStream || primeName || trainName)
+        quit("-D takes only a level, -m and -tN");
+#ifdef UNIX
+      runServer(serverName, threads ? threads : 1);
+#else
+      quit("-D needs Unix");
+#endif
+      return 0;
+    }
+
+    // Use a snapshot (-p), or make one from the files (-P)
+    if (primeName && trainName) quit("-p and -P cannot be used together");
+    if ((primeName || trainName) && doStream)
+      quit("-p and -P cannot be used with -s");
+    if (trainName && (threads || nonsolid || append || resume || doExtract
+        || doList))
+      quit("-P takes only a level and the files to train on");
+    if (trainName && level<1) quit("-P needs a level of 1 or more");
+    if (primeName) snapshot=new Snapshot(primeName), level=snapshot->getLevel();
+    if (trainName) snapshot=new Snapshot(level, budgetLevel(level));
+
+    // Compress or extract a pipe: paq8px -s [-d] < in > out
+    if (doStream) {
+      if (argc>1) quit("-s reads standard input and takes no file names");
+      quiet=true;
+#ifdef WINDOWS
+      _setmode(_fileno(stdin), _O_BINARY);
+      _setmode(_fileno(stdout), _O_BINARY);
+#endif
+      if (doExtract) decompressStream(stdin, stdout);
+      else compressStream(stdin, stdout);
+      return 0;
+    }
+
+    // Print help message
+    if (argc<2) {
+      printf(PROGNAME " archiver (C) 2008, Matt Mahoney et al.\n"
+        "Free under GPL, http://www.gnu.org/licenses/gpl.txt\n\n"
+#ifdef WINDOWS
+        "To compress or extract, drop a file or folder on the "
+        PROGNAME " icon.\n"
+        "The output will be put in the same folder as the input.\n"
+        "\n"
+        "Or from a command window: "
+#endif
+        "To compress:\n"
+        "  " PROGNAME " -level file               (compresses to file." PROGNAME ")\n"
+        "  " PROGNAME " -level archive files...   (creates archive." PROGNAME ")\n"
+        "  " PROGNAME " file                      (level -%d, pause when done)\n"
+        "level: -0 = store, -1 -2 -3 = faster (uses 63, 74, 96 MB)\n"
+        "-4 -5 -6 -7 -8 = smaller (uses 190, 329, 606, 1159, 2266 MB)\n"
+        "-9 -10 = smallest, 64-bit builds only (uses 4.5, 8.9 GB)\n"
+        "-tN after level: compress in N threads (uses N times more memory)\n"
+        "-m bytes: use at most bytes (or nK, nM, nG) of memory, auto: cgroup limit\n"
+        "-n after level: non-solid, so that single files extract quickly\n"
+        "-r: resume an interrupted compression\n"
+        "  " PROGNAME " [-level] -a archive." PROGNAME " files... (add files, compressed by\n"
+        "    the model trained on the old ones; makes the archive if it is missing)\n"
+        "  " PROGNAME " -level -P snapshot files... (train on files, save the model)\n"
+        "-p snapshot: start from a saved model (also to extract)\n"
+#if defined(WINDOWS) || defined (UNIX)
+        "You may also compress directories.\n"
+#endif
+        "\n"
+        "To extract or compare:\n"
+        "  " PROGNAME " -d dir1/archive." PROGNAME "      (extract to dir1)\n"
+        "  " PROGNAME " -d dir1/archive." PROGNAME " dir2 (extract to dir2)\n"
+        "  " PROGNAME " -d dir1/archive." PROGNAME " [dir2] files... (extract some files)\n"
+        "  " PROGNAME " archive." PROGNAME "              (extract, pause when done)\n"
+        "\n"
+        "To view contents: " PROGNAME " -l archive." PROGNAME "\n"
+        "\n"
+        "To serve requests from other programs on a Unix socket:\n"
+        "  " PROGNAME " -level -D socket [-tN] (see the source for the protocol)\n"
+        "\n"
+        "To compress or extract a pipe:\n"
+        "  " PROGNAME " -s -level < file > archive\n"
+        "  " PROGNAME " -s -d < archive > file\n"
+        "\n",
+        DEFAULT_OPTION);
+      quit();
+    }
+
+    FILE* archive=0;  // compressed file
+    int files=0;  // number of files to compress/decompress
+    Array<const char*> fname(1);  // file names (resized to files)
+    Array<long> fsize(1);   // file lengths (resized to files)
+    Array<int> dup(1);  // earlier identical file or -1 (resized to files)
+    SegmentJob job;
+    FILE* old=0;  // archive being appended to with -a
+    int oldfiles=0;  // files in it
+    String tmpName;  // of the new archive with -a
+    Checkpoints* ck=0;  // of a long solid compression
+
+    // Compress or decompress?  Get archive name
+    Mode mode=COMPRESS;
+    bool segmented=threads>0 || nonsolid;  // archive has an index of segments?
+    bool chained=false;  // segments coded by one model? (see compressChained())
+    long listsize=0;  // compressed size of file list if segmented
+    String archiveName(argv[1]);
+    {
+      const int prognamesize=strlen(PROGNAME);
+      const int arg1size=strlen(argv[1]);
+      if (arg1size>prognamesize+1 && argv[1][arg1size-prognamesize-1]=='.'
+          && equals(PROGNAME, argv[1]+arg1size-prognamesize)) {
+        mode=DECOMPRESS;
+      }
+      else if (doExtract || doList)
+        mode=DECOMPRESS;
+      else {
+        archiveName+=".";
+        archiveName+=PROGNAME;
+      }
+      if (append || trainName) mode=COMPRESS;
+      if (append && resume) quit("-a and -r cannot be used together");
+    }
+
+    // Compress: write archive header, get file names and sizes
+    String header_string;
+    if (mode==COMPRESS) {
+
+      // Append: start with the file list of the archive, which must be
+      // segmented.  A new archive is made with its segments copied.  If
+      // there is no archive, then a new chained one is made.
+      if (append) {
+        tmpName=archiveName.c_str();
+        tmpName+=".tmp";
+        FILE* f=fopen(archiveName.c_str(), "rb");
+        if (f) fclose(f);
+        else if (threads || nonsolid)
+          quit("-a makes a new archive without -tN or -n");
+        else segmented=chained=true;
+      }
+      if (append && !chained) {  // there is one
+        int flags;
+        old=openArchive(archiveName.c_str(), flags, listsize);
+        if (!(flags&1)) quit("-a needs an archive made with -a, -tN or -n");
+        segmented=true;
+        nonsolid=flags&32;
+        chained=flags&8;
+        job.wide=flags&128;
+        Array<U8> list(listsize);
+        if (fread(&list[0], 1, listsize, old)!=size_t(listsize))
+          quit("archive truncated");
+        const int m=memlevel;
+        if (nonsolid || chained) memlevel=0;
+        {
+          Encoder en(DECOMPRESS, &list[0], listsize);
+          files=oldfiles=readFileList(en, header_string);
+        }
+        memlevel=m;
+        if (files<0) quit("archive header corrupted");
+        threads=readSegments(job, old);
+      }
+
+      // Expand filenames to read later.  Write their base names and sizes
+      // to archive.
+      int i;
+      for (i=append?2:1; i<argc; ++i) {
+        String name(argv[i]);
+        int len=name.size()-1;
+        for (int j=0; j<=len; ++j)  // change \ to /
+          if (name[j]=='\\') name[j]='/';
+        while (len>0 && name[len-1]=='/')  // remove trailing /
+          name[--len]=0;
+        int base=len-1;
+        while (base>=0 && name[base]!='/') --base;  // find last /
+        ++base;
+        if (base==0 && len>=2 && name[1]==':') base=2;  // chop "C:"
+        int expanded=expand(header_string, name.c_str(), base);
+        if (!expanded && (i>1||argc==2))
+          printf("%s: not found, skipping...\n", name.c_str());
+        files+=expanded;
+      }
+
+      // If there is at least one file to compress
+      // then create the archive header.
+      if (files<=oldfiles) quit("Nothing to compress\n");
+      const int dups=markDuplicates(header_string, oldfiles);
+      if (resume && !(archive=fopen(archiveName.c_str(), "rb")))
+        printf("%s not found, starting over\n", archiveName.c_str()), resume=false;
+      if (archive) fclose(archive);
+
+      // If resuming, write the header to a temporary file to compare
+      // With -P, the archive is only used to train the model.
+      archive=resume || trainName ? tmpfile()
+        : fopen(append ? tmpName.c_str() : archiveName.c_str(), "wb+");
+      if (!archive) perror(archiveName.c_str()), quit();
+
+      // Size the tables for the input
+      long n=header_string.size();
+      String list(header_string.c_str());
+      for (char* p=&list[0]; *p;) {
+        long size;
+        int dup;
+        const char* name;
+        p=readFileLine(p, size, dup, name);
+        if (dup<0) n+=size;
+      }
+      const bool primed=snapshot && !trainName;
+      if (snapshot) memlevel=snapshot->getMemlevel();
+      else if (chained && !old) memlevel=budgetLevel(level);  // for later files too
+      else if (!old) memlevel=min(memoryLevel(level, n), budgetLevel(level));
+
+      // A long solid compression saves checkpoints.  Resume from the
+      // last one, or start over if there is none.
+      if (!segmented && !trainName && level>0 && n>=CHECKPOINTMIN)
+        ck=new Checkpoints(archiveName.c_str());
+      if (resume && !segmented && !(ck && ck->find())) {
+        printf("No checkpoint of %s, starting over\n", archiveName.c_str());
+        resume=false;
+        fclose(archive);
+        archive=fopen(archiveName.c_str(), "wb+");
+        if (!archive) perror(archiveName.c_str()), quit();
+      }
+      job.wide=segmented && n>0x7fffffffL;
+      fprintf(archive, PROGNAME "%c%c", segmented+2*(memlevel<level)
+        +8*chained+16*(dups>0)+32*nonsolid+64*primed+128*job.wide, '0'+level);
+      if (memlevel<level) putc('0'+memlevel, archive);
+      if (primed) put4(snapshot->hash(), archive);
+      if (segmented) put4(0, archive);  // file list size, filled in later
+      else if (resume) archive=resumeArchive(archive, archiveName.c_str());
+      if (old)
+        printf("Adding %d file(s) to archive %s...\n", files-oldfiles,
+          archiveName.c_str());
+      else if (trainName)
+        printf("Making snapshot %s from %d file(s)...\n", trainName, files);
+      else
+        printf("Creating archive %s with %d file(s)...\n",
+          archiveName.c_str(), files);
+      if (dups) printf("%d file(s) are copies of earlier files\n", dups);
+    }
+
+    // Decompress: open archive for reading and store file names and sizes
+    if (mode==DECOMPRESS) {
+      int flags;
+      archive=openArchive(archiveName.c_str(), flags, listsize);
+      segmented=flags&1;
+      chained=flags&8;
+      nonsolid=flags&32;
+      job.wide=flags&128;
+    }
+
+    // Set globals according to option
+    assert(level>=0 && level<=MAXLEVEL);
+    const long start=ftell(archive);  // of the file list
+    const int archiveLevel=memlevel;
+    if (nonsolid || chained) memlevel=0;  // small tables for the file list
+    Array<U8> list(mode==DECOMPRESS && segmented ? listsize : 0);
+    if (list.size() && fread(&list[0], 1, listsize, archive)!=size_t(listsize))
+      quit("archive truncated");
+    savable=ck!=0;
+    Encoder* en=list.size() ? new Encoder(DECOMPRESS, &list[0], listsize)
+      : new Encoder(mode, archive);  // deleted if segmented
+    savable=false;
+    if (ck) en->setCheckpoints(ck);
+
+    // Compress header
+    if (mode==COMPRESS) {
+      int len=header_string.size();
+      printf("\nFile list (%ld bytes)\n", len);
+      assert(en->getMode()==COMPRESS);
+      en->compress(0); // block type 0
+      en->compress(len>>24); en->compress(len>>16); en->compress(len>>8); en->compress(len); // block length
+      for (int i=0; i<len; i++) en->compress(header_string[i]);
+      if (segmented) {
+        en->flush();
+        listsize=en->size()-start;
+        fseek(archive, start-4, SEEK_SET);
+        put4(listsize, archive);
+        fseek(archive, 0, SEEK_END);
+      }
+      printf("Compressed from %ld to %ld bytes.\n",len,en->size()-start);
+    }
+
+    // Deompress header
+    if (mode==DECOMPRESS) {
+      files=readFileList(*en, header_string);
+      if (files<0) printf("%s: header corrupted\n", archiveName.c_str()), quit();
+      if (doList) printf("File list of %s archive:\n%s", archiveName.c_str(), header_string.c_str());
+      if (segmented) fseek(archive, start+listsize, SEEK_SET);
+    }
+    if (segmented) delete en, en=0;
+    memlevel=archiveLevel;
+
+    // Fill fname[files], fsize[files] with input filenames and sizes
+    // and dup[files] with the number of the first copy if a duplicate
+    fname.resize(files);
+    fsize.resize(files);
+    dup.resize(files);
+    Array<long> csize(files);  // compressed files' sizes, 0 for copies
+    char *p=&header_string[0];
+    for (int i=0; i<files; ++i) {
+      assert(p);
+      p=readFileLine(p, fsize[i], dup[i], fname[i]);
+      assert(fsize[i]>=0);
+      if (dup[i]<-1 || dup[i]>=i || (dup[i]>=0 && dup[dup[i]]>=0))
+        quit("archive header corrupted");
+      csize[i]=dup[i]<0 ? fsize[i] : 0;
+    }
+
+    // Compress or decompress files
+    assert(fname.size()==files);
+    assert(fsize.size()==files);
+    long total_size=0, coded_size=0;  // sum of file sizes, without copies
+    for (int i=0; i<files; ++i) total_size+=fsize[i], coded_size+=csize[i];
+    job.fname=&fname;
+    job.fsize=&csize;
+    job.archiveName=archiveName.c_str();
+    job.level=level;
+    job.memlevel=memlevel;
+    job.threads=threads ? threads : 1;
+    job.nonsolid=nonsolid;
+    if (mode==COMPRESS && chained) {
+      compressChained(job, coded_size, archive, old);
+      printf("\nTotal %ld bytes compressed to %ld bytes.\n", total_size, ftell(archive));
+    }
+    else if (mode==COMPRESS && segmented) {
+      if (resume) archive=resumeArchive(archive, archiveName.c_str());
+      compressSegments(job, coded_size, archive, resume, old);
+      printf("\nTotal %ld bytes compressed to %ld bytes.\n", total_size, ftell(archive));
+    }
+    else if (mode==COMPRESS) {
+      for (int i=0; i<files; ++i) {
+        printf("\n%d/%d  Filename: %s (%ld bytes)\n", i+1, files, fname[i], fsize[i]);
+        if (dup[i]>=0) printf("Same as %s, not compressed.\n", fname[dup[i]]);
+        else compress(fname[i], fsize[i], *en);
+      }
+      if (en->replaying()) quit("cannot resume: the files have changed");
+      en->flush();
+      if (ck) ck->remove();
+      printf("\nTotal %ld bytes compressed to %ld bytes.\n", total_size, en->size());
+      if (trainName) {
+        FILE* f=fopen(trainName, "wb");
+        if (!f) perror(trainName), quit();
+        en->saveModel(f);
+        const long n=ftell(f);
+        fclose(f);
+        printf("Snapshot %s: %ld bytes, hash %08X\n", trainName, n,
+          Snapshot(trainName).hash());
+      }
+    }
+
+    // Decompress files to dir2: paq8px -d dir1/archive.paq8px dir2
+    // If there is no dir2, then extract to dir1
+    // If there is no dir1, then extract to .
+    // If files are named after dir2 (or after the archive, if the first
+    // is in it) then extract only them.  The files they are copies of are
+    // decoded but not written.
+    else if (!doList) {
+      assert(argc>=2);
+      Array<U8> want(files);
+      const int first=argc>2 && findFiles(fname, argv[2], want) ? 2 : 3;
+      for (int i=3; i<argc; ++i)
+        if (!findFiles(fname, argv[i], want))
+          printf("%s: not in archive\n", argv[i]);
+      if (first>=argc)
+        for (int i=0; i<files; ++i) want[i]=1;
+      Array<U8> needed(files);  // a wanted file is a copy of it
+      Array<U8> decode(files);  // wanted or needed
+      for (int i=0; i<files; ++i)
+        if (want[i] && dup[i]>=0) needed[dup[i]]=1;
+      for (int i=0; i<files; ++i) decode[i]=want[i] || needed[i];
+      int last=files-1;  // last file to decode
+      while (last>=0 && !decode[last]) --last;
+      if (last<0) quit("Nothing to extract");
+      const bool hasDir=argc>2 && first==3;
+      String dir(hasDir?argv[2]:argv[1]);
+      if (!hasDir) {  // chop "/archive.paq8px"
+        int i;
+        for (i=dir.size()-2; i>=0; --i) {
+          if (dir[i]=='/' || dir[i]=='\\') {
+            dir[i]=0;
+            break;
+          }
+          if (i==1 && dir[i]==':') {  // leave "C:"
+            dir[i+1]=0;
+            break;
+          }
+        }
+        if (i==-1) dir=".";  // "/" not found
+      }
+      dir=dir.c_str();
+      if (dir[0] && (dir.size()!=3 || dir[1]!=':')) dir+="/";
+
+      // A copy is made from the extracted file of its original if this
+      // run wrote it or found it identical (good).  Otherwise (the
+      // original is not wanted, or a file of that name exists and may
+      // differ) the original is decoded to a temporary file src, which
+      // the original, if wanted, and its copies are made from.
+      Array<U8> good(files);
+      Array<FILE*> src(files);
+      SegmentReader* r=0;
+      int k=0;  // next segment of a chained archive
+      if (segmented) {
+        int t=readSegments(job, archive);
+        if (!threads) job.threads=t;
+        if (chained) {
+          fseek(archive, job.seg[0].offset, SEEK_SET);
+          en=new Encoder(DECOMPRESS, archive, job.seg[0].csize), k=1;
+        }
+        else {
+          if (first<argc) keepSegments(job, decode);
+          r=new SegmentReader(job);
+        }
+      }
+      long pos=0;  // of file i in the segments
+      for (int i=0; i<=last; pos+=csize[i++]) {
+        String out(dir.c_str());
+        out+=fname[i];
+        if (dup[i]>=0) {
+          if (!want[i]) continue;
+          String from(dir.c_str());
+          from+=fname[dup[i]];
+          if (src[dup[i]]) {
+            rewind(src[dup[i]]);
+            copyFile(src[dup[i]], from.c_str(), out.c_str(), fsize[i]);
+            continue;
+          }
+          FILE* in=good[dup[i]] ? fopen(from.c_str(), "rb") : 0;
+          if (!in)
+            printf(" %s %ld -> %s not extracted, skipping\n", out.c_str(),
+              fsize[i], from.c_str());
+          else copyFile(in, from.c_str(), out.c_str(), fsize[i]), fclose(in);
+          continue;
+        }
+        for (; chained && k<int(job.seg.size()) && job.seg[k].begin<=pos; ++k) {
+          fseek(archive, job.seg[k].offset, SEEK_SET);
+          en->restart(job.seg[k].csize);
+        }
+        if (r && decode[i] && fsize[i]>0) r->skip(pos);
+        FILE* f=0;  // src[i] if made
+        if (needed[i]) {
+          FILE* e=want[i] ? fopen(out.c_str(), "rb") : 0;
+          if (e) fclose(e);
+          if ((e || !want[i]) && !(f=tmpfile())) perror("tmpfile"), quit();
+        }
+        if (f) {  // decode to src[i]
+          src[i]=f;
+          for (long j=0; j<fsize[i] && r; ++j) {
+            const int c=r->get();
+            if (c==EOF) quit("archive truncated");
+            putc(c, f);
+          }
+          if (!r) decompressRecursive(f, fsize[i], *en, FDECOMPRESS);
+          if (ferror(f)) quit("tmpfile write error");
+          rewind(f);
+          if (want[i]) copyFile(f, 0, out.c_str(), fsize[i]);
+        }
+        else if (want[i] && r)
+          good[i]=decompressFile(out.c_str(), fsize[i], *r);
+        else if (want[i]) good[i]=decompress(out.c_str(), fsize[i], *en);
+        else if (!r)
+          decompressRecursive((FILE*)0, fsize[i], *en, FDISCARD);
+      }
+      for (int i=0; i<files; ++i) if (src[i]) fclose(src[i]);
+      delete r;
+    }
+    delete en;
+    delete ck;
+    fclose(archive);
+    if (append) {  // replace the archive appended to
+      if (old) fclose(old);
+#ifdef WINDOWS
+      remove(archiveName.c_str());  // rename() does not replace a file
+#endif
+      if (rename(tmpName.c_str(), archiveName.c_str()))
+        perror(tmpName.c_str()), quit();
+    }
+    if (!doList) programChecker.print();
+  }
+  catch(const char* s) {
+    if (s) fprintf(doStream?stderr:stdout, "%s\n", s);
+    if (doStream) return 1;
+  }
+  if (pause) {
+    printf("\nClose this window or press ENTER to continue...\n");
+    getchar();
+  }
+  return 0;
+}
+
+#endif